@@ -0,0 +1,54 @@
+#pragma once
+#include "Vector3D.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// BVH node: a bounding box and either two children (count 0; first is the
+// left child, the right one follows it) or count triangles from first in
+// leaf order. Children always come after their parent.
+struct BvhNode {
+    float min[3];
+    uint32_t first;
+    float max[3];
+    uint32_t count;
+};
+
+// Triangle in leaf order, laid out for the ray tests: a corner and the two
+// edges from it, in model space
+struct BvhTriangle {
+    float v0[3], e1[3], e2[3];
+    uint32_t index;   // triangle index in the source mesh
+};
+
+// Bounding volume hierarchy over an indexed triangle mesh, for the ray
+// tracer. Splits are chosen by the surface area heuristic over 16 centroid
+// bins per axis; leaves hold at most 8 triangles.
+class Bvh {
+public:
+    // With a pool, subtrees below the top levels are built on its threads.
+    // Degenerate triangles are kept (they never report a hit).
+    void build(const Vector3D* positions, size_t vertexCount, const uint32_t* indices, size_t triangleCount,
+               ThreadPool* pool = nullptr);
+    // Recompute triangles and boxes bottom-up from moved vertices (same
+    // count and indices as the build), keeping the tree. Linear in the mesh;
+    // boxes loosen as vertices stray far from where they were built, so
+    // rebuild after large changes. Rigid motion needs neither: transform the
+    // rays instead (Renderer::raytrace does).
+    void refit(const Vector3D* positions);
+
+    const std::vector<BvhNode>& getNodes() const { return nodes; }
+    const std::vector<BvhTriangle>& getTriangles() const { return triangles; }
+    // Vertex indices of the triangles in leaf order, 3 each
+    const std::vector<uint32_t>& getIndices() const { return leafIndices; }
+    bool empty() const { return nodes.empty(); }
+    // Box diagonal of the whole mesh, for scale-relative ray offsets
+    float getExtent() const;
+
+private:
+    std::vector<BvhNode> nodes;
+    std::vector<BvhTriangle> triangles;
+    std::vector<uint32_t> leafIndices;
+};
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+
+// Homogeneous clip-space vertex. The view frustum is -w <= x,y <= w and
+// 0 <= z <= w (see Matrix4x4::perspective).
+struct ClipVertex {
+    float x, y, z, w;
+};
+
+// Outcode bits, one per clip plane
+enum : uint8_t {
+    CLIP_LEFT = 1, CLIP_RIGHT = 2, CLIP_TOP = 4, CLIP_BOTTOM = 8,
+    CLIP_NEAR = 16, CLIP_FAR = 32
+};
+
+// Most vertices a triangle can have after clipping against all six planes
+const int MAX_CLIP_VERTICES = 9;
+
+// Planes the vertex is outside of. The side planes sit at |x| = guardX * w and
+// |y| = guardY * w: 1 gives the frustum itself, larger values a guard band.
+uint8_t clipOutcode(const ClipVertex& v, float guardX, float guardY);
+
+// Sutherland-Hodgman: clip the convex polygon in verts (capacity
+// MAX_CLIP_VERTICES) against the planes set in mask, in place. Returns the new
+// vertex count, 0 if nothing is left. bary, if given, holds a pair of weights
+// per vertex (e.g. barycentrics of the source triangle) and is clipped along
+// with it, so any vertex attribute can be rebuilt for the new vertices.
+int clipPolygon(ClipVertex* verts, int count, uint8_t mask, float guardX, float guardY, float (*bary)[2] = nullptr);
@@ -0,0 +1,36 @@
+#pragma once
+#include "Vector3D.h"
+#include <cstddef>
+
+class Matrix4x4 {
+public:
+    float m[4][4];
+
+    Matrix4x4();
+    
+    static Matrix4x4 identity();
+    static Matrix4x4 rotationX(float angle);
+    static Matrix4x4 rotationY(float angle);
+    static Matrix4x4 rotationZ(float angle);
+    static Matrix4x4 translation(float x, float y, float z);
+    static Matrix4x4 scale(float x, float y, float z);
+    // Perspective projection for a camera looking down +z (+y down the screen).
+    // fovX is the horizontal field of view in radians, aspect = width / height.
+    // Clip z runs from 0 at zNear to w at zFar; clip w is the view-space z.
+    static Matrix4x4 perspective(float fovX, float aspect, float zNear, float zFar);
+    // Orthographic projection with the same conventions: x and y in
+    // [-halfWidth, halfWidth] x [-halfHeight, halfHeight] map to [-1, 1],
+    // z from zNear to zFar maps to [0, 1], and w stays 1.
+    static Matrix4x4 orthographic(float halfWidth, float halfHeight, float zNear, float zFar);
+
+    Matrix4x4 operator*(const Matrix4x4& other) const;
+    // out[i] = left * right[i] for count matrices, with the same results as
+    // operator*; SSE2 builds each result row from the 4 rows of right[i]
+    static void multiply(const Matrix4x4& left, const Matrix4x4* right, size_t count, Matrix4x4* out);
+    Vector3D transform(const Vector3D& vec) const;
+    // Transform count points (w = 1) into structure-of-arrays output without
+    // dividing by w. outW receives homogeneous w; when null only the affine
+    // part is applied. SSE2 handles 4 points per step.
+    void transformPoints(const Vector3D* in, size_t count,
+                         float* outX, float* outY, float* outZ, float* outW = nullptr) const;
+};
\ No newline at end of file
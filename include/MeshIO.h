@@ -0,0 +1,87 @@
+#pragma once
+#include "Shapes.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+    MappedFile() {}
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const char* path);
+    void close();
+
+    const char* data() const { return ptr; }
+    size_t size() const { return length; }
+
+private:
+    const char* ptr = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* file = nullptr;
+    void* mapping = nullptr;
+#endif
+};
+
+// Pre-baked mesh file (.srm), little-endian. The header is followed by
+// 64-byte aligned sections laid out exactly as Renderer::drawMesh takes them,
+// so a mapped file is drawn with no parsing or copying:
+//   positions  vertexCount x 3 floats
+//   indices    triangleCount x 3 uint32
+//   colors     triangleCount x uint32 (0xRRGGBB)
+// Per-vertex normals and colors are not stored; recompute normals on load.
+struct MeshFileHeader {
+    char magic[8];                 // "SRMESH\0\0"
+    uint32_t version;              // MESH_FILE_VERSION
+    uint32_t headerSize;           // sizeof(MeshFileHeader)
+    uint64_t vertexCount, triangleCount;
+    uint64_t positionsOffset, indicesOffset, colorsOffset;
+    float boundsMin[3], boundsMax[3];
+};
+const uint32_t MESH_FILE_VERSION = 1;
+
+// A .srm file mapped into memory. Only the header and section sizes are
+// checked on open; validate() reads every index, so call it before drawing a
+// file that did not come from this process's saveMesh.
+class MappedMesh {
+public:
+    bool open(const char* path, std::string* error = nullptr);
+    bool validate(std::string* error = nullptr) const;
+
+    const Vector3D* positions() const { return positionData; }
+    const uint32_t* indices() const { return indexData; }
+    const uint32_t* colors() const { return colorData; }
+    size_t vertexCount() const { return header ? size_t(header->vertexCount) : 0; }
+    size_t triangleCount() const { return header ? size_t(header->triangleCount) : 0; }
+    Vector3D boundsMin() const;
+    Vector3D boundsMax() const;
+
+private:
+    MappedFile file;
+    const MeshFileHeader* header = nullptr;
+    const Vector3D* positionData = nullptr;
+    const uint32_t* indexData = nullptr;
+    const uint32_t* colorData = nullptr;
+};
+
+// Wavefront OBJ: v and f records (v/vt/vn forms, negative indices, optional
+// per-vertex r g b after the position). PLY: ascii or binary, vertex x y z
+// with optional red green blue, faces as vertex_indices lists with optional
+// face colors. Polygons are fan-triangulated. Triangles take their face
+// color, else the average of their vertex colors, else defaultColor. Without
+// face colors, vertex colors are also kept in mesh.vertexColors.
+//
+// Files are memory-mapped and parsed in parallel chunks: a counting pass
+// sizes the output, then every chunk writes its own slice of it.
+bool loadOBJ(const char* path, Mesh& mesh, std::string* error = nullptr, uint32_t defaultColor = 0xC8C8C8);
+bool loadPLY(const char* path, Mesh& mesh, std::string* error = nullptr, uint32_t defaultColor = 0xC8C8C8);
+// Pick the loader from the extension: .obj, .ply or .srm
+bool loadMesh(const char* path, Mesh& mesh, std::string* error = nullptr);
+bool saveMesh(const char* path, const Mesh& mesh, std::string* error = nullptr);
+
+void meshBounds(const Vector3D* positions, size_t count, Vector3D& boundsMin, Vector3D& boundsMax);
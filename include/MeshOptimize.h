@@ -0,0 +1,39 @@
+#pragma once
+#include "Renderer.h"
+#include "Shapes.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Average cache miss ratio: vertices transformed per triangle by a FIFO
+// post-transform cache of cacheSize entries (0.5 is ideal for large grids,
+// 3 means no reuse at all)
+float computeACMR(const uint32_t* indices, size_t triangleCount, size_t vertexCount, int cacheSize = 16);
+
+// Reorder triangles for post-transform cache locality (Tipsify, Sander et
+// al. 2007); colors move with their triangles. Linear in the triangle count.
+void optimizeVertexCache(Mesh& mesh, int cacheSize = 16);
+// Renumber vertices in order of first use so vertex fetches walk memory
+// forwards. Unreferenced vertices move to the end.
+void optimizeVertexFetch(Mesh& mesh);
+
+struct MeshOptimizeReport {
+    float acmrBefore, acmrAfter;
+};
+// Both passes; ACMR measured with a 16-entry FIFO
+MeshOptimizeReport optimizeMesh(Mesh& mesh);
+
+// Split a mesh into Renderer::drawMesh meshlets: consecutive triangle runs of
+// at most maxVertices unique vertices and maxTriangles triangles, in index
+// order (so run optimizeVertexCache first for compact clusters).
+std::vector<Meshlet> buildMeshlets(const Vector3D* positions, size_t vertexCount,
+                                   const uint32_t* indices, size_t triangleCount,
+                                   int maxVertices = 64, int maxTriangles = 124);
+inline std::vector<Meshlet> buildMeshlets(const Mesh& mesh, int maxVertices = 64, int maxTriangles = 124) {
+    return buildMeshlets(mesh.positions.data(), mesh.positions.size(), mesh.indices.data(), mesh.indices.size() / 3,
+                         maxVertices, maxTriangles);
+}
+
+// Bounding sphere of a whole mesh for InstancedMesh: centered on the bounding
+// box, radius out to the farthest vertex
+void computeBoundingSphere(const Vector3D* positions, size_t vertexCount, float center[3], float& radius);
@@ -0,0 +1,45 @@
+#pragma once
+#include "Renderer.h"
+#include "Shapes.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Reduce a mesh to about targetTriangles by quadric error metric edge
+// collapse (Garland and Heckbert 1997). Each collapse moves one vertex onto
+// its neighbor, so the output keeps a subset of the input vertices with their
+// attributes (normals, vertex colors, uvs) and surviving triangles keep their
+// colors. Open borders and attribute seams (split vertices) are held in place
+// by extra planes, and collapses that would flip a triangle or make the
+// surface non-manifold are skipped, so the result can stay above the target.
+// error, if given, receives the largest RMS distance of a moved vertex from
+// the planes it stood for: a geometric error estimate in model units.
+Mesh simplifyMesh(const Mesh& mesh, size_t targetTriangles, float* error = nullptr);
+
+// Levels of detail for Renderer::drawInstanced, finest (a copy of the mesh)
+// first. Each level is simplified from the previous one to ratio of its
+// triangles, until minTriangles or maxLevels. A level's minScreenRadius lets
+// the next one take over once that one's accumulated error, projected like
+// the bounding sphere, drops to pixelError pixels. lods point into meshes and
+// meshlets, so the chain moves but does not copy.
+struct LodChain {
+    std::vector<Mesh> meshes;
+    std::vector<std::vector<Meshlet>> meshlets;
+    std::vector<float> errors;   // accumulated error per level, model units
+    std::vector<MeshLod> lods;
+    float center[3] = { 0, 0, 0 };   // bounding sphere of every level
+    float radius = 0;
+
+    LodChain() = default;
+    LodChain(LodChain&&) = default;
+    LodChain& operator=(LodChain&&) = default;
+    LodChain(const LodChain&) = delete;
+    LodChain& operator=(const LodChain&) = delete;
+
+    InstancedMesh instanced() const {
+        InstancedMesh m = { lods.data(), lods.size(), { center[0], center[1], center[2] }, radius };
+        return m;
+    }
+};
+LodChain buildLodChain(const Mesh& mesh, int maxLevels = 4, float ratio = 0.25f, size_t minTriangles = 16,
+                       float pixelError = 1.0f);
@@ -0,0 +1,51 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Double/triple-buffered swapchain: the caller renders into one buffer while
+// a background thread presents the ones submitted before it, so presenting
+// never stalls rendering until every buffer is in flight. Frames are presented
+// in submission order and none are dropped.
+class Presenter {
+public:
+    // Called on the present thread for each submitted frame (ARGB32 rows
+    // pitchBytes apart). The buffer is not reused until it returns.
+    typedef std::function<void(const uint32_t* pixels, int pitchBytes)> PresentFn;
+
+    // bufferCount 2 = double buffering, 3 = triple buffering
+    Presenter(int width, int height, int bufferCount, PresentFn present);
+    // Presents every submitted frame before returning
+    ~Presenter();
+
+    Presenter(const Presenter&) = delete;
+    Presenter& operator=(const Presenter&) = delete;
+
+    // Buffer to render the next frame into, e.g. for Renderer::setTarget.
+    // Waits while every other buffer is queued or being presented.
+    uint32_t* acquire();
+    // Queue the acquired buffer for presentation
+    void submit();
+
+    int getPitch() const { return pitch * 4; }
+
+private:
+    void presentMain();
+
+    int pitch;   // pixels, rows padded to 64 bytes
+    std::vector<std::vector<uint32_t>> buffers;
+    PresentFn present;
+
+    std::mutex mutex;
+    std::condition_variable queued;     // frame submitted or shutdown
+    std::condition_variable released;   // a buffer became free
+    std::vector<int> freeBuffers;
+    std::deque<int> pending;            // submitted, oldest first
+    int current = -1;                   // acquired by the caller
+    bool stopping = false;
+    std::thread thread;
+};
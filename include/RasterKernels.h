@@ -0,0 +1,157 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+class Texture;
+class ShadowMap;
+
+// Instruction set used by the triangle fill inner loop
+enum class SimdLevel { Scalar, SSE2, AVX2 };
+
+// Attributes interpolated across smooth-shaded triangles: red, green, blue
+// (0-255, lighting already applied), then texture u and v on textured ones,
+// then shadow-map x, y and depth on shadowed ones
+enum { VAR_R, VAR_G, VAR_B, VAR_U, VAR_V, VAR_SX, VAR_SY, VAR_SZ, MAX_VARYINGS };
+
+// Varyings a smooth triangle sets up and steps
+inline int varyingCount(const Texture* texture, const ShadowMap* shadow) {
+    return shadow ? MAX_VARYINGS : texture ? VAR_SX : VAR_U;
+}
+
+// What a row kernel writes: the flat color, interpolated colors, or
+// interpolated colors modulating a texture sample; the shadowed modes scale
+// either by the light the shadow map lets through. Depth-only rows write no
+// color at all.
+enum class RowMode { Flat, Smooth, Textured, SmoothShadowed, TexturedShadowed, DepthOnly };
+const int ROW_MODE_COUNT = 6;
+
+// Fixed-function state around the pixel color. Row kernels are compiled
+// separately for every mode and state, so none of it is a per-pixel branch.
+enum class DepthTest {
+    Less,     // draw where z is nearer than the stored depth
+    Always    // draw every covered pixel
+};
+enum class BlendMode {
+    Opaque,   // overwrite
+    Alpha     // dst + (src - dst) * alpha, per 8-bit channel
+};
+
+// How the depth buffer stores z/w. Depths reach the rasterizer the way the
+// projection produces them: 0 at the near plane and 1 at the far one, except
+// under ReversedFloat32, whose projection swaps the two so that distant
+// depths sit near 0, where floats are dense. Kernels are compiled per format
+// too: depth is still interpolated as a float, then quantized and compared
+// the way the format stores it.
+enum class DepthFormat {
+    Float32,          // z as is, cleared to 1e9
+    Unorm16,          // z * 65535 rounded, 2 bytes per sample; cleared to 65535
+    Fixed24,          // z * (2^24 - 1) rounded, in the low bits of 4 bytes
+    ReversedFloat32   // z as is, nearer is larger (Less tests become Greater); cleared to 0
+};
+const int DEPTH_FORMAT_COUNT = 4;
+
+inline size_t depthBytes(DepthFormat format) { return format == DepthFormat::Unorm16 ? 2 : 4; }
+
+struct PipelineState {
+    DepthTest depthTest = DepthTest::Less;
+    bool depthWrite = true;
+    BlendMode blend = BlendMode::Opaque;
+    // Opacity 0-255 under BlendMode::Alpha, times the texel alpha when
+    // textured. Not part of the kernel specialization.
+    uint8_t alpha = 255;
+};
+
+// Triangle after setup: clamped pixel bounding box, edge functions and depth
+// plane, all anchored at pixel (minX, minY). Edge values include the fill-rule
+// bias, so a pixel is covered when all three are >= 0.
+struct TriangleSetup {
+    int minX, minY, maxX, maxY;
+    int64_t w0, w1, w2;
+    int64_t stepX0, stepX1, stepX2;
+    int64_t stepY0, stepY1, stepY2;
+    float z, dzdx, dzdy;
+    uint32_t color;
+    // Smooth shading: planes of 1/w and of each varying / w, anchored like z.
+    // Dividing one by the other per pixel gives perspective-correct values.
+    bool smooth;
+    float invW, dInvWdx, dInvWdy;
+    float var[MAX_VARYINGS], dVardx[MAX_VARYINGS], dVardy[MAX_VARYINGS];
+    // Textured triangles are smooth ones with u, v planes and this texture;
+    // shadowed ones have shadow-map planes and this map
+    const Texture* texture;
+    const ShadowMap* shadow;
+    PipelineState state;
+};
+
+// One row of a triangle span. Edge values are taken at the first pixel; depth
+// at pixel i is z + dzdx * float(dx + i), where dx is the first pixel's offset
+// from the setup's minX (so every sub-span of a row gets the same depths).
+// Smooth rows step 1/w and the varyings the same way and write
+// 0xFF000000 | r << 16 | g << 8 | b from (var / w) / (1 / w) instead of color.
+// Textured rows also need the y steps, for the texture footprint's mip level.
+// Multisample rows test coverage and depth at MSAA_SAMPLES points per pixel:
+// sampleEdge holds each edge's offset from the pixel center to every sample,
+// sampleZ the depth offset.
+struct RasterRow {
+    int64_t w0, w1, w2;
+    int64_t stepX0, stepX1, stepX2;
+    float z, dzdx;
+    int dx;
+    uint32_t color;
+    float invW, dInvWdx, dInvWdy;
+    float var[MAX_VARYINGS], dVardx[MAX_VARYINGS], dVardy[MAX_VARYINGS];
+    const Texture* texture;
+    const ShadowMap* shadow;
+    uint32_t alpha;   // 0-255, used by BlendMode::Alpha kernels
+    int64_t sampleEdge[3][4];
+    float sampleZ[4];
+};
+
+// Samples per pixel in multisample mode
+const int MSAA_SAMPLES = 4;
+
+// Depth-test and fill pixels [0, count) of a row. color/depth point at the
+// row's first pixel (color is unused by depth-only kernels), depth in the
+// kernel's DepthFormat. All kernels produce bit-identical output.
+typedef void (*RowKernel)(const RasterRow& row, int count, uint32_t* color, void* depth);
+
+// Best instruction set supported by the running CPU
+SimdLevel detectSimdLevel();
+// Kernel for a color mode (flat, or perspective-correct smooth or textured),
+// pipeline state (depth test / write, blending) and depth format
+RowKernel getRowKernel(SimdLevel level, RowMode mode = RowMode::Flat, const PipelineState& state = PipelineState(),
+                       DepthFormat format = DepthFormat::Float32);
+// Multisample kernel: color and depth point at MSAA_SAMPLES consecutive values
+// per pixel. The color is shaded once per pixel and written to every sample
+// that is covered and passes the depth test. AVX2 gets the SSE2 kernel, which
+// already handles a pixel's four samples in one register.
+RowKernel getMultisampleRowKernel(SimdLevel level, RowMode mode = RowMode::Flat, const PipelineState& state = PipelineState(),
+                                  DepthFormat format = DepthFormat::Float32);
+
+// Fill count pixels of color and depth (to the format's clear value) in one
+// pass; either pointer may be null. Streaming uses non-temporal stores that
+// bypass the cache, for memory that will not be read again before it would
+// have been evicted anyway.
+void clearSpan(uint32_t* color, void* depth, DepthFormat format, size_t count, uint32_t colorValue, bool streaming);
+
+// Single depth samples, for the code around the kernels: z as format stores
+// it, widened to 32 bits (a float's bits for the float formats); sample i of
+// a buffer in that format; whether stored depth a passes the Less test
+// against b (is nearer); and a stored depth back as the float z it rounds.
+uint32_t encodeDepth(float z, DepthFormat format);
+uint32_t loadDepth(const void* depth, size_t i, DepthFormat format);
+void storeDepth(void* depth, size_t i, uint32_t value, DepthFormat format);
+bool depthPasses(uint32_t a, uint32_t b, DepthFormat format);
+float decodeDepth(uint32_t value, DepthFormat format);
+
+// Average each pixel's MSAA_SAMPLES samples into count ARGB32 pixels: every
+// channel becomes (sum + 2) >> 2
+void resolveSpan(const uint32_t* samples, size_t count, uint32_t* color);
+
+// What the row kernel for this depth test and format would do to pixels
+// [0, count), without doing it (call it first): adds the covered samples to
+// tested and those passing the depth test to passed, and counts one in
+// passedPixels[i] for every pixel with a passing sample, if given. Depth is
+// laid out as the kernel sees it, MSAA_SAMPLES per pixel when multisample.
+void countRow(const RasterRow& row, int count, const void* depth, DepthFormat format, DepthTest test,
+              bool multisample, uint64_t& tested, uint64_t& passed, uint32_t* passedPixels);
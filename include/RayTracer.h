@@ -0,0 +1,44 @@
+#pragma once
+#include "Bvh.h"
+#include "RasterKernels.h"
+#include <cstdint>
+
+// One Renderer::raytrace call as the packet tracer sees it. Rays are traced
+// in the mesh's model space: the camera position and every pixel's direction
+// are mapped back through the inverse model-view, so the BVH never has to
+// follow rigid motion. A pixel's direction is dirBase + dirDx * x + dirDy * y
+// for its center (x + 0.5, y + 0.5), scaled so the ray parameter t is the
+// view-space depth of the point it reaches.
+struct RayTraceJob {
+    const Bvh* bvh;
+    const uint32_t* colors;         // 0xRRGGBB per source triangle; may be null with vertexColors
+    const Vector3D* normals;        // optional per-vertex model-space normals
+    const uint32_t* vertexColors;   // optional per-vertex 0xRRGGBB
+    float origin[3];
+    float dirBase[3], dirDx[3], dirDy[3];
+    float tNear, tFar;              // view depths of the near and far planes
+    float depthScale, depthOffset;  // stored depth = depthScale + depthOffset / t
+    DepthFormat depthFormat;        // and how it is stored and tested
+    float normalMatrix[3][3];       // model to view space for normals (cofactor matrix)
+    float lightView[3];             // unit direction towards the light, view space
+    float lightModel[3];            // the same direction in model space, any length
+    bool shadows;
+    float shadowScale;              // light left to a pixel whose shadow ray is blocked
+    float shadowOffset;             // model-space distance shadow rays start off the surface
+    SimdLevel simd;
+};
+
+struct RayCounts {
+    uint64_t primary = 0, shadow = 0;   // rays traced
+    uint64_t written = 0;               // pixels that passed the depth test
+};
+
+// Trace the pixels of an inclusive rect: closest hits within [tNear, tFar]
+// that pass the depth test against depth (rows depthStride samples apart) get
+// shaded like drawMesh would (flat face light or interpolated vertex light
+// and colors, no texturing) and written to color and depth. Packets of
+// coherent rays go through the BVH together, 8 (4x2 pixels) with AVX2 and
+// 4 (2x2) with SSE2, each node's box and each triangle tested against all
+// of them at once; the Scalar level traces one ray at a time.
+RayCounts traceRect(const RayTraceJob& job, int x0, int y0, int x1, int y1,
+                    uint32_t* color, int colorStride, void* depth, int depthStride);
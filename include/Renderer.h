@@ -1,8 +1,157 @@
 #pragma once
+#include "Matrix4x4.h"
+#include "RasterKernels.h"
+#include "ShadowMap.h"
+#include <atomic>
 #include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 
+class Bvh;
+class ThreadPool;
+
+// Hierarchical-Z rejection counters. A raster call is one triangle, or in
+// tiled mode the part of a triangle inside one tile.
+struct HiZStats {
+    uint64_t blocksRejected = 0;      // 8x8 blocks skipped before any per-pixel work
+    uint64_t trianglesRejected = 0;   // raster calls whose every block was rejected
+};
+
+// Time spent per pipeline stage in milliseconds, summed since the last
+// resetTimings(). Covers clear/clearZ, drawMesh and flush; in immediate mode
+// drawMesh rasterizes as it goes, so its setup time is counted as raster.
+struct RenderTimings {
+    double clear = 0;       // color/depth clears (run inside flush() in tiled mode)
+    double transform = 0;   // drawMesh vertex transform, outcodes and projection
+    double setup = 0;       // culling, lighting, clipping, triangle setup and binning
+    double raster = 0;      // tile pass in flush(), or the whole per-triangle loop in immediate mode
+    double sort = 0;        // ordering the transparent pass (see setTransparencySorting)
+    double resolve = 0;     // multisample resolve in immediate mode; tiled mode resolves
+                            // each tile right after rasterizing it, counted as raster
+    double shadow = 0;      // shadow pass: its drawMesh calls and the flush in endShadowPass
+    double trace = 0;       // raytrace calls, including the flush before each
+};
+
+// Shadow map parameters, applied from the next beginShadowPass()
+struct ShadowSettings {
+    int size = 1024;        // shadow map width and height in texels
+    float bias = 0.004f;    // depth offset against self-shadowing, as a fraction of the map's depth range
+    float strength = 0.6f;  // share of the light a fully occluded pixel loses, 0-1
+};
+
+// A run of consecutive mesh triangles with conservative model-space bounds,
+// so drawMesh can cull the whole run at once (see buildMeshlets)
+struct Meshlet {
+    uint32_t firstTriangle, triangleCount;
+    float center[3], radius;        // bounding sphere
+    float coneAxis[3], coneCutoff;  // every normal n has dot(n, coneAxis) >= coneCutoff; <= 0 disables the cone test
+};
+
+// Meshlet culling counters, summed since the last resetClusterStats()
+struct ClusterStats {
+    uint64_t meshletsTested = 0;
+    uint64_t frustumCulled = 0;    // bounding sphere outside a frustum plane
+    uint64_t backfaceCulled = 0;   // every triangle faces away (per the cull mode)
+};
+
+// Vertex of a smooth-shaded drawTriangle: pixel position and depth as for the
+// flat one, w the clip-space w (view depth) that attributes are interpolated
+// perspective-correctly by (1 everywhere gives affine interpolation), and
+// color channels 0-255 with lighting already applied. u, v are texture
+// coordinates, used while a texture is bound.
+struct ShadedVertex {
+    float x, y, z, w;
+    float r, g, b;
+    float u, v;
+};
+
+// Optional per-vertex drawMesh inputs, vertexCount entries each. Either one
+// switches to smooth (Gouraud) shading: normals are lit per vertex instead
+// of per face, colors (0xRRGGBB) replace the triangle colors. Both are
+// interpolated perspective-correctly. uvs, while a texture is bound, also
+// makes the mesh textured: the sampled texel times the lit color.
+struct VertexAttributes {
+    const Vector3D* normals = nullptr;   // model space, need not be unit length
+    const uint32_t* colors = nullptr;
+    const float* uvs = nullptr;          // 2 per vertex: u, v (1 = one texture width / height)
+};
+
+// One level of detail of an InstancedMesh: drawMesh inputs (meshlets
+// optional, null for a plain drawMesh) and the projected radius in pixels of
+// the instance's bounding sphere down to which the level is used. The last
+// level's radius is ignored. See buildLodChain for levels and radii made from
+// a single mesh.
+struct MeshLod {
+    const Vector3D* positions;
+    size_t vertexCount;
+    const uint32_t* indices;
+    size_t triangleCount;
+    const uint32_t* colors;
+    const Meshlet* meshlets = nullptr;
+    size_t meshletCount = 0;
+    VertexAttributes attributes;
+    float minScreenRadius = 0;
+};
+
+// A mesh drawn many times by drawInstanced: its levels of detail, finest
+// first, and a model-space bounding sphere holding every level
+struct InstancedMesh {
+    const MeshLod* lods;
+    size_t lodCount;
+    float center[3], radius;
+};
+
+const int MAX_INSTANCE_LODS = 8;
+
+// drawInstanced counters, summed since the last resetInstanceStats()
+struct InstanceStats {
+    uint64_t instancesTested = 0;
+    uint64_t frustumCulled = 0;               // bounding sphere outside a frustum plane
+    uint64_t lodDrawn[MAX_INSTANCE_LODS] = {}; // instances drawn per level (later levels count as the last)
+    uint64_t trianglesSubmitted = 0;          // triangle count of the levels drawn
+};
+
+// raytrace counters, summed since the last resetRayStats()
+struct RayStats {
+    uint64_t primaryRays = 0;   // one per pixel traced
+    uint64_t shadowRays = 0;    // one per visible pixel facing the light, with shadows on
+};
+
+// Instrumentation (Renderer::setStats) is compiled in unless built with
+// -DRENDER_STATS=0, which turns every counter into dead code
+#ifndef RENDER_STATS
+#define RENDER_STATS 1
+#endif
+
+// Pixel work of the main view's rasterizer (not the shadow pass, raytrace or
+// setPixel), as a whole or in one cell. Pixels are samples when
+// multisampling; raster calls rejected by hierarchical Z test nothing.
+struct PixelStats {
+    uint64_t tested = 0;    // covered, so depth tested
+    uint64_t passed = 0;    // of those, passed the depth test
+    uint64_t written = 0;   // of those, wrote color or depth
+    double ms = 0;          // time in the row kernels
+};
+
+// setStats counters, summed since the last resetStats(). Submitted triangles
+// are culled, rasterized, or too small to cover a pixel center; clipping can
+// turn one into several rasterized pieces.
+struct RenderStats {
+    uint64_t trianglesSubmitted = 0;    // by drawMesh (and so drawInstanced) and drawTriangle
+    uint64_t trianglesCulled = 0;       // outside the frustum, facing away, or in a culled meshlet
+    uint64_t trianglesRasterized = 0;   // set up and handed to the rasterizer
+    PixelStats pixels;
+};
+
+// Which triangles drawMesh discards, judged from their view-space winding
+enum class CullMode { None, Back, Front };
+
+// Inclusive pixel rect
+struct ScreenRect {
+    int x0, y0, x1, y1;
+};
+
 class Renderer {
 public:
     Renderer(int width, int height);
@@ -12,27 +161,484 @@ public:
     void clear(unsigned char r, unsigned char g, unsigned char b);
     // Reset Z buffer
     void clearZ();
+    // clear() and clearZ() together in one pass over both buffers
+    void clearColorAndDepth(unsigned char r, unsigned char g, unsigned char b);
 
     // Set a single pixel (z used for z-buffer test)
     void setPixel(int x, int y, float z, unsigned char r, unsigned char g, unsigned char b);
 
-    // Draw a filled triangle with simple z-interpolation and flat brightness
+    // Draw a filled triangle with simple z-interpolation and flat brightness.
+    // Positions are in pixels with sub-pixel precision (pixel centers at +0.5);
+    // either winding is accepted and shared edges follow the top-left fill rule.
     void drawTriangle(
-        int x0,int y0,float z0,
-        int x1,int y1,float z1,
-        int x2,int y2,float z2,
+        float x0,float y0,float z0,
+        float x1,float y1,float z1,
+        float x2,float y2,float z2,
         unsigned char r,unsigned char g,unsigned char b,
         float brightness
     );
 
+    // Gouraud-shaded triangle: color channels are interpolated with 1/w and
+    // the plane equations are set up once, so a pixel costs one divide more
+    // than a flat fill.
+    void drawTriangle(const ShadedVertex& v0, const ShadedVertex& v1, const ShadedVertex& v2);
+
+    // Draw an indexed mesh. indices holds 3 per triangle and colors one
+    // 0xRRGGBB per triangle (may be null if attributes has vertex colors).
+    // modelView maps positions into view space (camera at the origin looking
+    // down +z, +y down the screen). Each vertex is transformed once into
+    // structure-of-arrays view and clip-space buffers; triangles are then
+    // frustum-culled, back-face culled and lit, and only those crossing the
+    // near/far planes or the guard band get clipped. Flat shaded unless
+    // attributes supplies normals or vertex colors.
+    void drawMesh(const Vector3D* positions, size_t vertexCount,
+                  const uint32_t* indices, size_t triangleCount,
+                  const uint32_t* colors, const Matrix4x4& modelView,
+                  const VertexAttributes& attributes = VertexAttributes());
+    void drawMesh(const std::vector<Vector3D>& positions,
+                  const std::vector<uint32_t>& indices,
+                  const std::vector<uint32_t>& colors,
+                  const Matrix4x4& modelView) {
+        drawMesh(positions.data(), positions.size(), indices.data(), indices.size() / 3, colors.data(), modelView);
+    }
+    // Same, but triangles are submitted meshlet by meshlet and a meshlet whose
+    // bounding sphere is outside the frustum, or whose normal cone faces away
+    // under the cull mode, is skipped whole. Triangles not covered by a meshlet
+    // are not drawn. Non-uniform scale in modelView disables the cone test.
+    void drawMesh(const Vector3D* positions, size_t vertexCount,
+                  const uint32_t* indices, const uint32_t* colors,
+                  const Meshlet* meshlets, size_t meshletCount, const Matrix4x4& modelView,
+                  const VertexAttributes& attributes = VertexAttributes());
+
+    // Draw count instances of a mesh, transforms[i] mapping the mesh into
+    // world space and view from there into view space. Model-view matrices
+    // are built in batches; each instance's bounding sphere is frustum-culled
+    // and its projected size (radius over distance, in pixels through the
+    // projection's horizontal focal length) picks the level of detail, which
+    // then goes through drawMesh (the meshlet flavor when the level has
+    // meshlets). In a shadow pass instances are culled against the light's
+    // frustum but keep the level the camera would pick.
+    void drawInstanced(const InstancedMesh& mesh, const Matrix4x4* transforms, size_t count,
+                       const Matrix4x4& view) {
+        drawInstanced(mesh, transforms, count, view, Vector3D(0, 0, 0), projection.m[0][0] * width * 0.5f);
+    }
+    void drawInstanced(const InstancedMesh& mesh, const std::vector<Matrix4x4>& transforms,
+                       const Matrix4x4& view) {
+        drawInstanced(mesh, transforms.data(), transforms.size(), view);
+    }
+
+    // Ray traced alternative to drawMesh for the mesh bvh was built from
+    // (see Bvh): colors, modelView and attributes as for drawMesh, lit the
+    // same way from the same light, but every pixel is a ray from the camera
+    // through its center, traced in model space, and with shadows each lit
+    // pixel sends another towards the light, so the mesh shadows itself
+    // (ShadowSettings::strength applies; nothing outside this BVH casts
+    // shadows). Hits are depth-tested against, and written into, the same
+    // buffers drawMesh uses, so traced and rasterized meshes mix. In tiled
+    // mode tiles are traced on the thread pool. Textures are not sampled;
+    // the projection must be a perspective one. Flushes first; does nothing
+    // while multisampling or in a shadow pass.
+    void raytrace(const Bvh& bvh, const uint32_t* colors, const Matrix4x4& modelView,
+                  const VertexAttributes& attributes = VertexAttributes(), bool shadows = true);
+
+    // drawMesh camera and lighting. setFieldOfView/setDepthRange rebuild a
+    // Matrix4x4::perspective projection (horizontal fov in degrees); a custom
+    // projection must follow the same clip-space conventions. Depth stored for
+    // meshes is clip z / w, 0 at the near plane and 1 at the far plane (the
+    // other way round with DepthFormat::ReversedFloat32, which a custom
+    // projection then has to follow too).
+    void setFieldOfView(float degrees);
+    void setDepthRange(float zNear, float zFar);
+    void setProjection(const Matrix4x4& proj) { projection = proj; }
+    // direction towards the light in view space (normalized here)
+    void setLightDirection(const Vector3D& dir);
+    void setCullMode(CullMode mode) { cullMode = mode; }
+    // Depth test, depth write and blending of later draws (both drawTriangle
+    // flavors and drawMesh). Every combination with every shading mode (flat,
+    // Gouraud, textured) is its own compiled row kernel, picked once per
+    // triangle: the defaults run exactly the loop they always did. With the
+    // depth test off, hierarchical Z keeps its bounds but stops rejecting.
+    void setPipelineState(const PipelineState& state) { pipeline = state; }
+    const PipelineState& getPipelineState() const { return pipeline; }
+    // Texture for shaded drawTriangle and for drawMesh with uvs; nullptr for
+    // none. Not copied: it must stay alive until the draws are flushed.
+    void setTexture(const Texture* tex) { texture = tex; }
+    const Texture* getTexture() const { return texture; }
+
+    // Deferred tiled mode: drawTriangle only bins triangles into screen tiles
+    // and flush() rasterizes the tiles on a pool of worker threads, each tile's
+    // color and depth staying in cache. Output matches immediate mode exactly.
+    // Clears are fast clears: a tile nothing was drawn into since its last
+    // clear is skipped, so static background costs nothing after one frame.
+    // threads <= 0 uses every hardware thread.
+    void setTiled(bool enabled, int threads = 0, int tileSize = 64);
+    bool isTiled() const { return tiled; }
+    // Rasterize everything binned so far, then the transparent pass; call
+    // before reading the buffer. Immediate mode only has the transparent pass.
+    void flush();
+
+    // Transparent pass: while on, triangles drawn with BlendMode::Alpha are
+    // queued instead, and flush() (or the next clear) draws them after
+    // everything else, farthest first. The order comes from a stable LSD radix
+    // sort on each triangle's depth at the center of its screen bounds,
+    // quantized to 22 bits over the frame's depth range: two passes, O(n) in
+    // the queued triangles. It is per triangle: intersecting or cyclically
+    // overlapping ones can still blend in the wrong order. Off by default;
+    // usually paired with depth writes off.
+    void setTransparencySorting(bool enabled) { sortTransparent = enabled; }
+
+    // Incremental mode, for mostly static frames: draw calls (drawMesh,
+    // drawTriangle, raytrace, setPixel) are recorded instead of drawn, and
+    // flush() compares them in order with the draws the target showed after
+    // its last frame: the same mesh pointers and counts, transform, colors and
+    // render state mean the same pixels. Only cells (the tiles in tiled mode,
+    // 32x32 pixels otherwise) under the old or new screen bounds of a draw
+    // that changed, appeared or went away are cleared, and every draw
+    // overlapping them is replayed with its triangles clipped to those cells;
+    // the rest of the target keeps last frame's pixels. Each target set with
+    // setTarget remembers its own last frame, so a swapchain works too. A
+    // frame starts at clear() or clearColorAndDepth(), which record the clear
+    // color (clearZ() is implied). Mesh data must stay alive and unchanged
+    // until flush(); call invalidate() after changing it in place. raytrace()
+    // counts as changed every frame, and a shadow pass redraws everything.
+    // The transparent sort only sees the triangles replayed, so blended
+    // overlaps can order differently from a full redraw at equal depths.
+    void setIncremental(bool enabled);
+    bool isIncremental() const { return incremental; }
+    // Forget what every target shows: the next flush() redraws it all
+    void invalidate();
+    // Rects of the target rewritten since the frame's clear, merged row by
+    // row and not overlapping: all a presenter (SDL_UpdateWindowSurfaceRects,
+    // a damage-aware encoder) has to push. Outside incremental mode, the whole
+    // target.
+    const std::vector<ScreenRect>& getPresentedRects() const { return presentedRects; }
+
+    // Multisample anti-aliasing: 1 (off) or MSAA_SAMPLES. Coverage and depth
+    // are tested at 4 rotated-grid points per pixel with the same fixed-point
+    // edge functions, but each pixel is shaded once and its color written to
+    // the samples it covers, so the cost is far below supersampling. Samples
+    // live in the renderer; flush() averages them into the target (in tiled
+    // mode tile by tile, while each is still in cache). Depth is per sample,
+    // so intersections are anti-aliased too. Flushes first and starts the
+    // depth buffer over; samples start out as copies of the target's pixels.
+    void setMultisample(int samples);
+    int getMultisample() const { return samples; }
+
+    // Depth-only rendering for triangle draws: depth test and write through
+    // their own row kernels, no color, no lighting and no varyings, so a
+    // depth pre-pass or shadow map costs a fraction of a color pass. Flushes.
+    void setDepthOnly(bool enabled);
+    bool isDepthOnly() const { return depthOnly; }
+    // Depth buffer, width x height samples in getDepthFormat() (MSAA_SAMPLES
+    // per pixel, side by side, when multisampling); valid after flush()
+    const void* getDepthBuffer() const { return zbuffer.data(); }
+    // How depth is stored (see DepthFormat); Float32 by default. Unorm16
+    // halves the memory every depth test, write and clear touches, Fixed24
+    // spreads its precision evenly over the depth range, and ReversedFloat32
+    // makes setFieldOfView/setDepthRange swap the near and far planes, so
+    // distant depths land near 0 where floats are densest, and draws where
+    // depth is larger. Flushes and starts the depth buffer over.
+    void setDepthFormat(DepthFormat format);
+    DepthFormat getDepthFormat() const { return depthFormat; }
+
+    // Shadow mapping for drawMesh. Between beginShadowPass() and
+    // endShadowPass(), drawMesh renders depth only, into a separate shadow map
+    // seen from the light (setLightDirection) through an orthographic
+    // projection fitted to a view-space sphere that should hold every shadow
+    // caster and receiver. It uses the depth-only kernels and, in tiled mode,
+    // the same binning and thread pool. After endShadowPass(), drawMesh is
+    // shadowed: each pixel's position in the map is interpolated perspective-
+    // correctly and tested with 2x2 percentage-closer filtering. Shadowing
+    // lasts until the next beginShadowPass() or disableShadows(); the light
+    // should not move in between.
+    void setShadowSettings(const ShadowSettings& settings) { shadowSettings = settings; }
+    const ShadowSettings& getShadowSettings() const { return shadowSettings; }
+    void beginShadowPass(const Vector3D& center, float radius);
+    void endShadowPass();
+    void disableShadows();
+
+    // Hierarchical Z: a min/max depth per 8x8 block lets the rasterizer skip
+    // blocks (and whole triangles) that lie behind what is already drawn.
+    // On by default; output is identical either way.
+    void setHiZ(bool enabled) { hizEnabled = enabled; }
+    HiZStats getHiZStats() const;
+    void resetHiZStats();
+
+    RenderTimings getTimings() const { return timings; }
+    void resetTimings() { timings = RenderTimings(); }
+
+    ClusterStats getClusterStats() const { return clusterStats; }
+    void resetClusterStats() { clusterStats = ClusterStats(); }
+
+    InstanceStats getInstanceStats() const { return instanceStats; }
+    void resetInstanceStats() { instanceStats = InstanceStats(); }
+
+    RayStats getRayStats() const { return rayStats; }
+    void resetRayStats() { rayStats = RayStats(); }
+
+    // Instrumentation, off by default: triangle counts, pixel counts and
+    // row-kernel time per cell (the tiles in tiled mode, 32 pixels square
+    // otherwise), and how many times each pixel was written. Each row is
+    // first counted by a scalar pass that mirrors its kernel, which slows
+    // rasterization down but stays out of the kernel times. Off, the
+    // rasterizer pays one branch per raster call. Flushes.
+    void setStats(bool enabled);
+    bool isStatsEnabled() const { return statsEnabled; }
+    // Totals, the pixel ones summed over the cells
+    RenderStats getStats() const;
+    void resetStats();
+    int getStatsCellSize() const { return dirtyCell; }
+    int getStatsCellsX() const { return cellsX; }
+    int getStatsCellsY() const { return cellsY; }
+    const std::vector<PixelStats>& getCellStats() const { return cellStats; }   // row-major
+    const std::vector<uint32_t>& getOverdraw() const { return overdraw; }       // width x height
+    // width x height ARGB32 heatmaps, black where nothing was drawn: overdraw
+    // on a fixed scale from blue (written once) to red (8 times or more), and
+    // each cell's kernel time relative to the frame's costliest cell
+    void overdrawHeatmap(std::vector<uint32_t>& pixels) const;
+    void costHeatmap(std::vector<uint32_t>& pixels) const;
+
     // Raw buffer bytes (ARGB32, little-endian: 0xAARRGGBB). Returned as byte pointer.
+    // Rows are getPitch() bytes apart.
     const unsigned char* getBuffer() const { return reinterpret_cast<const unsigned char*>(buffer); }
+    int getPitch() const { return stride * 4; }
+
+    // Render into externally owned ARGB32 memory of width x height pixels whose
+    // rows are pitchBytes apart (a locked SDL surface, a shared-memory frame,
+    // a Presenter buffer). nullptr switches back to the internal buffer.
+    // Anything already drawn is flushed into the previous target first.
+    // Fast-clear state is remembered for the last few targets; pass
+    // contentsKept = false if something other than this renderer has written
+    // into the memory since it was last a target.
+    void setTarget(uint32_t* pixels, int pitchBytes, bool contentsKept = true);
 
     int getWidth() const { return width; }
     int getHeight() const { return height; }
 
+    // Triangle fill instruction set; defaults to the best the CPU supports.
+    // Requests above what the CPU supports are clamped. Output is identical.
+    void setSimdLevel(SimdLevel level);
+    SimdLevel getSimdLevel() const { return simd; }
+
 private:
     int width, height;
-    std::vector<float> zbuffer;
-    uint32_t* buffer;  // ARGB32 pixel buffer (row-major)
+    std::vector<uint32_t> zbuffer;   // samples per pixel, consecutive, in depthFormat
+    DepthFormat depthFormat = DepthFormat::Float32;
+    // Hierarchical Z and the triangle depth bounds keep depths times this, so
+    // that nearer is smaller in every format
+    float depthSign = 1.0f;
+    uint32_t* buffer;     // current ARGB32 target (row-major)
+    int stride;           // target row length in pixels
+    uint32_t* ownBuffer;  // internal target, used unless setTarget() says otherwise
+    SimdLevel simd;
+    // Row kernels by RowMode and pipeline state key (see pipelineKey), single
+    // and multisample
+    RowKernel kernels[ROW_MODE_COUNT][8];
+    RowKernel multisampleKernels[ROW_MODE_COUNT][8];
+    bool depthOnly = false;
+    const Texture* texture = nullptr;
+    PipelineState pipeline;
+
+    // Per-vertex smooth-shading input to setupTriangle: 1/w and each varying / w
+    struct VertexVaryings {
+        float invW;
+        float var[MAX_VARYINGS];
+    };
+    // varyings, if given, holds one entry per vertex and makes t smooth; a
+    // texture makes it textured as well (the u, v varyings are only read
+    // then), a shadow map shadowed (the shadow-map varyings likewise)
+    bool setupTriangle(
+        float x0,float y0,float z0,
+        float x1,float y1,float z1,
+        float x2,float y2,float z2,
+        uint32_t color, TriangleSetup& t,
+        const VertexVaryings* varyings = nullptr,
+        const Texture* tex = nullptr,
+        const ShadowMap* shadow = nullptr) const;
+    // Rasterize the part of t inside the inclusive pixel rect, block by block
+    // against the hierarchical Z
+    void rasterTriangle(const TriangleSetup& t, int x0, int y0, int x1, int y1);
+    // Run the row kernel over a rect already clamped to t's bounding box;
+    // with stats on, one cell at a time, counted and timed
+    void rasterRect(const TriangleSetup& t, int x0, int y0, int x1, int y1);
+    // rasterRect's rows through the kernel, or through countRow into a cell
+    template <bool COUNT>
+    void rasterRows(const TriangleSetup& t, int x0, int y0, int x1, int y1, PixelStats* cell);
+    // Depth sample i (pixel times samples plus sample) in the buffer
+    void* depthAt(size_t i) { return reinterpret_cast<unsigned char*>(zbuffer.data()) + i * depthBytes(depthFormat); }
+    // Size the depth buffer for the current format and sample count, cleared
+    void allocateDepth();
+    // Reset hierarchical Z over an inclusive pixel rect (block aligned, or
+    // ending at the screen edge)
+    void resetHiZRect(int x0, int y0, int x1, int y1);
+    // Recompute it over such a rect from the (single-sample) depth buffer
+    void updateHiZRect(int x0, int y0, int x1, int y1);
+    void binTriangle(const TriangleSetup& t);
+    // Bin (tiled mode) or rasterize a set-up triangle
+    void submitTriangle(const TriangleSetup& t);
+    // Immediate-mode rasterTriangle over the screen; with multisampling, also
+    // grows the rect flush() resolves
+    void drawImmediate(const TriangleSetup& t);
+    // Transparent pass: queue a blended triangle with its sort key; sort
+    // and draw (or bin) the queue
+    void queueTransparent(const TriangleSetup& t);
+    void drawTransparent();
+    // drawMesh stages: fill the post-transform buffers, then cull, light,
+    // clip and submit triangles [first, first + count)
+    void transformVertices(const Vector3D* positions, size_t vertexCount, const Matrix4x4& modelView,
+                           const VertexAttributes& attributes);
+    void submitSmooth(size_t t, uint32_t i0, uint32_t i1, uint32_t i2, const uint32_t* colors,
+                      float faceBrightness, uint8_t crossing, const VertexAttributes& attributes,
+                      const Texture* tex);
+    void submitTriangles(const uint32_t* indices, const uint32_t* colors, size_t first, size_t count,
+                         const VertexAttributes& attributes);
+    // View-space frustum planes of the projection (see drawMesh)
+    void frustumPlanes(float planes[6][4]) const;
+    // drawInstanced with LOD sizes measured from eye, the camera position in
+    // view's space (not the origin in the shadow renderer's light space), and
+    // focal, the camera's pixels per unit at unit distance
+    void drawInstanced(const InstancedMesh& mesh, const Matrix4x4* transforms, size_t count,
+                       const Matrix4x4& view, const Vector3D& eye, float focal);
+    // Incremental mode: record a draw (with the render state it depends on)
+    // for the frame, and the frame's flush: diff, clear and replay
+    enum class DrawKind : uint8_t { FlatTriangle, ShadedTriangle, Mesh, MeshletMesh, Raytrace, Pixel };
+    struct RecordedDraw {
+        DrawKind kind;
+        const Vector3D* positions;
+        size_t vertexCount;
+        const uint32_t* indices;
+        size_t triangleCount;
+        const uint32_t* colors;
+        const Meshlet* meshlets;
+        size_t meshletCount;
+        VertexAttributes attributes;
+        Matrix4x4 modelView;
+        const Bvh* bvh;
+        bool shadows;
+        // triangle corners; flat triangles and pixels keep their color in the
+        // first corner's r, g, b and a triangle's brightness in its u
+        ShadedVertex vertices[3];
+        PipelineState pipeline;
+        const Texture* texture;
+        CullMode cullMode;
+        bool sortTransparent, depthOnly, shadowed;
+        Vector3D lightDir;
+        Matrix4x4 projection;
+        ScreenRect bounds;   // pixels it can touch; empty while x0 > x1
+    };
+    RecordedDraw& recordDraw(DrawKind kind);
+    static bool sameDraw(const RecordedDraw& a, const RecordedDraw& b);
+    ScreenRect drawBounds(const RecordedDraw& d);
+    void replayDraw(const RecordedDraw& d);
+    void beginIncrementalFrame(uint32_t color);
+    void flushIncremental();
+    // Set the cells under a rect; whether any cell under it is dirty
+    void markCells(std::vector<uint8_t>& cells, const ScreenRect& r) const;
+    bool touchesDirty(int x0, int y0, int x1, int y1) const;
+    // Rects covering the set cells of a mask
+    void cellRects(const std::vector<uint8_t>& cells, std::vector<ScreenRect>& rects) const;
+    // Size the cell grid for the current mode (tiles, or DIRTY_CELL pixels)
+    void resetCells();
+    void renderTile(int tile);
+    // Average the sample colors of an inclusive pixel rect into the target
+    void resolveRect(int x0, int y0, int x1, int y1);
+    uint8_t tileClearFlags(int tile) const;
+    void clearStrip(int strip);
+
+    // Hierarchical Z: nearest / farthest stored depth per 8x8 block, times
+    // depthSign. Both are conservative bounds; depths only ever get nearer
+    // between clears.
+    bool hizEnabled = true;
+    int blocksX, blocksY;
+    std::vector<float> hizMin, hizMax;
+
+    // Multisampling: sample colors, MSAA_SAMPLES per pixel (depths are in
+    // zbuffer), and per tile whether they still hold a clear color
+    int samples = 1;
+    std::vector<uint32_t> sampleColor;
+    // Immediate mode: bounds of the samples drawn since the last resolve
+    // (empty while x0 > x1)
+    int resolveX0 = 0, resolveY0 = 0, resolveX1 = -1, resolveY1 = -1;
+    std::atomic<uint64_t> hizBlocksRejected{0}, hizTrianglesRejected{0};
+    RenderTimings timings;
+    ClusterStats clusterStats;
+    InstanceStats instanceStats;
+    RayStats rayStats;
+    // Instrumentation: on only if compiled in; cells follow the dirty cells
+    bool statsEnabled = false;
+    bool counting() const { return RENDER_STATS && statsEnabled; }
+    RenderStats stats;   // triangle counts; the pixels are in cellStats
+    std::vector<PixelStats> cellStats;
+    std::vector<uint32_t> overdraw;
+
+    // drawMesh state and post-transform buffers: view space for culling and
+    // lighting, clip space, and screen space for vertices in front of the camera
+    float fieldOfView = 90.0f, nearZ = 0.1f, farZ = 1000.0f;
+    Matrix4x4 projection;
+    Vector3D lightDir;
+    CullMode cullMode = CullMode::None;
+    std::vector<float> viewX, viewY, viewZ;
+    std::vector<float> clipX, clipY, clipZ, clipW;
+    std::vector<float> screenX, screenY, screenZ;
+    std::vector<uint8_t> frustumCodes, guardCodes;
+    std::vector<float> vertexLight;   // per-vertex brightness when normals are given
+    std::vector<Matrix4x4> instanceModelView;   // drawInstanced batch
+
+    // Shadow mapping: the depth-only renderer drawing the map, the light's
+    // view transform, view space to shadow-map pixels and depth, and the
+    // post-transform shadow-map positions of shadowed drawMesh vertices
+    ShadowSettings shadowSettings;
+    std::unique_ptr<Renderer> shadowRenderer;
+    bool shadowPass = false, shadowed = false;
+    Matrix4x4 lightView, shadowMatrix;
+    ShadowMap shadowMap;
+    std::vector<float> shadowX, shadowY, shadowZ;
+
+    // Transparent pass queue, and radix sort keys (depth key << 32 | index)
+    bool sortTransparent = false;
+    std::vector<TriangleSetup> transparent;
+    std::vector<uint64_t> sortKeys, sortScratch;
+    float transparentMinZ = 0, transparentMaxZ = 0;
+
+    // Deferred tiled mode state
+    bool tiled = false;
+    int tileSize = 64;
+    int tilesX = 0, tilesY = 0;
+    std::shared_ptr<ThreadPool> pool;   // shared with the shadow renderer
+    std::vector<TriangleSetup> triangles;        // binned this frame, in submission order
+    std::vector<std::vector<uint32_t>> bins;     // per tile: indices into triangles
+    std::vector<int> activeTiles;
+    bool colorClearPending = false, depthClearPending = false;
+    uint32_t clearColor = 0;
+    // Per tile: the color a target still holds untouched since its last clear,
+    // kept per recently used target (most recent first, [0] is current), and
+    // whether the depth buffer is untouched since its last clear
+    struct TileColor {
+        uint32_t color;
+        bool clean;
+    };
+    // In incremental mode a target also keeps the draws it shows and the
+    // color they were drawn over (valid once it has shown a frame)
+    struct TargetState {
+        uint32_t* pixels;
+        int stride;
+        std::vector<TileColor> tiles;
+        std::vector<RecordedDraw> shown;
+        uint32_t shownClear;
+        bool shownValid;
+    };
+    std::vector<TargetState> targets;
+    std::vector<uint8_t> tileDepthClean;
+    std::vector<TileColor> sampleTiles;
+    std::vector<uint8_t> clearFlags;   // per tile, for the clear in progress
+
+    // Incremental mode: the frame's draws so far, whether any were recorded
+    // (or the frame cleared) since the last flush, and while replaying, the
+    // cells being redrawn, as a mask and as rects. Cells are dirtyCell pixels
+    // square; presentedCells collects those rewritten since the clear.
+    bool incremental = false, framePending = false, replaying = false;
+    std::vector<RecordedDraw> frameDraws;
+    int dirtyCell = 32, cellsX = 0, cellsY = 0;
+    std::vector<uint8_t> dirtyCells, presentedCells;
+    std::vector<ScreenRect> dirtyRects, presentedRects;
 };
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdint>
+
+// Scene depth as seen from a light, looked up by the row kernels of shadowed
+// triangles. Lookups are in shadow-map pixels (centers at +0.5) and in the
+// map's depth range, as the depth-only pass stored it.
+class ShadowMap {
+public:
+    ShadowMap() = default;
+    // depth is width x height floats, row-major. A point counts as lit when
+    // its depth is within bias of the stored one; strength 0-256 is how much
+    // of the light a fully occluded point loses.
+    ShadowMap(const float* depth, int width, int height, float bias, uint32_t strength)
+        : depth(depth), width(width), height(height), bias(bias), strength(strength) {}
+
+    // Color channel scale at (x, y, z), 0-256: 2x2 percentage-closer
+    // filtering, each texel's depth test weighted bilinearly with 8-bit
+    // weights, then 256 - strength * occlusion. Outside the map is lit.
+    uint32_t light(float x, float y, float z) const;
+    // light() for 4 points: weights and depth tests in SSE2, the texel reads
+    // scalar (one bounds check per point while its 2x2 footprint is inside)
+    void light4(const float* x, const float* y, const float* z, uint32_t* out) const;
+
+private:
+    const float* depth = nullptr;
+    int width = 0, height = 0;
+    float bias = 0;
+    uint32_t strength = 0;
+
+    // stored depth at texel (x, y); infinitely far (always lit) outside
+    float depthAt(int x, int y) const;
+};
@@ -0,0 +1,60 @@
+#pragma once
+#include "Vector3D.h"
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// --- Math helpers ---
+struct Vec3 { float x,y,z; };
+constexpr float PI = 3.14159265358979323846f;
+
+// --- Tri struct ---
+struct Tri {
+    int v0,v1,v2;
+    unsigned char r,g,b;
+};
+
+// --- Shape generators ---
+void makeCube(std::vector<Vec3> &verts, std::vector<Tri> &tris);
+void makeTetrahedron(std::vector<Vec3> &verts, std::vector<Tri> &tris);
+void makeIcosahedron(std::vector<Vec3> &verts, std::vector<Tri> &tris);
+void makeHelix(std::vector<Vec3> &verts, std::vector<Tri> &tris, int N=100);
+void makeEnt(std::vector<Vec3> &verts, std::vector<Tri> &tris);
+// segments around and rings along the root; fewer give coarser levels of detail
+void makeCarrot(std::vector<Vec3> &verts, std::vector<Tri> &tris, int segments=28, int rings=18);
+
+// Shapes in viewer key order (keys 1..6): cube, tetrahedron, icosahedron,
+// helix, ent, carrot
+const int SHAPE_COUNT = 6;
+void makeShape(int index, std::vector<Vec3> &verts, std::vector<Tri> &tris);
+const char* shapeName(int index);
+
+// Indexed mesh in the layout Renderer::drawMesh takes
+struct Mesh {
+    std::vector<Vector3D> positions;
+    std::vector<uint32_t> indices;   // 3 per triangle
+    std::vector<uint32_t> colors;    // 0xRRGGBB per triangle
+    // Optional per-vertex attributes for smooth shading (VertexAttributes);
+    // empty or one per position
+    std::vector<Vector3D> normals;
+    std::vector<uint32_t> vertexColors;   // 0xRRGGBB
+    std::vector<float> uvs;               // texture u, v; empty or two per position
+};
+Mesh toMesh(const std::vector<Vec3> &verts, const std::vector<Tri> &tris);
+// Fill mesh.normals with the area-weighted sum of each vertex's face normals,
+// in the winding drawMesh lights faces with. Vertices shared across a hard
+// edge get rounded off; split them where a crease should stay sharp.
+void computeVertexNormals(const Vector3D *positions, size_t vertexCount,
+                          const uint32_t *indices, size_t triangleCount,
+                          std::vector<Vector3D> &normals);
+inline void computeVertexNormals(Mesh &mesh){
+    computeVertexNormals(mesh.positions.data(), mesh.positions.size(), mesh.indices.data(), mesh.indices.size()/3, mesh.normals);
+}
+// Fill uvs by projecting each vertex onto a sphere around the bounding
+// box center: u from longitude, v from latitude. Triangles straddling the
+// u = 0 / 1 seam interpolate across the whole texture; split seam vertices
+// where that shows.
+void computeSphericalUVs(const Vector3D *positions, size_t vertexCount, std::vector<float> &uvs);
+inline void computeSphericalUVs(Mesh &mesh){
+    computeSphericalUVs(mesh.positions.data(), mesh.positions.size(), mesh.uvs);
+}
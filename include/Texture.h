@@ -0,0 +1,73 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+enum class TextureFilter {
+    Nearest,     // nearest texel of the nearest mip
+    Bilinear,    // 2x2 texels of the nearest mip
+    Trilinear    // bilinear in the two nearest mips, blended
+};
+enum class TextureWrap { Repeat, Clamp };
+
+// Level of detail in 1/256 mip steps from rho2, the squared texels-per-pixel
+// footprint at level 0: log2(sqrt(rho2)) read piecewise-linearly off the float
+// bits, so scalar and SIMD code get the same integer.
+inline int textureLod(float rho2) {
+    int32_t bits;
+    memcpy(&bits, &rho2, sizeof(bits));
+    return (bits - 0x3F800000) >> 16;
+}
+
+// ARGB32 texture with a full mip chain. Every level is stored in 4x4-texel
+// tiles, one 64-byte cache line each, so a footprint walking down a column
+// touches a new line every 4 texels instead of every texel. Sizes are powers
+// of two (other sizes are resampled up), which makes wrapping, tiling and
+// mip addressing shifts and masks. Filtering is fixed-point: 8-bit weights,
+// exact integer blends, identical in the scalar and SSE2 samplers.
+class Texture {
+public:
+    // width x height ARGB32 pixels, rows pitchBytes apart (0 = tightly packed)
+    Texture(const uint32_t* pixels, int width, int height, int pitchBytes = 0);
+
+    void setFilter(TextureFilter f) { filter = f; }
+    void setWrap(TextureWrap w) { wrap = w; }
+    TextureFilter getFilter() const { return filter; }
+    TextureWrap getWrap() const { return wrap; }
+
+    int getWidth() const { return levels[0].width; }
+    int getHeight() const { return levels[0].height; }
+    int getLevelCount() const { return int(levels.size()); }
+
+    // Texel (x, y) of a level, wrapped per the wrap mode
+    uint32_t texel(int level, int x, int y) const;
+    // Filtered sample at normalized (u, v) with textureLod() lod
+    uint32_t sample(float u, float v, int lod) const;
+    // sample() for 4 pixels at once (SSE2 where available), same results
+    void sample4(const float* u, const float* v, const int* lod, uint32_t* out) const;
+
+private:
+    struct Level {
+        int width, height;
+        int tilesXShift;               // log2 of the tiles per row
+        size_t offset;                 // first texel in data
+    };
+    std::vector<Level> levels;
+    std::vector<uint32_t> data;        // all levels, tiled
+    TextureFilter filter = TextureFilter::Trilinear;
+    TextureWrap wrap = TextureWrap::Repeat;
+
+    uint32_t fetch(const Level& l, int x, int y) const;
+    int wrapCoord(int c, int size) const;
+    // Mip level and trilinear blend weight (0-255) for a lod
+    void pickLevel(int lod, int& level, int& blend) const;
+    uint32_t sampleLevel(int level, float u, float v) const;
+};
+
+// size x size pixels of cells x cells alternating squares, colors a and b
+std::vector<uint32_t> checkerboard(int size, int cells, uint32_t a, uint32_t b);
+
+// Binary PPM (P6, maxval 255) as ARGB32 with alpha 0xFF
+bool loadPPM(const char* path, std::vector<uint32_t>& pixels, int& width, int& height, std::string* error = nullptr);
@@ -0,0 +1,53 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for fork-join jobs. Each job is a range of task
+// indices dealt out to per-worker queues in contiguous blocks; a worker that
+// runs dry steals from the back of the others' queues.
+class ThreadPool {
+public:
+    // threadCount includes the calling thread; <= 0 uses every hardware thread
+    explicit ThreadPool(int threadCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int size() const { return workerCount; }
+
+    // Run fn(task) for every task in [0, count) and wait for all of them.
+    // The calling thread works on the job as worker 0.
+    void run(int count, const std::function<void(int)>& fn);
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<int> tasks;
+    };
+
+    void workerMain(int index);
+    void drain(int index);
+    bool pop(int index, int& task);
+    bool steal(int index, int& task);
+
+    int workerCount;
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<Queue>> queues;
+
+    std::mutex mutex;
+    std::condition_variable wake;   // new job or shutdown
+    std::condition_variable done;   // job finished
+    const std::function<void(int)>* job = nullptr;
+    uint64_t generation = 0;
+    int active = 0;                 // background workers inside drain()
+    bool stopping = false;
+    std::atomic<int> remaining{0};
+};
@@ -0,0 +1,76 @@
+#pragma once
+#include "Renderer.h"
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class ThreadPool;
+
+// One mesh and how it is drawn, shared read-only by every view of a batch.
+// Meshlets are optional; with them each view culls clusters on its own.
+struct BatchScene {
+    const Vector3D* positions = nullptr;
+    size_t vertexCount = 0;
+    const uint32_t* indices = nullptr;
+    size_t triangleCount = 0;
+    const uint32_t* colors = nullptr;   // per triangle
+    const Meshlet* meshlets = nullptr;
+    size_t meshletCount = 0;
+    VertexAttributes attributes;
+    const Texture* texture = nullptr;   // with attributes.uvs
+    CullMode cullMode = CullMode::None;
+    Vector3D lightDirection = Vector3D(1.0f, 0.7f, 0.0f);   // view space, so it turns with each camera
+    uint32_t clearColor = 0x0A0A1E;     // 0xRRGGBB
+    int samples = 1;                    // MSAA_SAMPLES for 4x multisampling
+    DepthFormat depthFormat = DepthFormat::Float32;
+};
+
+// A camera: the scene's model-view matrix and its own viewport
+struct BatchView {
+    Matrix4x4 modelView;
+    int width, height;
+    float fieldOfView = 90.0f;
+};
+
+// Renders many views of one scene as one job: thumbnails, turntables. Views
+// are dealt out to the worker threads, and each draws its views one after
+// another in immediate mode into a small framebuffer of its own, so views
+// never wait on each other the way one view's tiles wait at flush(). Renderers
+// are kept between batches, at most one per worker for each viewport size,
+// so a batch allocates nothing once its sizes have been seen; sizes a batch
+// does not use are freed when it starts.
+class ViewBatch {
+public:
+    // Called on a worker thread as soon as a view is drawn, possibly for
+    // several views at once and out of order. pixels (ARGB32, rows
+    // pitchBytes apart) are valid until it returns.
+    typedef std::function<void(size_t view, const uint32_t* pixels, int width, int height, int pitchBytes)> ViewFn;
+
+    // threadCount includes the calling thread; <= 0 uses every hardware thread
+    explicit ViewBatch(int threadCount = 0);
+    ~ViewBatch();
+
+    ViewBatch(const ViewBatch&) = delete;
+    ViewBatch& operator=(const ViewBatch&) = delete;
+
+    // Draw every view and hand each to done; returns when all have been
+    void render(const BatchScene& scene, const BatchView* views, size_t count, const ViewFn& done);
+    void render(const BatchScene& scene, const std::vector<BatchView>& views, const ViewFn& done) {
+        render(scene, views.data(), views.size(), done);
+    }
+
+    int getThreadCount() const;
+
+private:
+    // A renderer free for the next view of this size, or a new one
+    std::unique_ptr<Renderer> acquire(int width, int height);
+    void release(std::unique_ptr<Renderer> renderer);
+    // Free the idle renderers of sizes none of these views has
+    void keepSizes(const BatchView* views, size_t count);
+
+    std::unique_ptr<ThreadPool> pool;
+    std::mutex mutex;
+    std::vector<std::unique_ptr<Renderer>> idle;
+};
@@ -0,0 +1,659 @@
+// src/bench.cpp - fixed-scene benchmark with per-stage timing and JSON output
+//
+//   SoftwareRendererBench                          all scenes, JSON on stdout
+//   SoftwareRendererBench --output base.json       save a baseline
+//   SoftwareRendererBench --baseline base.json     exit 1 if any scene's median
+//                                                  frame is >10% slower
+//
+// Every scene renders the same frames on every run: the camera angle advances a
+// fixed step per frame, warm-up frames are excluded, and nothing depends on
+// wall-clock time. Present is timed as the pitched row copy the SDL viewer
+// does into its window surface (of the redrawn rects only, for incremental
+// scenes), unless --zero-copy renders into it directly.
+#include "Renderer.h"
+#include "Bvh.h"
+#include "Matrix4x4.h"
+#include "MeshOptimize.h"
+#include "MeshSimplify.h"
+#include "Shapes.h"
+#include "Texture.h"
+#include "ThreadPool.h"
+#include "ViewBatch.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A scene mesh, optimized for the vertex cache and split into meshlets
+// unless the run is --raw
+struct BenchMesh {
+    Mesh mesh;
+    std::vector<Meshlet> meshlets;
+    float acmr;
+    const Texture* texture = nullptr;   // drawn textured with mesh.uvs when set
+};
+
+struct Instance {
+    const BenchMesh* mesh;
+    float x, y, z;   // model offset in front of the camera
+    bool still = false;   // not spun: the same draw every frame
+};
+
+struct Scene {
+    std::string name;
+    int width, height;
+    std::vector<Instance> instances;
+    size_t triangles;   // submitted per frame
+    PipelineState state;
+    int samples = 1;    // Renderer::setMultisample
+    bool depthOnly = false;   // Renderer::setDepthOnly
+    DepthFormat depthFormat = DepthFormat::Float32;   // Renderer::setDepthFormat
+    // > 0: shadow pass over the instances first, the map fitted to this
+    // view-space sphere
+    float shadowRadius = 0;
+    Vector3D shadowCenter = Vector3D(0, 0, 0);
+    // Drawn with drawInstanced instead of per instance when set: world
+    // transforms, viewed from a camera circling above them. triangles is then
+    // measured (after LOD selection and culling).
+    const InstancedMesh* instanced = nullptr;
+    std::vector<Matrix4x4> transforms = std::vector<Matrix4x4>();
+    // Ray traced with Renderer::raytrace instead, with shadow rays: this BVH
+    // over the first instance's mesh. refit moves the mesh into view space
+    // each frame and refits the BVH to it, instead of turning the rays.
+    Bvh* bvh = nullptr;
+    bool refit = false;
+    // Renderer::setIncremental, and present only the rects it redrew
+    bool incremental = false;
+    // > 0: a frame is a turntable of this many views of the first instance,
+    // each width x height: one ViewBatch job when batched, else one view
+    // after another through a single renderer
+    int views = 0;
+    bool batched = false;
+};
+
+struct SceneResult {
+    std::string name;
+    int width, height, frames;
+    size_t triangles;
+    float acmr;                                        // triangle-weighted over instances
+    double clear, transform, setup, raster, sort, resolve, shadow, trace, present;   // mean ms per frame
+    double mean, p50, p99;                             // frame time ms
+    double trianglesPerSec, pixelsPerSec;
+    double raysPerSec;                                 // primary and shadow rays over trace time
+    double viewsPerSec;                                // turntable scenes
+};
+
+// Latitude/longitude sphere with 2 * rings * segments triangles, and
+// longitude / latitude uvs
+static Mesh makeSphereMesh(int rings, int segments, float radius) {
+    Mesh m;
+    for (int r = 0; r <= rings; ++r) {
+        float phi = PI * r / rings;
+        for (int s = 0; s <= segments; ++s) {
+            float theta = 2 * PI * s / segments;
+            m.positions.push_back(Vector3D(radius * sinf(phi) * cosf(theta), radius * cosf(phi), radius * sinf(phi) * sinf(theta)));
+            m.uvs.push_back(float(s) / segments);
+            m.uvs.push_back(float(r) / rings);
+        }
+    }
+    for (int r = 0; r < rings; ++r) {
+        for (int s = 0; s < segments; ++s) {
+            uint32_t a = r * (segments + 1) + s, b = a + segments + 1;
+            uint32_t quad[6] = { a, b, a + 1, a + 1, b, b + 1 };
+            m.indices.insert(m.indices.end(), quad, quad + 6);
+            uint32_t c = ((r + s) & 1) ? 0x3C8CDCu : 0xDCDCDCu;
+            m.colors.push_back(c);
+            m.colors.push_back(c);
+        }
+    }
+    return m;
+}
+
+static double percentile(std::vector<double> v, double p) {
+    if (v.empty()) return 0;
+    std::sort(v.begin(), v.end());
+    size_t i = size_t(std::ceil(p * v.size())) - 1;
+    return v[std::min(i, v.size() - 1)];
+}
+
+// Turntable views of the first instance, the camera stepping around it
+static std::vector<BatchView> turntable(const Scene& scene) {
+    const Instance& inst = scene.instances[0];
+    std::vector<BatchView> views;
+    for (int v = 0; v < scene.views; ++v)
+        views.push_back(BatchView{ Matrix4x4::translation(inst.x, inst.y, inst.z) * Matrix4x4::rotationX(0.3f) *
+                                   Matrix4x4::rotationY(2 * PI * v / scene.views), scene.width, scene.height, 90.0f });
+    return views;
+}
+
+// A frame is a whole turntable; each view is copied out as it completes
+static SceneResult runViews(const Scene& scene, int frames, int warmup, int threads, bool tiled) {
+    const BenchMesh& bm = *scene.instances[0].mesh;
+    const Mesh& m = bm.mesh;
+    BatchScene batchScene;
+    batchScene.positions = m.positions.data(); batchScene.vertexCount = m.positions.size();
+    batchScene.indices = m.indices.data(); batchScene.triangleCount = m.indices.size() / 3;
+    batchScene.colors = m.colors.data();
+    batchScene.meshlets = bm.meshlets.empty() ? nullptr : bm.meshlets.data();
+    batchScene.meshletCount = bm.meshlets.size();
+    std::vector<BatchView> views = turntable(scene);
+    std::vector<uint32_t> thumbnails(size_t(scene.width) * scene.height * views.size());
+    auto keep = [&](size_t view, const uint32_t* pixels, int width, int height, int pitchBytes) {
+        for (int y = 0; y < height; ++y)
+            memcpy(&thumbnails[(view * height + y) * width], reinterpret_cast<const unsigned char*>(pixels) + size_t(y) * pitchBytes, size_t(width) * 4);
+    };
+
+    std::unique_ptr<ViewBatch> batch;
+    std::unique_ptr<Renderer> renderer;
+    if (scene.batched) batch.reset(new ViewBatch(threads));
+    else {
+        renderer.reset(new Renderer(scene.width, scene.height));
+        if (tiled) renderer->setTiled(true, threads);
+        renderer->setLightDirection(batchScene.lightDirection);
+    }
+    std::vector<double> frameTimes;
+    for (int frame = 0; frame < warmup + frames; ++frame) {
+        if (frame == warmup && renderer) renderer->resetTimings();
+        auto start = std::chrono::steady_clock::now();
+        if (batch) batch->render(batchScene, views, keep);
+        else {
+            for (size_t v = 0; v < views.size(); ++v) {
+                renderer->clearColorAndDepth(10, 10, 30);
+                renderer->drawMesh(batchScene.positions, batchScene.vertexCount, batchScene.indices, batchScene.colors,
+                                   batchScene.meshlets, batchScene.meshletCount, views[v].modelView);
+                renderer->flush();
+                keep(v, reinterpret_cast<const uint32_t*>(renderer->getBuffer()), scene.width, scene.height, renderer->getPitch());
+            }
+        }
+        if (frame >= warmup)
+            frameTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    SceneResult res = SceneResult();
+    res.name = scene.name;
+    res.width = scene.width;
+    res.height = scene.height;
+    res.frames = frames;
+    res.triangles = scene.triangles;
+    res.acmr = bm.acmr;
+    if (renderer) {
+        RenderTimings t = renderer->getTimings();
+        res.clear = t.clear / frames;
+        res.transform = t.transform / frames;
+        res.setup = t.setup / frames;
+        res.raster = t.raster / frames;
+    }
+    double total = 0;
+    for (double f : frameTimes) total += f;
+    res.mean = total / frames;
+    res.p50 = percentile(frameTimes, 0.50);
+    res.p99 = percentile(frameTimes, 0.99);
+    double seconds = total * 0.001;
+    res.trianglesPerSec = seconds > 0 ? double(res.triangles) * frames / seconds : 0;
+    res.pixelsPerSec = seconds > 0 ? double(scene.width) * scene.height * scene.views * frames / seconds : 0;
+    res.viewsPerSec = seconds > 0 ? double(scene.views) * frames / seconds : 0;
+    return res;
+}
+
+static SceneResult runScene(const Scene& scene, int frames, int warmup, int threads, bool tiled, bool zeroCopy) {
+    if (scene.views > 0) return runViews(scene, frames, warmup, threads, tiled);
+    Renderer renderer(scene.width, scene.height);
+    if (tiled) renderer.setTiled(true, threads);
+    renderer.setFieldOfView(90.0f);
+    renderer.setLightDirection(Vector3D(1.0f, 0.7f, 0.0f));
+    renderer.setPipelineState(scene.state);
+    renderer.setTransparencySorting(true);   // only affects blended scenes
+    renderer.setMultisample(scene.samples);
+    renderer.setDepthOnly(scene.depthOnly);
+    renderer.setDepthFormat(scene.depthFormat);
+    renderer.setIncremental(scene.incremental);
+
+    // stand-in for the window surface: rows padded the way SDL pads them
+    int rowBytes = scene.width * 4;
+    int pitch = (rowBytes + 63) & ~63;
+    std::vector<unsigned char> surface(size_t(pitch) * scene.height);
+    if (zeroCopy) renderer.setTarget(reinterpret_cast<uint32_t*>(surface.data()), pitch);
+
+    SceneResult res = SceneResult();
+    res.name = scene.name;
+    res.width = scene.width;
+    res.height = scene.height;
+    res.frames = frames;
+    res.triangles = scene.triangles;
+    double missed = 0;
+    for (const Instance& inst : scene.instances) missed += double(inst.mesh->acmr) * (inst.mesh->mesh.indices.size() / 3);
+    res.acmr = scene.triangles ? float(missed / scene.triangles) : 0.0f;
+
+    std::vector<double> frameTimes;
+    double present = 0;
+    std::vector<Vector3D> moved;   // refit scenes: the mesh in view space
+    float angle = 0;
+    for (int frame = 0; frame < warmup + frames; ++frame) {
+        if (frame == warmup) {
+            renderer.resetTimings();
+            renderer.resetInstanceStats();
+            renderer.resetRayStats();
+            present = 0;
+        }
+        angle += 0.01f;
+        auto start = std::chrono::steady_clock::now();
+
+        Matrix4x4 spin = Matrix4x4::rotationY(angle) * Matrix4x4::rotationX(angle * 0.6f);
+        auto drawInstances = [&]() {
+            if (scene.instanced) {
+                Matrix4x4 view = Matrix4x4::rotationX(0.35f) * Matrix4x4::rotationY(angle) * Matrix4x4::translation(0, 3.0f, 0);
+                renderer.drawInstanced(*scene.instanced, scene.transforms, view);
+                return;
+            }
+            if (scene.bvh) {
+                const Instance& inst = scene.instances[0];
+                Matrix4x4 modelView = Matrix4x4::translation(inst.x, inst.y, inst.z) * spin;
+                const Mesh& m = inst.mesh->mesh;
+                if (scene.refit) {
+                    moved.resize(m.positions.size());
+                    for (size_t i = 0; i < moved.size(); ++i) moved[i] = modelView.transform(m.positions[i]);
+                    scene.bvh->refit(moved.data());
+                    modelView = Matrix4x4::identity();
+                }
+                renderer.raytrace(*scene.bvh, m.colors.data(), modelView);
+                return;
+            }
+            for (const Instance& inst : scene.instances) {
+                Matrix4x4 modelView = Matrix4x4::translation(inst.x, inst.y, inst.z) * (inst.still ? Matrix4x4::rotationX(0.5f) : spin);
+                const Mesh& m = inst.mesh->mesh;
+                VertexAttributes attributes;
+                if (!m.normals.empty()) attributes.normals = m.normals.data();
+                if (inst.mesh->texture) attributes.uvs = m.uvs.data();
+                renderer.setTexture(inst.mesh->texture);
+                if (inst.mesh->meshlets.empty())
+                    renderer.drawMesh(m.positions.data(), m.positions.size(), m.indices.data(), m.indices.size() / 3,
+                                      m.colors.data(), modelView, attributes);
+                else renderer.drawMesh(m.positions.data(), m.positions.size(), m.indices.data(), m.colors.data(),
+                                       inst.mesh->meshlets.data(), inst.mesh->meshlets.size(), modelView, attributes);
+            }
+        };
+        if (scene.shadowRadius > 0) {
+            renderer.beginShadowPass(scene.shadowCenter, scene.shadowRadius);
+            drawInstances();
+            renderer.endShadowPass();
+        }
+        renderer.clearColorAndDepth(10, 10, 30);
+        drawInstances();
+        renderer.flush();
+
+        auto presentStart = std::chrono::steady_clock::now();
+        if (!zeroCopy) {
+            const unsigned char* src = renderer.getBuffer();
+            for (const ScreenRect& r : renderer.getPresentedRects()) {
+                size_t offset = size_t(r.x0) * 4, bytes = size_t(r.x1 - r.x0 + 1) * 4;
+                for (int y = r.y0; y <= r.y1; ++y) memcpy(&surface[size_t(y) * pitch + offset], src + size_t(y) * rowBytes + offset, bytes);
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        if (frame >= warmup) {
+            present += std::chrono::duration<double, std::milli>(end - presentStart).count();
+            frameTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+        }
+    }
+
+    if (scene.instanced) res.triangles = size_t(renderer.getInstanceStats().trianglesSubmitted / frames);
+    RenderTimings t = renderer.getTimings();
+    double total = 0;
+    for (double f : frameTimes) total += f;
+    res.clear = t.clear / frames;
+    res.transform = t.transform / frames;
+    res.setup = t.setup / frames;
+    res.raster = t.raster / frames;
+    res.sort = t.sort / frames;
+    res.resolve = t.resolve / frames;
+    res.shadow = t.shadow / frames;
+    res.trace = t.trace / frames;
+    res.present = present / frames;
+    res.mean = total / frames;
+    res.p50 = percentile(frameTimes, 0.50);
+    res.p99 = percentile(frameTimes, 0.99);
+    double seconds = total * 0.001;
+    res.trianglesPerSec = seconds > 0 ? double(res.triangles) * frames / seconds : 0;
+    res.pixelsPerSec = seconds > 0 ? double(scene.width) * scene.height * frames / seconds : 0;
+    RayStats rays = renderer.getRayStats();
+    res.raysPerSec = t.trace > 0 ? double(rays.primaryRays + rays.shadowRays) / (t.trace * 0.001) : 0;
+    return res;
+}
+
+static void writeJson(FILE* f, const std::vector<SceneResult>& results, int frames, int threads, bool tiled, bool zeroCopy,
+                      bool optimized, const char* simd) {
+    fprintf(f, "{\n  \"frames\": %d,\n  \"threads\": %d,\n  \"tiled\": %s,\n  \"zero_copy\": %s,\n  \"optimized\": %s,\n  \"simd\": \"%s\",\n  \"scenes\": [\n",
+            frames, threads, tiled ? "true" : "false", zeroCopy ? "true" : "false", optimized ? "true" : "false", simd);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const SceneResult& r = results[i];
+        fprintf(f, "    { \"name\": \"%s\", \"width\": %d, \"height\": %d, \"triangles\": %zu, \"acmr\": %.3f,\n"
+                   "      \"clear_ms\": %.4f, \"transform_ms\": %.4f, \"setup_ms\": %.4f, \"raster_ms\": %.4f, \"sort_ms\": %.4f, \"resolve_ms\": %.4f, \"shadow_ms\": %.4f, \"trace_ms\": %.4f,\n"
+                   "      \"present_ms\": %.4f, \"mean_ms\": %.4f, \"p50_ms\": %.4f, \"p99_ms\": %.4f,\n"
+                   "      \"triangles_per_sec\": %.0f, \"pixels_per_sec\": %.0f, \"rays_per_sec\": %.0f, \"views_per_sec\": %.1f }%s\n",
+                r.name.c_str(), r.width, r.height, r.triangles, r.acmr,
+                r.clear, r.transform, r.setup, r.raster, r.sort, r.resolve, r.shadow, r.trace, r.present,
+                r.mean, r.p50, r.p99, r.trianglesPerSec, r.pixelsPerSec, r.raysPerSec, r.viewsPerSec,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+// Pull (name, p50_ms) pairs out of a file written by writeJson
+static bool readBaseline(const char* path, std::vector<std::pair<std::string, double>>& out) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+    std::string text;
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) text.append(chunk, n);
+    fclose(f);
+
+    size_t pos = 0;
+    while ((pos = text.find("\"name\": \"", pos)) != std::string::npos) {
+        pos += 9;
+        size_t end = text.find('"', pos);
+        size_t p50 = text.find("\"p50_ms\": ", end);
+        if (end == std::string::npos || p50 == std::string::npos) break;
+        out.push_back(std::make_pair(text.substr(pos, end - pos), atof(text.c_str() + p50 + 10)));
+        pos = p50;
+    }
+    return !out.empty();
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: SoftwareRendererBench [options]\n"
+        "  --frames N        measured frames per scene (default 60)\n"
+        "  --warmup N        unmeasured frames first (default 5)\n"
+        "  --threads N       raster threads, 0 = all cores (default 0)\n"
+        "  --immediate       rasterize in drawMesh instead of tiled at flush()\n"
+        "  --zero-copy       render into the surface instead of copying at present\n"
+        "  --raw             draw meshes in generated order: no vertex cache\n"
+        "                    optimization, no meshlet culling\n"
+        "  --scene TEXT      only scenes whose name contains TEXT\n"
+        "  --quick           640x480 only, 20 frames\n"
+        "  --output PATH     write JSON here instead of stdout\n"
+        "  --baseline PATH   compare median frame times against a saved run\n"
+        "  --tolerance F     allowed slowdown before failing (default 0.10)\n");
+}
+
+int main(int argc, char** argv) {
+    int frames = 60, warmup = 5, threads = 0;
+    bool tiled = true, quick = false, zeroCopy = false, optimize = true;
+    double tolerance = 0.10;
+    std::string filter, output, baseline;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (a == "--help" || a == "-h") { usage(); return 0; }
+        else if (a == "--frames" && hasValue) frames = atoi(argv[++i]);
+        else if (a == "--warmup" && hasValue) warmup = atoi(argv[++i]);
+        else if (a == "--threads" && hasValue) threads = atoi(argv[++i]);
+        else if (a == "--immediate") tiled = false;
+        else if (a == "--zero-copy") zeroCopy = true;
+        else if (a == "--raw") optimize = false;
+        else if (a == "--scene" && hasValue) filter = argv[++i];
+        else if (a == "--quick") quick = true;
+        else if (a == "--output" && hasValue) output = argv[++i];
+        else if (a == "--baseline" && hasValue) baseline = argv[++i];
+        else if (a == "--tolerance" && hasValue) tolerance = atof(argv[++i]);
+        else { fprintf(stderr, "unknown option '%s'\n", a.c_str()); usage(); return 1; }
+    }
+    if (quick) frames = std::min(frames, 20);
+    if (frames <= 0 || warmup < 0) { usage(); return 1; }
+
+    // Meshes: the viewer's shapes plus scaled-up synthetic ones
+    auto prepare = [optimize](Mesh m) {
+        BenchMesh b;
+        if (optimize) optimizeMesh(m);
+        b.acmr = computeACMR(m.indices.data(), m.indices.size() / 3, m.positions.size());
+        if (optimize) b.meshlets = buildMeshlets(m);
+        b.mesh = std::move(m);
+        return b;
+    };
+    std::vector<BenchMesh> shapes;
+    for (int s = 0; s < SHAPE_COUNT; ++s) {
+        std::vector<Vec3> verts; std::vector<Tri> tris;
+        makeShape(s, verts, tris);
+        shapes.push_back(prepare(toMesh(verts, tris)));
+    }
+    BenchMesh sphere = prepare(makeSphereMesh(256, 512, 1.2f));   // 262144 triangles
+    // 16x fewer triangles, Gouraud shaded: compare against sphere-262k
+    Mesh smoothSphere = makeSphereMesh(64, 128, 1.2f);
+    // exact normals: the seam and pole vertices are duplicated, so averaging
+    // face normals would leave creases. The winding faces them inward.
+    for (const Vector3D& p : smoothSphere.positions) smoothSphere.normals.push_back(p * -1.0f);
+    BenchMesh sphereSmooth = prepare(smoothSphere);
+    // the same sphere with a trilinear-filtered 256x256 checker: compare
+    // against sphere-16k-smooth for the cost of sampling
+    std::vector<uint32_t> checker = checkerboard(256, 16, 0xFFE0E0E0u, 0xFF3C8CDCu);
+    Texture checkerTexture(checker.data(), 256, 256);
+    BenchMesh sphereTextured = prepare(std::move(smoothSphere));
+    sphereTextured.texture = &checkerTexture;
+    BenchMesh ball = prepare(makeSphereMesh(16, 32, 0.25f));      // 1024 triangles, instanced
+    BenchMesh gauge = prepare(makeSphereMesh(32, 64, 0.4f));      // 4096 triangles, dashboard
+
+    // carrot levels of detail for drawInstanced, simplified from the full one
+    // (1000 triangles) down to tens of triangles
+    LodChain carrotLods = buildLodChain(shapes[5].mesh);
+    InstancedMesh carrots = carrotLods.instanced();
+    InstancedMesh carrotsFull = carrots;   // the finest level only, for comparison
+    carrotsFull.lodCount = 1;
+    // 100x100 upright carrots one unit apart, each turned its own way
+    std::vector<Matrix4x4> carrotField;
+    for (int gz = 0; gz < 100; ++gz)
+        for (int gx = 0; gx < 100; ++gx)
+            carrotField.push_back(Matrix4x4::translation(gx - 49.5f, 0, gz - 49.5f) * Matrix4x4::rotationY(float((gx * 7 + gz * 13) % 17)) *
+                                  Matrix4x4::rotationX(PI) * Matrix4x4::scale(0.4f, 0.4f, 0.4f));
+
+    // BVHs for the ray traced scenes, built on the bench's thread count
+    Bvh carrotBvh, carrotRefitBvh, sphereBvh;
+    int poolThreads;   // what --threads 0 came to, for the JSON
+    {
+        ThreadPool buildPool(threads);
+        poolThreads = buildPool.size();
+        const Mesh& carrot = shapes[5].mesh;
+        carrotBvh.build(carrot.positions.data(), carrot.positions.size(), carrot.indices.data(), carrot.indices.size() / 3, &buildPool);
+        carrotRefitBvh.build(carrot.positions.data(), carrot.positions.size(), carrot.indices.data(), carrot.indices.size() / 3, &buildPool);
+        auto bvhStart = std::chrono::steady_clock::now();
+        sphereBvh.build(sphere.mesh.positions.data(), sphere.mesh.positions.size(), sphere.mesh.indices.data(),
+                        sphere.mesh.indices.size() / 3, &buildPool);
+        fprintf(stderr, "sphere-262k BVH built in %.1f ms\n",
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - bvhStart).count());
+    }
+
+    struct Resolution { int w, h; };
+    std::vector<Resolution> resolutions = { {640, 480}, {1280, 720}, {1920, 1080} };
+    if (quick) resolutions.resize(1);
+
+    std::vector<Scene> scenes;
+    for (const Resolution& res : resolutions) {
+        std::string suffix = "@" + std::to_string(res.w) + "x" + std::to_string(res.h);
+        for (int s = 0; s < SHAPE_COUNT; ++s) {
+            Scene sc = { std::string(shapeName(s)) + suffix, res.w, res.h, { { &shapes[s], 0, 0, 3.5f } }, shapes[s].mesh.indices.size() / 3, PipelineState() };
+            scenes.push_back(sc);
+        }
+        // anti-aliased carrot: 4x multisampling, against rendering 2x2 the pixels
+        Scene msaa = { "carrot-msaa4" + suffix, res.w, res.h, { { &shapes[5], 0, 0, 3.5f } }, shapes[5].mesh.indices.size() / 3, PipelineState() };
+        msaa.samples = MSAA_SAMPLES;
+        scenes.push_back(msaa);
+        Scene ssaa = msaa;
+        ssaa.name = "carrot-ssaa4" + suffix;
+        ssaa.width *= 2;
+        ssaa.height *= 2;
+        ssaa.samples = 1;
+        scenes.push_back(ssaa);
+        Scene dense = { "sphere-262k" + suffix, res.w, res.h, { { &sphere, 0, 0, 3.0f } }, sphere.mesh.indices.size() / 3, PipelineState() };
+        scenes.push_back(dense);
+        // the same sphere into depth alone, as a depth pre-pass or shadow map would be
+        Scene depth = dense;
+        depth.name = "sphere-262k-depth" + suffix;
+        depth.depthOnly = true;
+        scenes.push_back(depth);
+        // every triangle blended and sorted back to front each frame
+        Scene glassSphere = dense;
+        glassSphere.name = "sphere-262k-transparent" + suffix;
+        glassSphere.state.depthWrite = false;
+        glassSphere.state.blend = BlendMode::Alpha;
+        glassSphere.state.alpha = 96;
+        scenes.push_back(glassSphere);
+        Scene smooth = { "sphere-16k-smooth" + suffix, res.w, res.h, { { &sphereSmooth, 0, 0, 3.0f } }, sphereSmooth.mesh.indices.size() / 3, PipelineState() };
+        scenes.push_back(smooth);
+        Scene textured = { "sphere-16k-textured" + suffix, res.w, res.h, { { &sphereTextured, 0, 0, 3.0f } }, sphereTextured.mesh.indices.size() / 3, PipelineState() };
+        scenes.push_back(textured);
+        // 20x20 grid of balls receding in depth: many small triangles, overdraw
+        Scene field = { "ball-field-400" + suffix, res.w, res.h, {}, 0, PipelineState() };
+        for (int gy = 0; gy < 20; ++gy)
+            for (int gx = 0; gx < 20; ++gx)
+                field.instances.push_back({ &ball, (gx - 9.5f) * 0.4f, (gy - 9.5f) * 0.3f, 3.0f + 0.05f * ((gx * 7 + gy * 3) % 20) });
+        field.triangles = field.instances.size() * (ball.mesh.indices.size() / 3);
+        scenes.push_back(field);
+        // the field casting shadows on itself from a 1024x1024 map over all of it
+        Scene shadowed = field;
+        shadowed.name = "ball-field-400-shadows" + suffix;
+        shadowed.shadowRadius = 5.2f;
+        shadowed.shadowCenter = Vector3D(0.0f, 0.0f, 3.5f);
+        scenes.push_back(shadowed);
+        // 10k carrots through drawInstanced: instance culling and levels of detail
+        Scene carrotScene = { "carrot-field-10k" + suffix, res.w, res.h, {}, 0, PipelineState() };
+        carrotScene.instanced = &carrots;
+        carrotScene.transforms = carrotField;
+        scenes.push_back(carrotScene);
+        Scene carrotFull = carrotScene;
+        carrotFull.name = "carrot-field-10k-nolod" + suffix;
+        carrotFull.instanced = &carrotsFull;
+        scenes.push_back(carrotFull);
+        // ray traced with shadow rays: the carrot with rays turned into model
+        // space, the same with the BVH refitted to the spinning mesh instead,
+        // and the dense sphere
+        Scene carrotTraced = { "carrot-rt" + suffix, res.w, res.h, { { &shapes[5], 0, 0, 3.5f } }, shapes[5].mesh.indices.size() / 3, PipelineState() };
+        carrotTraced.bvh = &carrotBvh;
+        scenes.push_back(carrotTraced);
+        Scene carrotRefit = carrotTraced;
+        carrotRefit.name = "carrot-rt-refit" + suffix;
+        carrotRefit.bvh = &carrotRefitBvh;
+        carrotRefit.refit = true;
+        scenes.push_back(carrotRefit);
+        Scene sphereTraced = dense;
+        sphereTraced.name = "sphere-262k-rt" + suffix;
+        sphereTraced.bvh = &sphereBvh;
+        scenes.push_back(sphereTraced);
+        // dashboard: a 6x4 panel of still spheres with one spinning carrot
+        // among them, redrawn whole every frame and incrementally
+        Scene dashboard = { "dashboard" + suffix, res.w, res.h, {}, 0, PipelineState() };
+        for (int gy = 0; gy < 4; ++gy) {
+            for (int gx = 0; gx < 6; ++gx) {
+                float x = (gx - 2.5f) * 1.0f, y = (gy - 1.5f) * 1.0f;
+                if (gx == 5 && gy == 3) dashboard.instances.push_back({ &shapes[5], x * 2.0f, y * 2.0f, 7.0f });
+                else dashboard.instances.push_back({ &gauge, x, y, 3.5f, true });
+                dashboard.triangles += dashboard.instances.back().mesh->mesh.indices.size() / 3;
+            }
+        }
+        scenes.push_back(dashboard);
+        Scene dashboardIncremental = dashboard;
+        dashboardIncremental.name = "dashboard-incremental" + suffix;
+        dashboardIncremental.incremental = true;
+        scenes.push_back(dashboardIncremental);
+        // the same field half transparent: blended, depth tested but not written
+        Scene glass = field;
+        glass.name = "ball-field-400-blend" + suffix;
+        glass.state.depthWrite = false;
+        glass.state.blend = BlendMode::Alpha;
+        glass.state.alpha = 128;
+        scenes.push_back(glass);
+    }
+
+    // the ball field into depth alone in every depth format, up to 4K, where
+    // the depth buffer's traffic is most of the frame
+    static const struct { const char* name; DepthFormat format; } depthFormats[] = {
+        { "float", DepthFormat::Float32 }, { "unorm16", DepthFormat::Unorm16 },
+        { "fixed24", DepthFormat::Fixed24 }, { "reversed", DepthFormat::ReversedFloat32 }
+    };
+    std::vector<Resolution> depthResolutions = resolutions;
+    if (!quick) depthResolutions.push_back({ 3840, 2160 });
+    for (const Resolution& res : depthResolutions) {
+        std::string suffix = "@" + std::to_string(res.w) + "x" + std::to_string(res.h);
+        for (const auto& f : depthFormats) {
+            Scene prepass = { "ball-field-400-depth-" + std::string(f.name) + suffix, res.w, res.h, {}, 0, PipelineState() };
+            for (int gy = 0; gy < 20; ++gy)
+                for (int gx = 0; gx < 20; ++gx)
+                    prepass.instances.push_back({ &ball, (gx - 9.5f) * 0.4f, (gy - 9.5f) * 0.3f, 3.0f + 0.05f * ((gx * 7 + gy * 3) % 20) });
+            prepass.triangles = prepass.instances.size() * (ball.mesh.indices.size() / 3);
+            prepass.depthOnly = true;
+            prepass.depthFormat = f.format;
+            scenes.push_back(prepass);
+        }
+    }
+
+    // carrot thumbnails: a 64-view turntable per frame, batched across the
+    // threads against drawn one view after another
+    std::vector<Resolution> thumbnailSizes = { {256, 256} };
+    if (!quick) thumbnailSizes.push_back({ 512, 512 });
+    for (const Resolution& res : thumbnailSizes) {
+        std::string suffix = "@" + std::to_string(res.w) + "x" + std::to_string(res.h);
+        Scene views = { "carrot-turntable-64" + suffix, res.w, res.h, { { &shapes[5], 0, 0, 3.5f } }, 64 * (shapes[5].mesh.indices.size() / 3), PipelineState() };
+        views.views = 64;
+        views.batched = true;
+        scenes.push_back(views);
+        Scene serial = views;
+        serial.name = "carrot-turntable-64-serial" + suffix;
+        serial.batched = false;
+        scenes.push_back(serial);
+    }
+
+    std::vector<SceneResult> results;
+    for (const Scene& sc : scenes) {
+        if (!filter.empty() && sc.name.find(filter) == std::string::npos) continue;
+        SceneResult r = runScene(sc, frames, warmup, threads, tiled, zeroCopy);
+        fprintf(stderr, "%-28s p50 %8.3f ms  p99 %8.3f ms  %7.2f Mtri/s  ACMR %.3f",
+                r.name.c_str(), r.p50, r.p99, r.trianglesPerSec * 1e-6, r.acmr);
+        if (sc.bvh) fprintf(stderr, "  %7.2f Mrays/s", r.raysPerSec * 1e-6);
+        if (sc.views) fprintf(stderr, "  %7.1f views/s", r.viewsPerSec);
+        fprintf(stderr, "\n");
+        results.push_back(r);
+    }
+
+    static const char* simdNames[] = { "scalar", "sse2", "avx2" };
+    Renderer probe(1, 1);
+    const char* simd = simdNames[int(probe.getSimdLevel())];
+
+    FILE* out = stdout;
+    if (!output.empty() && !(out = fopen(output.c_str(), "w"))) {
+        fprintf(stderr, "cannot open '%s'\n", output.c_str());
+        return 1;
+    }
+    writeJson(out, results, frames, poolThreads, tiled, zeroCopy, optimize, simd);
+    if (out != stdout) fclose(out);
+
+    if (baseline.empty()) return 0;
+
+    std::vector<std::pair<std::string, double>> base;
+    if (!readBaseline(baseline.c_str(), base)) {
+        fprintf(stderr, "cannot read baseline '%s'\n", baseline.c_str());
+        return 1;
+    }
+    int regressions = 0;
+    for (const SceneResult& r : results) {
+        for (const auto& b : base) {
+            if (b.first != r.name || b.second <= 0) continue;
+            double change = r.p50 / b.second - 1.0;
+            bool slow = change > tolerance;
+            fprintf(stderr, "%-28s %8.3f -> %8.3f ms  %+6.1f%%%s\n",
+                    r.name.c_str(), b.second, r.p50, change * 100.0, slow ? "  REGRESSION" : "");
+            regressions += slow;
+        }
+    }
+    if (regressions) {
+        fprintf(stderr, "%d scene(s) slower than baseline by more than %.0f%%\n", regressions, tolerance * 100.0);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,264 @@
+#include "Bvh.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+
+static const int SAH_BINS = 16;
+static const uint32_t MAX_LEAF_TRIANGLES = 8;
+// Cost of visiting a node relative to testing one triangle
+static const float TRAVERSAL_COST = 1.0f;
+// Subtrees this large are handed to the pool once the top levels are split
+static const uint32_t PARALLEL_MIN_TRIANGLES = 4096;
+// Deeper nodes split by count, whatever the SAH says, so the tree
+// (and the tracer's traversal stack) stays shallow on pathological input
+static const int SAH_MAX_DEPTH = 64;
+
+struct Box {
+    float min[3], max[3];
+};
+
+static inline Box emptyBox() {
+    return Box{ { HUGE_VALF, HUGE_VALF, HUGE_VALF }, { -HUGE_VALF, -HUGE_VALF, -HUGE_VALF } };
+}
+
+static inline void grow(Box& b, const float* p) {
+    for (int k = 0; k < 3; ++k) {
+        b.min[k] = std::min(b.min[k], p[k]);
+        b.max[k] = std::max(b.max[k], p[k]);
+    }
+}
+
+static inline void grow(Box& b, const Box& o) {
+    for (int k = 0; k < 3; ++k) {
+        b.min[k] = std::min(b.min[k], o.min[k]);
+        b.max[k] = std::max(b.max[k], o.max[k]);
+    }
+}
+
+// Half the surface area; empty boxes have none
+static inline float halfArea(const Box& b) {
+    float dx = b.max[0] - b.min[0], dy = b.max[1] - b.min[1], dz = b.max[2] - b.min[2];
+    if (dx < 0.0f || dy < 0.0f || dz < 0.0f) return 0.0f;
+    return dx * dy + dy * dz + dz * dx;
+}
+
+// Shared build inputs: per-triangle boxes and centroids, and the triangle
+// order that the build partitions in place (subtrees own disjoint ranges)
+struct BuildState {
+    const std::vector<Box>* bounds;
+    const std::vector<float>* centroids;   // 3 per triangle
+    uint32_t* order;
+    int parallelDepth;   // deeper subtrees are deferred to the pool; < 0 never
+};
+
+struct Subtree {
+    uint32_t node, begin, end;
+    int depth;
+};
+
+static void buildNode(const BuildState& s, std::vector<BvhNode>& out, uint32_t node, uint32_t begin, uint32_t end,
+                      int depth, std::vector<Subtree>* deferred) {
+    const std::vector<Box>& bounds = *s.bounds;
+    const float* centroids = s.centroids->data();
+    uint32_t* order = s.order;
+    Box box = emptyBox(), centroidBox = emptyBox();
+    for (uint32_t i = begin; i < end; ++i) {
+        grow(box, bounds[order[i]]);
+        grow(centroidBox, centroids + 3 * order[i]);
+    }
+    BvhNode& n = out[node];
+    for (int k = 0; k < 3; ++k) {
+        n.min[k] = box.min[k];
+        n.max[k] = box.max[k];
+    }
+    uint32_t count = end - begin;
+    n.first = begin;
+    n.count = count;
+    if (count <= 2) return;
+
+    // Binned SAH: for each axis, the cost of splitting after each bin
+    float bestCost = HUGE_VALF;
+    int bestAxis = -1, bestSplit = 0;
+    for (int axis = 0; axis < 3 && depth < SAH_MAX_DEPTH; ++axis) {
+        float lo = centroidBox.min[axis], extent = centroidBox.max[axis] - lo;
+        if (!(extent > 0.0f)) continue;
+        float scale = SAH_BINS / extent;
+        Box binBox[SAH_BINS];
+        uint32_t binCount[SAH_BINS] = {};
+        for (int b = 0; b < SAH_BINS; ++b) binBox[b] = emptyBox();
+        for (uint32_t i = begin; i < end; ++i) {
+            uint32_t t = order[i];
+            int b = std::min(SAH_BINS - 1, int((centroids[3 * t + axis] - lo) * scale));
+            ++binCount[b];
+            grow(binBox[b], bounds[t]);
+        }
+        float leftCost[SAH_BINS];
+        Box acc = emptyBox();
+        uint32_t accCount = 0;
+        for (int b = 0; b < SAH_BINS - 1; ++b) {
+            grow(acc, binBox[b]);
+            accCount += binCount[b];
+            leftCost[b] = halfArea(acc) * accCount;
+        }
+        acc = emptyBox();
+        accCount = 0;
+        for (int b = SAH_BINS - 1; b > 0; --b) {
+            grow(acc, binBox[b]);
+            accCount += binCount[b];
+            float cost = leftCost[b - 1] + halfArea(acc) * accCount;
+            if (accCount < count && cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = b;   // bins [0, b) go left
+            }
+        }
+    }
+
+    float area = halfArea(box);
+    bool splitPays = bestAxis >= 0 && TRAVERSAL_COST * area + bestCost < float(count) * area;
+    if (!splitPays && count <= MAX_LEAF_TRIANGLES) return;
+
+    uint32_t mid;
+    if (bestAxis >= 0) {
+        float lo = centroidBox.min[bestAxis], scale = SAH_BINS / (centroidBox.max[bestAxis] - lo);
+        mid = uint32_t(std::partition(order + begin, order + end, [&](uint32_t t) {
+            return std::min(SAH_BINS - 1, int((centroids[3 * t + bestAxis] - lo) * scale)) < bestSplit;
+        }) - order);
+    } else {
+        mid = begin + count / 2;   // every centroid in one point (or too deep): split by count
+    }
+    if (mid == begin || mid == end) mid = begin + count / 2;
+
+    uint32_t left = uint32_t(out.size());
+    out.resize(left + 2);
+    out[node].first = left;
+    out[node].count = 0;
+    const uint32_t ranges[2][2] = { { begin, mid }, { mid, end } };
+    for (int c = 0; c < 2; ++c) {
+        uint32_t b = ranges[c][0], e = ranges[c][1];
+        if (deferred && depth + 1 >= s.parallelDepth && e - b >= PARALLEL_MIN_TRIANGLES) deferred->push_back(Subtree{ left + c, b, e, depth + 1 });
+        else buildNode(s, out, left + c, b, e, depth + 1, deferred);
+    }
+}
+
+void Bvh::build(const Vector3D* positions, size_t vertexCount, const uint32_t* indices, size_t triangleCount,
+                ThreadPool* pool) {
+    (void)vertexCount;
+    nodes.clear();
+    triangles.clear();
+    leafIndices.clear();
+    if (triangleCount == 0) return;
+
+    std::vector<Box> bounds(triangleCount);
+    std::vector<float> centroids(triangleCount * 3);
+    std::vector<uint32_t> order(triangleCount);
+    auto prepare = [&](size_t first, size_t last) {
+        for (size_t t = first; t < last; ++t) {
+            Box b = emptyBox();
+            for (int k = 0; k < 3; ++k) {
+                const Vector3D& p = positions[indices[3 * t + k]];
+                const float v[3] = { p.x, p.y, p.z };
+                grow(b, v);
+            }
+            bounds[t] = b;
+            for (int k = 0; k < 3; ++k) centroids[3 * t + k] = (b.min[k] + b.max[k]) * 0.5f;
+            order[t] = uint32_t(t);
+        }
+    };
+    const size_t CHUNK = 16384;
+    if (pool) {
+        pool->run(int((triangleCount + CHUNK - 1) / CHUNK), [&](int task) {
+            prepare(size_t(task) * CHUNK, std::min(triangleCount, size_t(task + 1) * CHUNK));
+        });
+    } else {
+        prepare(0, triangleCount);
+    }
+
+    // The top levels split serially until there are a few subtrees per
+    // thread; each subtree then builds into its own node list on the pool
+    BuildState s;
+    s.bounds = &bounds;
+    s.centroids = &centroids;
+    s.order = order.data();
+    s.parallelDepth = -1;
+    if (pool) {
+        s.parallelDepth = 2;
+        while ((1 << (s.parallelDepth - 2)) < pool->size()) ++s.parallelDepth;
+    }
+    nodes.reserve(triangleCount * 2 / 3 + 1);
+    nodes.resize(1);
+    std::vector<Subtree> deferred;
+    if (pool && triangleCount >= PARALLEL_MIN_TRIANGLES * 2) {
+        buildNode(s, nodes, 0, 0, uint32_t(triangleCount), 0, &deferred);
+    } else {
+        buildNode(s, nodes, 0, 0, uint32_t(triangleCount), 0, nullptr);
+    }
+    if (!deferred.empty()) {
+        std::vector<std::vector<BvhNode>> local(deferred.size());
+        pool->run(int(deferred.size()), [&](int task) {
+            const Subtree& sub = deferred[task];
+            local[task].reserve((sub.end - sub.begin) * 2 / 3 + 1);
+            local[task].resize(1);
+            buildNode(s, local[task], 0, sub.begin, sub.end, sub.depth, nullptr);
+        });
+        // Splice: a subtree's root replaces its placeholder, the rest are
+        // appended with child links moved past the nodes already there
+        for (size_t i = 0; i < deferred.size(); ++i) {
+            std::vector<BvhNode>& sub = local[i];
+            uint32_t base = uint32_t(nodes.size()) - 1;
+            for (BvhNode& n : sub) {
+                if (n.count == 0) n.first += base;
+            }
+            nodes[deferred[i].node] = sub[0];
+            nodes.insert(nodes.end(), sub.begin() + 1, sub.end());
+        }
+    }
+
+    leafIndices.resize(triangleCount * 3);
+    for (size_t i = 0; i < triangleCount; ++i) {
+        for (int k = 0; k < 3; ++k) leafIndices[3 * i + k] = indices[3 * order[i] + k];
+    }
+    triangles.resize(triangleCount);
+    for (size_t i = 0; i < triangleCount; ++i) triangles[i].index = order[i];
+    refit(positions);
+}
+
+void Bvh::refit(const Vector3D* positions) {
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        const Vector3D& a = positions[leafIndices[3 * i]];
+        const Vector3D& b = positions[leafIndices[3 * i + 1]];
+        const Vector3D& c = positions[leafIndices[3 * i + 2]];
+        BvhTriangle& t = triangles[i];
+        t.v0[0] = a.x; t.v0[1] = a.y; t.v0[2] = a.z;
+        t.e1[0] = b.x - a.x; t.e1[1] = b.y - a.y; t.e1[2] = b.z - a.z;
+        t.e2[0] = c.x - a.x; t.e2[1] = c.y - a.y; t.e2[2] = c.z - a.z;
+    }
+    // children come after their parents, so walking backwards sees them first
+    for (size_t i = nodes.size(); i-- > 0;) {
+        BvhNode& n = nodes[i];
+        Box b = emptyBox();
+        if (n.count > 0) {
+            for (uint32_t k = n.first * 3; k < (n.first + n.count) * 3; ++k) {
+                const Vector3D& p = positions[leafIndices[k]];
+                const float v[3] = { p.x, p.y, p.z };
+                grow(b, v);
+            }
+        } else {
+            for (uint32_t c = n.first; c < n.first + 2; ++c) {
+                const BvhNode& child = nodes[c];
+                grow(b, Box{ { child.min[0], child.min[1], child.min[2] }, { child.max[0], child.max[1], child.max[2] } });
+            }
+        }
+        for (int k = 0; k < 3; ++k) {
+            n.min[k] = b.min[k];
+            n.max[k] = b.max[k];
+        }
+    }
+}
+
+float Bvh::getExtent() const {
+    if (nodes.empty()) return 0.0f;
+    const BvhNode& root = nodes[0];
+    float dx = root.max[0] - root.min[0], dy = root.max[1] - root.min[1], dz = root.max[2] - root.min[2];
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+}
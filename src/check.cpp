@@ -0,0 +1,189 @@
+// src/check.cpp - exact-output checks: make check
+//
+// Renders a few fixed frames every way the renderer can draw them and
+// compares the color and depth buffers byte for byte with the scalar,
+// immediate-mode frames at the same multisampling and depth format: the SSE2
+// and AVX2 kernels, tiled binning, hierarchical-Z off, and incremental
+// redraws. The frames cover every row mode (flat, Gouraud, textured,
+// shadowed, depth-only), the pipeline states, sorted transparency, ray
+// tracing and the depth-only / shadow state changes that flush mid-frame.
+// Prints every mismatch and exits 1 if there was any.
+#include "Renderer.h"
+#include "Bvh.h"
+#include "Matrix4x4.h"
+#include "MeshOptimize.h"
+#include "Shapes.h"
+#include "Texture.h"
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+static const int W = 301, H = 227;   // tiles and cells cut at the edges
+static const int FRAMES = 6;
+
+struct CheckMesh {
+    Mesh mesh;
+    std::vector<Meshlet> meshlets;
+};
+
+struct Scene {
+    std::vector<CheckMesh> shapes;
+    Bvh bvh;                          // over the carrot, in model space
+    std::unique_ptr<Texture> texture;
+    std::vector<Vector3D> floorPositions;
+    std::vector<uint32_t> floorIndices, floorColors;
+};
+
+// One way of drawing a frame. The reference is the first: scalar, immediate, HiZ on.
+struct Mode {
+    const char* name;
+    SimdLevel simd;
+    bool tiled, hiz, incremental;
+};
+
+static const Mode MODES[] = {
+    { "scalar",                   SimdLevel::Scalar, false, true,  false },
+    { "sse2",                     SimdLevel::SSE2,   false, true,  false },
+    { "avx2",                     SimdLevel::AVX2,   false, true,  false },
+    { "scalar tiled",             SimdLevel::Scalar, true,  true,  false },
+    { "sse2 tiled",               SimdLevel::SSE2,   true,  true,  false },
+    { "avx2 tiled",               SimdLevel::AVX2,   true,  true,  false },
+    { "avx2 no-hiz",              SimdLevel::AVX2,   false, false, false },
+    { "avx2 tiled no-hiz",        SimdLevel::AVX2,   true,  false, false },
+    { "avx2 incremental",         SimdLevel::AVX2,   false, true,  true  },
+    { "avx2 tiled incremental",   SimdLevel::AVX2,   true,  true,  true  },
+};
+
+static const char* DEPTH_NAMES[DEPTH_FORMAT_COUNT] = { "float", "unorm16", "fixed24", "reversed" };
+
+// Frames 0 and 1 add a shadow pass and a traced carrot, which redraw
+// everything; the rest move a little so incremental frames redraw parts.
+static void drawFrame(Renderer& r, const Scene& scene, int frame) {
+    r.clearColorAndDepth(10, 10, 30);
+    bool shadows = frame < 2;
+    const CheckMesh& carrot = scene.shapes[5];
+    if (shadows) {
+        r.beginShadowPass(Vector3D(0.0f, 0.4f, 4.0f), 3.0f);
+        r.drawMesh(carrot.mesh.positions.data(), carrot.mesh.positions.size(), carrot.mesh.indices.data(),
+                   carrot.mesh.colors.data(), carrot.meshlets.data(), carrot.meshlets.size(),
+                   Matrix4x4::translation(0.0f, 0.3f, 4.0f) * Matrix4x4::scale(0.6f, 0.6f, 0.6f));
+        r.endShadowPass();
+    }
+    for (int i = 0; i < 12; ++i) {
+        if (i == 9 && frame >= 4) continue;   // disappears
+        const CheckMesh& o = scene.shapes[i % 6];
+        bool moving = i == 5 || (i == 7 && frame >= 3 && frame < 5);
+        float a = moving ? 0.15f * frame : 0.3f * i;
+        Matrix4x4 mv = Matrix4x4::translation((i % 4 - 1.5f) * 1.6f, (i / 4 - 1) * 1.3f, 4.0f + 0.4f * (i % 3))
+                     * Matrix4x4::rotationY(a) * Matrix4x4::rotationX(0.6f * a) * Matrix4x4::scale(0.7f, 0.7f, 0.7f);
+        VertexAttributes attributes;
+        if (i % 3 == 0) attributes.normals = o.mesh.normals.data();
+        if (i == 0 || i == 4) {
+            attributes.uvs = o.mesh.uvs.data();
+            r.setTexture(scene.texture.get());
+        }
+        PipelineState state;
+        if (i == 2 || i == 8) { state.blend = BlendMode::Alpha; state.depthWrite = false; state.alpha = 140; }
+        if (i == 6) state.depthTest = DepthTest::Always;
+        if (i == 10) state.depthWrite = false;
+        r.setPipelineState(state);
+        r.setTransparencySorting(i == 8);
+        r.setCullMode(i == 11 ? CullMode::Back : CullMode::None);
+        if (i % 2) {
+            r.drawMesh(o.mesh.positions.data(), o.mesh.positions.size(), o.mesh.indices.data(), o.mesh.colors.data(),
+                       o.meshlets.data(), o.meshlets.size(), mv, attributes);
+        } else {
+            r.drawMesh(o.mesh.positions.data(), o.mesh.positions.size(), o.mesh.indices.data(), o.mesh.indices.size() / 3,
+                       o.mesh.colors.data(), mv, attributes);
+        }
+        r.setTexture(nullptr);
+    }
+    r.setPipelineState(PipelineState());
+    r.setTransparencySorting(false);
+    r.setCullMode(CullMode::None);
+    r.drawMesh(scene.floorPositions, scene.floorIndices, scene.floorColors, Matrix4x4::identity());
+    if (shadows) r.disableShadows();
+
+    // a depth-only draw between color draws, both flushing mid-frame
+    r.setDepthOnly(true);
+    r.drawTriangle(4, 4, 0.05f, 40, 6, 0.05f, 6, 36, 0.05f, 0, 255, 0, 1.0f);
+    r.setDepthOnly(false);
+    float x = 20.0f + 6.0f * frame;
+    r.drawTriangle(x, 150, 0.3f, x + 40, 170, 0.3f, x + 5, 200, 0.3f, 200, 100, 50, 1.0f);
+    r.setPixel(5, 5, 0.5f, 255, 0, 0);
+    if (frame == 0 && r.getMultisample() == 1) {   // raytrace() does not multisample
+        r.raytrace(scene.bvh, carrot.mesh.colors.data(),
+                   Matrix4x4::translation(1.2f, -0.6f, 3.2f) * Matrix4x4::rotationY(0.7f));
+    }
+    r.flush();
+}
+
+int main() {
+    Scene scene;
+    for (int s = 0; s < 6; ++s) {
+        std::vector<Vec3> verts;
+        std::vector<Tri> tris;
+        makeShape(s, verts, tris);
+        CheckMesh o;
+        o.mesh = toMesh(verts, tris);
+        optimizeMesh(o.mesh);
+        computeVertexNormals(o.mesh);
+        computeSphericalUVs(o.mesh);
+        o.meshlets = buildMeshlets(o.mesh);
+        scene.shapes.push_back(std::move(o));
+    }
+    const Mesh& carrot = scene.shapes[5].mesh;
+    scene.bvh.build(carrot.positions.data(), carrot.positions.size(), carrot.indices.data(), carrot.indices.size() / 3);
+    scene.texture.reset(new Texture(checkerboard(64, 8, 0xFFE0E0E0u, 0xFF303030u).data(), 64, 64));
+    scene.floorPositions = { Vector3D(-5, 1.6f, 2), Vector3D(5, 1.6f, 2), Vector3D(5, 1.6f, 9), Vector3D(-5, 1.6f, 9) };
+    scene.floorIndices = { 0, 1, 2, 0, 2, 3 };
+    scene.floorColors = { 0x909090, 0x808080 };
+
+    static const char* simdNames[] = { "scalar", "sse2", "avx2" };
+    SimdLevel best = detectSimdLevel();
+    if (best != SimdLevel::AVX2)
+        fprintf(stderr, "note: this CPU stops at %s, so higher levels run as %s\n", simdNames[int(best)], simdNames[int(best)]);
+
+    const int modeCount = int(sizeof(MODES) / sizeof(MODES[0]));
+    int mismatches = 0, compared = 0;
+    for (int samples : { 1, MSAA_SAMPLES }) {
+        for (int format = 0; format < DEPTH_FORMAT_COUNT; ++format) {
+            std::vector<std::unique_ptr<Renderer>> renderers;
+            for (const Mode& mode : MODES) {
+                Renderer* r = new Renderer(W, H);
+                renderers.emplace_back(r);
+                if (mode.tiled) r->setTiled(true, 3, 32);
+                r->setMultisample(samples);
+                r->setDepthFormat(DepthFormat(format));
+                r->setSimdLevel(mode.simd);
+                r->setHiZ(mode.hiz);
+                r->setLightDirection(Vector3D(0.6f, -1.0f, 0.5f));
+                if (mode.incremental) r->setIncremental(true);
+            }
+            size_t colorBytes = size_t(W) * H * 4;
+            size_t depthSize = size_t(W) * H * samples * depthBytes(DepthFormat(format));
+            for (int frame = 0; frame < FRAMES; ++frame) {
+                for (auto& r : renderers) drawFrame(*r, scene, frame);
+                const Renderer& reference = *renderers[0];
+                for (int m = 1; m < modeCount; ++m) {
+                    const Renderer& r = *renderers[m];
+                    ++compared;
+                    bool color = memcmp(r.getBuffer(), reference.getBuffer(), colorBytes) == 0;
+                    bool depth = memcmp(r.getDepthBuffer(), reference.getDepthBuffer(), depthSize) == 0;
+                    if (color && depth) continue;
+                    ++mismatches;
+                    fprintf(stderr, "MISMATCH %-24s msaa %d %-8s frame %d:%s%s\n", MODES[m].name, samples,
+                            DEPTH_NAMES[format], frame, color ? "" : " color", depth ? "" : " depth");
+                }
+            }
+            fprintf(stderr, "msaa %d %-8s checked\n", samples, DEPTH_NAMES[format]);
+        }
+    }
+    if (mismatches) {
+        fprintf(stderr, "%d of %d frames differ from the scalar immediate-mode reference\n", mismatches, compared);
+        return 1;
+    }
+    fprintf(stderr, "all %d frames match the scalar immediate-mode reference\n", compared);
+    return 0;
+}
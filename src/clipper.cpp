@@ -0,0 +1,60 @@
+#include "Clipper.h"
+
+uint8_t clipOutcode(const ClipVertex& v, float guardX, float guardY) {
+    uint8_t code = 0;
+    if (v.x < -guardX * v.w) code |= CLIP_LEFT;
+    if (v.x > guardX * v.w) code |= CLIP_RIGHT;
+    if (v.y < -guardY * v.w) code |= CLIP_TOP;
+    if (v.y > guardY * v.w) code |= CLIP_BOTTOM;
+    if (v.z < 0.0f) code |= CLIP_NEAR;
+    if (v.z > v.w) code |= CLIP_FAR;
+    return code;
+}
+
+// Signed distance to a plane, >= 0 inside
+static inline float planeDistance(const ClipVertex& v, uint8_t plane, float guardX, float guardY) {
+    switch (plane) {
+        case CLIP_LEFT: return v.x + guardX * v.w;
+        case CLIP_RIGHT: return guardX * v.w - v.x;
+        case CLIP_TOP: return v.y + guardY * v.w;
+        case CLIP_BOTTOM: return guardY * v.w - v.y;
+        case CLIP_NEAR: return v.z;
+        default: return v.w - v.z;
+    }
+}
+
+int clipPolygon(ClipVertex* verts, int count, uint8_t mask, float guardX, float guardY, float (*bary)[2]) {
+    ClipVertex out[MAX_CLIP_VERTICES];
+    float outBary[MAX_CLIP_VERTICES][2];
+    // near first: afterwards every vertex has w > 0
+    static const uint8_t order[] = { CLIP_NEAR, CLIP_FAR, CLIP_LEFT, CLIP_RIGHT, CLIP_TOP, CLIP_BOTTOM };
+    for (uint8_t plane : order) {
+        if (!(mask & plane)) continue;
+        int n = 0;
+        for (int i = 0; i < count; ++i) {
+            int j = (i + 1) % count;
+            const ClipVertex& a = verts[i];
+            const ClipVertex& b = verts[j];
+            float da = planeDistance(a, plane, guardX, guardY);
+            float db = planeDistance(b, plane, guardX, guardY);
+            if (da >= 0.0f) {
+                if (bary) { outBary[n][0] = bary[i][0]; outBary[n][1] = bary[i][1]; }
+                out[n++] = a;
+            }
+            if ((da >= 0.0f) != (db >= 0.0f)) {
+                float t = da / (da - db);
+                if (bary) {
+                    outBary[n][0] = bary[i][0] + (bary[j][0] - bary[i][0]) * t;
+                    outBary[n][1] = bary[i][1] + (bary[j][1] - bary[i][1]) * t;
+                }
+                out[n++] = { a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t,
+                             a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t };
+            }
+        }
+        count = n;
+        if (count < 3) return 0;
+        for (int i = 0; i < count; ++i) verts[i] = out[i];
+        if (bary) for (int i = 0; i < count; ++i) { bary[i][0] = outBary[i][0]; bary[i][1] = outBary[i][1]; }
+    }
+    return count;
+}
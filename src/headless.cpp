@@ -0,0 +1,619 @@
+// src/headless.cpp - render frames with no window and stream them out
+//
+//   SoftwareRendererHeadless --width 1920 --height 1080 --frames 300 --shape 5 |
+//       ffmpeg -f rawvideo -pix_fmt bgra -s 1920x1080 -r 60 -i - carrot.mp4
+//
+// Frames are rendered back to back (no vsync, no sleep) with the same camera
+// and animation as the SDL viewer, triple-buffered so frame N+1 rasterizes
+// while frame N is converted and written on the present thread. Output is
+// raw BGRA (the renderer's ARGB32 little-endian bytes), raw RGB24, or PPM,
+// either concatenated on stdout / a pipe (or one file) or written one file
+// per frame with a printf-style pattern.
+// --stats writes the renderer's instrumentation as one JSON object per frame,
+// --overdraw and --cost its heatmaps as PPM files. --views renders a turntable
+// of the model in one ViewBatch job instead, the views spread over the threads.
+#include "Renderer.h"
+#include "Bvh.h"
+#include "Presenter.h"
+#include "Matrix4x4.h"
+#include "MeshIO.h"
+#include "MeshOptimize.h"
+#include "MeshSimplify.h"
+#include "Shapes.h"
+#include "Texture.h"
+#include "ThreadPool.h"
+#include "ViewBatch.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+enum class Format { BGRA, RGB, PPM };
+
+static void usage() {
+    fprintf(stderr,
+        "usage: SoftwareRendererHeadless [options]\n"
+        "  --width N         frame width (default 800)\n"
+        "  --height N        frame height (default 600)\n"
+        "  --frames N        frames to render (default 180)\n"
+        "  --shape N         0 cube, 1 tetrahedron, 2 icosahedron, 3 helix, 4 ent, 5 carrot (default 5)\n"
+        "  --mesh PATH       render a .obj, .ply or .srm file instead (.srm is mapped, not copied)\n"
+        "  --cull C          none | back | front triangle culling (default none)\n"
+        "  --smooth          Gouraud shading from per-vertex normals (and vertex colors\n"
+        "                    if the file has them) instead of flat faces\n"
+        "  --texture T       texture the model with a .ppm (P6) file or 'checker'; uses\n"
+        "                    spherical uvs, and smooth shading for the lighting\n"
+        "  --filter F        nearest | bilinear | trilinear texture filtering (default trilinear)\n"
+        "  --alpha N         draw the model N/255 opaque: blended, without depth writes,\n"
+        "                    triangles sorted back to front each frame\n"
+        "  --msaa            4x multisample anti-aliasing\n"
+        "  --shadows         light from above with a shadow-mapped floor under the model\n"
+        "  --instances N     draw an N x N field of the model with drawInstanced, the\n"
+        "                    camera circling over it\n"
+        "  --raytrace        ray trace the model through a BVH instead of rasterizing it;\n"
+        "                    with --shadows it shadows itself by shadow rays (no --msaa,\n"
+        "                    --instances or textures)\n"
+        "  --views N         render N views of the model around a turntable as one batch,\n"
+        "                    one view per thread at a time, and report views/s; each view\n"
+        "                    is written as it completes (to stdout in order)\n"
+        "  --incremental     redraw only the tiles whose contents change from one frame to\n"
+        "                    the next (the same output; with --step 0 only the first)\n"
+        "  --depth D         float | unorm16 | fixed24 | reversed depth buffer format\n"
+        "                    (default float)\n"
+        "  --step R          rotation per frame in radians (default 0.01)\n"
+        "  --threads N       raster threads, 0 = all cores (default 0)\n"
+        "  --buffers N       swapchain buffers, 1 = render and write in turn (default 3)\n"
+        "  --format F        bgra | rgb | ppm (default bgra)\n"
+        "  --output PATH     '-' for stdout (default), a file taking every frame, or a\n"
+        "                    pattern like frames/frame_%%04d.ppm for one file per frame\n"
+        "  --stats PATH      per-frame triangle and pixel counts and per-tile raster time,\n"
+        "                    one JSON object per line\n"
+        "  --overdraw PATH   overdraw heatmap per frame, one file or a pattern like\n"
+        "                    heat/overdraw_%%04d.ppm\n"
+        "  --cost PATH       per-tile raster time heatmap per frame, like --overdraw\n");
+}
+
+// Output paths: one integer conversion (%d, %04d; %% is a literal %) makes a
+// pattern naming a file per frame, and a path with none is a single file
+// every frame is appended to. Returns the number of conversions, or -1 for
+// any other conversion, which would make snprintf read past its argument.
+static int frameConversions(const std::string& path) {
+    int count = 0;
+    for (size_t i = 0; i < path.size(); ++i) {
+        if (path[i] != '%') continue;
+        if (++i < path.size() && path[i] == '%') continue;
+        while (i < path.size() && (path[i] == '0' || path[i] == '-')) ++i;
+        while (i < path.size() && path[i] >= '0' && path[i] <= '9') ++i;
+        if (i >= path.size() || (path[i] != 'd' && path[i] != 'i')) return -1;
+        ++count;
+    }
+    return count;
+}
+
+// A path with no frame number is opened once, to take every frame
+static bool openStream(const std::string& path, FILE*& stream) {
+    if (path.empty() || frameConversions(path) != 0) return true;
+    if ((stream = fopen(path.c_str(), "wb"))) return true;
+    fprintf(stderr, "cannot open '%s'\n", path.c_str());
+    return false;
+}
+
+// The file for one frame of a pattern with a single conversion
+static std::string framePath(const std::string& pattern, int frame) {
+    char path[1024];
+    snprintf(path, sizeof(path), pattern.c_str(), frame);
+    return path;
+}
+
+// Write one W x H frame whose rows are pitch bytes apart; rgb is scratch
+// space reused across frames
+static bool writeFrame(FILE* f, const unsigned char* pixels, int pitch, int W, int H,
+                       Format format, std::vector<unsigned char>& rgb) {
+    if (format == Format::BGRA) {
+        if (pitch == W * 4) return fwrite(pixels, 4, size_t(W) * H, f) == size_t(W) * H;
+        for (int y = 0; y < H; ++y)
+            if (fwrite(pixels + size_t(y) * pitch, 4, W, f) != size_t(W)) return false;
+        return true;
+    }
+
+    if (format == Format::PPM) fprintf(f, "P6\n%d %d\n255\n", W, H);
+    rgb.resize(size_t(W) * H * 3);
+    for (int y = 0; y < H; ++y) {
+        const unsigned char* src = pixels + size_t(y) * pitch;
+        unsigned char* dst = &rgb[size_t(y) * W * 3];
+        for (int x = 0; x < W; ++x) {
+            dst[x*3+0] = src[x*4+2];
+            dst[x*3+1] = src[x*4+1];
+            dst[x*3+2] = src[x*4+0];
+        }
+    }
+    return fwrite(rgb.data(), 1, rgb.size(), f) == rgb.size();
+}
+
+// One frame's instrumentation as a line of JSON; cells row-major
+static void writeStats(FILE* f, int frame, double frameMs, const Renderer& renderer) {
+    RenderStats st = renderer.getStats();
+    fprintf(f, "{\"frame\": %d, \"frame_ms\": %.4f, \"triangles_submitted\": %llu, \"triangles_culled\": %llu, "
+               "\"triangles_rasterized\": %llu, \"pixels_tested\": %llu, \"pixels_passed\": %llu, \"pixels_written\": %llu, "
+               "\"raster_ms\": %.4f, \"cell_size\": %d, \"cells_x\": %d, \"cells_y\": %d, \"cell_ms\": [",
+            frame, frameMs, (unsigned long long)st.trianglesSubmitted, (unsigned long long)st.trianglesCulled,
+            (unsigned long long)st.trianglesRasterized, (unsigned long long)st.pixels.tested,
+            (unsigned long long)st.pixels.passed, (unsigned long long)st.pixels.written, st.pixels.ms,
+            renderer.getStatsCellSize(), renderer.getStatsCellsX(), renderer.getStatsCellsY());
+    const std::vector<PixelStats>& cells = renderer.getCellStats();
+    for (size_t i = 0; i < cells.size(); ++i) fprintf(f, "%s%.4f", i ? ", " : "", cells[i].ms);
+    fprintf(f, "], \"cell_written\": [");
+    for (size_t i = 0; i < cells.size(); ++i) fprintf(f, "%s%llu", i ? ", " : "", (unsigned long long)cells[i].written);
+    fprintf(f, "]}\n");
+}
+
+// A heatmap appended to stream, or else to the file pattern names for this frame
+static bool writeHeatmap(FILE* stream, const std::string& pattern, int frame, const std::vector<uint32_t>& pixels,
+                         int W, int H, std::vector<unsigned char>& rgb) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(pixels.data());
+    if (stream) {
+        if (writeFrame(stream, bytes, W * 4, W, H, Format::PPM, rgb)) return true;
+        fprintf(stderr, "write failed: '%s'\n", pattern.c_str());
+        return false;
+    }
+    std::string path = framePath(pattern, frame);
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) { fprintf(stderr, "cannot open '%s'\n", path.c_str()); return false; }
+    bool ok = writeFrame(f, bytes, W * 4, W, H, Format::PPM, rgb);
+    if (fclose(f) != 0 || !ok) { fprintf(stderr, "write failed: '%s'\n", path.c_str()); return false; }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    int W=800, H=600, frames=180, shape=5, threads=0, buffers=3, instances=0, views=0;
+    float step=0.01f;
+    Format format=Format::BGRA;
+    std::string output="-", meshPath, statsPath, overdrawPath, costPath;
+    CullMode cull=CullMode::None;
+    bool smooth=false, msaa=false, shadows=false, raytrace=false, incremental=false;
+    int alpha=-1;
+    std::string texturePath;
+    TextureFilter filter=TextureFilter::Trilinear;
+    DepthFormat depthFormat=DepthFormat::Float32;
+
+    for (int i=1; i<argc; ++i) {
+        std::string a=argv[i];
+        bool hasValue = i+1 < argc;
+        if (a=="--help" || a=="-h") { usage(); return 0; }
+        else if (a=="--width" && hasValue) W=atoi(argv[++i]);
+        else if (a=="--height" && hasValue) H=atoi(argv[++i]);
+        else if (a=="--frames" && hasValue) frames=atoi(argv[++i]);
+        else if (a=="--shape" && hasValue) shape=atoi(argv[++i]);
+        else if (a=="--mesh" && hasValue) meshPath=argv[++i];
+        else if (a=="--step" && hasValue) step=float(atof(argv[++i]));
+        else if (a=="--threads" && hasValue) threads=atoi(argv[++i]);
+        else if (a=="--buffers" && hasValue) buffers=atoi(argv[++i]);
+        else if (a=="--instances" && hasValue) instances=atoi(argv[++i]);
+        else if (a=="--views" && hasValue) views=atoi(argv[++i]);
+        else if (a=="--output" && hasValue) output=argv[++i];
+        else if (a=="--stats" && hasValue) statsPath=argv[++i];
+        else if (a=="--overdraw" && hasValue) overdrawPath=argv[++i];
+        else if (a=="--cost" && hasValue) costPath=argv[++i];
+        else if (a=="--smooth") smooth=true;
+        else if (a=="--msaa") msaa=true;
+        else if (a=="--shadows") shadows=true;
+        else if (a=="--raytrace") raytrace=true;
+        else if (a=="--incremental") incremental=true;
+        else if (a=="--alpha" && hasValue) alpha=std::min(255, std::max(0, atoi(argv[++i])));
+        else if (a=="--texture" && hasValue) texturePath=argv[++i];
+        else if (a=="--filter" && hasValue) {
+            std::string v=argv[++i];
+            if (v=="nearest") filter=TextureFilter::Nearest;
+            else if (v=="bilinear") filter=TextureFilter::Bilinear;
+            else if (v=="trilinear") filter=TextureFilter::Trilinear;
+            else { fprintf(stderr, "unknown filter '%s'\n", v.c_str()); return 1; }
+        }
+        else if (a=="--depth" && hasValue) {
+            std::string v=argv[++i];
+            if (v=="float") depthFormat=DepthFormat::Float32;
+            else if (v=="unorm16") depthFormat=DepthFormat::Unorm16;
+            else if (v=="fixed24") depthFormat=DepthFormat::Fixed24;
+            else if (v=="reversed") depthFormat=DepthFormat::ReversedFloat32;
+            else { fprintf(stderr, "unknown depth format '%s'\n", v.c_str()); return 1; }
+        }
+        else if (a=="--cull" && hasValue) {
+            std::string v=argv[++i];
+            if (v=="none") cull=CullMode::None;
+            else if (v=="back") cull=CullMode::Back;
+            else if (v=="front") cull=CullMode::Front;
+            else { fprintf(stderr, "unknown cull mode '%s'\n", v.c_str()); return 1; }
+        }
+        else if (a=="--format" && hasValue) {
+            std::string v=argv[++i];
+            if (v=="bgra") format=Format::BGRA;
+            else if (v=="rgb") format=Format::RGB;
+            else if (v=="ppm") format=Format::PPM;
+            else { fprintf(stderr, "unknown format '%s'\n", v.c_str()); return 1; }
+        }
+        else { fprintf(stderr, "unknown option '%s'\n", a.c_str()); usage(); return 1; }
+    }
+    if (W<=0 || H<=0 || frames<0 || instances<0 || views<0) { usage(); return 1; }
+    if (raytrace && (msaa || instances>0 || !texturePath.empty())) {
+        fprintf(stderr, "--raytrace does not combine with --msaa, --instances or --texture\n");
+        return 1;
+    }
+    if (views>0 && (raytrace || instances>0 || shadows || incremental || alpha>=0 ||
+                    !statsPath.empty() || !overdrawPath.empty() || !costPath.empty())) {
+        fprintf(stderr, "--views does not combine with --raytrace, --instances, --shadows, --incremental, --alpha or stats\n");
+        return 1;
+    }
+    for (const std::string* path : { &output, &overdrawPath, &costPath }) {
+        int conversions = frameConversions(*path);
+        if (conversions < 0 || conversions > 1) {
+            fprintf(stderr, "'%s': a path takes at most one frame number, as %%d or %%04d (%%%% for a %%)\n", path->c_str());
+            return 1;
+        }
+    }
+
+    std::unique_ptr<Texture> texture;
+    if (!texturePath.empty()) {
+        std::vector<uint32_t> pixels;
+        int tw=256, th=256;
+        std::string error;
+        if (texturePath=="checker") pixels=checkerboard(tw, 16, 0xFFE0E0E0u, 0xFF303030u);
+        else if (!loadPPM(texturePath.c_str(), pixels, tw, th, &error)) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        texture.reset(new Texture(pixels.data(), tw, th));
+        texture->setFilter(filter);
+        smooth=true;
+    }
+
+    // Frames go to one stream unless the path is a pattern: stdout, or a file
+    // (or named pipe) opened once
+    bool toStdout = output=="-";
+    FILE* out = nullptr;
+    if (toStdout) {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        out = stdout;
+    }
+    else if (!openStream(output, out)) return 1;
+    if (out) setvbuf(out, nullptr, _IOFBF, size_t(1) << 20);
+    auto closeOutput = [&]() {
+        if (!out) return true;
+        bool ok = toStdout ? fflush(out) == 0 : fclose(out) == 0;
+        out = nullptr;
+        if (!ok) fprintf(stderr, "write failed: '%s'\n", output.c_str());
+        return ok;
+    };
+
+    Renderer renderer(W,H);
+    renderer.setTiled(true, threads);
+    if (msaa) renderer.setMultisample(MSAA_SAMPLES);
+    renderer.setDepthFormat(depthFormat);
+    if (incremental) renderer.setIncremental(true);
+    bool instrumented = !statsPath.empty() || !overdrawPath.empty() || !costPath.empty();
+    if (instrumented) renderer.setStats(true);
+    FILE* statsFile = nullptr;
+    if (!statsPath.empty() && !(statsFile = fopen(statsPath.c_str(), "w"))) {
+        fprintf(stderr, "cannot open '%s'\n", statsPath.c_str());
+        return 1;
+    }
+    FILE* overdrawFile = nullptr;
+    FILE* costFile = nullptr;
+    if (!openStream(overdrawPath, overdrawFile) || !openStream(costPath, costFile)) return 1;
+
+    std::vector<Vec3> verts; std::vector<Tri> tris;
+    Mesh mesh;
+    MappedMesh mapped;
+    const Vector3D* positions; const uint32_t* indices; const uint32_t* colors;
+    size_t vertexCount, triangleCount;
+    Matrix4x4 fit = Matrix4x4::identity();
+    if (meshPath.empty()) {
+        makeShape(shape,verts,tris);
+        mesh=toMesh(verts,tris);
+    }
+    else {
+        std::string error;
+        auto loadStart = std::chrono::steady_clock::now();
+        bool baked = meshPath.size() > 4 && meshPath.compare(meshPath.size()-4, 4, ".srm") == 0;
+        if (!(baked ? mapped.open(meshPath.c_str(), &error) : loadMesh(meshPath.c_str(), mesh, &error))) {
+            fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        if (baked && !mapped.validate(&error)) {
+            fprintf(stderr, "%s: %s\n", meshPath.c_str(), error.c_str());
+            return 1;
+        }
+        fprintf(stderr, "loaded %s in %.1f ms\n", meshPath.c_str(),
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count());
+    }
+    if (!mapped.positions()) {
+        // .srm files were optimized when baked
+        MeshOptimizeReport report=optimizeMesh(mesh);
+        fprintf(stderr, "vertex cache ACMR %.3f -> %.3f\n", report.acmrBefore, report.acmrAfter);
+    }
+    if (mapped.positions()) {
+        positions=mapped.positions(); vertexCount=mapped.vertexCount();
+        indices=mapped.indices(); colors=mapped.colors(); triangleCount=mapped.triangleCount();
+    }
+    else {
+        positions=mesh.positions.data(); vertexCount=mesh.positions.size();
+        indices=mesh.indices.data(); colors=mesh.colors.data(); triangleCount=mesh.indices.size()/3;
+    }
+    std::vector<Meshlet> meshlets=buildMeshlets(positions, vertexCount, indices, triangleCount);
+    VertexAttributes attributes;
+    if (smooth) {
+        if (mesh.normals.empty()) computeVertexNormals(positions, vertexCount, indices, triangleCount, mesh.normals);
+        attributes.normals=mesh.normals.data();
+        if (!mesh.vertexColors.empty()) attributes.colors=mesh.vertexColors.data();
+    }
+    if (texture) {
+        if (mesh.uvs.empty()) computeSphericalUVs(positions, vertexCount, mesh.uvs);
+        attributes.uvs=mesh.uvs.data();
+        renderer.setTexture(texture.get());
+    }
+    if (!meshPath.empty()) {
+        // assets are y-up and any size: center, flip y and scale into the shapes' unit radius
+        Vector3D lo, hi;
+        if (mapped.positions()) { lo=mapped.boundsMin(); hi=mapped.boundsMax(); }
+        else meshBounds(positions, vertexCount, lo, hi);
+        Vector3D center=(lo+hi)*0.5f;
+        float radius=std::max(1e-6f, (hi-lo).magnitude()*0.5f);
+        fit = Matrix4x4::scale(1.5f/radius, -1.5f/radius, 1.5f/radius) * Matrix4x4::translation(-center.x, -center.y, -center.z);
+    }
+
+    // same camera and light as the viewer at t = 0
+    float cameraZ=3.5f;
+    renderer.setFieldOfView(90.0f);
+    renderer.setLightDirection(Vector3D(1.0f, 0.7f, 0.0f));
+    renderer.setCullMode(cull);
+    // floor in view space below the model, facing up (-y), for --shadows
+    const std::vector<Vector3D> floorPositions = {
+        Vector3D(-4.0f, 1.4f, 1.0f), Vector3D(4.0f, 1.4f, 1.0f), Vector3D(4.0f, 1.4f, 8.0f), Vector3D(-4.0f, 1.4f, 8.0f)
+    };
+    const std::vector<uint32_t> floorIndices = { 0, 1, 2, 0, 2, 3 }, floorColors = { 0x909090, 0x909090 };
+    if (shadows) renderer.setLightDirection(Vector3D(0.6f, -1.0f, -0.5f));
+    if (alpha >= 0) {
+        PipelineState state;
+        state.depthWrite=false;
+        state.blend=BlendMode::Alpha;
+        state.alpha=uint8_t(alpha);
+        renderer.setPipelineState(state);
+        renderer.setTransparencySorting(true);
+    }
+
+    // --instances: the model standing upright on a grid one unit apart, each
+    // turned its own way, with levels of detail simplified from it
+    LodChain lodChain;
+    std::vector<Matrix4x4> transforms;
+    if (instances > 0) {
+        Mesh source;
+        if (mapped.positions()) {
+            source.positions.assign(positions, positions+vertexCount);
+            source.indices.assign(indices, indices+triangleCount*3);
+            source.colors.assign(colors, colors+triangleCount);
+        }
+        const Mesh& base = mapped.positions() ? source : mesh;
+        auto lodStart = std::chrono::steady_clock::now();
+        lodChain = buildLodChain(base);
+        fprintf(stderr, "levels of detail in %.1f ms:", std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - lodStart).count());
+        for (const MeshLod& lod : lodChain.lods) fprintf(stderr, " %zu", lod.triangleCount);
+        fprintf(stderr, " triangles\n");
+        if (!smooth) for (MeshLod& lod : lodChain.lods) lod.attributes = VertexAttributes();
+        if (!texture) for (MeshLod& lod : lodChain.lods) lod.attributes.uvs = nullptr;
+    }
+    InstancedMesh field = lodChain.instanced();
+
+    // --raytrace: one BVH over the model, built on as many threads as the
+    // rasterizer uses; rotation turns the rays, so it is never rebuilt
+    Bvh bvh;
+    if (raytrace) {
+        auto bvhStart = std::chrono::steady_clock::now();
+        {
+            ThreadPool buildPool(threads);
+            bvh.build(positions, vertexCount, indices, triangleCount, &buildPool);
+        }
+        fprintf(stderr, "BVH over %zu triangles: %zu nodes in %.1f ms\n", triangleCount, bvh.getNodes().size(),
+                std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - bvhStart).count());
+    }
+    for (int gz=0; gz<instances; ++gz)
+        for (int gx=0; gx<instances; ++gx)
+            transforms.push_back(Matrix4x4::translation(gx-(instances-1)*0.5f, 0, gz-(instances-1)*0.5f)
+                                 * Matrix4x4::rotationY(float((gx*7+gz*13)%17)) * Matrix4x4::rotationX(PI)
+                                 * Matrix4x4::scale(0.4f, 0.4f, 0.4f) * fit);
+
+    // --views: a turntable at the viewer's camera distance, tilted a little,
+    // one step of 2 pi / views around the model's vertical axis per view
+    if (views > 0) {
+        BatchScene scene;
+        scene.positions=positions; scene.vertexCount=vertexCount;
+        scene.indices=indices; scene.triangleCount=triangleCount; scene.colors=colors;
+        scene.meshlets=meshlets.data(); scene.meshletCount=meshlets.size();
+        scene.attributes=attributes; scene.texture=texture.get(); scene.cullMode=cull;
+        scene.samples=msaa ? MSAA_SAMPLES : 1; scene.depthFormat=depthFormat;
+        std::vector<BatchView> cameras;
+        for (int v=0; v<views; ++v)
+            cameras.push_back(BatchView{ Matrix4x4::translation(0,0,cameraZ) * Matrix4x4::rotationX(0.3f)
+                                         * Matrix4x4::rotationY(2*PI*v/views) * fit, W, H, 90.0f });
+
+        // files are written by the worker that drew the view; stdout takes
+        // them in order, holding copies of those that finish early
+        std::mutex outMutex;
+        std::map<size_t, std::vector<uint32_t>> early;
+        std::vector<unsigned char> streamRGB;
+        size_t next = 0;
+        std::atomic<bool> failed{false};
+        auto writeView = [&](FILE* f, size_t view, const uint32_t* pixels, int pitch, std::vector<unsigned char>& rgb) {
+            if (!writeFrame(f, reinterpret_cast<const unsigned char*>(pixels), pitch, W, H, format, rgb)) {
+                fprintf(stderr, "write failed at view %zu\n", view);
+                failed = true;
+            }
+        };
+        ViewBatch batch(threads);
+        auto start = std::chrono::steady_clock::now();
+        batch.render(scene, cameras, [&](size_t view, const uint32_t* pixels, int, int, int pitch) {
+            if (failed) return;
+            if (!out) {
+                static thread_local std::vector<unsigned char> rgb;
+                std::string path = framePath(output, int(view));
+                FILE* f = fopen(path.c_str(), "wb");
+                if (!f) { fprintf(stderr, "cannot open '%s'\n", path.c_str()); failed = true; return; }
+                writeView(f, view, pixels, pitch, rgb);
+                if (fclose(f) != 0) { fprintf(stderr, "write failed: '%s'\n", path.c_str()); failed = true; }
+                return;
+            }
+            std::lock_guard<std::mutex> lock(outMutex);
+            if (view != next) {
+                early[view].assign(pixels, pixels + size_t(pitch / 4) * H);
+                return;
+            }
+            writeView(out, view, pixels, pitch, streamRGB);
+            for (++next; early.count(next); ++next) {
+                writeView(out, next, early[next].data(), pitch, streamRGB);
+                early.erase(next);
+            }
+        });
+        if (!closeOutput() || failed) return 1;
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fprintf(stderr, "%d views %dx%d on %d threads in %.3f s (%.1f views/s)\n", views, W, H, batch.getThreadCount(),
+                seconds, seconds > 0 ? views / seconds : 0.0);
+        return 0;
+    }
+
+    const char* pixFmt = format==Format::RGB ? "rgb24" : "bgra";
+    if (toStdout && format!=Format::PPM)
+        fprintf(stderr, "streaming %d frames: ffmpeg -f rawvideo -pix_fmt %s -s %dx%d -i - out.mp4\n", frames, pixFmt, W, H);
+
+    // Writes run on the present thread when buffered; a failure stops rendering
+    std::vector<unsigned char> rgb;
+    std::atomic<bool> failed{false};
+    int written = 0;
+    auto write = [&](const uint32_t* pixels, int pitch) {
+        if (failed) return;
+        FILE* f = out;
+        if (!out) {
+            std::string path = framePath(output, written);
+            f = fopen(path.c_str(), "wb");
+            if (!f) { fprintf(stderr, "cannot open '%s'\n", path.c_str()); failed = true; return; }
+        }
+        bool ok = writeFrame(f, reinterpret_cast<const unsigned char*>(pixels), pitch, W, H, format, rgb);
+        if (!out) ok = fclose(f) == 0 && ok;
+        if (!ok) { fprintf(stderr, "write failed at frame %d\n", written); failed = true; }
+        ++written;
+    };
+
+    double redrawn = 0;   // pixels, summed over frames
+    RenderStats statsTotal;
+    std::vector<uint32_t> heatmap;
+    std::vector<unsigned char> heatmapRGB;   // rgb is the present thread's
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::unique_ptr<Presenter> presenter;
+        if (buffers > 1) presenter.reset(new Presenter(W, H, buffers, write));
+        float angle=0;
+        for (int frame=0; frame<frames && !failed; ++frame) {
+            angle+=step;
+            auto frameStart = std::chrono::steady_clock::now();
+            if (instrumented) renderer.resetStats();
+            Matrix4x4 modelView = Matrix4x4::translation(0,0,cameraZ)
+                                * Matrix4x4::rotationY(angle) * Matrix4x4::rotationX(angle*0.6f) * fit;
+            if (shadows) {
+                // the model casts; the sphere holds it and the floor under it
+                renderer.beginShadowPass(Vector3D(0.0f, 0.4f, cameraZ), 2.6f);
+                renderer.drawMesh(positions, vertexCount, indices, colors, meshlets.data(), meshlets.size(), modelView);
+                renderer.endShadowPass();
+            }
+            if (presenter) renderer.setTarget(presenter->acquire(), presenter->getPitch());
+            renderer.clearColorAndDepth(10,10,30);
+            if (instances > 0) {
+                // eye 3 units above the field's center, looking slightly down
+                Matrix4x4 view = Matrix4x4::rotationX(0.35f) * Matrix4x4::rotationY(angle) * Matrix4x4::translation(0, 3.0f, 0);
+                renderer.drawInstanced(field, transforms, view);
+            }
+            else if (raytrace) renderer.raytrace(bvh, colors, modelView, attributes, shadows);
+            else renderer.drawMesh(positions, vertexCount, indices, colors, meshlets.data(), meshlets.size(), modelView, attributes);
+            if (shadows) renderer.drawMesh(floorPositions, floorIndices, floorColors, Matrix4x4::identity());
+            renderer.flush();
+            for (const ScreenRect& r : renderer.getPresentedRects()) redrawn += double(r.x1-r.x0+1) * (r.y1-r.y0+1);
+            if (instrumented) {
+                double frameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+                RenderStats st = renderer.getStats();
+                statsTotal.trianglesSubmitted += st.trianglesSubmitted;
+                statsTotal.trianglesCulled += st.trianglesCulled;
+                statsTotal.trianglesRasterized += st.trianglesRasterized;
+                statsTotal.pixels.tested += st.pixels.tested;
+                statsTotal.pixels.passed += st.pixels.passed;
+                statsTotal.pixels.written += st.pixels.written;
+                statsTotal.pixels.ms += st.pixels.ms;
+                if (statsFile) writeStats(statsFile, frame, frameMs, renderer);
+                if (!overdrawPath.empty()) {
+                    renderer.overdrawHeatmap(heatmap);
+                    if (!writeHeatmap(overdrawFile, overdrawPath, frame, heatmap, W, H, heatmapRGB)) failed = true;
+                }
+                if (!costPath.empty()) {
+                    renderer.costHeatmap(heatmap);
+                    if (!writeHeatmap(costFile, costPath, frame, heatmap, W, H, heatmapRGB)) failed = true;
+                }
+            }
+
+            if (presenter) presenter->submit();
+            else write(reinterpret_cast<const uint32_t*>(renderer.getBuffer()), renderer.getPitch());
+        }
+        // the presenter writes out every queued frame as it goes out of scope
+    }
+    const std::pair<FILE*, const std::string*> files[] = { { statsFile, &statsPath }, { overdrawFile, &overdrawPath }, { costFile, &costPath } };
+    for (const auto& file : files) {
+        if (file.first && fclose(file.first) != 0) {
+            fprintf(stderr, "write failed: '%s'\n", file.second->c_str());
+            failed = true;
+        }
+    }
+    if (!closeOutput()) failed = true;
+    if (failed) return 1;
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "%d frames %dx%d in %.2f s (%.1f fps)\n", frames, W, H, seconds, seconds > 0 ? frames / seconds : 0.0);
+    if (incremental && frames > 0)
+        fprintf(stderr, "incremental: redrew %.1f%% of the pixels\n", 100.0 * redrawn / (double(W) * H * frames));
+    if (instrumented && frames > 0) {
+        fprintf(stderr, "triangles: %llu submitted, %llu culled, %llu rasterized\n",
+                (unsigned long long)statsTotal.trianglesSubmitted, (unsigned long long)statsTotal.trianglesCulled,
+                (unsigned long long)statsTotal.trianglesRasterized);
+        fprintf(stderr, "pixels: %llu tested, %llu passed, %llu written (%.2f writes per pixel), %.1f ms in the row kernels\n",
+                (unsigned long long)statsTotal.pixels.tested, (unsigned long long)statsTotal.pixels.passed,
+                (unsigned long long)statsTotal.pixels.written,
+                double(statsTotal.pixels.written) / (double(W) * H * frames), statsTotal.pixels.ms);
+    }
+    ClusterStats clusters=renderer.getClusterStats();
+    fprintf(stderr, "%zu meshlets: %llu tested, %llu outside the frustum, %llu back-facing\n", meshlets.size(),
+            (unsigned long long)clusters.meshletsTested, (unsigned long long)clusters.frustumCulled,
+            (unsigned long long)clusters.backfaceCulled);
+    if (raytrace) {
+        RayStats rays=renderer.getRayStats();
+        double traceMs=renderer.getTimings().trace;
+        fprintf(stderr, "%llu primary + %llu shadow rays in %.1f ms of tracing (%.2f Mrays/s)\n",
+                (unsigned long long)rays.primaryRays, (unsigned long long)rays.shadowRays, traceMs,
+                traceMs > 0 ? (rays.primaryRays + rays.shadowRays) / (traceMs * 1000.0) : 0.0);
+    }
+    if (instances > 0) {
+        InstanceStats inst=renderer.getInstanceStats();
+        fprintf(stderr, "%llu instances tested, %llu outside the frustum, drawn per level:",
+                (unsigned long long)inst.instancesTested, (unsigned long long)inst.frustumCulled);
+        for (size_t l=0; l<lodChain.lods.size() && l<size_t(MAX_INSTANCE_LODS); ++l)
+            fprintf(stderr, " %llu", (unsigned long long)inst.lodDrawn[l]);
+        fprintf(stderr, "\n");
+    }
+    return 0;
+}
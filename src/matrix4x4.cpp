@@ -2,6 +2,10 @@
 #include <cmath>
 #include <cstring>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 Matrix4x4::Matrix4x4() {
     std::memset(m, 0, sizeof(m));
 }
@@ -55,6 +59,35 @@ Matrix4x4 Matrix4x4::translation(float x, float y, float z) {
     return result;
 }
 
+Matrix4x4 Matrix4x4::scale(float x, float y, float z) {
+    Matrix4x4 result = identity();
+    result.m[0][0] = x;
+    result.m[1][1] = y;
+    result.m[2][2] = z;
+    return result;
+}
+
+Matrix4x4 Matrix4x4::perspective(float fovX, float aspect, float zNear, float zFar) {
+    Matrix4x4 result;
+    float f = 1.0f / std::tan(fovX * 0.5f);
+    result.m[0][0] = f;
+    result.m[1][1] = f * aspect;
+    result.m[2][2] = zFar / (zFar - zNear);
+    result.m[2][3] = -zNear * zFar / (zFar - zNear);
+    result.m[3][2] = 1.0f;
+    return result;
+}
+
+Matrix4x4 Matrix4x4::orthographic(float halfWidth, float halfHeight, float zNear, float zFar) {
+    Matrix4x4 result;
+    result.m[0][0] = 1.0f / halfWidth;
+    result.m[1][1] = 1.0f / halfHeight;
+    result.m[2][2] = 1.0f / (zFar - zNear);
+    result.m[2][3] = -zNear / (zFar - zNear);
+    result.m[3][3] = 1.0f;
+    return result;
+}
+
 Matrix4x4 Matrix4x4::operator*(const Matrix4x4& other) const {
     Matrix4x4 result;
     for (int i = 0; i < 4; i++) {
@@ -68,6 +101,25 @@ Matrix4x4 Matrix4x4::operator*(const Matrix4x4& other) const {
     return result;
 }
 
+void Matrix4x4::multiply(const Matrix4x4& left, const Matrix4x4* right, size_t count, Matrix4x4* out) {
+#ifdef __SSE2__
+    for (size_t n = 0; n < count; ++n) {
+        const __m128 r0 = _mm_loadu_ps(right[n].m[0]), r1 = _mm_loadu_ps(right[n].m[1]);
+        const __m128 r2 = _mm_loadu_ps(right[n].m[2]), r3 = _mm_loadu_ps(right[n].m[3]);
+        for (int i = 0; i < 4; i++) {
+            // summed from 0 in k order, as operator* does
+            __m128 row = _mm_add_ps(_mm_setzero_ps(), _mm_mul_ps(_mm_set1_ps(left.m[i][0]), r0));
+            row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(left.m[i][1]), r1));
+            row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(left.m[i][2]), r2));
+            row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(left.m[i][3]), r3));
+            _mm_storeu_ps(out[n].m[i], row);
+        }
+    }
+#else
+    for (size_t n = 0; n < count; ++n) out[n] = left * right[n];
+#endif
+}
+
 Vector3D Matrix4x4::transform(const Vector3D& vec) const {
     float w = m[3][0] * vec.x + m[3][1] * vec.y + m[3][2] * vec.z + m[3][3];
     if (w == 0.0f) w = 1.0f;
@@ -77,4 +129,38 @@ Vector3D Matrix4x4::transform(const Vector3D& vec) const {
         (m[1][0] * vec.x + m[1][1] * vec.y + m[1][2] * vec.z + m[1][3]) / w,
         (m[2][0] * vec.x + m[2][1] * vec.y + m[2][2] * vec.z + m[2][3]) / w
     );
-}
\ No newline at end of file
+}
+
+void Matrix4x4::transformPoints(const Vector3D* in, size_t count,
+                                float* outX, float* outY, float* outZ, float* outW) const {
+    static_assert(sizeof(Vector3D) == 3 * sizeof(float), "Vector3D must be tightly packed xyz");
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 m00 = _mm_set1_ps(m[0][0]), m01 = _mm_set1_ps(m[0][1]), m02 = _mm_set1_ps(m[0][2]), m03 = _mm_set1_ps(m[0][3]);
+    const __m128 m10 = _mm_set1_ps(m[1][0]), m11 = _mm_set1_ps(m[1][1]), m12 = _mm_set1_ps(m[1][2]), m13 = _mm_set1_ps(m[1][3]);
+    const __m128 m20 = _mm_set1_ps(m[2][0]), m21 = _mm_set1_ps(m[2][1]), m22 = _mm_set1_ps(m[2][2]), m23 = _mm_set1_ps(m[2][3]);
+    const __m128 m30 = _mm_set1_ps(m[3][0]), m31 = _mm_set1_ps(m[3][1]), m32 = _mm_set1_ps(m[3][2]), m33 = _mm_set1_ps(m[3][3]);
+    for (; i + 4 <= count; i += 4) {
+        // 4 packed xyz points: a = x0 y0 z0 x1, b = y1 z1 x2 y2, c = z2 x3 y3 z3
+        const float* p = &in[i].x;
+        __m128 a = _mm_loadu_ps(p), b = _mm_loadu_ps(p + 4), c = _mm_loadu_ps(p + 8);
+        __m128 x = _mm_shuffle_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 0, 0)),
+                                  _mm_shuffle_ps(b, c, _MM_SHUFFLE(1, 1, 2, 2)), _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 y = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 1, 1)),
+                                  _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 2, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0));
+        __m128 z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)),
+                                  _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+        _mm_storeu_ps(outX + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m00, x), _mm_mul_ps(m01, y)), _mm_add_ps(_mm_mul_ps(m02, z), m03)));
+        _mm_storeu_ps(outY + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m10, x), _mm_mul_ps(m11, y)), _mm_add_ps(_mm_mul_ps(m12, z), m13)));
+        _mm_storeu_ps(outZ + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m20, x), _mm_mul_ps(m21, y)), _mm_add_ps(_mm_mul_ps(m22, z), m23)));
+        if (outW) _mm_storeu_ps(outW + i, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m30, x), _mm_mul_ps(m31, y)), _mm_add_ps(_mm_mul_ps(m32, z), m33)));
+    }
+#endif
+    for (; i < count; ++i) {
+        const Vector3D& v = in[i];
+        outX[i] = (m[0][0] * v.x + m[0][1] * v.y) + (m[0][2] * v.z + m[0][3]);
+        outY[i] = (m[1][0] * v.x + m[1][1] * v.y) + (m[1][2] * v.z + m[1][3]);
+        outZ[i] = (m[2][0] * v.x + m[2][1] * v.y) + (m[2][2] * v.z + m[2][3]);
+        if (outW) outW[i] = (m[3][0] * v.x + m[3][1] * v.y) + (m[3][2] * v.z + m[3][3]);
+    }
+}
@@ -0,0 +1,874 @@
+#include "MeshIO.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static bool fail(std::string* error, const std::string& message) {
+    if (error) *error = message;
+    return false;
+}
+
+// --- Memory mapping ---
+
+bool MappedFile::open(const char* path) {
+    close();
+#ifdef _WIN32
+    HANDLE f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (f == INVALID_HANDLE_VALUE) return false;
+    file = f;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(f, &size)) { close(); return false; }
+    length = size_t(size.QuadPart);
+    if (length == 0) return true;   // nothing to map
+    mapping = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) { close(); return false; }
+    ptr = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!ptr) { close(); return false; }
+#else
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0) { ::close(fd); return false; }
+    length = size_t(st.st_size);
+    if (length > 0) {
+        void* p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) { ::close(fd); length = 0; return false; }
+        ptr = static_cast<const char*>(p);
+    }
+    ::close(fd);   // the mapping keeps the file alive
+#endif
+    return true;
+}
+
+void MappedFile::close() {
+#ifdef _WIN32
+    if (ptr) UnmapViewOfFile(ptr);
+    if (mapping) CloseHandle(mapping);
+    if (file) CloseHandle(file);
+    mapping = file = nullptr;
+#else
+    if (ptr) munmap(const_cast<char*>(ptr), length);
+#endif
+    ptr = nullptr;
+    length = 0;
+}
+
+// --- Number parsing without allocation or locale lookups ---
+
+static inline bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+static inline const char* skipBlanks(const char* p, const char* end) {
+    while (p < end && isBlank(*p)) ++p;
+    return p;
+}
+
+static inline const char* skipToken(const char* p, const char* end) {
+    while (p < end && !isBlank(*p) && *p != '\n') ++p;
+    return p;
+}
+
+static inline const char* lineEnd(const char* p, const char* end) {
+    const char* n = static_cast<const char*>(memchr(p, '\n', size_t(end - p)));
+    return n ? n : end;
+}
+
+// Decimal with optional sign, fraction and exponent. Up to 18 significant
+// digits are kept, which is exact enough for float output.
+static bool parseNumber(const char*& p, const char* end, double& out) {
+    static const double POW10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    p = skipBlanks(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool digits = false;
+    for (; p < end && unsigned(*p - '0') < 10; ++p, digits = true) {
+        if (mantissa < 100000000000000000ull) mantissa = mantissa * 10 + unsigned(*p - '0');
+        else ++exponent;
+    }
+    if (p < end && *p == '.') {
+        for (++p; p < end && unsigned(*p - '0') < 10; ++p, digits = true) {
+            if (mantissa < 100000000000000000ull) {
+                mantissa = mantissa * 10 + unsigned(*p - '0');
+                --exponent;
+            }
+        }
+    }
+    if (!digits) return false;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool expNegative = false;
+        if (q < end && (*q == '-' || *q == '+')) expNegative = *q++ == '-';
+        int e = 0;
+        bool expDigits = false;
+        for (; q < end && unsigned(*q - '0') < 10; ++q, expDigits = true) e = std::min(e * 10 + int(*q - '0'), 9999);
+        if (expDigits) {
+            exponent += expNegative ? -e : e;
+            p = q;
+        }
+    }
+    double v = double(mantissa);
+    if (exponent >= -22 && exponent <= 22) v = exponent < 0 ? v / POW10[-exponent] : v * POW10[exponent];
+    else v *= std::pow(10.0, exponent);
+    out = negative ? -v : v;
+    return true;
+}
+
+static bool parseInteger(const char*& p, const char* end, int64_t& out) {
+    p = skipBlanks(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    if (p >= end || unsigned(*p - '0') >= 10) return false;
+    int64_t v = 0;
+    for (; p < end && unsigned(*p - '0') < 10; ++p) v = std::min<int64_t>(v * 10 + (*p - '0'), int64_t(1) << 40);
+    out = negative ? -v : v;
+    return true;
+}
+
+static inline uint32_t colorChannel(double v, bool normalized) {
+    if (normalized) v *= 255.0;
+    return uint32_t(std::min(255.0, std::max(0.0, std::round(v))));
+}
+
+// --- Parallel chunking ---
+
+// A run of whole lines parsed by one task; counts come from the counting pass
+// and bases are their prefix sums.
+struct Chunk {
+    const char* begin;
+    const char* end;
+    size_t lines = 0, vertices = 0, triangles = 0;
+    size_t lineBase = 0, vertexBase = 0, triangleBase = 0;
+    bool vertexColors = false;
+    size_t errorLine = 0;          // 1-based, within the chunk; 0 = no error
+    const char* error = nullptr;
+};
+
+static const size_t MIN_CHUNK_BYTES = 256 << 10;
+
+static std::vector<Chunk> splitLines(const char* begin, const char* end, int parts) {
+    size_t bytes = size_t(end - begin);
+    size_t count = std::max<size_t>(1, std::min<size_t>(size_t(parts), bytes / MIN_CHUNK_BYTES));
+    std::vector<Chunk> chunks;
+    const char* p = begin;
+    for (size_t i = 1; i <= count && p < end; ++i) {
+        const char* cut = i == count ? end : std::max(p, begin + bytes * i / count);
+        if (cut < end) cut = std::min(end, lineEnd(cut, end) + 1);
+        Chunk c;
+        c.begin = p;
+        c.end = cut;
+        chunks.push_back(c);
+        p = cut;
+    }
+    return chunks;
+}
+
+static bool chunkError(const std::vector<Chunk>& chunks, const char* path, std::string* error) {
+    for (const Chunk& c : chunks) {
+        if (!c.error) continue;
+        char message[512];
+        snprintf(message, sizeof(message), "%s:%zu: %s", path, c.lineBase + c.errorLine, c.error);
+        return fail(error, message);
+    }
+    return true;
+}
+
+// Triangle colors from the average of their vertex colors
+static void averageVertexColors(ThreadPool& pool, Mesh& mesh, const std::vector<uint32_t>& vertexColors) {
+    size_t triangles = mesh.colors.size();
+    int tasks = int(std::min<size_t>(size_t(pool.size()) * 4, triangles / 4096 + 1));
+    pool.run(tasks, [&](int task) {
+        size_t begin = triangles * task / tasks, end = triangles * (task + 1) / tasks;
+        for (size_t t = begin; t < end; ++t) {
+            uint32_t sum[3] = { 0, 0, 0 };
+            for (int k = 0; k < 3; ++k) {
+                uint32_t c = vertexColors[mesh.indices[3 * t + k]];
+                sum[0] += (c >> 16) & 0xFF; sum[1] += (c >> 8) & 0xFF; sum[2] += c & 0xFF;
+            }
+            mesh.colors[t] = ((sum[0] + 1) / 3) << 16 | ((sum[1] + 1) / 3) << 8 | ((sum[2] + 1) / 3);
+        }
+    });
+}
+
+// --- OBJ ---
+
+static inline bool isRecord(const char* p, const char* le, char kind) {
+    return p + 1 < le && p[0] == kind && isBlank(p[1]);
+}
+
+// Number of vertex references on an f line
+static inline size_t faceCorners(const char* p, const char* le) {
+    size_t corners = 0;
+    for (p = skipBlanks(p + 1, le); p < le && *p != '#'; p = skipBlanks(skipToken(p, le), le)) ++corners;
+    return corners;
+}
+
+static void countOBJ(Chunk& c) {
+    for (const char* p = c.begin; p < c.end;) {
+        const char* le = lineEnd(p, c.end);
+        const char* s = skipBlanks(p, le);
+        if (isRecord(s, le, 'v')) ++c.vertices;
+        else if (isRecord(s, le, 'f')) {
+            size_t corners = faceCorners(s, le);
+            if (corners >= 3) c.triangles += corners - 2;
+        }
+        ++c.lines;
+        p = le + 1;
+    }
+}
+
+static void parseOBJ(Chunk& c, Mesh& mesh, std::vector<uint32_t>& vertexColors, uint32_t defaultColor) {
+    size_t vertexCount = mesh.positions.size();
+    size_t v = c.vertexBase, t = c.triangleBase, line = 0;
+    for (const char* p = c.begin; p < c.end; p = lineEnd(p, c.end) + 1) {
+        ++line;
+        const char* le = lineEnd(p, c.end);
+        const char* s = skipBlanks(p, le);
+        if (isRecord(s, le, 'v')) {
+            double xyz[3], rgb[3];
+            s += 1;
+            for (double& value : xyz) {
+                if (!parseNumber(s, le, value)) { c.error = "bad vertex"; c.errorLine = line; return; }
+            }
+            mesh.positions[v] = Vector3D(float(xyz[0]), float(xyz[1]), float(xyz[2]));
+            // optional vertex color in 0..1
+            if (parseNumber(s, le, rgb[0]) && parseNumber(s, le, rgb[1]) && parseNumber(s, le, rgb[2])) {
+                vertexColors[v] = colorChannel(rgb[0], true) << 16 | colorChannel(rgb[1], true) << 8 | colorChannel(rgb[2], true);
+                c.vertexColors = true;
+            } else {
+                vertexColors[v] = defaultColor;
+            }
+            ++v;
+        } else if (isRecord(s, le, 'f')) {
+            // vertices defined before this line, for negative (relative) indices
+            int64_t defined = int64_t(v);
+            uint32_t first = 0, prev = 0;
+            int corner = 0;
+            for (s = skipBlanks(s + 1, le); s < le && *s != '#'; s = skipBlanks(skipToken(s, le), le), ++corner) {
+                int64_t index;
+                if (!parseInteger(s, le, index) || index == 0) { c.error = "bad face index"; c.errorLine = line; return; }
+                index = index > 0 ? index - 1 : defined + index;
+                if (index < 0 || index >= int64_t(vertexCount)) { c.error = "face index out of range"; c.errorLine = line; return; }
+                uint32_t i = uint32_t(index);
+                if (corner >= 2) {
+                    mesh.indices[3 * t] = first; mesh.indices[3 * t + 1] = prev; mesh.indices[3 * t + 2] = i;
+                    mesh.colors[t] = defaultColor;
+                    ++t;
+                }
+                if (corner == 0) first = i;
+                prev = i;
+            }
+        }
+    }
+}
+
+bool loadOBJ(const char* path, Mesh& mesh, std::string* error, uint32_t defaultColor) {
+    MappedFile file;
+    if (!file.open(path)) return fail(error, std::string("cannot open ") + path);
+    ThreadPool pool(0);
+    std::vector<Chunk> chunks = splitLines(file.data(), file.data() + file.size(), pool.size() * 4);
+
+    pool.run(int(chunks.size()), [&](int i) { countOBJ(chunks[i]); });
+    size_t lines = 0, vertices = 0, triangles = 0;
+    for (Chunk& c : chunks) {
+        c.lineBase = lines; c.vertexBase = vertices; c.triangleBase = triangles;
+        lines += c.lines; vertices += c.vertices; triangles += c.triangles;
+    }
+    if (vertices > std::numeric_limits<uint32_t>::max()) return fail(error, std::string(path) + ": too many vertices");
+
+    mesh.positions.resize(vertices);
+    mesh.indices.resize(triangles * 3);
+    mesh.colors.resize(triangles);
+    mesh.normals.clear();
+    mesh.vertexColors.clear();
+    mesh.uvs.clear();
+    std::vector<uint32_t> vertexColors(vertices);
+    pool.run(int(chunks.size()), [&](int i) { parseOBJ(chunks[i], mesh, vertexColors, defaultColor); });
+    if (!chunkError(chunks, path, error)) return false;
+
+    for (const Chunk& c : chunks) {
+        if (c.vertexColors) {
+            averageVertexColors(pool, mesh, vertexColors);
+            mesh.vertexColors.swap(vertexColors);
+            break;
+        }
+    }
+    return true;
+}
+
+// --- PLY ---
+
+enum class PlyType { Int8, UInt8, Int16, UInt16, Int32, UInt32, Float32, Float64 };
+
+struct PlyProperty {
+    std::string name;
+    PlyType type;
+    bool list = false;
+    PlyType countType = PlyType::UInt8;
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count = 0;
+    std::vector<PlyProperty> properties;
+};
+
+static bool plyType(const std::string& name, PlyType& type) {
+    static const struct { const char* name; PlyType type; } types[] = {
+        { "char", PlyType::Int8 }, { "int8", PlyType::Int8 }, { "uchar", PlyType::UInt8 }, { "uint8", PlyType::UInt8 },
+        { "short", PlyType::Int16 }, { "int16", PlyType::Int16 }, { "ushort", PlyType::UInt16 }, { "uint16", PlyType::UInt16 },
+        { "int", PlyType::Int32 }, { "int32", PlyType::Int32 }, { "uint", PlyType::UInt32 }, { "uint32", PlyType::UInt32 },
+        { "float", PlyType::Float32 }, { "float32", PlyType::Float32 }, { "double", PlyType::Float64 }, { "float64", PlyType::Float64 },
+    };
+    for (const auto& t : types) {
+        if (name == t.name) { type = t.type; return true; }
+    }
+    return false;
+}
+
+static inline size_t plySize(PlyType t) {
+    switch (t) {
+        case PlyType::Int8: case PlyType::UInt8: return 1;
+        case PlyType::Int16: case PlyType::UInt16: return 2;
+        case PlyType::Int32: case PlyType::UInt32: case PlyType::Float32: return 4;
+        case PlyType::Float64: return 8;
+    }
+    return 1;
+}
+
+static inline bool plyFloat(PlyType t) { return t == PlyType::Float32 || t == PlyType::Float64; }
+
+static inline double readBinary(const char* p, PlyType t, bool swap) {
+    unsigned char b[8];
+    size_t n = plySize(t);
+    memcpy(b, p, n);
+    if (swap) std::reverse(b, b + n);
+    switch (t) {
+        case PlyType::Int8: { int8_t v; memcpy(&v, b, 1); return v; }
+        case PlyType::UInt8: return b[0];
+        case PlyType::Int16: { int16_t v; memcpy(&v, b, 2); return v; }
+        case PlyType::UInt16: { uint16_t v; memcpy(&v, b, 2); return v; }
+        case PlyType::Int32: { int32_t v; memcpy(&v, b, 4); return v; }
+        case PlyType::UInt32: { uint32_t v; memcpy(&v, b, 4); return v; }
+        case PlyType::Float32: { float v; memcpy(&v, b, 4); return v; }
+        case PlyType::Float64: { double v; memcpy(&v, b, 8); return v; }
+    }
+    return 0;
+}
+
+// Where the fields we use sit in the vertex and face elements (-1 = absent)
+struct PlyLayout {
+    int vertexElement = -1, faceElement = -1;
+    int x = -1, y = -1, z = -1;
+    int vertexRGB[3] = { -1, -1, -1 };
+    int faceIndices = -1;
+    int faceRGB[3] = { -1, -1, -1 };
+};
+
+static int findProperty(const PlyElement& e, const char* a, const char* b = nullptr) {
+    for (size_t i = 0; i < e.properties.size(); ++i) {
+        if (e.properties[i].name == a || (b && e.properties[i].name == b)) return int(i);
+    }
+    return -1;
+}
+
+// Triangles in one face, read from its list count
+static inline size_t fanTriangles(double corners) { return corners >= 3 ? size_t(corners) - 2 : 0; }
+
+// Value parsing for one ascii element line; values[i] receives non-list
+// properties, and the face index list is fanned straight into the mesh.
+struct PlyAsciiFace {
+    uint32_t* indices;
+    size_t vertexCount;
+};
+
+static const char* parsePlyAsciiLine(const PlyElement& e, const PlyLayout& layout, bool isFace,
+                                     const char* p, const char* le, double* values,
+                                     PlyAsciiFace* face, size_t& triangles) {
+    for (size_t k = 0; k < e.properties.size(); ++k) {
+        const PlyProperty& prop = e.properties[k];
+        double v;
+        if (!parseNumber(p, le, v)) return "missing value";
+        if (!prop.list) {
+            values[k] = v;
+            continue;
+        }
+        size_t n = size_t(std::max(0.0, v));
+        bool isIndexList = isFace && int(k) == layout.faceIndices;
+        uint32_t first = 0, prev = 0;
+        for (size_t j = 0; j < n; ++j) {
+            int64_t index;
+            if (!isIndexList || !face) {
+                if (!parseNumber(p, le, v)) return "missing list value";
+                continue;
+            }
+            if (!parseInteger(p, le, index)) return "bad face index";
+            if (index < 0 || index >= int64_t(face->vertexCount)) return "face index out of range";
+            uint32_t i = uint32_t(index);
+            if (j >= 2) {
+                face->indices[0] = first; face->indices[1] = prev; face->indices[2] = i;
+                face->indices += 3;
+            }
+            if (j == 0) first = i;
+            prev = i;
+        }
+        if (isIndexList) triangles += fanTriangles(double(n));
+    }
+    return nullptr;
+}
+
+static bool loadPLYAscii(const char* path, const char* body, const char* end, const std::vector<PlyElement>& elements,
+                         const PlyLayout& layout, Mesh& mesh, std::vector<uint32_t>& vertexColors,
+                         bool& faceColors, std::string* error) {
+    ThreadPool pool(0);
+    std::vector<Chunk> chunks = splitLines(body, end, pool.size() * 4);
+    // element i occupies item lines [first[i], first[i] + count)
+    std::vector<size_t> first;
+    size_t total = 0;
+    for (const PlyElement& e : elements) { first.push_back(total); total += e.count; }
+    auto elementOf = [&](size_t item) {
+        int e = int(std::upper_bound(first.begin(), first.end(), item) - first.begin()) - 1;
+        return (e >= 0 && item < first[e] + elements[e].count) ? e : -1;
+    };
+
+    // pass 1: item lines (blank lines skipped)
+    pool.run(int(chunks.size()), [&](int i) {
+        Chunk& c = chunks[i];
+        for (const char* p = c.begin; p < c.end; p = lineEnd(p, c.end) + 1) {
+            const char* le = lineEnd(p, c.end);
+            if (skipBlanks(p, le) < le) ++c.lines;
+        }
+    });
+    size_t items = 0;
+    for (Chunk& c : chunks) { c.lineBase = items; items += c.lines; }
+    if (items < total) return fail(error, std::string(path) + ": file ends early");
+
+    // pass 2: triangles per chunk
+    const PlyElement* faceElement = layout.faceElement >= 0 ? &elements[layout.faceElement] : nullptr;
+    if (faceElement) {
+        pool.run(int(chunks.size()), [&](int i) {
+            Chunk& c = chunks[i];
+            std::vector<double> values(faceElement->properties.size());
+            size_t item = c.lineBase, line = 0;
+            for (const char* p = c.begin; p < c.end && !c.error; p = lineEnd(p, c.end) + 1) {
+                const char* le = lineEnd(p, c.end);
+                if (skipBlanks(p, le) >= le) continue;
+                ++line;
+                if (elementOf(item++) != layout.faceElement) continue;
+                c.error = parsePlyAsciiLine(*faceElement, layout, true, p, le, values.data(), nullptr, c.triangles);
+                c.errorLine = line;
+            }
+        });
+        if (!chunkError(chunks, path, error)) return false;
+    }
+    size_t triangles = 0;
+    for (Chunk& c : chunks) { c.triangleBase = triangles; triangles += c.triangles; }
+
+    size_t vertexCount = layout.vertexElement >= 0 ? elements[layout.vertexElement].count : 0;
+    mesh.positions.resize(vertexCount);
+    mesh.indices.resize(triangles * 3);
+    mesh.colors.resize(triangles);
+
+    // pass 3: parse vertices and faces
+    pool.run(int(chunks.size()), [&](int i) {
+        Chunk& c = chunks[i];
+        std::vector<double> values(16);
+        PlyAsciiFace face = { mesh.indices.data() + 3 * c.triangleBase, vertexCount };
+        size_t item = c.lineBase, line = 0, t = c.triangleBase;
+        for (const char* p = c.begin; p < c.end && !c.error; p = lineEnd(p, c.end) + 1) {
+            const char* le = lineEnd(p, c.end);
+            if (skipBlanks(p, le) >= le) continue;
+            ++line;
+            size_t index = item++;
+            int e = elementOf(index);
+            if (e < 0 || (e != layout.vertexElement && e != layout.faceElement)) continue;
+            const PlyElement& el = elements[e];
+            values.resize(std::max(values.size(), el.properties.size()));
+            size_t made = 0;
+            c.error = parsePlyAsciiLine(el, layout, e == layout.faceElement, p, le, values.data(), &face, made);
+            c.errorLine = line;
+            if (c.error) break;
+            if (e == layout.vertexElement) {
+                size_t v = index - first[e];
+                mesh.positions[v] = Vector3D(float(values[layout.x]), float(values[layout.y]), float(values[layout.z]));
+                if (layout.vertexRGB[0] >= 0) {
+                    uint32_t rgb = 0;
+                    for (int k = 0; k < 3; ++k) rgb = rgb << 8 | colorChannel(values[layout.vertexRGB[k]], plyFloat(el.properties[layout.vertexRGB[k]].type));
+                    vertexColors[v] = rgb;
+                }
+            } else {
+                uint32_t rgb = 0;
+                if (layout.faceRGB[0] >= 0) {
+                    for (int k = 0; k < 3; ++k) rgb = rgb << 8 | colorChannel(values[layout.faceRGB[k]], plyFloat(el.properties[layout.faceRGB[k]].type));
+                }
+                for (size_t k = 0; k < made; ++k) mesh.colors[t++] = rgb;
+            }
+        }
+    });
+    faceColors = layout.faceRGB[0] >= 0;
+    return chunkError(chunks, path, error);
+}
+
+static bool loadPLYBinary(const char* path, const char* p, const char* end, bool swap,
+                          const std::vector<PlyElement>& elements, const PlyLayout& layout,
+                          Mesh& mesh, std::vector<uint32_t>& vertexColors, bool& faceColors, std::string* error) {
+    size_t vertexCount = layout.vertexElement >= 0 ? elements[layout.vertexElement].count : 0;
+    const std::string truncated = std::string(path) + ": file ends early";
+    for (int e = 0; e < int(elements.size()); ++e) {
+        const PlyElement& el = elements[e];
+        bool fixed = true;
+        size_t stride = 0;
+        std::vector<size_t> offsets;
+        for (const PlyProperty& prop : el.properties) {
+            offsets.push_back(stride);
+            stride += plySize(prop.type);
+            fixed &= !prop.list;
+        }
+
+        if (e == layout.vertexElement && fixed) {
+            // fixed-size records: convert in parallel straight from the mapping
+            if (size_t(end - p) / std::max<size_t>(stride, 1) < el.count) return fail(error, truncated);
+            mesh.positions.resize(el.count);
+            ThreadPool pool(0);
+            int tasks = int(std::min<size_t>(size_t(pool.size()) * 4, el.count / 16384 + 1));
+            pool.run(tasks, [&](int task) {
+                size_t begin = el.count * task / tasks, stop = el.count * (task + 1) / tasks;
+                for (size_t v = begin; v < stop; ++v) {
+                    const char* r = p + v * stride;
+                    mesh.positions[v] = Vector3D(float(readBinary(r + offsets[layout.x], el.properties[layout.x].type, swap)),
+                                                 float(readBinary(r + offsets[layout.y], el.properties[layout.y].type, swap)),
+                                                 float(readBinary(r + offsets[layout.z], el.properties[layout.z].type, swap)));
+                    if (layout.vertexRGB[0] >= 0) {
+                        uint32_t rgb = 0;
+                        for (int k = 0; k < 3; ++k) {
+                            const PlyProperty& c = el.properties[layout.vertexRGB[k]];
+                            rgb = rgb << 8 | colorChannel(readBinary(r + offsets[layout.vertexRGB[k]], c.type, swap), plyFloat(c.type));
+                        }
+                        vertexColors[v] = rgb;
+                    }
+                }
+            });
+            p += el.count * stride;
+            continue;
+        }
+
+        bool isVertex = e == layout.vertexElement, isFace = e == layout.faceElement;
+        if (isVertex) mesh.positions.resize(el.count);
+        if (isFace) {
+            mesh.indices.reserve(el.count * 3);
+            mesh.colors.reserve(el.count);
+        }
+        std::vector<double> values(el.properties.size());
+        for (size_t item = 0; item < el.count; ++item) {
+            size_t made = 0;
+            for (size_t k = 0; k < el.properties.size(); ++k) {
+                const PlyProperty& prop = el.properties[k];
+                if (!prop.list) {
+                    if (size_t(end - p) < plySize(prop.type)) return fail(error, truncated);
+                    values[k] = readBinary(p, prop.type, swap);
+                    p += plySize(prop.type);
+                    continue;
+                }
+                if (size_t(end - p) < plySize(prop.countType)) return fail(error, truncated);
+                size_t n = size_t(std::max(0.0, readBinary(p, prop.countType, swap)));
+                p += plySize(prop.countType);
+                size_t itemSize = plySize(prop.type);
+                if (size_t(end - p) / itemSize < n) return fail(error, truncated);
+                if (isFace && int(k) == layout.faceIndices) {
+                    uint32_t corners[3];
+                    for (size_t j = 0; j < n; ++j) {
+                        double index = readBinary(p + j * itemSize, prop.type, swap);
+                        if (index < 0 || index >= double(vertexCount)) return fail(error, std::string(path) + ": face index out of range");
+                        corners[j < 2 ? j : 2] = uint32_t(index);
+                        if (j >= 2) {
+                            mesh.indices.insert(mesh.indices.end(), corners, corners + 3);
+                            corners[1] = corners[2];
+                            ++made;
+                        }
+                    }
+                }
+                p += n * itemSize;
+            }
+            if (isVertex) {
+                mesh.positions[item] = Vector3D(float(values[layout.x]), float(values[layout.y]), float(values[layout.z]));
+                if (layout.vertexRGB[0] >= 0) {
+                    uint32_t rgb = 0;
+                    for (int k = 0; k < 3; ++k) rgb = rgb << 8 | colorChannel(values[layout.vertexRGB[k]], plyFloat(el.properties[layout.vertexRGB[k]].type));
+                    vertexColors[item] = rgb;
+                }
+            } else if (isFace) {
+                uint32_t rgb = 0;
+                if (layout.faceRGB[0] >= 0) {
+                    for (int k = 0; k < 3; ++k) rgb = rgb << 8 | colorChannel(values[layout.faceRGB[k]], plyFloat(el.properties[layout.faceRGB[k]].type));
+                }
+                mesh.colors.insert(mesh.colors.end(), made, rgb);
+            }
+        }
+    }
+    faceColors = layout.faceRGB[0] >= 0;
+    return true;
+}
+
+bool loadPLY(const char* path, Mesh& mesh, std::string* error, uint32_t defaultColor) {
+    MappedFile file;
+    if (!file.open(path)) return fail(error, std::string("cannot open ") + path);
+    const char* p = file.data();
+    const char* end = p + file.size();
+    if (file.size() < 4 || memcmp(p, "ply", 3) != 0) return fail(error, std::string(path) + ": not a PLY file");
+
+    // Header: one keyword line at a time up to end_header
+    enum { Ascii, LittleEndian, BigEndian } format = Ascii;
+    bool haveFormat = false;
+    std::vector<PlyElement> elements;
+    for (p = lineEnd(p, end) + 1;; p = lineEnd(p, end) + 1) {
+        if (p >= end) return fail(error, std::string(path) + ": missing end_header");
+        const char* le = lineEnd(p, end);
+        std::vector<std::string> words;
+        for (const char* s = skipBlanks(p, le); s < le; s = skipBlanks(s, le)) {
+            const char* t = skipToken(s, le);
+            words.push_back(std::string(s, t));
+            s = t;
+        }
+        if (words.empty() || words[0] == "comment" || words[0] == "obj_info") continue;
+        if (words[0] == "end_header") { p = le < end ? le + 1 : end; break; }
+        if (words[0] == "format" && words.size() >= 2) {
+            haveFormat = true;
+            if (words[1] == "ascii") format = Ascii;
+            else if (words[1] == "binary_little_endian") format = LittleEndian;
+            else if (words[1] == "binary_big_endian") format = BigEndian;
+            else return fail(error, std::string(path) + ": unknown format " + words[1]);
+        } else if (words[0] == "element" && words.size() >= 3) {
+            PlyElement e;
+            e.name = words[1];
+            e.count = size_t(strtoull(words[2].c_str(), nullptr, 10));
+            elements.push_back(e);
+        } else if (words[0] == "property" && !elements.empty()) {
+            PlyProperty prop;
+            bool ok;
+            if (words.size() >= 5 && words[1] == "list") {
+                prop.list = true;
+                prop.name = words[4];
+                ok = plyType(words[2], prop.countType) && plyType(words[3], prop.type);
+            } else {
+                ok = words.size() >= 3 && plyType(words[1], prop.type);
+                if (ok) prop.name = words[2];
+            }
+            if (!ok) return fail(error, std::string(path) + ": bad property line");
+            elements.back().properties.push_back(prop);
+        }
+    }
+    if (!haveFormat) return fail(error, std::string(path) + ": missing format line");
+
+    PlyLayout layout;
+    for (size_t i = 0; i < elements.size(); ++i) {
+        const PlyElement& e = elements[i];
+        if (e.name == "vertex" && layout.vertexElement < 0) {
+            layout.vertexElement = int(i);
+            layout.x = findProperty(e, "x");
+            layout.y = findProperty(e, "y");
+            layout.z = findProperty(e, "z");
+            layout.vertexRGB[0] = findProperty(e, "red", "r");
+            layout.vertexRGB[1] = findProperty(e, "green", "g");
+            layout.vertexRGB[2] = findProperty(e, "blue", "b");
+        } else if (e.name == "face" && layout.faceElement < 0) {
+            layout.faceElement = int(i);
+            layout.faceIndices = findProperty(e, "vertex_indices", "vertex_index");
+            layout.faceRGB[0] = findProperty(e, "red");
+            layout.faceRGB[1] = findProperty(e, "green");
+            layout.faceRGB[2] = findProperty(e, "blue");
+        }
+    }
+    if (layout.vertexElement < 0 || layout.x < 0 || layout.y < 0 || layout.z < 0)
+        return fail(error, std::string(path) + ": no vertex x/y/z");
+    const PlyElement& vertexElement = elements[layout.vertexElement];
+    if (vertexElement.properties[layout.x].list || vertexElement.properties[layout.y].list || vertexElement.properties[layout.z].list)
+        return fail(error, std::string(path) + ": vertex position is a list");
+    if (layout.faceElement >= 0 && (layout.faceIndices < 0 || !elements[layout.faceElement].properties[layout.faceIndices].list))
+        return fail(error, std::string(path) + ": faces have no vertex_indices list");
+    for (int k = 0; k < 3; ++k) {
+        if (layout.vertexRGB[k] < 0 || vertexElement.properties[layout.vertexRGB[k]].list) layout.vertexRGB[0] = -1;
+        if (layout.faceElement >= 0 && (layout.faceRGB[k] < 0 || elements[layout.faceElement].properties[layout.faceRGB[k]].list)) layout.faceRGB[0] = -1;
+    }
+    if (vertexElement.count > std::numeric_limits<uint32_t>::max()) return fail(error, std::string(path) + ": too many vertices");
+    // Every item takes at least a byte (binary: its fixed fields and list
+    // counts), so counts the body cannot hold fail before anything is sized
+    size_t left = size_t(end - p);
+    for (const PlyElement& e : elements) {
+        size_t least = 0;
+        for (const PlyProperty& prop : e.properties) least += plySize(prop.list ? prop.countType : prop.type);
+        if (format == Ascii || least == 0) least = 1;
+        if (e.count > left / least) return fail(error, std::string(path) + ": file ends early");
+        left -= e.count * least;
+    }
+
+    mesh.positions.clear();
+    mesh.indices.clear();
+    mesh.colors.clear();
+    mesh.normals.clear();
+    mesh.vertexColors.clear();
+    mesh.uvs.clear();
+    std::vector<uint32_t> vertexColors(layout.vertexRGB[0] >= 0 ? vertexElement.count : 0);
+    bool faceColors = false;
+    const uint16_t probe = 1;
+    bool hostLittle = *reinterpret_cast<const unsigned char*>(&probe) == 1;
+    bool ok = format == Ascii
+        ? loadPLYAscii(path, p, end, elements, layout, mesh, vertexColors, faceColors, error)
+        : loadPLYBinary(path, p, end, (format == LittleEndian) != hostLittle, elements, layout, mesh, vertexColors, faceColors, error);
+    if (!ok) return false;
+
+    if (!faceColors) {
+        if (!vertexColors.empty()) {
+            ThreadPool pool(0);
+            averageVertexColors(pool, mesh, vertexColors);
+            mesh.vertexColors.swap(vertexColors);
+        } else {
+            std::fill(mesh.colors.begin(), mesh.colors.end(), defaultColor);
+        }
+    }
+    return true;
+}
+
+// --- Baked binary meshes ---
+
+static const char MESH_MAGIC[8] = { 'S', 'R', 'M', 'E', 'S', 'H', 0, 0 };
+static const uint64_t MESH_ALIGN = 64;
+
+static inline uint64_t alignUp(uint64_t v) { return (v + MESH_ALIGN - 1) & ~(MESH_ALIGN - 1); }
+
+void meshBounds(const Vector3D* positions, size_t count, Vector3D& boundsMin, Vector3D& boundsMax) {
+    if (count == 0) {
+        boundsMin = boundsMax = Vector3D(0, 0, 0);
+        return;
+    }
+    boundsMin = boundsMax = positions[0];
+    for (size_t i = 1; i < count; ++i) {
+        const Vector3D& p = positions[i];
+        boundsMin.x = std::min(boundsMin.x, p.x); boundsMax.x = std::max(boundsMax.x, p.x);
+        boundsMin.y = std::min(boundsMin.y, p.y); boundsMax.y = std::max(boundsMax.y, p.y);
+        boundsMin.z = std::min(boundsMin.z, p.z); boundsMax.z = std::max(boundsMax.z, p.z);
+    }
+}
+
+bool saveMesh(const char* path, const Mesh& mesh, std::string* error) {
+    static_assert(sizeof(Vector3D) == 12, "Vector3D must be tightly packed xyz");
+    MeshFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MESH_MAGIC, sizeof(MESH_MAGIC));
+    header.version = MESH_FILE_VERSION;
+    header.headerSize = sizeof(MeshFileHeader);
+    header.vertexCount = mesh.positions.size();
+    header.triangleCount = mesh.indices.size() / 3;
+    header.positionsOffset = alignUp(sizeof(MeshFileHeader));
+    header.indicesOffset = alignUp(header.positionsOffset + header.vertexCount * sizeof(Vector3D));
+    header.colorsOffset = alignUp(header.indicesOffset + header.triangleCount * 3 * sizeof(uint32_t));
+    Vector3D lo, hi;
+    meshBounds(mesh.positions.data(), mesh.positions.size(), lo, hi);
+    header.boundsMin[0] = lo.x; header.boundsMin[1] = lo.y; header.boundsMin[2] = lo.z;
+    header.boundsMax[0] = hi.x; header.boundsMax[1] = hi.y; header.boundsMax[2] = hi.z;
+
+    FILE* f = fopen(path, "wb");
+    if (!f) return fail(error, std::string("cannot create ") + path);
+    static const char zeros[MESH_ALIGN] = {};
+    uint64_t at = 0;
+    bool ok = true;
+    auto put = [&](uint64_t offset, const void* data, size_t bytes) {
+        ok = ok && fwrite(zeros, 1, size_t(offset - at), f) == size_t(offset - at);
+        ok = ok && (bytes == 0 || fwrite(data, 1, bytes, f) == bytes);
+        at = offset + bytes;
+    };
+    put(0, &header, sizeof(header));
+    put(header.positionsOffset, mesh.positions.data(), mesh.positions.size() * sizeof(Vector3D));
+    put(header.indicesOffset, mesh.indices.data(), size_t(header.triangleCount) * 3 * sizeof(uint32_t));
+    std::vector<uint32_t> colors(mesh.colors.begin(), mesh.colors.end());
+    colors.resize(size_t(header.triangleCount), 0xC8C8C8);
+    put(header.colorsOffset, colors.data(), colors.size() * sizeof(uint32_t));
+    ok = (fclose(f) == 0) && ok;
+    return ok || fail(error, std::string("write failed: ") + path);
+}
+
+bool MappedMesh::open(const char* path, std::string* error) {
+    header = nullptr;
+    if (!file.open(path)) return fail(error, std::string("cannot open ") + path);
+    uint64_t size = file.size();
+    const MeshFileHeader* h = reinterpret_cast<const MeshFileHeader*>(file.data());
+    if (size < sizeof(MeshFileHeader) || memcmp(h->magic, MESH_MAGIC, sizeof(MESH_MAGIC)) != 0)
+        return fail(error, std::string(path) + ": not a baked mesh");
+    if (h->version != MESH_FILE_VERSION || h->headerSize != sizeof(MeshFileHeader))
+        return fail(error, std::string(path) + ": unsupported mesh file version");
+    // each section aligned and inside the file
+    auto fits = [&](uint64_t offset, uint64_t count, uint64_t itemSize) {
+        return offset % 4 == 0 && offset <= size && count <= (size - offset) / itemSize;
+    };
+    if (!fits(h->positionsOffset, h->vertexCount, sizeof(Vector3D)) ||
+        !fits(h->indicesOffset, h->triangleCount, 3 * sizeof(uint32_t)) ||
+        !fits(h->colorsOffset, h->triangleCount, sizeof(uint32_t)) ||
+        h->vertexCount > std::numeric_limits<uint32_t>::max())
+        return fail(error, std::string(path) + ": truncated or corrupt mesh file");
+    header = h;
+    positionData = reinterpret_cast<const Vector3D*>(file.data() + h->positionsOffset);
+    indexData = reinterpret_cast<const uint32_t*>(file.data() + h->indicesOffset);
+    colorData = reinterpret_cast<const uint32_t*>(file.data() + h->colorsOffset);
+    return true;
+}
+
+bool MappedMesh::validate(std::string* error) const {
+    if (!header) return fail(error, "no mesh file open");
+    size_t count = triangleCount() * 3, vertices = vertexCount();
+    for (size_t i = 0; i < count; ++i) {
+        if (indexData[i] >= vertices) return fail(error, "index out of range");
+    }
+    return true;
+}
+
+Vector3D MappedMesh::boundsMin() const {
+    return header ? Vector3D(header->boundsMin[0], header->boundsMin[1], header->boundsMin[2]) : Vector3D();
+}
+
+Vector3D MappedMesh::boundsMax() const {
+    return header ? Vector3D(header->boundsMax[0], header->boundsMax[1], header->boundsMax[2]) : Vector3D();
+}
+
+static bool hasExtension(const char* path, const char* ext) {
+    size_t n = strlen(path), m = strlen(ext);
+    if (n < m) return false;
+    for (size_t i = 0; i < m; ++i) {
+        char c = path[n - m + i];
+        if (c >= 'A' && c <= 'Z') c = char(c - 'A' + 'a');
+        if (c != ext[i]) return false;
+    }
+    return true;
+}
+
+bool loadMesh(const char* path, Mesh& mesh, std::string* error) {
+    if (hasExtension(path, ".obj")) return loadOBJ(path, mesh, error);
+    if (hasExtension(path, ".ply")) return loadPLY(path, mesh, error);
+    if (hasExtension(path, ".srm")) {
+        MappedMesh mapped;
+        if (!mapped.open(path, error)) return false;
+        std::string message;
+        if (!mapped.validate(&message)) return fail(error, std::string(path) + ": " + message);
+        mesh.positions.assign(mapped.positions(), mapped.positions() + mapped.vertexCount());
+        mesh.indices.assign(mapped.indices(), mapped.indices() + mapped.triangleCount() * 3);
+        mesh.colors.assign(mapped.colors(), mapped.colors() + mapped.triangleCount());
+        mesh.normals.clear();
+        mesh.vertexColors.clear();
+        mesh.uvs.clear();
+        return true;
+    }
+    return fail(error, std::string(path) + ": unknown mesh extension (want .obj, .ply or .srm)");
+}
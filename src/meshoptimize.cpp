@@ -0,0 +1,226 @@
+#include "MeshOptimize.h"
+#include <algorithm>
+#include <cmath>
+
+float computeACMR(const uint32_t* indices, size_t triangleCount, size_t vertexCount, int cacheSize) {
+    if (triangleCount == 0) return 0.0f;
+    // a vertex is cached while fewer than cacheSize misses followed its own
+    std::vector<uint64_t> loadedAt(vertexCount, 0);
+    uint64_t misses = 0;
+    for (size_t i = 0; i < triangleCount * 3; ++i) {
+        uint32_t v = indices[i];
+        if (loadedAt[v] == 0 || misses - loadedAt[v] >= uint64_t(cacheSize)) loadedAt[v] = ++misses;
+    }
+    return float(double(misses) / double(triangleCount));
+}
+
+void optimizeVertexCache(Mesh& mesh, int cacheSize) {
+    size_t vertexCount = mesh.positions.size();
+    size_t triangleCount = mesh.indices.size() / 3;
+    if (triangleCount == 0) return;
+    const uint32_t* indices = mesh.indices.data();
+
+    // vertex -> triangles adjacency (CSR), and live triangle counts
+    std::vector<uint32_t> live(vertexCount, 0), offsets(vertexCount + 1, 0);
+    for (size_t i = 0; i < triangleCount * 3; ++i) ++live[indices[i]];
+    for (size_t v = 0; v < vertexCount; ++v) offsets[v + 1] = offsets[v] + live[v];
+    std::vector<uint32_t> adjacency(triangleCount * 3), fill(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        for (int k = 0; k < 3; ++k) adjacency[fill[indices[3 * t + k]]++] = uint32_t(t);
+    }
+
+    std::vector<uint32_t> cacheTime(vertexCount, 0);
+    std::vector<uint8_t> emitted(triangleCount, 0);
+    std::vector<uint32_t> order, deadEnd, candidates;
+    order.reserve(triangleCount);
+    uint32_t timestamp = uint32_t(cacheSize) + 1;
+    size_t cursor = 0;
+
+    int64_t fan = 0;
+    while (fan >= 0) {
+        // emit every remaining triangle around the fanning vertex
+        candidates.clear();
+        for (uint32_t a = offsets[fan]; a < offsets[fan + 1]; ++a) {
+            uint32_t t = adjacency[a];
+            if (emitted[t]) continue;
+            emitted[t] = 1;
+            order.push_back(t);
+            for (int k = 0; k < 3; ++k) {
+                uint32_t v = indices[3 * t + k];
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                --live[v];
+                if (timestamp - cacheTime[v] > uint32_t(cacheSize)) cacheTime[v] = timestamp++;
+            }
+        }
+
+        // next fan: the candidate that stays in cache longest while its
+        // remaining triangles are emitted
+        fan = -1;
+        int64_t best = -1;
+        for (uint32_t v : candidates) {
+            if (live[v] == 0) continue;
+            int64_t priority = 0;
+            if (int64_t(timestamp - cacheTime[v]) + 2 * int64_t(live[v]) <= cacheSize) priority = timestamp - cacheTime[v];
+            if (priority > best) {
+                best = priority;
+                fan = v;
+            }
+        }
+        if (fan >= 0) continue;
+        // dead end: recently used vertices first, then the next unused one in order
+        while (!deadEnd.empty()) {
+            uint32_t v = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[v] > 0) { fan = v; break; }
+        }
+        if (fan >= 0) continue;
+        while (cursor < vertexCount && live[cursor] == 0) ++cursor;
+        if (cursor < vertexCount) fan = int64_t(cursor);
+    }
+
+    std::vector<uint32_t> newIndices(triangleCount * 3);
+    std::vector<uint32_t> newColors(mesh.colors.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        uint32_t t = order[i];
+        for (int k = 0; k < 3; ++k) newIndices[3 * i + k] = indices[3 * t + k];
+        if (t < mesh.colors.size()) newColors[i] = mesh.colors[t];
+    }
+    mesh.indices.swap(newIndices);
+    mesh.colors.swap(newColors);
+}
+
+// values[i] = old values[order[i]], for attributes of stride values per
+// vertex; empty attribute arrays stay empty
+template <typename T>
+static void permute(std::vector<T>& values, const std::vector<uint32_t>& order, size_t stride = 1) {
+    if (values.empty()) return;
+    std::vector<T> out;
+    out.reserve(order.size() * stride);
+    for (uint32_t i : order) out.insert(out.end(), values.begin() + i * stride, values.begin() + (i + 1) * stride);
+    values.swap(out);
+}
+
+void optimizeVertexFetch(Mesh& mesh) {
+    const uint32_t UNUSED = ~0u;
+    size_t vertexCount = mesh.positions.size();
+    std::vector<uint32_t> remap(vertexCount, UNUSED);
+    std::vector<uint32_t> order;   // old index of each new vertex
+    order.reserve(vertexCount);
+    for (uint32_t& i : mesh.indices) {
+        if (remap[i] == UNUSED) {
+            remap[i] = uint32_t(order.size());
+            order.push_back(i);
+        }
+        i = remap[i];
+    }
+    for (size_t v = 0; v < vertexCount; ++v) {
+        if (remap[v] == UNUSED) order.push_back(uint32_t(v));
+    }
+    permute(mesh.positions, order);
+    permute(mesh.normals, order);
+    permute(mesh.vertexColors, order);
+    permute(mesh.uvs, order, 2);
+}
+
+MeshOptimizeReport optimizeMesh(Mesh& mesh) {
+    MeshOptimizeReport report;
+    size_t triangles = mesh.indices.size() / 3;
+    report.acmrBefore = computeACMR(mesh.indices.data(), triangles, mesh.positions.size());
+    optimizeVertexCache(mesh);
+    optimizeVertexFetch(mesh);
+    report.acmrAfter = computeACMR(mesh.indices.data(), triangles, mesh.positions.size());
+    return report;
+}
+
+// Bounding sphere and normal cone of triangles [first, first + count)
+static void meshletBounds(const Vector3D* positions, const uint32_t* indices, Meshlet& m) {
+    Vector3D lo = positions[indices[3 * m.firstTriangle]], hi = lo;
+    Vector3D normalSum(0, 0, 0);
+    std::vector<Vector3D> normals;
+    normals.reserve(m.triangleCount);
+    for (uint32_t t = m.firstTriangle; t < m.firstTriangle + m.triangleCount; ++t) {
+        const Vector3D& a = positions[indices[3 * t]];
+        const Vector3D& b = positions[indices[3 * t + 1]];
+        const Vector3D& c = positions[indices[3 * t + 2]];
+        for (const Vector3D* p : { &a, &b, &c }) {
+            lo.x = std::min(lo.x, p->x); hi.x = std::max(hi.x, p->x);
+            lo.y = std::min(lo.y, p->y); hi.y = std::max(hi.y, p->y);
+            lo.z = std::min(lo.z, p->z); hi.z = std::max(hi.z, p->z);
+        }
+        // same winding as drawMesh's facing test
+        Vector3D n = (b - a).cross(c - a);
+        if (n.magnitude() > 0.0f) {
+            normals.push_back(n.normalize());
+            normalSum = normalSum + normals.back();
+        }
+    }
+    Vector3D center = (lo + hi) * 0.5f;
+    float radius = 0.0f;
+    for (uint32_t t = m.firstTriangle; t < m.firstTriangle + m.triangleCount; ++t) {
+        for (int k = 0; k < 3; ++k) radius = std::max(radius, (positions[indices[3 * t + k]] - center).magnitude());
+    }
+    m.center[0] = center.x; m.center[1] = center.y; m.center[2] = center.z;
+    m.radius = radius;
+
+    // cone: axis along the mean normal, cutoff the cosine of the widest normal
+    m.coneAxis[0] = m.coneAxis[1] = m.coneAxis[2] = 0.0f;
+    m.coneCutoff = -1.0f;
+    if (normals.empty() || normalSum.magnitude() < 1e-6f) return;
+    Vector3D axis = normalSum.normalize();
+    float cutoff = 1.0f;
+    for (const Vector3D& n : normals) cutoff = std::min(cutoff, n.dot(axis));
+    m.coneAxis[0] = axis.x; m.coneAxis[1] = axis.y; m.coneAxis[2] = axis.z;
+    m.coneCutoff = cutoff;
+}
+
+std::vector<Meshlet> buildMeshlets(const Vector3D* positions, size_t vertexCount,
+                                   const uint32_t* indices, size_t triangleCount,
+                                   int maxVertices, int maxTriangles) {
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> seenIn(vertexCount, ~0u);   // meshlet that last used each vertex
+    Meshlet current = Meshlet();
+    int uniqueVertices = 0;
+    for (size_t t = 0; t < triangleCount; ++t) {
+        uint32_t id = uint32_t(meshlets.size());
+        int fresh = 0;
+        for (int k = 0; k < 3; ++k) fresh += seenIn[indices[3 * t + k]] != id;
+        if (current.triangleCount > 0 && (uniqueVertices + fresh > maxVertices || int(current.triangleCount) >= maxTriangles)) {
+            meshletBounds(positions, indices, current);
+            meshlets.push_back(current);
+            current = Meshlet();
+            current.firstTriangle = uint32_t(t);
+            uniqueVertices = 0;
+            id = uint32_t(meshlets.size());
+        }
+        for (int k = 0; k < 3; ++k) {
+            uint32_t v = indices[3 * t + k];
+            if (seenIn[v] != id) {
+                seenIn[v] = id;
+                ++uniqueVertices;
+            }
+        }
+        ++current.triangleCount;
+    }
+    if (current.triangleCount > 0) {
+        meshletBounds(positions, indices, current);
+        meshlets.push_back(current);
+    }
+    return meshlets;
+}
+
+void computeBoundingSphere(const Vector3D* positions, size_t vertexCount, float center[3], float& radius) {
+    center[0] = center[1] = center[2] = 0.0f;
+    radius = 0.0f;
+    if (vertexCount == 0) return;
+    Vector3D lo = positions[0], hi = lo;
+    for (size_t i = 1; i < vertexCount; ++i) {
+        const Vector3D& p = positions[i];
+        lo.x = std::min(lo.x, p.x); hi.x = std::max(hi.x, p.x);
+        lo.y = std::min(lo.y, p.y); hi.y = std::max(hi.y, p.y);
+        lo.z = std::min(lo.z, p.z); hi.z = std::max(hi.z, p.z);
+    }
+    Vector3D c = (lo + hi) * 0.5f;
+    for (size_t i = 0; i < vertexCount; ++i) radius = std::max(radius, (positions[i] - c).magnitude());
+    center[0] = c.x; center[1] = c.y; center[2] = c.z;
+}
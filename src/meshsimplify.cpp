@@ -0,0 +1,280 @@
+#include "MeshSimplify.h"
+#include "MeshOptimize.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <queue>
+#include <utility>
+
+// Weight of a border's plane against the area-weighted face planes
+static const double BORDER_WEIGHT = 10.0;
+
+// Sum of weighted squared distances to a set of planes (a, b, c, d) as a
+// symmetric 4x4 matrix, and the total weight
+struct Quadric {
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2, weight;
+};
+
+static Quadric planeQuadric(double a, double b, double c, double d, double w) {
+    return Quadric{ w * a * a, w * a * b, w * a * c, w * a * d, w * b * b, w * b * c, w * b * d,
+                    w * c * c, w * c * d, w * d * d, w };
+}
+
+static void addQuadric(Quadric& q, const Quadric& o) {
+    q.a2 += o.a2; q.ab += o.ab; q.ac += o.ac; q.ad += o.ad; q.b2 += o.b2;
+    q.bc += o.bc; q.bd += o.bd; q.c2 += o.c2; q.cd += o.cd; q.d2 += o.d2;
+    q.weight += o.weight;
+}
+
+static double quadricError(const Quadric& q, const Vector3D& p) {
+    double x = p.x, y = p.y, z = p.z;
+    double e = x * x * q.a2 + 2 * x * y * q.ab + 2 * x * z * q.ac + 2 * x * q.ad
+             + y * y * q.b2 + 2 * y * z * q.bc + 2 * y * q.bd
+             + z * z * q.c2 + 2 * z * q.cd + q.d2;
+    return std::max(0.0, e);
+}
+
+// A queued collapse of vertex from onto vertex to, valid while neither
+// vertex's quadric has changed since (their versions still match)
+struct Collapse {
+    double cost;
+    uint32_t from, to;
+    uint32_t fromVersion, toVersion;
+    bool operator>(const Collapse& o) const { return cost > o.cost; }
+};
+
+Mesh simplifyMesh(const Mesh& mesh, size_t targetTriangles, float* error) {
+    const size_t vertexCount = mesh.positions.size();
+    const size_t triangleCount = mesh.indices.size() / 3;
+    const std::vector<Vector3D>& pos = mesh.positions;
+    std::vector<uint32_t> indices(mesh.indices.begin(), mesh.indices.begin() + triangleCount * 3);
+    std::vector<uint8_t> alive(triangleCount, 1);
+    size_t liveTriangles = 0;
+
+    // vertex -> triangles; entries of dead or moved-away triangles are
+    // skipped when read
+    std::vector<std::vector<uint32_t>> around(vertexCount);
+    std::vector<Quadric> quadrics(vertexCount, Quadric());
+    for (size_t t = 0; t < triangleCount; ++t) {
+        uint32_t i0 = indices[3 * t], i1 = indices[3 * t + 1], i2 = indices[3 * t + 2];
+        if (i0 == i1 || i1 == i2 || i0 == i2) {
+            alive[t] = 0;
+            continue;
+        }
+        ++liveTriangles;
+        Vector3D n = (pos[i1] - pos[i0]).cross(pos[i2] - pos[i0]);
+        float area2 = n.magnitude();
+        for (int k = 0; k < 3; ++k) around[indices[3 * t + k]].push_back(uint32_t(t));
+        if (area2 <= 0.0f) continue;
+        n = n * (1.0f / area2);
+        Quadric q = planeQuadric(n.x, n.y, n.z, -n.dot(pos[i0]), 0.5 * area2);
+        for (int k = 0; k < 3; ++k) addQuadric(quadrics[indices[3 * t + k]], q);
+    }
+
+    auto contains = [&](uint32_t t, uint32_t v) {
+        return indices[3 * t] == v || indices[3 * t + 1] == v || indices[3 * t + 2] == v;
+    };
+    // live triangles around a that also use b
+    auto sharedTriangles = [&](uint32_t a, uint32_t b) {
+        int n = 0;
+        for (uint32_t t : around[a]) n += alive[t] && contains(t, a) && contains(t, b);
+        return n;
+    };
+
+    // Borders (edges of one triangle, which includes the seams of split
+    // vertices) get a plane through the edge, perpendicular to the face
+    std::vector<uint8_t> border(vertexCount, 0);
+    for (size_t t = 0; t < triangleCount; ++t) {
+        if (!alive[t]) continue;
+        for (int k = 0; k < 3; ++k) {
+            uint32_t a = indices[3 * t + k], b = indices[3 * t + (k + 1) % 3];
+            if (sharedTriangles(a, b) != 1) continue;
+            border[a] = border[b] = 1;
+            uint32_t c = indices[3 * t + (k + 2) % 3];
+            Vector3D edge = pos[b] - pos[a];
+            Vector3D n = edge.cross(pos[c] - pos[a]).cross(edge);
+            float len = n.magnitude();
+            if (len <= 0.0f) continue;
+            n = n * (1.0f / len);
+            double w = BORDER_WEIGHT * edge.dot(edge);
+            Quadric q = planeQuadric(n.x, n.y, n.z, -n.dot(pos[a]), w);
+            addQuadric(quadrics[a], q);
+            addQuadric(quadrics[b], q);
+        }
+    }
+
+    std::vector<uint32_t> version(vertexCount, 0);
+    std::vector<uint8_t> removed(vertexCount, 0);
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> queue;
+    // queue the cheaper direction of edge (a, b)
+    auto push = [&](uint32_t a, uint32_t b) {
+        Quadric q = quadrics[a];
+        addQuadric(q, quadrics[b]);
+        double ab = quadricError(q, pos[b]), ba = quadricError(q, pos[a]);
+        if (ab <= ba) queue.push(Collapse{ ab, a, b, version[a], version[b] });
+        else queue.push(Collapse{ ba, b, a, version[b], version[a] });
+    };
+    for (size_t t = 0; t < triangleCount; ++t) {
+        if (!alive[t]) continue;
+        for (int k = 0; k < 3; ++k) {
+            uint32_t a = indices[3 * t + k], b = indices[3 * t + (k + 1) % 3];
+            if (a < b || sharedTriangles(a, b) == 1) push(a, b);   // interior edges once
+        }
+    }
+
+    double maxError = 0.0;
+    std::vector<uint32_t> ring, ringTo;
+    while (liveTriangles > targetTriangles && !queue.empty()) {
+        Collapse c = queue.top();
+        queue.pop();
+        uint32_t from = c.from, to = c.to;
+        if (removed[from] || removed[to] || version[from] != c.fromVersion || version[to] != c.toVersion) continue;
+        int shared = sharedTriangles(from, to);
+        if (shared == 0) continue;
+        // a border vertex may only slide along its border
+        if (border[from] && shared != 1) continue;
+
+        // Link condition: the only vertices next to both ends are the far
+        // corners of the triangles on the edge, or the surface pinches
+        ring.clear(); ringTo.clear();
+        for (uint32_t t : around[from]) {
+            if (!alive[t] || !contains(t, from)) continue;
+            for (int k = 0; k < 3; ++k) ring.push_back(indices[3 * t + k]);
+        }
+        for (uint32_t t : around[to]) {
+            if (!alive[t] || !contains(t, to)) continue;
+            for (int k = 0; k < 3; ++k) ringTo.push_back(indices[3 * t + k]);
+        }
+        std::sort(ring.begin(), ring.end());
+        ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+        std::sort(ringTo.begin(), ringTo.end());
+        ringTo.erase(std::unique(ringTo.begin(), ringTo.end()), ringTo.end());
+        int common = 0;
+        for (uint32_t v : ring) {
+            if (v != from && v != to && std::binary_search(ringTo.begin(), ringTo.end(), v)) ++common;
+        }
+        if (common != shared) continue;
+
+        // no triangle that stays may turn over
+        bool flips = false;
+        for (uint32_t t : around[from]) {
+            if (!alive[t] || !contains(t, from) || contains(t, to)) continue;
+            Vector3D p[3], q[3];
+            for (int k = 0; k < 3; ++k) {
+                uint32_t v = indices[3 * t + k];
+                p[k] = pos[v];
+                q[k] = pos[v == from ? to : v];
+            }
+            Vector3D before = (p[1] - p[0]).cross(p[2] - p[0]);
+            Vector3D after = (q[1] - q[0]).cross(q[2] - q[0]);
+            if (after.dot(before) <= 0.0f) {
+                flips = true;
+                break;
+            }
+        }
+        if (flips) continue;
+
+        for (uint32_t t : around[from]) {
+            if (!alive[t] || !contains(t, from)) continue;
+            if (contains(t, to)) {
+                alive[t] = 0;
+                --liveTriangles;
+                continue;
+            }
+            for (int k = 0; k < 3; ++k) {
+                if (indices[3 * t + k] == from) indices[3 * t + k] = to;
+            }
+            around[to].push_back(t);
+        }
+        around[from].clear();
+        removed[from] = 1;
+        // RMS distance of to from the planes the moved vertex stood for
+        const Quadric& q = quadrics[from];
+        if (q.weight > 0.0) maxError = std::max(maxError, std::sqrt(quadricError(q, pos[to]) / q.weight));
+        addQuadric(quadrics[to], quadrics[from]);
+        ++version[to];
+
+        // requeue every edge at to with its new quadric
+        for (uint32_t v : ring) {
+            if (v != from && v != to && !removed[v]) push(v, to);
+        }
+        for (uint32_t v : ringTo) {
+            if (v != from && v != to && !removed[v] && !std::binary_search(ring.begin(), ring.end(), v)) push(v, to);
+        }
+    }
+    if (error) *error = float(maxError);
+
+    // compact: surviving triangles in their order, used vertices renumbered
+    const uint32_t UNUSED = ~0u;
+    std::vector<uint32_t> remap(vertexCount, UNUSED);
+    Mesh out;
+    for (size_t t = 0; t < triangleCount; ++t) {
+        if (!alive[t]) continue;
+        for (int k = 0; k < 3; ++k) {
+            uint32_t v = indices[3 * t + k];
+            if (remap[v] == UNUSED) {
+                remap[v] = uint32_t(out.positions.size());
+                out.positions.push_back(pos[v]);
+                if (!mesh.normals.empty()) out.normals.push_back(mesh.normals[v]);
+                if (!mesh.vertexColors.empty()) out.vertexColors.push_back(mesh.vertexColors[v]);
+                if (!mesh.uvs.empty()) {
+                    out.uvs.push_back(mesh.uvs[2 * v]);
+                    out.uvs.push_back(mesh.uvs[2 * v + 1]);
+                }
+            }
+            out.indices.push_back(remap[v]);
+        }
+        if (t < mesh.colors.size()) out.colors.push_back(mesh.colors[t]);
+    }
+    return out;
+}
+
+LodChain buildLodChain(const Mesh& mesh, int maxLevels, float ratio, size_t minTriangles, float pixelError) {
+    LodChain chain;
+    chain.meshes.push_back(mesh);
+    chain.errors.push_back(0.0f);
+    while (int(chain.meshes.size()) < maxLevels) {
+        const Mesh& last = chain.meshes.back();
+        size_t triangles = last.indices.size() / 3;
+        if (triangles <= minTriangles) break;
+        size_t target = std::max(minTriangles, size_t(triangles * ratio));
+        float error = 0.0f;
+        Mesh next = simplifyMesh(last, target, &error);
+        // stuck (every remaining collapse is blocked): stop here
+        if (next.indices.size() / 3 > triangles * 9 / 10) break;
+        optimizeMesh(next);
+        chain.errors.push_back(chain.errors.back() + error);
+        chain.meshes.push_back(std::move(next));
+    }
+
+    const Mesh& finest = chain.meshes.front();
+    computeBoundingSphere(finest.positions.data(), finest.positions.size(), chain.center, chain.radius);
+    Vector3D center(chain.center[0], chain.center[1], chain.center[2]);
+    for (const Mesh& m : chain.meshes) {
+        for (const Vector3D& p : m.positions) chain.radius = std::max(chain.radius, (p - center).magnitude());
+    }
+
+    // Level l gives way to l + 1 once the sphere's screen radius r makes
+    // error(l + 1) * r / radius fall to pixelError
+    for (size_t l = 0; l < chain.meshes.size(); ++l) chain.meshlets.push_back(buildMeshlets(chain.meshes[l]));
+    for (size_t l = 0; l < chain.meshes.size(); ++l) {
+        const Mesh& m = chain.meshes[l];
+        MeshLod lod;
+        lod.positions = m.positions.data();
+        lod.vertexCount = m.positions.size();
+        lod.indices = m.indices.data();
+        lod.triangleCount = m.indices.size() / 3;
+        lod.colors = m.colors.data();
+        lod.meshlets = chain.meshlets[l].data();
+        lod.meshletCount = chain.meshlets[l].size();
+        if (!m.normals.empty()) lod.attributes.normals = m.normals.data();
+        if (!m.vertexColors.empty()) lod.attributes.colors = m.vertexColors.data();
+        if (!m.uvs.empty()) lod.attributes.uvs = m.uvs.data();
+        if (l + 1 < chain.meshes.size()) {
+            float next = chain.errors[l + 1];
+            lod.minScreenRadius = next > 0.0f ? pixelError * chain.radius / next : HUGE_VALF;
+        }
+        chain.lods.push_back(lod);
+    }
+    return chain;
+}
@@ -0,0 +1,61 @@
+#include "Presenter.h"
+#include <algorithm>
+
+Presenter::Presenter(int width, int height, int bufferCount, PresentFn presentFn)
+    : pitch((width + 15) & ~15), present(std::move(presentFn)) {
+    bufferCount = std::max(2, bufferCount);
+    for (int i = 0; i < bufferCount; ++i) {
+        buffers.emplace_back(size_t(pitch) * height);
+        freeBuffers.push_back(i);
+    }
+    thread = std::thread(&Presenter::presentMain, this);
+}
+
+Presenter::~Presenter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    queued.notify_all();
+    thread.join();
+}
+
+uint32_t* Presenter::acquire() {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (current < 0) {
+        released.wait(lock, [&] { return !freeBuffers.empty(); });
+        current = freeBuffers.back();
+        freeBuffers.pop_back();
+    }
+    return buffers[current].data();
+}
+
+void Presenter::submit() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (current < 0) return;
+        pending.push_back(current);
+        current = -1;
+    }
+    queued.notify_one();
+}
+
+void Presenter::presentMain() {
+    for (;;) {
+        int index;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            queued.wait(lock, [&] { return stopping || !pending.empty(); });
+            // drain what was submitted before shutting down
+            if (pending.empty()) return;
+            index = pending.front();
+            pending.pop_front();
+        }
+        present(buffers[index].data(), pitch * 4);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            freeBuffers.push_back(index);
+        }
+        released.notify_one();
+    }
+}
@@ -0,0 +1,967 @@
+#include "RasterKernels.h"
+#include "ShadowMap.h"
+#include "Texture.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RASTER_X86 1
+#endif
+
+// Same results as maxps / minps, NaN included (the second operand wins)
+static inline float maxf(float a, float b) { return a > b ? a : b; }
+static inline float minf(float a, float b) { return a < b ? a : b; }
+
+// Depth as format FMT stores it: the stored type, z quantized to it (clamped
+// to [0, 1] and rounded half up for the fixed-point formats), the value
+// clear() leaves, and the depth test (a nearer than b)
+template <DepthFormat FMT>
+struct DepthCodec {
+    typedef float Stored;
+    static inline Stored encode(float z) { return z; }
+    static inline Stored cleared() { return 1e9f; }
+    static inline bool nearer(Stored a, Stored b) { return a < b; }
+};
+template <>
+struct DepthCodec<DepthFormat::ReversedFloat32> {
+    typedef float Stored;
+    static inline Stored encode(float z) { return z; }
+    static inline Stored cleared() { return 0.0f; }
+    static inline bool nearer(Stored a, Stored b) { return a > b; }
+};
+template <>
+struct DepthCodec<DepthFormat::Unorm16> {
+    typedef uint16_t Stored;
+    static constexpr float SCALE = 65535.0f;
+    static inline Stored encode(float z) { return Stored(minf(maxf(z * SCALE + 0.5f, 0.0f), SCALE)); }
+    static inline Stored cleared() { return 0xFFFF; }
+    static inline bool nearer(Stored a, Stored b) { return a < b; }
+};
+template <>
+struct DepthCodec<DepthFormat::Fixed24> {
+    typedef uint32_t Stored;
+    static constexpr float SCALE = 16777215.0f;
+    static inline Stored encode(float z) { return Stored(minf(maxf(z * SCALE + 0.5f, 0.0f), SCALE)); }
+    static inline Stored cleared() { return 0xFFFFFF; }
+    static inline bool nearer(Stored a, Stored b) { return a < b; }
+};
+
+// Interpolated color channel k at x, given w there: clamped to 0-255 and
+// rounded half up
+static inline int litChannel(const RasterRow& row, int k, float x, float w) {
+    return int(minf(maxf((row.var[k] + row.dVardx[k] * x) * w, 0.0f), 255.0f) + 0.5f);
+}
+
+static constexpr bool isTextured(RowMode mode) { return mode == RowMode::Textured || mode == RowMode::TexturedShadowed; }
+static constexpr bool isShadowed(RowMode mode) { return mode == RowMode::SmoothShadowed || mode == RowMode::TexturedShadowed; }
+
+// Smooth-shaded color at x = dx + i, given w there (the inverse of the
+// interpolated 1/w): varyings times w
+static inline uint32_t shadePixel(const RasterRow& row, float x, float w) {
+    uint32_t c = 0xFF000000u;
+    for (int k = VAR_R; k <= VAR_B; ++k) c |= uint32_t(litChannel(row, k, x, w)) << (16 - 8 * k);
+    return c;
+}
+
+// Textured color at x: the texture at the perspective-correct (u, v), mip
+// level from the larger of the x and y footprints in texels (derivatives of
+// u = U / Q are (dU - u dQ) / Q), each channel scaled by the lit color as
+// (texel * (c + 1)) >> 8. Alpha is the texel's, for blending.
+static inline uint32_t texturePixel(const RasterRow& row, float x, float w) {
+    float u = (row.var[VAR_U] + row.dVardx[VAR_U] * x) * w;
+    float v = (row.var[VAR_V] + row.dVardx[VAR_V] * x) * w;
+    float texW = float(row.texture->getWidth()), texH = float(row.texture->getHeight());
+    float ax = (row.dVardx[VAR_U] - u * row.dInvWdx) * w * texW;
+    float bx = (row.dVardx[VAR_V] - v * row.dInvWdx) * w * texH;
+    float ay = (row.dVardy[VAR_U] - u * row.dInvWdy) * w * texW;
+    float by = (row.dVardy[VAR_V] - v * row.dInvWdy) * w * texH;
+    uint32_t texel = row.texture->sample(u, v, textureLod(maxf(ax * ax + bx * bx, ay * ay + by * by)));
+    uint32_t c = texel & 0xFF000000u;
+    for (int k = VAR_R; k <= VAR_B; ++k) {
+        int shift = 16 - 8 * k;
+        c |= ((((texel >> shift) & 0xFF) * uint32_t(litChannel(row, k, x, w) + 1)) >> 8) << shift;
+    }
+    return c;
+}
+
+// Color c at x with its red, green and blue scaled by the light the shadow
+// map lets through to the perspective-correct shadow-map position
+static inline uint32_t shadowPixel(const RasterRow& row, float x, float w, uint32_t c) {
+    uint32_t scale = row.shadow->light((row.var[VAR_SX] + row.dVardx[VAR_SX] * x) * w,
+                                       (row.var[VAR_SY] + row.dVardx[VAR_SY] * x) * w,
+                                       (row.var[VAR_SZ] + row.dVardx[VAR_SZ] * x) * w);
+    uint32_t out = c & 0xFF000000u;
+    for (int shift = 0; shift <= 16; shift += 8) out |= ((((c >> shift) & 0xFF) * scale) >> 8) << shift;
+    return out;
+}
+
+template <RowMode MODE>
+static inline uint32_t pixelColor(const RasterRow& row, float x) {
+    if (MODE == RowMode::Flat || MODE == RowMode::DepthOnly) return row.color;
+    float w = 1.0f / (row.invW + row.dInvWdx * x);
+    uint32_t c = isTextured(MODE) ? texturePixel(row, x, w) : shadePixel(row, x, w);
+    return isShadowed(MODE) ? shadowPixel(row, x, w, c) : c;
+}
+
+// src over dst with opacity a (0-255), all four channels: a is stretched to
+// 0-256 and each channel becomes (dst * (256 - a) + src * a + 128) >> 8, so
+// 255 keeps src exactly. Every term fits in 16 bits for the SIMD blends.
+static inline uint32_t blendPixel(uint32_t src, uint32_t dst, uint32_t a) {
+    a += a >> 7;
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t s = (src >> shift) & 0xFF, d = (dst >> shift) & 0xFF;
+        out |= ((d * (256 - a) + s * a + 128) >> 8) << shift;
+    }
+    return out;
+}
+
+// Opacity a shaded color src is blended with: the row's alpha, times the
+// texel's when textured
+template <RowMode MODE>
+static inline uint32_t srcAlpha(const RasterRow& row, uint32_t src) {
+    return isTextured(MODE) ? ((src >> 24) * (row.alpha + 1)) >> 8 : row.alpha;
+}
+
+// Pixel written over dst: opaque, or blended by srcAlpha
+template <RowMode MODE, BlendMode BLEND>
+static inline uint32_t outputPixel(const RasterRow& row, float x, uint32_t dst) {
+    uint32_t src = pixelColor<MODE>(row, x);
+    if (BLEND == BlendMode::Opaque) return src | 0xFF000000u;
+    return blendPixel(src | 0xFF000000u, dst, srcAlpha<MODE>(row, src));
+}
+
+// Scalar reference: pixels [begin, end) of the row
+template <RowMode MODE, DepthTest TEST, bool WRITE, BlendMode BLEND, DepthFormat FMT>
+static inline void fillSpanScalar(const RasterRow& row, int begin, int end, uint32_t* color,
+                                  typename DepthCodec<FMT>::Stored* depth) {
+    int64_t w0 = row.w0 + row.stepX0 * begin;
+    int64_t w1 = row.w1 + row.stepX1 * begin;
+    int64_t w2 = row.w2 + row.stepX2 * begin;
+    bool inside = false;
+    for (int i = begin; i < end; ++i) {
+        if ((w0 | w1 | w2) >= 0) {
+            inside = true;
+            float x = float(row.dx + i);
+            typename DepthCodec<FMT>::Stored z = DepthCodec<FMT>::encode(row.z + row.dzdx * x);
+            if (TEST == DepthTest::Always || DepthCodec<FMT>::nearer(z, depth[i])) {
+                if (WRITE) depth[i] = z;
+                if (MODE != RowMode::DepthOnly) color[i] = outputPixel<MODE, BLEND>(row, x, color[i]);
+            }
+        } else if (inside) {
+            return; // triangles are convex: the span on this row is done
+        }
+        w0 += row.stepX0; w1 += row.stepX1; w2 += row.stepX2;
+    }
+}
+
+template <RowMode MODE, DepthTest TEST, bool WRITE, BlendMode BLEND, DepthFormat FMT>
+static void fillRowScalar(const RasterRow& row, int count, uint32_t* color, void* depth) {
+    fillSpanScalar<MODE, TEST, WRITE, BLEND, FMT>(row, 0, count, color, static_cast<typename DepthCodec<FMT>::Stored*>(depth));
+}
+
+// Clamp [begin, end) to the pixels where one edge, at the sample that has it
+// largest, is still >= 0
+static inline void clampToEdge(int64_t w, int64_t stepX, const int64_t* offsets, int& begin, int& end) {
+    int64_t e = w + std::max(std::max(offsets[0], offsets[1]), std::max(offsets[2], offsets[3]));
+    if (stepX == 0) {
+        if (e < 0) end = begin;
+    } else if (stepX > 0) {
+        if (e < 0) begin = int(std::max<int64_t>(begin, (-e + stepX - 1) / stepX));
+    } else {
+        if (e < 0) end = begin;
+        else end = int(std::min<int64_t>(end, e / -stepX + 1));
+    }
+}
+
+// Pixels of a multisample row where some sample may be covered. A sample's
+// coverage along a row is one run, but the union of four runs can have gaps,
+// so the kernels still test every sample in between.
+static inline void multisampleSpan(const RasterRow& row, int count, int& begin, int& end) {
+    begin = 0;
+    end = count;
+    clampToEdge(row.w0, row.stepX0, row.sampleEdge[0], begin, end);
+    clampToEdge(row.w1, row.stepX1, row.sampleEdge[1], begin, end);
+    clampToEdge(row.w2, row.stepX2, row.sampleEdge[2], begin, end);
+}
+
+// Multisample reference
+template <RowMode MODE, DepthTest TEST, bool WRITE, BlendMode BLEND, DepthFormat FMT>
+static void fillRowMultisampleScalar(const RasterRow& row, int count, uint32_t* color, void* depthOut) {
+    typedef DepthCodec<FMT> Codec;
+    typename Codec::Stored* depth = static_cast<typename Codec::Stored*>(depthOut);
+    int begin, end;
+    multisampleSpan(row, count, begin, end);
+    int64_t w0 = row.w0 + row.stepX0 * begin, w1 = row.w1 + row.stepX1 * begin, w2 = row.w2 + row.stepX2 * begin;
+    color += size_t(begin) * MSAA_SAMPLES;
+    depth += size_t(begin) * MSAA_SAMPLES;
+    for (int i = begin; i < end; ++i, color += MSAA_SAMPLES, depth += MSAA_SAMPLES) {
+        unsigned pass = 0;
+        float x = float(row.dx + i);
+        float z = row.z + row.dzdx * x;
+        typename Codec::Stored sampleZ[MSAA_SAMPLES];
+        for (int s = 0; s < MSAA_SAMPLES; ++s) {
+            int64_t e0 = w0 + row.sampleEdge[0][s], e1 = w1 + row.sampleEdge[1][s], e2 = w2 + row.sampleEdge[2][s];
+            if ((e0 | e1 | e2) < 0) continue;
+            sampleZ[s] = Codec::encode(z + row.sampleZ[s]);
+            if (TEST == DepthTest::Always || Codec::nearer(sampleZ[s], depth[s])) pass |= 1u << s;
+        }
+        if (pass) {
+            uint32_t src = pixelColor<MODE>(row, x);
+            uint32_t a = srcAlpha<MODE>(row, src);
+            for (int s = 0; s < MSAA_SAMPLES; ++s) {
+                if (!(pass >> s & 1)) continue;
+                if (WRITE) depth[s] = sampleZ[s];
+                if (MODE != RowMode::DepthOnly) color[s] = BLEND == BlendMode::Opaque ? src | 0xFF000000u : blendPixel(src | 0xFF000000u, color[s], a);
+            }
+        }
+        w0 += row.stepX0; w1 += row.stepX1; w2 += row.stepX2;
+    }
+}
+
+#ifdef RASTER_X86
+
+// Lit color channels of shadePixel for 4 pixels at x (alpha left 0)
+__attribute__((target("sse2")))
+static inline __m128i shade4(const RasterRow& row, __m128 x, __m128 w) {
+    __m128i c = _mm_setzero_si128();
+    for (int k = VAR_R; k <= VAR_B; ++k) {
+        __m128 v = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(row.var[k]), _mm_mul_ps(_mm_set1_ps(row.dVardx[k]), x)), w);
+        v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+        __m128i channel = _mm_cvttps_epi32(_mm_add_ps(v, _mm_set1_ps(0.5f)));
+        c = _mm_or_si128(c, _mm_sll_epi32(channel, _mm_cvtsi32_si128(16 - 8 * k)));
+    }
+    return c;
+}
+
+// Texture lookups for 4 pixels at x, computed as texturePixel does and
+// handed to Texture::sample4; returns the unmodulated texels
+__attribute__((target("sse2")))
+static inline __m128i sampleTexture4(const RasterRow& row, __m128 x, __m128 w) {
+    const __m128 dQdx = _mm_set1_ps(row.dInvWdx), dQdy = _mm_set1_ps(row.dInvWdy);
+    __m128 u = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(row.var[VAR_U]), _mm_mul_ps(_mm_set1_ps(row.dVardx[VAR_U]), x)), w);
+    __m128 v = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(row.var[VAR_V]), _mm_mul_ps(_mm_set1_ps(row.dVardx[VAR_V]), x)), w);
+    __m128 texW = _mm_set1_ps(float(row.texture->getWidth())), texH = _mm_set1_ps(float(row.texture->getHeight()));
+    __m128 ax = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(row.dVardx[VAR_U]), _mm_mul_ps(u, dQdx)), w), texW);
+    __m128 bx = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(row.dVardx[VAR_V]), _mm_mul_ps(v, dQdx)), w), texH);
+    __m128 ay = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(row.dVardy[VAR_U]), _mm_mul_ps(u, dQdy)), w), texW);
+    __m128 by = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_set1_ps(row.dVardy[VAR_V]), _mm_mul_ps(v, dQdy)), w), texH);
+    __m128 rho2 = _mm_max_ps(_mm_add_ps(_mm_mul_ps(ax, ax), _mm_mul_ps(bx, bx)),
+                             _mm_add_ps(_mm_mul_ps(ay, ay), _mm_mul_ps(by, by)));
+    // textureLod(), 4-wide
+    __m128i lod = _mm_srai_epi32(_mm_sub_epi32(_mm_castps_si128(rho2), _mm_set1_epi32(0x3F800000)), 16);
+    alignas(16) float us[4], vs[4];
+    alignas(16) int lods[4];
+    alignas(16) uint32_t texels[4];
+    _mm_store_ps(us, u);
+    _mm_store_ps(vs, v);
+    _mm_store_si128(reinterpret_cast<__m128i*>(lods), lod);
+    row.texture->sample4(us, vs, lods, texels);
+    return _mm_load_si128(reinterpret_cast<const __m128i*>(texels));
+}
+
+// texturePixel for 4 pixels at x. Channel products fit in 16 bits, so the
+// SSE2 16-bit multiply does for the missing 32-bit one.
+__attribute__((target("sse2")))
+static inline __m128i texture4(const RasterRow& row, __m128 x, __m128 w) {
+    __m128i texel = sampleTexture4(row, x, w);
+    __m128i lit = shade4(row, x, w);
+    const __m128i mask = _mm_set1_epi32(0xFF), one = _mm_set1_epi32(1);
+    __m128i c = _mm_and_si128(texel, _mm_set1_epi32(int(0xFF000000u)));
+    for (int shift = 0; shift <= 16; shift += 8) {
+        __m128i count = _mm_cvtsi32_si128(shift);
+        __m128i t = _mm_and_si128(_mm_srl_epi32(texel, count), mask);
+        __m128i l = _mm_add_epi32(_mm_and_si128(_mm_srl_epi32(lit, count), mask), one);
+        c = _mm_or_si128(c, _mm_sll_epi32(_mm_srli_epi32(_mm_mullo_epi16(t, l), 8), count));
+    }
+    return c;
+}
+
+// shadowPixel for 4 pixels: coordinates in SSE2, map lookups by
+// ShadowMap::light4, and the channel scales as 16-bit multiplies (the
+// products fit in 16 bits)
+__attribute__((target("sse2")))
+static inline __m128i shadow4(const RasterRow& row, __m128 x, __m128 w, __m128i c) {
+    alignas(16) float coords[3][4];
+    for (int k = 0; k < 3; ++k) {
+        __m128 v = _mm_add_ps(_mm_set1_ps(row.var[VAR_SX + k]), _mm_mul_ps(_mm_set1_ps(row.dVardx[VAR_SX + k]), x));
+        _mm_store_ps(coords[k], _mm_mul_ps(v, w));
+    }
+    alignas(16) uint32_t scales[4];
+    row.shadow->light4(coords[0], coords[1], coords[2], scales);
+    __m128i scale = _mm_load_si128(reinterpret_cast<const __m128i*>(scales));
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    __m128i out = _mm_and_si128(c, _mm_set1_epi32(int(0xFF000000u)));
+    for (int shift = 0; shift <= 16; shift += 8) {
+        __m128i count = _mm_cvtsi32_si128(shift);
+        __m128i channel = _mm_and_si128(_mm_srl_epi32(c, count), mask);
+        out = _mm_or_si128(out, _mm_sll_epi32(_mm_srli_epi32(_mm_mullo_epi16(channel, scale), 8), count));
+    }
+    return out;
+}
+
+template <RowMode MODE>
+__attribute__((target("sse2")))
+static inline __m128i pixelColor4(const RasterRow& row, __m128 x, __m128i colorv) {
+    if (MODE == RowMode::Flat || MODE == RowMode::DepthOnly) return colorv;
+    __m128 w = _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_set1_ps(row.invW), _mm_mul_ps(_mm_set1_ps(row.dInvWdx), x)));
+    __m128i c = isTextured(MODE) ? texture4(row, x, w) : _mm_or_si128(shade4(row, x, w), _mm_set1_epi32(int(0xFF000000u)));
+    return isShadowed(MODE) ? shadow4(row, x, w, c) : c;
+}
+
+// blendPixel for 4 pixels, a per pixel in 32-bit lanes
+__attribute__((target("sse2")))
+static inline __m128i blend4(__m128i src, __m128i dst, __m128i a) {
+    const __m128i zero = _mm_setzero_si128();
+    a = _mm_add_epi32(a, _mm_srli_epi32(a, 7));
+    // each pixel's weight in all four of its 16-bit channels
+    __m128i a16 = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+    __m128i aLo = _mm_unpacklo_epi32(a16, a16), aHi = _mm_unpackhi_epi32(a16, a16);
+    const __m128i full = _mm_set1_epi16(256), round = _mm_set1_epi16(128);
+    __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), _mm_sub_epi16(full, aLo)),
+                                             _mm_mullo_epi16(_mm_unpacklo_epi8(src, zero), aLo)), round);
+    __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), _mm_sub_epi16(full, aHi)),
+                                             _mm_mullo_epi16(_mm_unpackhi_epi8(src, zero), aHi)), round);
+    return _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+}
+
+// outputPixel for 4 pixels
+template <RowMode MODE, BlendMode BLEND>
+__attribute__((target("sse2")))
+static inline __m128i outputPixel4(const RasterRow& row, __m128 x, __m128i colorv, __m128i dst) {
+    const __m128i opaque = _mm_set1_epi32(int(0xFF000000u));
+    __m128i src = pixelColor4<MODE>(row, x, colorv);
+    if (BLEND == BlendMode::Opaque) return _mm_or_si128(src, opaque);
+    __m128i a = _mm_set1_epi32(int(row.alpha));
+    if (isTextured(MODE))
+        a = _mm_srli_epi32(_mm_mullo_epi16(_mm_srli_epi32(src, 24), _mm_add_epi32(a, _mm_set1_epi32(1))), 8);
+    return blend4(_mm_or_si128(src, opaque), dst, a);
+}
+
+// SSE2 quantize to DepthCodec's fixed point: clamp(z * scale + 0.5, 0, scale)
+__attribute__((target("sse2")))
+static inline __m128i quantize4(__m128 z, float scale) {
+    const __m128 s = _mm_set1_ps(scale);
+    return _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(z, s), _mm_set1_ps(0.5f)), _mm_setzero_ps()), s));
+}
+
+// DepthCodec for 4 samples: encoded depths travel in 32-bit lanes (a float's
+// bits for the float formats) and nearer() gives a lane mask
+template <DepthFormat FMT>
+struct Depth4 {
+    typedef typename DepthCodec<FMT>::Stored Stored;
+    __attribute__((target("sse2"))) static inline __m128i encode(__m128 z) { return _mm_castps_si128(z); }
+    __attribute__((target("sse2"))) static inline __m128i load(const Stored* p) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    }
+    __attribute__((target("sse2"))) static inline void store(Stored* p, __m128i v) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+    }
+    __attribute__((target("sse2"))) static inline __m128i nearer(__m128i a, __m128i b) {
+        return _mm_castps_si128(FMT == DepthFormat::ReversedFloat32 ? _mm_cmpgt_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b))
+                                                                    : _mm_cmplt_ps(_mm_castsi128_ps(a), _mm_castsi128_ps(b)));
+    }
+};
+template <>
+struct Depth4<DepthFormat::Fixed24> {
+    typedef uint32_t Stored;
+    __attribute__((target("sse2"))) static inline __m128i encode(__m128 z) { return quantize4(z, DepthCodec<DepthFormat::Fixed24>::SCALE); }
+    __attribute__((target("sse2"))) static inline __m128i load(const Stored* p) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    }
+    __attribute__((target("sse2"))) static inline void store(Stored* p, __m128i v) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v);
+    }
+    __attribute__((target("sse2"))) static inline __m128i nearer(__m128i a, __m128i b) { return _mm_cmplt_epi32(a, b); }
+};
+// 16-bit samples are widened on load; SSE2 has no unsigned 32-to-16 pack, so
+// stores bias them into signed range around a saturating one
+template <>
+struct Depth4<DepthFormat::Unorm16> {
+    typedef uint16_t Stored;
+    __attribute__((target("sse2"))) static inline __m128i encode(__m128 z) { return quantize4(z, DepthCodec<DepthFormat::Unorm16>::SCALE); }
+    __attribute__((target("sse2"))) static inline __m128i load(const Stored* p) {
+        return _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), _mm_setzero_si128());
+    }
+    __attribute__((target("sse2"))) static inline void store(Stored* p, __m128i v) {
+        __m128i biased = _mm_sub_epi32(v, _mm_set1_epi32(0x8000));
+        __m128i packed = _mm_xor_si128(_mm_packs_epi32(biased, biased), _mm_set1_epi16(int16_t(0x8000)));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), packed);
+    }
+    __attribute__((target("sse2"))) static inline __m128i nearer(__m128i a, __m128i b) { return _mm_cmplt_epi32(a, b); }
+};
+
+// Multisample kernel, one pixel per step: its four samples' edge values are
+// two int64 registers per edge and their depths and colors one register each.
+// The color is shaded by the scalar code once per pixel.
+template <RowMode MODE, DepthTest TEST, bool WRITE, BlendMode BLEND, DepthFormat FMT>
+__attribute__((target("sse2")))
+static void fillRowMultisampleSSE2(const RasterRow& row, int count, uint32_t* color, void* depthOut) {
+    typedef Depth4<FMT> Depth;
+    typename Depth::Stored* depth = static_cast<typename Depth::Stored*>(depthOut);
+    int begin, end;
+    multisampleSpan(row, count, begin, end);
+    if (begin >= end) return;
+    int64_t w0 = row.w0 + row.stepX0 * begin, w1 = row.w1 + row.stepX1 * begin, w2 = row.w2 + row.stepX2 * begin;
+    __m128i w0a = _mm_set_epi64x(w0 + row.sampleEdge[0][1], w0 + row.sampleEdge[0][0]);
+    __m128i w0b = _mm_set_epi64x(w0 + row.sampleEdge[0][3], w0 + row.sampleEdge[0][2]);
+    __m128i w1a = _mm_set_epi64x(w1 + row.sampleEdge[1][1], w1 + row.sampleEdge[1][0]);
+    __m128i w1b = _mm_set_epi64x(w1 + row.sampleEdge[1][3], w1 + row.sampleEdge[1][2]);
+    __m128i w2a = _mm_set_epi64x(w2 + row.sampleEdge[2][1], w2 + row.sampleEdge[2][0]);
+    __m128i w2b = _mm_set_epi64x(w2 + row.sampleEdge[2][3], w2 + row.sampleEdge[2][2]);
+    const __m128i step0 = _mm_set1_epi64x(row.stepX0);
+    const __m128i step1 = _mm_set1_epi64x(row.stepX1);
+    const __m128i step2 = _mm_set1_epi64x(row.stepX2);
+    const __m128 sampleZ = _mm_loadu_ps(row.sampleZ);
+    const __m128i opaque = _mm_set1_epi32(int(0xFF000000u));
+
+    color += size_t(begin) * MSAA_SAMPLES;
+    depth += size_t(begin) * MSAA_SAMPLES;
+    for (int i = begin; i < end; ++i, color += MSAA_SAMPLES, depth += MSAA_SAMPLES) {
+        __m128i ea = _mm_or_si128(_mm_or_si128(w0a, w1a), w2a);
+        __m128i eb = _mm_or_si128(_mm_or_si128(w0b, w1b), w2b);
+        __m128 hi = _mm_shuffle_ps(_mm_castsi128_ps(ea), _mm_castsi128_ps(eb), _MM_SHUFFLE(3, 1, 3, 1));
+        __m128 outside = _mm_castsi128_ps(_mm_srai_epi32(_mm_castps_si128(hi), 31));
+        if (_mm_movemask_ps(outside) != 0xF) {
+            float x = float(row.dx + i);
+            __m128i z = Depth::encode(_mm_add_ps(_mm_set1_ps(row.z + row.dzdx * x), sampleZ));
+            __m128i d = Depth::load(depth);
+            __m128 pass = TEST == DepthTest::Always ? _mm_xor_ps(outside, _mm_castsi128_ps(_mm_set1_epi32(-1)))
+                                                    : _mm_andnot_ps(outside, _mm_castsi128_ps(Depth::nearer(z, d)));
+            __m128i pm = _mm_castps_si128(pass);
+            if (WRITE && _mm_movemask_ps(pass)) Depth::store(depth, _mm_or_si128(_mm_and_si128(pm, z), _mm_andnot_si128(pm, d)));
+            if (MODE != RowMode::DepthOnly && _mm_movemask_ps(pass)) {
+                __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(color));
+                uint32_t src = pixelColor<MODE>(row, x);
+                __m128i out = _mm_or_si128(_mm_set1_epi32(int(src)), opaque);
+                if (BLEND == BlendMode::Alpha) out = blend4(out, c, _mm_set1_epi32(int(srcAlpha<MODE>(row, src))));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(color), _mm_or_si128(_mm_and_si128(pm, out), _mm_andnot_si128(pm, c)));
+            }
+        }
+        w0a = _mm_add_epi64(w0a, step0); w0b = _mm_add_epi64(w0b, step0);
+        w1a = _mm_add_epi64(w1a, step1); w1b = _mm_add_epi64(w1b, step1);
+        w2a = _mm_add_epi64(w2a, step2); w2b = _mm_add_epi64(w2b, step2);
+    }
+}
+
+// 4 pixels per step. Edge values stay int64 (two per register), so coverage
+// is exact and matches the scalar path.
+template <RowMode MODE, DepthTest TEST, bool WRITE, BlendMode BLEND, DepthFormat FMT>
+__attribute__((target("sse2")))
+static void fillRowSSE2(const RasterRow& row, int count, uint32_t* color, void* depthOut) {
+    typedef Depth4<FMT> Depth;
+    typename Depth::Stored* depth = static_cast<typename Depth::Stored*>(depthOut);
+    __m128i w0a = _mm_set_epi64x(row.w0 + row.stepX0, row.w0);
+    __m128i w1a = _mm_set_epi64x(row.w1 + row.stepX1, row.w1);
+    __m128i w2a = _mm_set_epi64x(row.w2 + row.stepX2, row.w2);
+    __m128i w0b = _mm_add_epi64(w0a, _mm_set1_epi64x(row.stepX0 * 2));
+    __m128i w1b = _mm_add_epi64(w1a, _mm_set1_epi64x(row.stepX1 * 2));
+    __m128i w2b = _mm_add_epi64(w2a, _mm_set1_epi64x(row.stepX2 * 2));
+    const __m128i step0 = _mm_set1_epi64x(row.stepX0 * 4);
+    const __m128i step1 = _mm_set1_epi64x(row.stepX1 * 4);
+    const __m128i step2 = _mm_set1_epi64x(row.stepX2 * 4);
+    const __m128i lane = _mm_add_epi32(_mm_set1_epi32(row.dx), _mm_setr_epi32(0, 1, 2, 3));
+    const __m128 z0 = _mm_set1_ps(row.z);
+    const __m128 dzdx = _mm_set1_ps(row.dzdx);
+    const __m128i colorv = _mm_set1_epi32(int(row.color));
+
+    bool inside = false;
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i ea = _mm_or_si128(_mm_or_si128(w0a, w1a), w2a);
+        __m128i eb = _mm_or_si128(_mm_or_si128(w0b, w1b), w2b);
+        // high dword of each int64 lane carries the sign; spread it into a lane mask
+        __m128 hi = _mm_shuffle_ps(_mm_castsi128_ps(ea), _mm_castsi128_ps(eb), _MM_SHUFFLE(3, 1, 3, 1));
+        __m128 outside = _mm_castsi128_ps(_mm_srai_epi32(_mm_castps_si128(hi), 31));
+        if (_mm_movemask_ps(outside) == 0xF) {
+            if (inside) return;
+        } else {
+            inside = true;
+            __m128 x = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(i), lane));
+            __m128i z = Depth::encode(_mm_add_ps(z0, _mm_mul_ps(dzdx, x)));
+            __m128i d = Depth::load(depth + i);
+            __m128 inside4 = _mm_castsi128_ps(_mm_xor_si128(_mm_castps_si128(outside), _mm_set1_epi32(-1)));
+            __m128 pass = TEST == DepthTest::Always ? inside4 : _mm_andnot_ps(outside, _mm_castsi128_ps(Depth::nearer(z, d)));
+            __m128i pm = _mm_castps_si128(pass);
+            if (WRITE && _mm_movemask_ps(pass)) Depth::store(depth + i, _mm_or_si128(_mm_and_si128(pm, z), _mm_andnot_si128(pm, d)));
+            if (MODE != RowMode::DepthOnly && _mm_movemask_ps(pass)) {
+                __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(color + i));
+                __m128i src = outputPixel4<MODE, BLEND>(row, x, colorv, c);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(color + i),
+                                 _mm_or_si128(_mm_and_si128(pm, src), _mm_andnot_si128(pm, c)));
+            }
+        }
+        w0a = _mm_add_epi64(w0a, step0); w0b = _mm_add_epi64(w0b, step0);
+        w1a = _mm_add_epi64(w1a, step1); w1b = _mm_add_epi64(w1b, step1);
+        w2a = _mm_add_epi64(w2a, step2); w2b = _mm_add_epi64(w2b, step2);
+    }
+    if (i < count) fillSpanScalar<MODE, TEST, WRITE, BLEND, FMT>(row, i, count, color, depth);
+}
+
+// Texels at x times the lit color, as texturePixel
+__attribute__((target("avx2")))
+static inline __m256i modulateTexture8(const RasterRow& row, __m256 x, __m256 w, __m256i lit) {
+    const __m256i alpha = _mm256_set1_epi32(int(0xFF000000u));
+    __m256i texel = _mm256_set_m128i(sampleTexture4(row, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(w, 1)),
+                                     sampleTexture4(row, _mm256_castps256_ps128(x), _mm256_castps256_ps128(w)));
+    const __m256i mask = _mm256_set1_epi32(0xFF), one = _mm256_set1_epi32(1);
+    __m256i c = _mm256_and_si256(texel, alpha);
+    for (int shift = 0; shift <= 16; shift += 8) {
+        __m128i count = _mm_cvtsi32_si128(shift);
+        __m256i t = _mm256_and_si256(_mm256_srl_epi32(texel, count), mask);
+        __m256i l = _mm256_add_epi32(_mm256_and_si256(_mm256_srl_epi32(lit, count), mask), one);
+        c = _mm256_or_si256(c, _mm256_sll_epi32(_mm256_srli_epi32(_mm256_mullo_epi32(t, l), 8), count));
+    }
+    return c;
+}
+
+// pixelColor4 for 8 pixels at x; texture samples and shadow lookups go 4 at
+// a time
+template <RowMode MODE>
+__attribute__((target("avx2")))
+static inline __m256i pixelColor8(const RasterRow& row, __m256 x, __m256i colorv) {
+    if (MODE == RowMode::Flat || MODE == RowMode::DepthOnly) return colorv;
+    __m256 w = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_add_ps(_mm256_set1_ps(row.invW), _mm256_mul_ps(_mm256_set1_ps(row.dInvWdx), x)));
+    __m256i lit = _mm256_setzero_si256();
+    for (int k = VAR_R; k <= VAR_B; ++k) {
+        __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_set1_ps(row.var[k]), _mm256_mul_ps(_mm256_set1_ps(row.dVardx[k]), x)), w);
+        v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(255.0f));
+        __m256i channel = _mm256_cvttps_epi32(_mm256_add_ps(v, _mm256_set1_ps(0.5f)));
+        lit = _mm256_or_si256(lit, _mm256_sll_epi32(channel, _mm_cvtsi32_si128(16 - 8 * k)));
+    }
+    const __m256i alpha = _mm256_set1_epi32(int(0xFF000000u));
+    __m256i c = _mm256_or_si256(lit, alpha);
+    if (isTextured(MODE)) c = modulateTexture8(row, x, w, lit);
+    if (!isShadowed(MODE)) return c;
+    return _mm256_set_m128i(shadow4(row, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(w, 1), _mm256_extracti128_si256(c, 1)),
+                            shadow4(row, _mm256_castps256_ps128(x), _mm256_castps256_ps128(w), _mm256_castsi256_si128(c)));
+}
+
+// blend4 for 8 pixels; unpack and pack both stay within 128-bit halves, so
+// pixels keep their order
+__attribute__((target("avx2")))
+static inline __m256i blend8(__m256i src, __m256i dst, __m256i a) {
+    const __m256i zero = _mm256_setzero_si256();
+    a = _mm256_add_epi32(a, _mm256_srli_epi32(a, 7));
+    __m256i a16 = _mm256_or_si256(a, _mm256_slli_epi32(a, 16));
+    __m256i aLo = _mm256_unpacklo_epi32(a16, a16), aHi = _mm256_unpackhi_epi32(a16, a16);
+    const __m256i full = _mm256_set1_epi16(256), round = _mm256_set1_epi16(128);
+    __m256i lo = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(dst, zero), _mm256_sub_epi16(full, aLo)),
+                                                   _mm256_mullo_epi16(_mm256_unpacklo_epi8(src, zero), aLo)), round);
+    __m256i hi = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(dst, zero), _mm256_sub_epi16(full, aHi)),
+                                                   _mm256_mullo_epi16(_mm256_unpackhi_epi8(src, zero), aHi)), round);
+    return _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8));
+}
+
+// outputPixel for 8 pixels
+template <RowMode MODE, BlendMode BLEND>
+__attribute__((target("avx2")))
+static inline __m256i outputPixel8(const RasterRow& row, __m256 x, __m256i colorv, __m256i dst) {
+    const __m256i opaque = _mm256_set1_epi32(int(0xFF000000u));
+    __m256i src = pixelColor8<MODE>(row, x, colorv);
+    if (BLEND == BlendMode::Opaque) return _mm256_or_si256(src, opaque);
+    __m256i a = _mm256_set1_epi32(int(row.alpha));
+    if (isTextured(MODE))
+        a = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(src, 24), _mm256_add_epi32(a, _mm256_set1_epi32(1))), 8);
+    return blend8(_mm256_or_si256(src, opaque), dst, a);
+}
+
+// Depth4 for 8 pixels, of which the first n (at least 1) exist: loads leave
+// the others 0 and stores skip them. Stores get the stored depths alongside
+// the new ones, for formats that cannot mask their stores.
+template <DepthFormat FMT>
+struct Depth8 {
+    typedef typename DepthCodec<FMT>::Stored Stored;
+    __attribute__((target("avx2"))) static inline __m256i encode(__m256 z) { return _mm256_castps_si256(z); }
+    __attribute__((target("avx2"))) static inline __m256i load(const Stored* p, __m256i valid, int) {
+        return _mm256_castps_si256(_mm256_maskload_ps(p, valid));
+    }
+    __attribute__((target("avx2"))) static inline void store(Stored* p, __m256i pass, __m256i v, __m256i, int) {
+        _mm256_maskstore_ps(p, pass, _mm256_castsi256_ps(v));
+    }
+    __attribute__((target("avx2"))) static inline __m256i nearer(__m256i a, __m256i b) {
+        return _mm256_castps_si256(_mm256_cmp_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b),
+                                                 FMT == DepthFormat::ReversedFloat32 ? _CMP_GT_OQ : _CMP_LT_OQ));
+    }
+};
+
+__attribute__((target("avx2")))
+static inline __m256i quantize8(__m256 z, float scale) {
+    const __m256 s = _mm256_set1_ps(scale);
+    return _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(z, s), _mm256_set1_ps(0.5f)),
+                                                           _mm256_setzero_ps()), s));
+}
+
+template <>
+struct Depth8<DepthFormat::Fixed24> {
+    typedef uint32_t Stored;
+    __attribute__((target("avx2"))) static inline __m256i encode(__m256 z) { return quantize8(z, DepthCodec<DepthFormat::Fixed24>::SCALE); }
+    __attribute__((target("avx2"))) static inline __m256i load(const Stored* p, __m256i valid, int) {
+        return _mm256_maskload_epi32(reinterpret_cast<const int*>(p), valid);
+    }
+    __attribute__((target("avx2"))) static inline void store(Stored* p, __m256i pass, __m256i v, __m256i, int) {
+        _mm256_maskstore_epi32(reinterpret_cast<int*>(p), pass, v);
+    }
+    __attribute__((target("avx2"))) static inline __m256i nearer(__m256i a, __m256i b) { return _mm256_cmpgt_epi32(b, a); }
+};
+// No 16-bit masked loads or stores: the row tail goes through a buffer, and
+// stores write the blend of new and stored depths
+template <>
+struct Depth8<DepthFormat::Unorm16> {
+    typedef uint16_t Stored;
+    __attribute__((target("avx2"))) static inline __m256i encode(__m256 z) { return quantize8(z, DepthCodec<DepthFormat::Unorm16>::SCALE); }
+    __attribute__((target("avx2"))) static inline __m256i load(const Stored* p, __m256i, int n) {
+        alignas(16) uint16_t tail[8] = {};
+        if (n < 8) p = static_cast<const Stored*>(memcpy(tail, p, size_t(n) * sizeof(Stored)));
+        return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+    }
+    __attribute__((target("avx2"))) static inline void store(Stored* p, __m256i pass, __m256i v, __m256i d, int n) {
+        __m256i merged = _mm256_blendv_epi8(d, v, pass);
+        // packus works within 128-bit halves: gather its low quadwords
+        __m128i packed = _mm256_castsi256_si128(_mm256_permute4x64_epi64(_mm256_packus_epi32(merged, merged), _MM_SHUFFLE(3, 1, 2, 0)));
+        if (n >= 8) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(p), packed);
+            return;
+        }
+        alignas(16) uint16_t tail[8];
+        _mm_store_si128(reinterpret_cast<__m128i*>(tail), packed);
+        memcpy(p, tail, size_t(n) * sizeof(Stored));
+    }
+    __attribute__((target("avx2"))) static inline __m256i nearer(__m256i a, __m256i b) { return _mm256_cmpgt_epi32(b, a); }
+};
+
+// 8 pixels per step with true masked loads/stores, so the row tail needs no
+// scalar cleanup.
+template <RowMode MODE, DepthTest TEST, bool WRITE, BlendMode BLEND, DepthFormat FMT>
+__attribute__((target("avx2")))
+static void fillRowAVX2(const RasterRow& row, int count, uint32_t* color, void* depthOut) {
+    typedef Depth8<FMT> Depth;
+    typename Depth::Stored* depth = static_cast<typename Depth::Stored*>(depthOut);
+    const __m256i laneStep0 = _mm256_setr_epi64x(0, row.stepX0, row.stepX0 * 2, row.stepX0 * 3);
+    const __m256i laneStep1 = _mm256_setr_epi64x(0, row.stepX1, row.stepX1 * 2, row.stepX1 * 3);
+    const __m256i laneStep2 = _mm256_setr_epi64x(0, row.stepX2, row.stepX2 * 2, row.stepX2 * 3);
+    __m256i w0a = _mm256_add_epi64(_mm256_set1_epi64x(row.w0), laneStep0);
+    __m256i w1a = _mm256_add_epi64(_mm256_set1_epi64x(row.w1), laneStep1);
+    __m256i w2a = _mm256_add_epi64(_mm256_set1_epi64x(row.w2), laneStep2);
+    __m256i w0b = _mm256_add_epi64(w0a, _mm256_set1_epi64x(row.stepX0 * 4));
+    __m256i w1b = _mm256_add_epi64(w1a, _mm256_set1_epi64x(row.stepX1 * 4));
+    __m256i w2b = _mm256_add_epi64(w2a, _mm256_set1_epi64x(row.stepX2 * 4));
+    const __m256i step0 = _mm256_set1_epi64x(row.stepX0 * 8);
+    const __m256i step1 = _mm256_set1_epi64x(row.stepX1 * 8);
+    const __m256i step2 = _mm256_set1_epi64x(row.stepX2 * 8);
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 z0 = _mm256_set1_ps(row.z);
+    const __m256 dzdx = _mm256_set1_ps(row.dzdx);
+    const __m256i colorv = _mm256_set1_epi32(int(row.color));
+
+    bool inside = false;
+    for (int i = 0; i < count; i += 8) {
+        __m256i ea = _mm256_or_si256(_mm256_or_si256(w0a, w1a), w2a);
+        __m256i eb = _mm256_or_si256(_mm256_or_si256(w0b, w1b), w2b);
+        // shuffle_ps works per 128-bit half: gives pixels 0,1,4,5 | 2,3,6,7; permute restores order
+        __m256 hi = _mm256_shuffle_ps(_mm256_castsi256_ps(ea), _mm256_castsi256_ps(eb), _MM_SHUFFLE(3, 1, 3, 1));
+        __m256i sign = _mm256_permute4x64_epi64(_mm256_castps_si256(hi), _MM_SHUFFLE(3, 1, 2, 0));
+        __m256i idx = _mm256_add_epi32(_mm256_set1_epi32(i), lane);
+        __m256i valid = _mm256_cmpgt_epi32(_mm256_set1_epi32(count), idx);
+        __m256i zIdx = _mm256_add_epi32(idx, _mm256_set1_epi32(row.dx));
+        __m256i covered = _mm256_andnot_si256(_mm256_srai_epi32(sign, 31), valid);
+        if (_mm256_testz_si256(covered, covered)) {
+            if (inside) return;
+        } else {
+            inside = true;
+            __m256 x = _mm256_cvtepi32_ps(zIdx);
+            __m256i z = Depth::encode(_mm256_add_ps(z0, _mm256_mul_ps(dzdx, x)));
+            __m256i pass = covered, d = _mm256_setzero_si256();
+            if (TEST == DepthTest::Less || (WRITE && FMT == DepthFormat::Unorm16)) d = Depth::load(depth + i, valid, count - i);
+            if (TEST == DepthTest::Less) pass = _mm256_and_si256(covered, Depth::nearer(z, d));
+            if (WRITE && !_mm256_testz_si256(pass, pass)) Depth::store(depth + i, pass, z, d, count - i);
+            if (MODE != RowMode::DepthOnly && !_mm256_testz_si256(pass, pass)) {
+                __m256i dst = BLEND == BlendMode::Alpha ? _mm256_maskload_epi32(reinterpret_cast<const int*>(color + i), valid)
+                                                        : _mm256_setzero_si256();
+                _mm256_maskstore_epi32(reinterpret_cast<int*>(color + i), pass, outputPixel8<MODE, BLEND>(row, x, colorv, dst));
+            }
+        }
+        w0a = _mm256_add_epi64(w0a, step0); w0b = _mm256_add_epi64(w0b, step0);
+        w1a = _mm256_add_epi64(w1a, step1); w1b = _mm256_add_epi64(w1b, step1);
+        w2a = _mm256_add_epi64(w2a, step2); w2b = _mm256_add_epi64(w2b, step2);
+    }
+}
+
+// Non-temporal fill of 32-bit values: scalar up to 16-byte alignment, then
+// 64 bytes per step straight to memory.
+__attribute__((target("sse2")))
+static void streamFill32(uint32_t* p, size_t count, uint32_t value) {
+    size_t i = 0;
+    for (; i < count && (reinterpret_cast<uintptr_t>(p + i) & 15); ++i) p[i] = value;
+    const __m128i v = _mm_set1_epi32(int(value));
+    for (; i + 16 <= count; i += 16) {
+        _mm_stream_si128(reinterpret_cast<__m128i*>(p + i), v);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(p + i + 4), v);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(p + i + 8), v);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(p + i + 12), v);
+    }
+    for (; i < count; ++i) p[i] = value;
+    // order the streaming stores before whatever hands the memory on
+    _mm_sfence();
+}
+
+// streamFill32 for 16-bit values
+__attribute__((target("sse2")))
+static void streamFill16(uint16_t* p, size_t count, uint16_t value) {
+    size_t i = 0;
+    for (; i < count && (reinterpret_cast<uintptr_t>(p + i) & 15); ++i) p[i] = value;
+    const __m128i v = _mm_set1_epi16(int16_t(value));
+    for (; i + 32 <= count; i += 32) {
+        _mm_stream_si128(reinterpret_cast<__m128i*>(p + i), v);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(p + i + 8), v);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(p + i + 16), v);
+        _mm_stream_si128(reinterpret_cast<__m128i*>(p + i + 24), v);
+    }
+    for (; i < count; ++i) p[i] = value;
+    _mm_sfence();
+}
+
+// resolveSpan for 4 pixels: each register holds one pixel's samples, widened
+// to 16 bits per channel and summed
+__attribute__((target("sse2")))
+static inline __m128i resolve4(const uint32_t* samples) {
+    const __m128i zero = _mm_setzero_si128();
+    __m128i sums[4];
+    for (int p = 0; p < 4; ++p) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + p * MSAA_SAMPLES));
+        sums[p] = _mm_add_epi16(_mm_unpacklo_epi8(s, zero), _mm_unpackhi_epi8(s, zero));
+    }
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi64(sums[0], sums[1]), _mm_unpackhi_epi64(sums[0], sums[1]));
+    __m128i hi = _mm_add_epi16(_mm_unpacklo_epi64(sums[2], sums[3]), _mm_unpackhi_epi64(sums[2], sums[3]));
+    const __m128i round = _mm_set1_epi16(2);
+    return _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(lo, round), 2), _mm_srli_epi16(_mm_add_epi16(hi, round), 2));
+}
+
+#endif
+
+void resolveSpan(const uint32_t* samples, size_t count, uint32_t* color) {
+    size_t i = 0;
+#ifdef RASTER_X86
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(color + i), resolve4(samples + i * MSAA_SAMPLES));
+#endif
+    for (; i < count; ++i) {
+        const uint32_t* s = samples + i * MSAA_SAMPLES;
+        uint32_t out = 0;
+        for (int shift = 0; shift < 32; shift += 8) {
+            uint32_t sum = 2;
+            for (int k = 0; k < MSAA_SAMPLES; ++k) sum += (s[k] >> shift) & 0xFF;
+            out |= (sum >> 2) << shift;
+        }
+        color[i] = out;
+    }
+}
+
+// Same coverage and depths as the scalar kernels, sample by sample
+template <DepthFormat FMT, bool MULTISAMPLE>
+static void countRowScalar(const RasterRow& row, int count, const void* depthIn, bool always,
+                           uint64_t& tested, uint64_t& passed, uint32_t* passedPixels) {
+    typedef DepthCodec<FMT> Codec;
+    const int samples = MULTISAMPLE ? MSAA_SAMPLES : 1;
+    const typename Codec::Stored* depth = static_cast<const typename Codec::Stored*>(depthIn);
+    int64_t w0 = row.w0, w1 = row.w1, w2 = row.w2;
+    for (int i = 0; i < count; ++i, depth += samples) {
+        float z = row.z + row.dzdx * float(row.dx + i);
+        bool any = false;
+        for (int s = 0; s < samples; ++s) {
+            int64_t e0 = w0, e1 = w1, e2 = w2;
+            if (MULTISAMPLE) { e0 += row.sampleEdge[0][s]; e1 += row.sampleEdge[1][s]; e2 += row.sampleEdge[2][s]; }
+            if ((e0 | e1 | e2) < 0) continue;
+            ++tested;
+            if (always || Codec::nearer(Codec::encode(MULTISAMPLE ? z + row.sampleZ[s] : z), depth[s])) {
+                ++passed;
+                any = true;
+            }
+        }
+        if (any && passedPixels) ++passedPixels[i];
+        w0 += row.stepX0; w1 += row.stepX1; w2 += row.stepX2;
+    }
+}
+
+template <DepthFormat FMT>
+static void countRowFormat(const RasterRow& row, int count, const void* depth, bool always, bool multisample,
+                           uint64_t& tested, uint64_t& passed, uint32_t* passedPixels) {
+    if (multisample) countRowScalar<FMT, true>(row, count, depth, always, tested, passed, passedPixels);
+    else countRowScalar<FMT, false>(row, count, depth, always, tested, passed, passedPixels);
+}
+
+void countRow(const RasterRow& row, int count, const void* depth, DepthFormat format, DepthTest test,
+              bool multisample, uint64_t& tested, uint64_t& passed, uint32_t* passedPixels) {
+    bool always = test == DepthTest::Always;
+    switch (format) {
+        case DepthFormat::Unorm16:
+            countRowFormat<DepthFormat::Unorm16>(row, count, depth, always, multisample, tested, passed, passedPixels);
+            return;
+        case DepthFormat::Fixed24:
+            countRowFormat<DepthFormat::Fixed24>(row, count, depth, always, multisample, tested, passed, passedPixels);
+            return;
+        case DepthFormat::ReversedFloat32:
+            countRowFormat<DepthFormat::ReversedFloat32>(row, count, depth, always, multisample, tested, passed, passedPixels);
+            return;
+        case DepthFormat::Float32: break;
+    }
+    countRowFormat<DepthFormat::Float32>(row, count, depth, always, multisample, tested, passed, passedPixels);
+}
+
+uint32_t encodeDepth(float z, DepthFormat format) {
+    uint32_t bits;
+    switch (format) {
+        case DepthFormat::Unorm16: return DepthCodec<DepthFormat::Unorm16>::encode(z);
+        case DepthFormat::Fixed24: return DepthCodec<DepthFormat::Fixed24>::encode(z);
+        case DepthFormat::Float32: case DepthFormat::ReversedFloat32: break;
+    }
+    memcpy(&bits, &z, sizeof(bits));
+    return bits;
+}
+
+uint32_t loadDepth(const void* depth, size_t i, DepthFormat format) {
+    if (format == DepthFormat::Unorm16) return static_cast<const uint16_t*>(depth)[i];
+    return static_cast<const uint32_t*>(depth)[i];
+}
+
+void storeDepth(void* depth, size_t i, uint32_t value, DepthFormat format) {
+    if (format == DepthFormat::Unorm16) static_cast<uint16_t*>(depth)[i] = uint16_t(value);
+    else static_cast<uint32_t*>(depth)[i] = value;
+}
+
+bool depthPasses(uint32_t a, uint32_t b, DepthFormat format) {
+    if (format == DepthFormat::Unorm16 || format == DepthFormat::Fixed24) return a < b;
+    float za, zb;
+    memcpy(&za, &a, sizeof(za));
+    memcpy(&zb, &b, sizeof(zb));
+    return format == DepthFormat::ReversedFloat32 ? za > zb : za < zb;
+}
+
+// The fixed-point formats give the top of the range of z that rounds to the
+// value, so a bound taken from stored depths stays conservative
+float decodeDepth(uint32_t value, DepthFormat format) {
+    switch (format) {
+        case DepthFormat::Unorm16: return (float(value) + 0.5f) / DepthCodec<DepthFormat::Unorm16>::SCALE;
+        case DepthFormat::Fixed24: return (float(value) + 0.5f) / DepthCodec<DepthFormat::Fixed24>::SCALE;
+        case DepthFormat::Float32: case DepthFormat::ReversedFloat32: break;
+    }
+    float z;
+    memcpy(&z, &value, sizeof(z));
+    return z;
+}
+
+// The value clear() leaves, encoded like encodeDepth
+static uint32_t clearedDepth(DepthFormat format) {
+    switch (format) {
+        case DepthFormat::Unorm16: return DepthCodec<DepthFormat::Unorm16>::cleared();
+        case DepthFormat::Fixed24: return DepthCodec<DepthFormat::Fixed24>::cleared();
+        case DepthFormat::ReversedFloat32: return encodeDepth(DepthCodec<DepthFormat::ReversedFloat32>::cleared(), format);
+        case DepthFormat::Float32: break;
+    }
+    return encodeDepth(DepthCodec<DepthFormat::Float32>::cleared(), format);
+}
+
+void clearSpan(uint32_t* color, void* depth, DepthFormat format, size_t count, uint32_t colorValue, bool streaming) {
+    bool half = format == DepthFormat::Unorm16;
+    uint32_t depthValue = clearedDepth(format);
+#ifdef RASTER_X86
+    if (streaming) {
+        if (color) streamFill32(color, count, colorValue);
+        if (depth && half) streamFill16(static_cast<uint16_t*>(depth), count, uint16_t(depthValue));
+        else if (depth) streamFill32(static_cast<uint32_t*>(depth), count, depthValue);
+        return;
+    }
+#else
+    (void)streaming;
+#endif
+    if (color) std::fill(color, color + count, colorValue);
+    if (depth && half) std::fill_n(static_cast<uint16_t*>(depth), count, uint16_t(depthValue));
+    else if (depth) std::fill_n(static_cast<uint32_t*>(depth), count, depthValue);
+}
+
+SimdLevel detectSimdLevel() {
+#ifdef RASTER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse2")) return SimdLevel::SSE2;
+#endif
+    return SimdLevel::Scalar;
+}
+
+// Every (mode, pipeline state, depth format) combination of one kernel family,
+// picked at run time once per triangle; each is its own compiled loop
+template <template <RowMode, DepthTest, bool, BlendMode, DepthFormat> class Family,
+          RowMode MODE, DepthTest TEST, bool WRITE, BlendMode BLEND>
+static RowKernel pickFormat(DepthFormat format) {
+    switch (format) {
+        case DepthFormat::Unorm16: return Family<MODE, TEST, WRITE, BLEND, DepthFormat::Unorm16>::fill;
+        case DepthFormat::Fixed24: return Family<MODE, TEST, WRITE, BLEND, DepthFormat::Fixed24>::fill;
+        case DepthFormat::ReversedFloat32: return Family<MODE, TEST, WRITE, BLEND, DepthFormat::ReversedFloat32>::fill;
+        case DepthFormat::Float32: break;
+    }
+    return Family<MODE, TEST, WRITE, BLEND, DepthFormat::Float32>::fill;
+}
+
+template <template <RowMode, DepthTest, bool, BlendMode, DepthFormat> class Family, RowMode MODE, DepthTest TEST, bool WRITE>
+static RowKernel pickBlend(BlendMode blend, DepthFormat format) {
+    return blend == BlendMode::Alpha ? pickFormat<Family, MODE, TEST, WRITE, BlendMode::Alpha>(format)
+                                     : pickFormat<Family, MODE, TEST, WRITE, BlendMode::Opaque>(format);
+}
+
+template <template <RowMode, DepthTest, bool, BlendMode, DepthFormat> class Family, RowMode MODE>
+static RowKernel pickState(const PipelineState& state, DepthFormat format) {
+    if (state.depthTest == DepthTest::Always)
+        return state.depthWrite ? pickBlend<Family, MODE, DepthTest::Always, true>(state.blend, format)
+                                : pickBlend<Family, MODE, DepthTest::Always, false>(state.blend, format);
+    return state.depthWrite ? pickBlend<Family, MODE, DepthTest::Less, true>(state.blend, format)
+                            : pickBlend<Family, MODE, DepthTest::Less, false>(state.blend, format);
+}
+
+template <template <RowMode, DepthTest, bool, BlendMode, DepthFormat> class Family>
+static RowKernel pickKernel(RowMode mode, const PipelineState& state, DepthFormat format) {
+    switch (mode) {
+        case RowMode::Textured: return pickState<Family, RowMode::Textured>(state, format);
+        case RowMode::Smooth: return pickState<Family, RowMode::Smooth>(state, format);
+        case RowMode::TexturedShadowed: return pickState<Family, RowMode::TexturedShadowed>(state, format);
+        case RowMode::SmoothShadowed: return pickState<Family, RowMode::SmoothShadowed>(state, format);
+        case RowMode::DepthOnly: return pickState<Family, RowMode::DepthOnly>(state, format);
+        case RowMode::Flat: break;
+    }
+    return pickState<Family, RowMode::Flat>(state, format);
+}
+
+template <RowMode MODE, DepthTest TEST, bool WRITE, BlendMode BLEND, DepthFormat FMT>
+struct ScalarKernel { static constexpr RowKernel fill = fillRowScalar<MODE, TEST, WRITE, BLEND, FMT>; };
+template <RowMode MODE, DepthTest TEST, bool WRITE, BlendMode BLEND, DepthFormat FMT>
+struct MultisampleScalarKernel { static constexpr RowKernel fill = fillRowMultisampleScalar<MODE, TEST, WRITE, BLEND, FMT>; };
+#ifdef RASTER_X86
+template <RowMode MODE, DepthTest TEST, bool WRITE, BlendMode BLEND, DepthFormat FMT>
+struct SSE2Kernel { static constexpr RowKernel fill = fillRowSSE2<MODE, TEST, WRITE, BLEND, FMT>; };
+template <RowMode MODE, DepthTest TEST, bool WRITE, BlendMode BLEND, DepthFormat FMT>
+struct AVX2Kernel { static constexpr RowKernel fill = fillRowAVX2<MODE, TEST, WRITE, BLEND, FMT>; };
+template <RowMode MODE, DepthTest TEST, bool WRITE, BlendMode BLEND, DepthFormat FMT>
+struct MultisampleSSE2Kernel { static constexpr RowKernel fill = fillRowMultisampleSSE2<MODE, TEST, WRITE, BLEND, FMT>; };
+#endif
+
+RowKernel getRowKernel(SimdLevel level, RowMode mode, const PipelineState& state, DepthFormat format) {
+#ifdef RASTER_X86
+    switch (level) {
+        case SimdLevel::AVX2: return pickKernel<AVX2Kernel>(mode, state, format);
+        case SimdLevel::SSE2: return pickKernel<SSE2Kernel>(mode, state, format);
+        case SimdLevel::Scalar: break;
+    }
+#else
+    (void)level;
+#endif
+    return pickKernel<ScalarKernel>(mode, state, format);
+}
+
+RowKernel getMultisampleRowKernel(SimdLevel level, RowMode mode, const PipelineState& state, DepthFormat format) {
+#ifdef RASTER_X86
+    if (level != SimdLevel::Scalar) return pickKernel<MultisampleSSE2Kernel>(mode, state, format);
+#else
+    (void)level;
+#endif
+    return pickKernel<MultisampleScalarKernel>(mode, state, format);
+}
@@ -0,0 +1,353 @@
+#include "RayTracer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RAY_X86 1
+#endif
+
+// Packets are written once over GCC vector types W floats wide: the 4-wide
+// one compiles to SSE2, the 1-wide one to plain scalar code, and the AVX2
+// entry point inlines the 8-wide one into an avx2 function, which gives it
+// 256-bit registers. The helpers taking and returning 8-wide vectors are
+// static and only ever inlined there, so GCC's note that their calling
+// convention depends on AVX does not apply.
+#pragma GCC diagnostic ignored "-Wpsabi"
+template <int W> struct Lanes;
+template <> struct Lanes<1> {
+    typedef float F __attribute__((vector_size(4)));
+    typedef int32_t M __attribute__((vector_size(4)));
+};
+template <> struct Lanes<4> {
+    typedef float F __attribute__((vector_size(16)));
+    typedef int32_t M __attribute__((vector_size(16)));
+};
+template <> struct Lanes<8> {
+    typedef float F __attribute__((vector_size(32)));
+    typedef int32_t M __attribute__((vector_size(32)));
+};
+
+// Pixels per packet across and down: 4x2, 2x2 or one
+template <int W> struct PacketShape {
+    static const int X = W == 8 ? 4 : W == 4 ? 2 : 1;
+    static const int Y = W / X;
+};
+
+// Traversal stack entries: nodes past the deepest split the builder makes
+// (see SAH_MAX_DEPTH in bvh.cpp) are not possible
+static const int STACK_SIZE = 128;
+
+// Lanes of a where m is set, of b elsewhere. Single-lane vectors spell it
+// out bitwise: GCC miscompiles float ?: on them at -O2.
+template <class F, class M> static inline F select(const M& m, const F& a, const F& b) { return m ? a : b; }
+static inline Lanes<1>::F select(const Lanes<1>::M& m, const Lanes<1>::F& a, const Lanes<1>::F& b) {
+    typedef Lanes<1>::M M;
+    return (Lanes<1>::F)(((M)a & m) | ((M)b & ~m));
+}
+template <class F> static inline F vmin(const F& a, const F& b) { return select(a < b, a, b); }
+template <class F> static inline F vmax(const F& a, const F& b) { return select(a > b, a, b); }
+
+template <int W> static inline bool any(const typename Lanes<W>::M& m) {
+    int32_t bits = 0;
+    for (int i = 0; i < W; ++i) bits |= m[i];
+    return bits != 0;
+}
+
+template <int W> static inline float laneMin(const typename Lanes<W>::F& v) {
+    float r = v[0];
+    for (int i = 1; i < W; ++i) r = std::min(r, v[i]);
+    return r;
+}
+
+template <int W> static inline float laneMax(const typename Lanes<W>::F& v) {
+    float r = v[0];
+    for (int i = 1; i < W; ++i) r = std::max(r, v[i]);
+    return r;
+}
+
+// W rays. Lanes with tMax below tMin are inactive: they hit nothing.
+template <int W> struct Packet {
+    typedef typename Lanes<W>::F F;
+    F o[3], d[3], inv[3];
+    F tMin;
+};
+
+// Slab test of every ray against a node's box, up to tMax. entry receives
+// where each ray enters the box (meaningful only where it hits).
+template <int W>
+static inline typename Lanes<W>::M hitBox(const Packet<W>& p, const typename Lanes<W>::F& tMax, const BvhNode& n,
+                                          typename Lanes<W>::F& entry) {
+    typedef typename Lanes<W>::F F;
+    F near = p.tMin, far = tMax;
+    for (int k = 0; k < 3; ++k) {
+        F t0 = (n.min[k] - p.o[k]) * p.inv[k];
+        F t1 = (n.max[k] - p.o[k]) * p.inv[k];
+        near = vmax(near, vmin(t0, t1));
+        far = vmin(far, vmax(t0, t1));
+    }
+    entry = near;
+    return near <= far;
+}
+
+// Möller-Trumbore against one triangle for every ray, either side facing;
+// hits strictly between tMin and tMax. u, v are the barycentrics of the
+// second and third corners.
+template <int W>
+static inline typename Lanes<W>::M hitTriangle(const Packet<W>& p, const typename Lanes<W>::F& tMax, const BvhTriangle& tri,
+                                               typename Lanes<W>::F& t, typename Lanes<W>::F& u,
+                                               typename Lanes<W>::F& v) {
+    typedef typename Lanes<W>::F F;
+    const float* e1 = tri.e1;
+    const float* e2 = tri.e2;
+    F px = p.d[1] * e2[2] - p.d[2] * e2[1];
+    F py = p.d[2] * e2[0] - p.d[0] * e2[2];
+    F pz = p.d[0] * e2[1] - p.d[1] * e2[0];
+    F inv = 1.0f / (e1[0] * px + e1[1] * py + e1[2] * pz);   // inf (and no hit) when parallel
+    F sx = p.o[0] - tri.v0[0], sy = p.o[1] - tri.v0[1], sz = p.o[2] - tri.v0[2];
+    u = (sx * px + sy * py + sz * pz) * inv;
+    F qx = sy * e1[2] - sz * e1[1];
+    F qy = sz * e1[0] - sx * e1[2];
+    F qz = sx * e1[1] - sy * e1[0];
+    v = (p.d[0] * qx + p.d[1] * qy + p.d[2] * qz) * inv;
+    t = (e2[0] * qx + e2[1] * qy + e2[2] * qz) * inv;
+    return (u >= 0.0f) & (v >= 0.0f) & (u + v <= 1.0f) & (t > p.tMin) & (t < tMax);
+}
+
+// Nearest hit of every ray: tMax shrinks to its distance, triangle to its
+// leaf-order index (untouched where nothing is hit). Children are visited
+// nearest first and skipped once every ray has a hit in front of them.
+template <int W>
+static void closestHit(const Bvh& bvh, const Packet<W>& p, typename Lanes<W>::F& tMax, typename Lanes<W>::M& triangle,
+                       typename Lanes<W>::F& hitU, typename Lanes<W>::F& hitV) {
+    typedef typename Lanes<W>::F F;
+    typedef typename Lanes<W>::M M;
+    const BvhNode* nodes = bvh.getNodes().data();
+    const BvhTriangle* triangles = bvh.getTriangles().data();
+    struct Entry {
+        uint32_t node;
+        float entry;
+    } stack[STACK_SIZE];
+    int top = 0;
+    F entry;
+    M hit = hitBox(p, tMax, nodes[0], entry);
+    if (!any<W>(hit)) return;
+    stack[top++] = Entry{ 0, laneMin<W>(select(hit, entry, F{} + HUGE_VALF)) };
+    while (top > 0) {
+        Entry e = stack[--top];
+        if (e.entry > laneMax<W>(tMax)) continue;
+        const BvhNode& n = nodes[e.node];
+        if (n.count > 0) {
+            for (uint32_t i = n.first; i < n.first + n.count; ++i) {
+                F t, u, v;
+                M h = hitTriangle(p, tMax, triangles[i], t, u, v);
+                if (!any<W>(h)) continue;
+                tMax = select(h, t, tMax);
+                triangle = (h & int32_t(i)) | (~h & triangle);
+                hitU = select(h, u, hitU);
+                hitV = select(h, v, hitV);
+            }
+            continue;
+        }
+        F entry0, entry1;
+        M hit0 = hitBox(p, tMax, nodes[n.first], entry0);
+        M hit1 = hitBox(p, tMax, nodes[n.first + 1], entry1);
+        bool any0 = any<W>(hit0), any1 = any<W>(hit1);
+        float near0 = any0 ? laneMin<W>(select(hit0, entry0, F{} + HUGE_VALF)) : 0.0f;
+        float near1 = any1 ? laneMin<W>(select(hit1, entry1, F{} + HUGE_VALF)) : 0.0f;
+        // the nearer child goes on top
+        if (any0 && any1 && near0 > near1) {
+            stack[top++] = Entry{ n.first, near0 };
+            stack[top++] = Entry{ n.first + 1, near1 };
+        } else {
+            if (any1) stack[top++] = Entry{ n.first + 1, near1 };
+            if (any0) stack[top++] = Entry{ n.first, near0 };
+        }
+    }
+}
+
+// Which rays hit anything before their tMax; stops as soon as all have
+template <int W>
+static void anyHit(const Bvh& bvh, const Packet<W>& p, const typename Lanes<W>::F& rayMax, typename Lanes<W>::M& occluded) {
+    typedef typename Lanes<W>::F F;
+    typedef typename Lanes<W>::M M;
+    F tMax = rayMax;
+    const BvhNode* nodes = bvh.getNodes().data();
+    const BvhTriangle* triangles = bvh.getTriangles().data();
+    M active = p.tMin <= tMax;
+    occluded = M{};
+    F blocked = F{} - 1.0f;   // tMax of a ray that needs no more tests
+    uint32_t stack[STACK_SIZE];
+    int top = 0;
+    F entry;
+    if (!any<W>(hitBox(p, tMax, nodes[0], entry))) return;
+    stack[top++] = 0;
+    while (top > 0) {
+        const BvhNode& n = nodes[stack[--top]];
+        if (n.count > 0) {
+            for (uint32_t i = n.first; i < n.first + n.count; ++i) {
+                F t, u, v;
+                M h = hitTriangle(p, tMax, triangles[i], t, u, v);
+                occluded |= h;
+                tMax = select(h, blocked, tMax);
+            }
+            if (!any<W>(active & ~occluded)) return;
+            continue;
+        }
+        for (uint32_t c = n.first; c < n.first + 2; ++c) {
+            if (any<W>(hitBox(p, tMax, nodes[c], entry))) stack[top++] = c;
+        }
+    }
+}
+
+// Light reaching a normal n given in model space, as drawMesh lights it:
+// the normal taken to view space, normalized, dotted with the light
+static inline float lightFor(const RayTraceJob& job, const float* n, float* viewNormal = nullptr) {
+    float v[3];
+    for (int r = 0; r < 3; ++r) v[r] = job.normalMatrix[r][0] * n[0] + job.normalMatrix[r][1] * n[1] + job.normalMatrix[r][2] * n[2];
+    float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    if (viewNormal) std::memcpy(viewNormal, v, sizeof(v));
+    if (!(length > 0.0f)) return 0.0f;
+    return std::max(0.0f, (v[0] * job.lightView[0] + v[1] * job.lightView[1] + v[2] * job.lightView[2]) / length);
+}
+
+static inline int channel(float v) {
+    return int(std::min(std::max(v, 0.0f), 255.0f) + 0.5f);
+}
+
+template <int W>
+static RayCounts traceRectW(const RayTraceJob& job, int x0, int y0, int x1, int y1,
+                            uint32_t* color, int colorStride, void* depth, int depthStride) {
+    typedef typename Lanes<W>::F F;
+    typedef typename Lanes<W>::M M;
+    const int PX = PacketShape<W>::X, PY = PacketShape<W>::Y;
+    const Bvh& bvh = *job.bvh;
+    const BvhTriangle* triangles = bvh.getTriangles().data();
+    const uint32_t* indices = bvh.getIndices().data();
+    bool smooth = job.normals || job.vertexColors;
+    RayCounts counts;
+
+    Packet<W> primary;
+    for (int k = 0; k < 3; ++k) primary.o[k] = F{} + job.origin[k];
+    primary.tMin = F{} + job.tNear;
+    Packet<W> shadow;
+    shadow.tMin = F{};
+    for (int k = 0; k < 3; ++k) shadow.o[k] = F{};
+    for (int k = 0; k < 3; ++k) {
+        // never exactly 0, so the slab test sees +-inf and not NaN
+        float d = job.lightModel[k];
+        if (std::fabs(d) < 1e-20f) d = 1e-20f;
+        shadow.d[k] = F{} + d;
+        shadow.inv[k] = F{} + 1.0f / d;
+    }
+
+    for (int py = y0; py <= y1; py += PY) {
+        for (int px = x0; px <= x1; px += PX) {
+            F tMax;
+            for (int i = 0; i < W; ++i) {
+                int x = px + i % PX, y = py + i / PX;
+                bool inside = x <= x1 && y <= y1;
+                tMax[i] = inside ? job.tFar : -1.0f;
+                counts.primary += inside;
+                for (int k = 0; k < 3; ++k) {
+                    float d = job.dirBase[k] + job.dirDx[k] * float(x) + job.dirDy[k] * float(y);
+                    if (std::fabs(d) < 1e-20f) d = 1e-20f;
+                    primary.d[k][i] = d;
+                    primary.inv[k][i] = 1.0f / d;
+                }
+            }
+            M triangle = M{} - 1;
+            F u = F{}, v = F{};
+            closestHit(bvh, primary, tMax, triangle, u, v);
+
+            // Shade every lane that hit and passes the depth test; lanes
+            // facing the light also get a shadow ray from the hit point
+            float rgb[W][3];
+            uint32_t stored[W] = {};
+            F shadowMax = F{} - 1.0f;
+            bool anyShadow = false;
+            for (int i = 0; i < W; ++i) {
+                if (triangle[i] < 0) continue;
+                int x = px + i % PX, y = py + i / PX;
+                float t = tMax[i];
+                stored[i] = encodeDepth(job.depthScale + job.depthOffset / t, job.depthFormat);
+                if (!depthPasses(stored[i], loadDepth(depth, size_t(y) * depthStride + x, job.depthFormat), job.depthFormat)) {
+                    triangle[i] = -1;
+                    continue;
+                }
+                const BvhTriangle& tri = triangles[triangle[i]];
+                float n[3] = { tri.e1[1] * tri.e2[2] - tri.e1[2] * tri.e2[1],
+                               tri.e1[2] * tri.e2[0] - tri.e1[0] * tri.e2[2],
+                               tri.e1[0] * tri.e2[1] - tri.e1[1] * tri.e2[0] };
+                float brightness = lightFor(job, n);
+                bool lit = brightness > 0.0f;
+                if (smooth) {
+                    const uint32_t* corner = indices + 3 * size_t(triangle[i]);
+                    float weight[3] = { 1.0f - u[i] - v[i], u[i], v[i] };
+                    rgb[i][0] = rgb[i][1] = rgb[i][2] = 0.0f;
+                    for (int k = 0; k < 3; ++k) {
+                        uint32_t c = job.vertexColors ? job.vertexColors[corner[k]] : job.colors ? job.colors[tri.index] : 0xFFFFFFu;
+                        float light = brightness;
+                        if (job.normals) {
+                            const Vector3D& vn = job.normals[corner[k]];
+                            const float normal[3] = { vn.x, vn.y, vn.z };
+                            light = lightFor(job, normal);
+                        }
+                        for (int ch = 0; ch < 3; ++ch) rgb[i][ch] += weight[k] * float((c >> (16 - 8 * ch)) & 0xFF) * light;
+                    }
+                } else {
+                    uint32_t c = job.colors[tri.index];
+                    for (int ch = 0; ch < 3; ++ch) rgb[i][ch] = float((c >> (16 - 8 * ch)) & 0xFF) * brightness;
+                }
+                if (!job.shadows) continue;
+                if (!lit) {
+                    // facing away from the light: it shadows itself
+                    if (smooth) for (int ch = 0; ch < 3; ++ch) rgb[i][ch] *= job.shadowScale;
+                    continue;
+                }
+                // start just off the surface, on the light's side
+                float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                float side = n[0] * job.lightModel[0] + n[1] * job.lightModel[1] + n[2] * job.lightModel[2];
+                float offset = (side > 0.0f ? job.shadowOffset : -job.shadowOffset) / length;
+                for (int k = 0; k < 3; ++k) shadow.o[k][i] = primary.o[k][i] + primary.d[k][i] * t + n[k] * offset;
+                shadowMax[i] = HUGE_VALF;
+                anyShadow = true;
+                ++counts.shadow;
+            }
+            if (anyShadow) {
+                M blocked;
+                anyHit(bvh, shadow, shadowMax, blocked);
+                for (int i = 0; i < W; ++i) {
+                    if (!blocked[i]) continue;
+                    for (int ch = 0; ch < 3; ++ch) rgb[i][ch] *= job.shadowScale;
+                }
+            }
+            for (int i = 0; i < W; ++i) {
+                if (triangle[i] < 0) continue;
+                int x = px + i % PX, y = py + i / PX;
+                color[size_t(y) * colorStride + x] = 0xFF000000u | uint32_t(channel(rgb[i][0])) << 16 |
+                                                    uint32_t(channel(rgb[i][1])) << 8 | uint32_t(channel(rgb[i][2]));
+                storeDepth(depth, size_t(y) * depthStride + x, stored[i], job.depthFormat);
+                ++counts.written;
+            }
+        }
+    }
+    return counts;
+}
+
+#ifdef RAY_X86
+__attribute__((target("avx2"), flatten))
+static RayCounts traceRectAvx2(const RayTraceJob& job, int x0, int y0, int x1, int y1,
+                               uint32_t* color, int colorStride, void* depth, int depthStride) {
+    return traceRectW<8>(job, x0, y0, x1, y1, color, colorStride, depth, depthStride);
+}
+#endif
+
+RayCounts traceRect(const RayTraceJob& job, int x0, int y0, int x1, int y1,
+                    uint32_t* color, int colorStride, void* depth, int depthStride) {
+#ifdef RAY_X86
+    if (job.simd == SimdLevel::AVX2) return traceRectAvx2(job, x0, y0, x1, y1, color, colorStride, depth, depthStride);
+#endif
+    if (job.simd != SimdLevel::Scalar) return traceRectW<4>(job, x0, y0, x1, y1, color, colorStride, depth, depthStride);
+    return traceRectW<1>(job, x0, y0, x1, y1, color, colorStride, depth, depthStride);
+}
@@ -1,8 +1,24 @@
 #include "Renderer.h"
+#include "Bvh.h"
+#include "Clipper.h"
+#include "RayTracer.h"
+#include "ThreadPool.h"
 #include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <cstring>
 #include <cstdint>
+#include <cstdlib>
+
+// Hierarchical-Z block size in pixels (tiles are a multiple of it)
+static const int HIZ_BLOCK = 8;
+// Incremental mode tracks changes in cells this many pixels square outside
+// tiled mode (whole HiZ blocks); tiled mode uses the tiles
+static const int DIRTY_CELL = 32;
+
+static inline double nowMs() {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 // pack RGB * brightness into 0xAARRGGBB (alpha = 0xFF)
 static inline uint32_t packColor(unsigned char r, unsigned char g, unsigned char b, float brightness) {
@@ -16,62 +32,1811 @@ static inline uint32_t packColor(unsigned char r, unsigned char g, unsigned char
 }
 
 Renderer::Renderer(int w, int h) : width(w), height(h) {
-    buffer = new uint32_t[width * height];
-    zbuffer.resize(width * height, 1e9f);
+    setSimdLevel(detectSimdLevel());
+    setFieldOfView(90.0f);
+    setLightDirection(Vector3D(0, 0, -1));
+    ownBuffer = new uint32_t[width * height];
+    buffer = ownBuffer;
+    stride = width;
+    targets.push_back(TargetState{ buffer, stride, std::vector<TileColor>(), std::vector<RecordedDraw>(), 0, false });
+    allocateDepth();
+    blocksX = (width + HIZ_BLOCK - 1) / HIZ_BLOCK;
+    blocksY = (height + HIZ_BLOCK - 1) / HIZ_BLOCK;
+    hizMin.resize(size_t(blocksX) * blocksY, 1e9f);
+    hizMax.resize(size_t(blocksX) * blocksY, 1e9f);
+    resetCells();
+    presentedRects.assign(1, ScreenRect{ 0, 0, width - 1, height - 1 });
     clear(0,0,0);
 }
 Renderer::~Renderer() {
-    delete[] buffer;
+    delete[] ownBuffer;
 }
 
+// Index of a pipeline state's kernels in Renderer::kernels
+static inline int pipelineKey(const PipelineState& s) {
+    return (s.depthTest == DepthTest::Always) << 2 | s.depthWrite << 1 | (s.blend == BlendMode::Alpha);
+}
+
+void Renderer::setSimdLevel(SimdLevel level) {
+    simd = std::min(level, detectSimdLevel());
+    for (int mode = 0; mode < ROW_MODE_COUNT; ++mode) {
+        for (int key = 0; key < 8; ++key) {
+            PipelineState state;
+            state.depthTest = key & 4 ? DepthTest::Always : DepthTest::Less;
+            state.depthWrite = (key & 2) != 0;
+            state.blend = key & 1 ? BlendMode::Alpha : BlendMode::Opaque;
+            kernels[mode][pipelineKey(state)] = getRowKernel(simd, RowMode(mode), state, depthFormat);
+            multisampleKernels[mode][pipelineKey(state)] = getMultisampleRowKernel(simd, RowMode(mode), state, depthFormat);
+        }
+    }
+}
+
+// Fast-clear state is kept for this many targets, enough for the internal
+// buffer plus a triple-buffered swapchain.
+static const size_t MAX_TARGETS = 4;
+
+void Renderer::setTarget(uint32_t* pixels, int pitchBytes, bool contentsKept) {
+    flush();
+    if (!pixels) {
+        pixels = ownBuffer;
+        pitchBytes = width * 4;
+    }
+    buffer = pixels;
+    stride = pitchBytes / 4;
+
+    auto it = std::find_if(targets.begin(), targets.end(), [&](const TargetState& t) { return t.pixels == pixels; });
+    TargetState target = { pixels, stride, std::vector<TileColor>(), std::vector<RecordedDraw>(), 0, false };
+    if (it != targets.end()) {
+        if (contentsKept && it->stride == stride) {
+            target.tiles.swap(it->tiles);
+            target.shown.swap(it->shown);
+            target.shownClear = it->shownClear;
+            target.shownValid = it->shownValid;
+        }
+        targets.erase(it);
+    }
+    if (tiled && target.tiles.empty()) target.tiles.assign(size_t(tilesX) * tilesY, TileColor{ 0, false });
+    targets.insert(targets.begin(), std::move(target));
+    if (targets.size() > MAX_TARGETS) targets.resize(MAX_TARGETS);
+}
+
+// Whole-frame clears stream past the cache once the buffers are too big to
+// stay cached until the triangles arrive.
+static const size_t STREAMING_CLEAR_BYTES = size_t(8) << 20;
+
 void Renderer::clear(unsigned char r, unsigned char g, unsigned char b) {
+    if (!transparent.empty()) flush();
     uint32_t color = packColor(r,g,b,1.0f);
-    for (int i = 0; i < width * height; ++i) buffer[i] = color;
+    if (incremental) {
+        beginIncrementalFrame(color);
+        return;
+    }
+    if (tiled) {
+        // deferred to flush(), which clears in parallel before rasterizing
+        if (!triangles.empty()) flush();
+        colorClearPending = true;
+        clearColor = color;
+        return;
+    }
+    double start = nowMs();
+    size_t count = size_t(width) * height;
+    bool streaming = count * 4 * samples >= STREAMING_CLEAR_BYTES;
+    if (stride == width) clearSpan(buffer, nullptr, depthFormat, count, color, streaming);
+    else for (int y = 0; y < height; ++y) clearSpan(buffer + size_t(y) * stride, nullptr, depthFormat, width, color, streaming);
+    if (samples > 1) clearSpan(sampleColor.data(), nullptr, depthFormat, count * samples, color, streaming);
+    timings.clear += nowMs() - start;
 }
 
 void Renderer::clearZ() {
-    std::fill(zbuffer.begin(), zbuffer.end(), 1e9f);
+    if (incremental) return;   // depth is cleared with the color, cell by cell
+    if (!transparent.empty()) flush();
+    if (tiled) {
+        if (!triangles.empty()) flush();
+        depthClearPending = true;
+        return;
+    }
+    double start = nowMs();
+    size_t count = size_t(width) * height * samples;
+    clearSpan(nullptr, zbuffer.data(), depthFormat, count, 0, count * depthBytes(depthFormat) >= STREAMING_CLEAR_BYTES);
+    resetHiZRect(0, 0, width - 1, height - 1);
+    timings.clear += nowMs() - start;
+}
+
+void Renderer::clearColorAndDepth(unsigned char r, unsigned char g, unsigned char b) {
+    if (!transparent.empty()) flush();
+    if (tiled || incremental) {
+        clear(r,g,b);
+        clearZ();
+        return;
+    }
+    double start = nowMs();
+    uint32_t color = packColor(r,g,b,1.0f);
+    size_t count = size_t(width) * height;
+    bool streaming = count * (4 + depthBytes(depthFormat)) * samples >= STREAMING_CLEAR_BYTES;
+    if (samples > 1) {
+        // samples and their depths side by side, then the target
+        clearSpan(sampleColor.data(), zbuffer.data(), depthFormat, count * samples, color, streaming);
+        if (stride == width) clearSpan(buffer, nullptr, depthFormat, count, color, streaming);
+        else for (int y = 0; y < height; ++y) clearSpan(buffer + size_t(y) * stride, nullptr, depthFormat, width, color, streaming);
+    }
+    else if (stride == width) clearSpan(buffer, zbuffer.data(), depthFormat, count, color, streaming);
+    else for (int y = 0; y < height; ++y) clearSpan(buffer + size_t(y) * stride, depthAt(size_t(y) * width), depthFormat, width, color, streaming);
+    resetHiZRect(0, 0, width - 1, height - 1);
+    timings.clear += nowMs() - start;
+}
+
+void Renderer::resetHiZRect(int x0, int y0, int x1, int y1) {
+    int bx0 = x0 / HIZ_BLOCK, bx1 = x1 / HIZ_BLOCK;
+    for (int by = y0 / HIZ_BLOCK; by <= y1 / HIZ_BLOCK; ++by) {
+        size_t row = size_t(by) * blocksX;
+        std::fill(hizMin.begin() + row + bx0, hizMin.begin() + row + bx1 + 1, 1e9f);
+        std::fill(hizMax.begin() + row + bx0, hizMax.begin() + row + bx1 + 1, 1e9f);
+    }
+}
+
+void Renderer::updateHiZRect(int x0, int y0, int x1, int y1) {
+    for (int by = y0 / HIZ_BLOCK; by <= y1 / HIZ_BLOCK; ++by) {
+        int py0 = by * HIZ_BLOCK, py1 = std::min(py0 + HIZ_BLOCK, height);
+        for (int bx = x0 / HIZ_BLOCK; bx <= x1 / HIZ_BLOCK; ++bx) {
+            int px0 = bx * HIZ_BLOCK, px1 = std::min(px0 + HIZ_BLOCK, width);
+            float nearest = 1e9f, farthest = -1e9f;
+            for (int y = py0; y < py1; ++y) {
+                for (int x = px0; x < px1; ++x) {
+                    float z = depthSign * decodeDepth(loadDepth(zbuffer.data(), size_t(y) * width + x, depthFormat), depthFormat);
+                    nearest = std::min(nearest, z);
+                    farthest = std::max(farthest, z);
+                }
+            }
+            hizMin[size_t(by) * blocksX + bx] = nearest;
+            hizMax[size_t(by) * blocksX + bx] = farthest;
+        }
+    }
+}
+
+HiZStats Renderer::getHiZStats() const {
+    HiZStats stats;
+    stats.blocksRejected = hizBlocksRejected;
+    stats.trianglesRejected = hizTrianglesRejected;
+    return stats;
+}
+
+void Renderer::resetHiZStats() {
+    hizBlocksRejected = 0;
+    hizTrianglesRejected = 0;
 }
 
 void Renderer::setPixel(int x, int y, float z, unsigned char r, unsigned char g, unsigned char b) {
     if (x < 0 || x >= width || y < 0 || y >= height) return;
-    int idx = y * width + x;
-    if (z < zbuffer[idx]) {
-        zbuffer[idx] = z;
-        buffer[idx] = packColor(r,g,b,1.0f);
+    if (incremental && !replaying) {
+        RecordedDraw& d = recordDraw(DrawKind::Pixel);
+        d.vertices[0].x = float(x); d.vertices[0].y = float(y); d.vertices[0].z = z;
+        d.vertices[0].r = r; d.vertices[0].g = g; d.vertices[0].b = b;
+        return;
+    }
+    if (replaying && !touchesDirty(x, y, x, y)) return;
+    flush();
+    // every sample of the pixel sits at depth z
+    size_t idx = (size_t(y) * width + x) * samples;
+    uint32_t color = packColor(r,g,b,1.0f);
+    uint32_t stored = encodeDepth(z, depthFormat);
+    bool wrote = false;
+    for (int s = 0; s < samples; ++s) {
+        if (!depthPasses(stored, loadDepth(zbuffer.data(), idx + s, depthFormat), depthFormat)) continue;
+        storeDepth(zbuffer.data(), idx + s, stored, depthFormat);
+        if (samples > 1) sampleColor[idx + s] = color;
+        wrote = true;
+    }
+    if (wrote) {
+        if (samples > 1) resolveSpan(&sampleColor[idx], 1, buffer + size_t(y) * stride + x);
+        else buffer[size_t(y) * stride + x] = color;
+        float& nearest = hizMin[size_t(y / HIZ_BLOCK) * blocksX + x / HIZ_BLOCK];
+        nearest = std::min(nearest, depthSign * z);
+        if (tiled) {
+            size_t tile = size_t(y / tileSize) * tilesX + x / tileSize;
+            targets[0].tiles[tile].clean = false;
+            tileDepthClean[tile] = false;
+            sampleTiles[tile].clean = false;
+        }
+    }
+}
+
+// Sub-pixel precision of the rasterizer: vertices snap to 1/256 pixel.
+static const int SUBPIXEL_BITS = 8;
+static const int64_t SUBPIXEL_ONE = int64_t(1) << SUBPIXEL_BITS;
+static const int64_t SUBPIXEL_HALF = SUBPIXEL_ONE >> 1;
+// Vertices beyond this many pixels from the origin are rejected; keeps the
+// fixed-point edge products comfortably inside int64.
+static const float MAX_COORD = float(1 << 21);
+
+// 4x multisample pattern: sample offsets from the pixel center in 1/16
+// pixel, a rotated grid so near-horizontal and near-vertical edges both see
+// four distinct sample rows / columns
+static const int SAMPLE_X[MSAA_SAMPLES] = { -2, 6, -6, 2 };
+static const int SAMPLE_Y[MSAA_SAMPLES] = { -6, -2, 2, 6 };
+// Farthest a sample lies from its pixel center along x or y, in subpixels
+static const int64_t SAMPLE_REACH = 6 * SUBPIXEL_ONE / 16;
+
+// Change of an edge value from the pixel center to sample s (exact: steps are
+// whole multiples of SUBPIXEL_ONE)
+static inline int64_t sampleEdgeOffset(int64_t stepX, int64_t stepY, int s) {
+    return (stepX * SAMPLE_X[s] + stepY * SAMPLE_Y[s]) / 16;
+}
+
+// Bound on |sampleEdgeOffset| over every sample
+static inline int64_t sampleEdgeReach(int64_t stepX, int64_t stepY) {
+    return (std::abs(stepX) + std::abs(stepY)) * 6 / 16;
+}
+
+static inline int64_t toFixed(float v) {
+    return static_cast<int64_t>(std::llround(double(v) * SUBPIXEL_ONE));
+}
+
+// Edge function E(x,y) = a*x + b*y + c over fixed-point coordinates. E > 0 is
+// inside for the canonical winding; bias folds in the top-left fill rule so
+// coverage is simply E + bias >= 0.
+struct Edge {
+    int64_t a, b, c;
+    int64_t bias;
+};
+
+static inline Edge makeEdge(int64_t ax, int64_t ay, int64_t bx, int64_t by) {
+    Edge e;
+    e.a = ay - by;
+    e.b = bx - ax;
+    e.c = -(e.a * ax + e.b * ay);
+    // y points down: a "left" edge has a > 0, a "top" edge is horizontal with b > 0
+    bool topLeft = e.a > 0 || (e.a == 0 && e.b > 0);
+    e.bias = topLeft ? 0 : -1;
+    return e;
+}
+
+// Plane through per-vertex values q0, q1, q2 (v1 and v2 in canonical winding),
+// anchored at t's first pixel; set up once in double
+static inline void setupPlane(double q0, double q1, double q2, const TriangleSetup& t,
+                              const Edge& e1, const Edge& e2, double invArea,
+                              float& at, float& ddx, float& ddy) {
+    double dq1 = q1 - q0, dq2 = q2 - q0;
+    at = float(q0 + (dq1 * double(t.w1 - e1.bias) + dq2 * double(t.w2 - e2.bias)) * invArea);
+    ddx = float((dq1 * double(t.stepX1) + dq2 * double(t.stepX2)) * invArea);
+    ddy = float((dq1 * double(t.stepY1) + dq2 * double(t.stepY2)) * invArea);
+}
+
+// Triangle setup for the fixed-point edge-function rasterizer. Returns false
+// if the triangle is degenerate or its bounds hold no pixel center (no sample
+// when multisampling) on screen.
+bool Renderer::setupTriangle(
+    float x0,float y0,float z0,
+    float x1,float y1,float z1,
+    float x2,float y2,float z2,
+    uint32_t color, TriangleSetup& t,
+    const VertexVaryings* varyings,
+    const Texture* tex,
+    const ShadowMap* shadow
+) const {
+    // also rejects NaN
+    if (!(std::fabs(x0) < MAX_COORD && std::fabs(y0) < MAX_COORD &&
+          std::fabs(x1) < MAX_COORD && std::fabs(y1) < MAX_COORD &&
+          std::fabs(x2) < MAX_COORD && std::fabs(y2) < MAX_COORD)) return false;
+
+    int64_t fx0 = toFixed(x0), fy0 = toFixed(y0);
+    int64_t fx1 = toFixed(x1), fy1 = toFixed(y1);
+    int64_t fx2 = toFixed(x2), fy2 = toFixed(y2);
+
+    // Twice the signed area; flip to the canonical (positive) winding
+    int64_t area = (fx1 - fx0) * (fy2 - fy0) - (fy1 - fy0) * (fx2 - fx0);
+    if (area == 0) return false;
+    int v1 = 1, v2 = 2;
+    if (area < 0) {
+        std::swap(fx1, fx2); std::swap(fy1, fy2); std::swap(z1, z2);
+        std::swap(v1, v2);
+        area = -area;
+    }
+
+    // Bounding box of covered pixel centers (or samples), clamped to the screen
+    int64_t reach = samples > 1 ? SAMPLE_REACH : 0;
+    int64_t loX = std::min({fx0, fx1, fx2}) - reach, hiX = std::max({fx0, fx1, fx2}) + reach;
+    int64_t loY = std::min({fy0, fy1, fy2}) - reach, hiY = std::max({fy0, fy1, fy2}) + reach;
+    t.minX = int(std::max<int64_t>(0, -((SUBPIXEL_HALF - loX) >> SUBPIXEL_BITS)));
+    t.maxX = int(std::min<int64_t>(width - 1, (hiX - SUBPIXEL_HALF) >> SUBPIXEL_BITS));
+    t.minY = int(std::max<int64_t>(0, -((SUBPIXEL_HALF - loY) >> SUBPIXEL_BITS)));
+    t.maxY = int(std::min<int64_t>(height - 1, (hiY - SUBPIXEL_HALF) >> SUBPIXEL_BITS));
+    if (t.minX > t.maxX || t.minY > t.maxY) return false;
+
+    // e0 is opposite v0 (its weight), e1 opposite v1, e2 opposite v2
+    Edge e0 = makeEdge(fx1, fy1, fx2, fy2);
+    Edge e1 = makeEdge(fx2, fy2, fx0, fy0);
+    Edge e2 = makeEdge(fx0, fy0, fx1, fy1);
+
+    // Edge values at the center of the first pixel, and per-pixel / per-row steps
+    int64_t px = int64_t(t.minX) * SUBPIXEL_ONE + SUBPIXEL_HALF;
+    int64_t py = int64_t(t.minY) * SUBPIXEL_ONE + SUBPIXEL_HALF;
+    t.w0 = e0.a * px + e0.b * py + e0.c + e0.bias;
+    t.w1 = e1.a * px + e1.b * py + e1.c + e1.bias;
+    t.w2 = e2.a * px + e2.b * py + e2.c + e2.bias;
+    t.stepX0 = e0.a * SUBPIXEL_ONE; t.stepY0 = e0.b * SUBPIXEL_ONE;
+    t.stepX1 = e1.a * SUBPIXEL_ONE; t.stepY1 = e1.b * SUBPIXEL_ONE;
+    t.stepX2 = e2.a * SUBPIXEL_ONE; t.stepY2 = e2.b * SUBPIXEL_ONE;
+
+    // Depth plane z(x,y) anchored at the first pixel, then the smooth-shading planes
+    double invArea = 1.0 / double(area);
+    setupPlane(z0, z1, z2, t, e1, e2, invArea, t.z, t.dzdx, t.dzdy);
+    t.color = color;
+    t.state = pipeline;
+    t.smooth = varyings != nullptr;
+    t.texture = varyings ? tex : nullptr;
+    t.shadow = varyings ? shadow : nullptr;
+    if (varyings) {
+        const VertexVaryings& a = varyings[0];
+        const VertexVaryings& b = varyings[v1];
+        const VertexVaryings& c = varyings[v2];
+        setupPlane(a.invW, b.invW, c.invW, t, e1, e2, invArea, t.invW, t.dInvWdx, t.dInvWdy);
+        for (int k = 0, n = varyingCount(t.texture, t.shadow); k < n; ++k)
+            setupPlane(a.var[k], b.var[k], c.var[k], t, e1, e2, invArea, t.var[k], t.dVardx[k], t.dVardy[k]);
+    }
+    return true;
+}
+
+// Depth of t's plane at pixel (x,y), rounded exactly as the row kernels do.
+// Float add/multiply are monotonic, so over a rect the extremes sit at corners.
+static inline float planeZ(const TriangleSetup& t, int x, int y) {
+    return (t.z + t.dzdy * float(y - t.minY)) + t.dzdx * float(x - t.minX);
+}
+
+// Edge value of t at pixel (x,y)
+static inline int64_t edgeAt(int64_t w, int64_t stepX, int64_t stepY, const TriangleSetup& t, int x, int y) {
+    return w + stepX * (x - t.minX) + stepY * (y - t.minY);
+}
+
+void Renderer::rasterTriangle(const TriangleSetup& t, int x0, int y0, int x1, int y1) {
+    x0 = std::max(x0, t.minX); x1 = std::min(x1, t.maxX);
+    y0 = std::max(y0, t.minY); y1 = std::min(y1, t.maxY);
+    if (x0 > x1 || y0 > y1) return;
+    if (!hizEnabled || (t.state.depthTest == DepthTest::Always && !t.state.depthWrite)) {
+        rasterRect(t, x0, y0, x1, y1);
+        return;
+    }
+
+    // Samples sit up to 6/16 pixel from the centers the bounds are taken at:
+    // widen depths by half a pixel's worth of slope (plus an ulp for the
+    // rounding of the sample offset) and require coverage that far inside
+    // Bounds are taken times depthSign, like the HiZ ones (negation is exact)
+    float dzdx = depthSign * t.dzdx, dzdy = depthSign * t.dzdy;
+    bool multisample = samples > 1;
+    float zReach = multisample ? (std::fabs(dzdx) + std::fabs(dzdy)) * 0.5f : 0.0f;
+    auto lowZ = [&](int x, int y) {
+        float z = depthSign * planeZ(t, x, y);
+        return multisample ? std::nextafter(z - zReach, -HUGE_VALF) : z;
+    };
+    auto highZ = [&](int x, int y) {
+        float z = depthSign * planeZ(t, x, y);
+        return multisample ? std::nextafter(z + zReach, HUGE_VALF) : z;
+    };
+    int64_t reach0 = multisample ? sampleEdgeReach(t.stepX0, t.stepY0) : 0;
+    int64_t reach1 = multisample ? sampleEdgeReach(t.stepX1, t.stepY1) : 0;
+    int64_t reach2 = multisample ? sampleEdgeReach(t.stepX2, t.stepY2) : 0;
+    if (t.state.depthTest == DepthTest::Always) {
+        // writes depth without testing it, so stored depths may grow: widen
+        // each block's bounds to the plane's range over the block instead
+        for (int by0 = y0 - y0 % HIZ_BLOCK; by0 <= y1; by0 += HIZ_BLOCK) {
+            int ry0 = std::max(by0, y0), ry1 = std::min(by0 + HIZ_BLOCK - 1, y1);
+            for (int bx0 = x0 - x0 % HIZ_BLOCK; bx0 <= x1; bx0 += HIZ_BLOCK) {
+                int rx0 = std::max(bx0, x0), rx1 = std::min(bx0 + HIZ_BLOCK - 1, x1);
+                size_t b = size_t(by0 / HIZ_BLOCK) * blocksX + bx0 / HIZ_BLOCK;
+                hizMin[b] = std::min(hizMin[b], lowZ(dzdx >= 0 ? rx0 : rx1, dzdy >= 0 ? ry0 : ry1));
+                hizMax[b] = std::max(hizMax[b], highZ(dzdx >= 0 ? rx1 : rx0, dzdy >= 0 ? ry1 : ry0));
+            }
+        }
+        rasterRect(t, x0, y0, x1, y1);
+        return;
+    }
+    bool writes = t.state.depthWrite;
+
+    uint64_t rejected = 0;
+    bool drew = false;
+    auto flushRun = [&](int& runX0, int runX1, int ry0, int ry1) {
+        if (runX0 < 0) return;
+        rasterRect(t, runX0, ry0, runX1, ry1);
+        drew = true;
+        runX0 = -1;
+    };
+    for (int by0 = y0 - y0 % HIZ_BLOCK; by0 <= y1; by0 += HIZ_BLOCK) {
+        int ry0 = std::max(by0, y0), ry1 = std::min(by0 + HIZ_BLOCK - 1, y1);
+        int blockRow = by0 / HIZ_BLOCK;
+        int fullY1 = std::min(by0 + HIZ_BLOCK, height) - 1;
+        int runX0 = -1, runX1 = -1;  // run of accepted blocks on this block row
+        for (int bx0 = x0 - x0 % HIZ_BLOCK; bx0 <= x1; bx0 += HIZ_BLOCK) {
+            int rx0 = std::max(bx0, x0), rx1 = std::min(bx0 + HIZ_BLOCK - 1, x1);
+            size_t b = size_t(blockRow) * blocksX + bx0 / HIZ_BLOCK;
+            float zNear = lowZ(dzdx >= 0 ? rx0 : rx1, dzdy >= 0 ? ry0 : ry1);
+            if (zNear >= hizMax[b]) {
+                ++rejected;  // nothing here can pass the depth test
+                flushRun(runX0, runX1, ry0, ry1);
+            } else {
+                if (writes) {
+                    hizMin[b] = std::min(hizMin[b], zNear);
+                    // If the triangle covers every pixel of the block, no stored
+                    // depth there can stay above the triangle's farthest depth
+                    int fullX1 = std::min(bx0 + HIZ_BLOCK, width) - 1;
+                    if (bx0 >= t.minX && by0 >= t.minY && fullX1 <= t.maxX && fullY1 <= t.maxY &&
+                        edgeAt(t.w0, t.stepX0, t.stepY0, t, t.stepX0 > 0 ? bx0 : fullX1, t.stepY0 > 0 ? by0 : fullY1) >= reach0 &&
+                        edgeAt(t.w1, t.stepX1, t.stepY1, t, t.stepX1 > 0 ? bx0 : fullX1, t.stepY1 > 0 ? by0 : fullY1) >= reach1 &&
+                        edgeAt(t.w2, t.stepX2, t.stepY2, t, t.stepX2 > 0 ? bx0 : fullX1, t.stepY2 > 0 ? by0 : fullY1) >= reach2) {
+                        float zFar = highZ(dzdx >= 0 ? fullX1 : bx0, dzdy >= 0 ? fullY1 : by0);
+                        hizMax[b] = std::min(hizMax[b], zFar);
+                    }
+                }
+                if (runX0 < 0) runX0 = rx0;
+                runX1 = rx1;
+            }
+        }
+        flushRun(runX0, runX1, ry0, ry1);
+    }
+    if (rejected) {
+        hizBlocksRejected += rejected;
+        if (!drew) ++hizTrianglesRejected;
+    }
+}
+
+// Edge values are stepped incrementally per row here and per pixel in the
+// row kernel (scalar, SSE2 or AVX2); no divides in the inner loop.
+template <bool COUNT>
+void Renderer::rasterRows(const TriangleSetup& t, int x0, int y0, int x1, int y1, PixelStats* cell) {
+    RasterRow row;
+    row.stepX0 = t.stepX0; row.stepX1 = t.stepX1; row.stepX2 = t.stepX2;
+    row.dzdx = t.dzdx;
+    row.dx = x0 - t.minX;
+    row.color = t.color;
+
+    int64_t dy = y0 - t.minY;
+    int64_t w0Row = t.w0 + t.stepX0 * row.dx + t.stepY0 * dy;
+    int64_t w1Row = t.w1 + t.stepX1 * row.dx + t.stepY1 * dy;
+    int64_t w2Row = t.w2 + t.stepX2 * row.dx + t.stepY2 * dy;
+
+    RowMode mode = depthOnly ? RowMode::DepthOnly
+                 : t.shadow ? (t.texture ? RowMode::TexturedShadowed : RowMode::SmoothShadowed)
+                 : t.texture ? RowMode::Textured : t.smooth ? RowMode::Smooth : RowMode::Flat;
+    bool multisample = samples > 1;
+    RowKernel kernel = (multisample ? multisampleKernels : kernels)[int(mode)][pipelineKey(t.state)];
+    if (multisample) {
+        for (int s = 0; s < MSAA_SAMPLES; ++s) {
+            row.sampleEdge[0][s] = sampleEdgeOffset(t.stepX0, t.stepY0, s);
+            row.sampleEdge[1][s] = sampleEdgeOffset(t.stepX1, t.stepY1, s);
+            row.sampleEdge[2][s] = sampleEdgeOffset(t.stepX2, t.stepY2, s);
+            row.sampleZ[s] = t.dzdx * (float(SAMPLE_X[s]) / 16.0f) + t.dzdy * (float(SAMPLE_Y[s]) / 16.0f);
+        }
+    }
+    row.alpha = t.state.alpha;
+    int varyings = varyingCount(t.texture, t.shadow);
+    if (t.smooth) {
+        row.texture = t.texture;
+        row.shadow = t.shadow;
+        row.dInvWdx = t.dInvWdx; row.dInvWdy = t.dInvWdy;
+        for (int k = 0; k < varyings; ++k) {
+            row.dVardx[k] = t.dVardx[k];
+            row.dVardy[k] = t.dVardy[k];
+        }
+    }
+
+    int count = x1 - x0 + 1;
+    bool writes = mode != RowMode::DepthOnly || t.state.depthWrite;
+    for (int y = y0; y <= y1; ++y) {
+        row.w0 = w0Row; row.w1 = w1Row; row.w2 = w2Row;
+        float dy = float(y - t.minY);
+        row.z = t.z + t.dzdy * dy;
+        if (t.smooth) {
+            row.invW = t.invW + t.dInvWdy * dy;
+            for (int k = 0; k < varyings; ++k) row.var[k] = t.var[k] + t.dVardy[k] * dy;
+        }
+        size_t first = (size_t(y) * width + x0) * samples;
+        if (COUNT) {
+            uint64_t passed = 0;
+            countRow(row, count, depthAt(first), depthFormat, t.state.depthTest, multisample, cell->tested, passed,
+                     writes ? &overdraw[size_t(y) * width + x0] : nullptr);
+            cell->passed += passed;
+            if (writes) cell->written += passed;
+        }
+        else if (multisample) kernel(row, count, sampleColor.data() + first, depthAt(first));
+        else kernel(row, count, buffer + size_t(y) * stride + x0, depthAt(first));
+        w0Row += t.stepY0; w1Row += t.stepY1; w2Row += t.stepY2;
+    }
+}
+
+void Renderer::rasterRect(const TriangleSetup& t, int x0, int y0, int x1, int y1) {
+    if (!counting()) {
+        rasterRows<false>(t, x0, y0, x1, y1, nullptr);
+        return;
+    }
+    // Count before the kernels change the depths; time only the kernels. A
+    // cell's sub-span of a row gets the same depths as the whole row.
+    for (int cy = y0 / dirtyCell; cy <= y1 / dirtyCell; ++cy) {
+        int ry0 = std::max(y0, cy * dirtyCell), ry1 = std::min(y1, cy * dirtyCell + dirtyCell - 1);
+        for (int cx = x0 / dirtyCell; cx <= x1 / dirtyCell; ++cx) {
+            int rx0 = std::max(x0, cx * dirtyCell), rx1 = std::min(x1, cx * dirtyCell + dirtyCell - 1);
+            PixelStats& cell = cellStats[size_t(cy) * cellsX + cx];
+            rasterRows<true>(t, rx0, ry0, rx1, ry1, &cell);
+            double start = nowMs();
+            rasterRows<false>(t, rx0, ry0, rx1, ry1, &cell);
+            cell.ms += nowMs() - start;
+        }
     }
 }
 
-// Simple barycentric triangle rasterizer (flat brightness)
 void Renderer::drawTriangle(
-    int x0,int y0,float z0,
-    int x1,int y1,float z1,
-    int x2,int y2,float z2,
+    float x0,float y0,float z0,
+    float x1,float y1,float z1,
+    float x2,float y2,float z2,
     unsigned char r,unsigned char g,unsigned char b,
     float brightness
 ) {
-    int minX = std::max(0, std::min({x0, x1, x2}));
-    int maxX = std::min(width - 1, std::max({x0, x1, x2}));
-    int minY = std::max(0, std::min({y0, y1, y2}));
-    int maxY = std::min(height - 1, std::max({y0, y1, y2}));
-
-    // Compute denominator for barycentric coordinates
-    float denom = float((y1 - y2) * (x0 - x2) + (x2 - x1) * (y0 - y2));
-    if (std::fabs(denom) < 1e-6f) return;
-
-    for (int y = minY; y <= maxY; ++y) {
-        for (int x = minX; x <= maxX; ++x) {
-            float w0 = float((y1 - y2) * (x - x2) + (x2 - x1) * (y - y2)) / denom;
-            float w1 = float((y2 - y0) * (x - x2) + (x0 - x2) * (y - y2)) / denom;
-            float w2 = 1.0f - w0 - w1;
-            if (w0 >= 0.0f && w1 >= 0.0f && w2 >= 0.0f) {
-                float z = w0 * z0 + w1 * z1 + w2 * z2;
-                int idx = y * width + x;
-                if (z < zbuffer[idx]) {
-                    zbuffer[idx] = z;
-                    buffer[idx] = packColor(r, g, b, brightness);
+    if (incremental && !replaying) {
+        RecordedDraw& d = recordDraw(DrawKind::FlatTriangle);
+        const float corners[3][3] = { { x0, y0, z0 }, { x1, y1, z1 }, { x2, y2, z2 } };
+        for (int k = 0; k < 3; ++k) {
+            d.vertices[k].x = corners[k][0]; d.vertices[k].y = corners[k][1]; d.vertices[k].z = corners[k][2];
+        }
+        d.vertices[0].r = r; d.vertices[0].g = g; d.vertices[0].b = b;
+        d.vertices[0].u = brightness;
+        return;
+    }
+    if (counting()) ++stats.trianglesSubmitted;
+    TriangleSetup t;
+    if (!setupTriangle(x0,y0,z0, x1,y1,z1, x2,y2,z2, packColor(r,g,b,brightness), t)) return;
+    submitTriangle(t);
+}
+
+void Renderer::drawTriangle(const ShadedVertex& v0, const ShadedVertex& v1, const ShadedVertex& v2) {
+    if (incremental && !replaying) {
+        RecordedDraw& d = recordDraw(DrawKind::ShadedTriangle);
+        d.vertices[0] = v0; d.vertices[1] = v1; d.vertices[2] = v2;
+        return;
+    }
+    if (counting()) ++stats.trianglesSubmitted;
+    VertexVaryings varyings[3];
+    const ShadedVertex* v[3] = { &v0, &v1, &v2 };
+    for (int k = 0; k < 3; ++k) {
+        float invW = 1.0f / v[k]->w;
+        varyings[k] = { invW, { v[k]->r * invW, v[k]->g * invW, v[k]->b * invW, v[k]->u * invW, v[k]->v * invW } };
+    }
+    TriangleSetup t;
+    if (!setupTriangle(v0.x,v0.y,v0.z, v1.x,v1.y,v1.z, v2.x,v2.y,v2.z, 0, t, varyings, texture)) return;
+    submitTriangle(t);
+}
+
+// --- Mesh submission ---
+
+// Triangles are only clipped against the sides once they reach this many
+// pixels beyond the viewport; the rasterizer handles the rest with its
+// fixed-point edge functions.
+static const float GUARD_BAND_PIXELS = 4096.0f;
+
+void Renderer::setFieldOfView(float degrees) {
+    fieldOfView = degrees;
+    // reversed Z: the near plane maps to 1 and the far one to 0
+    bool reversed = depthFormat == DepthFormat::ReversedFloat32;
+    projection = Matrix4x4::perspective(degrees * 3.14159265358979323846f / 180.0f,
+                                        float(width) / float(height), reversed ? farZ : nearZ, reversed ? nearZ : farZ);
+}
+
+void Renderer::setDepthRange(float zNear, float zFar) {
+    nearZ = zNear;
+    farZ = zFar;
+    setFieldOfView(fieldOfView);
+}
+
+void Renderer::setLightDirection(const Vector3D& dir) {
+    lightDir = dir.normalize();
+}
+
+void Renderer::submitTriangle(const TriangleSetup& t) {
+    if (replaying && !touchesDirty(t.minX, t.minY, t.maxX, t.maxY)) return;
+    if (counting()) ++stats.trianglesRasterized;
+    if (sortTransparent && t.state.blend == BlendMode::Alpha) queueTransparent(t);
+    else if (tiled) binTriangle(t);
+    else drawImmediate(t);
+}
+
+void Renderer::drawImmediate(const TriangleSetup& t) {
+    if (replaying) {
+        for (const ScreenRect& r : dirtyRects) rasterTriangle(t, r.x0, r.y0, r.x1, r.y1);
+    }
+    else rasterTriangle(t, 0, 0, width - 1, height - 1);
+    if (samples == 1) return;
+    if (resolveX0 > resolveX1) {
+        resolveX0 = t.minX; resolveY0 = t.minY;
+        resolveX1 = t.maxX; resolveY1 = t.maxY;
+        return;
+    }
+    resolveX0 = std::min(resolveX0, t.minX); resolveY0 = std::min(resolveY0, t.minY);
+    resolveX1 = std::max(resolveX1, t.maxX); resolveY1 = std::max(resolveY1, t.maxY);
+}
+
+// Normals go through the cofactor matrix (det * inverse transpose) of the
+// upper 3x3, which keeps them perpendicular under any scale and facing the
+// same way as drawMesh's face normals
+static void normalMatrix(const Matrix4x4& modelView, float cof[3][3]) {
+    const float (*m)[4] = modelView.m;
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            cof[r][c] = m[(r + 1) % 3][(c + 1) % 3] * m[(r + 2) % 3][(c + 2) % 3] -
+                        m[(r + 1) % 3][(c + 2) % 3] * m[(r + 2) % 3][(c + 1) % 3];
+        }
+    }
+}
+
+void Renderer::transformVertices(const Vector3D* positions, size_t vertexCount, const Matrix4x4& modelView,
+                                 const VertexAttributes& attributes) {
+    // Transform every vertex once: view space, then clip space
+    viewX.resize(vertexCount); viewY.resize(vertexCount); viewZ.resize(vertexCount);
+    clipX.resize(vertexCount); clipY.resize(vertexCount); clipZ.resize(vertexCount); clipW.resize(vertexCount);
+    screenX.resize(vertexCount); screenY.resize(vertexCount); screenZ.resize(vertexCount);
+    frustumCodes.resize(vertexCount); guardCodes.resize(vertexCount);
+    modelView.transformPoints(positions, vertexCount, viewX.data(), viewY.data(), viewZ.data());
+    (projection * modelView).transformPoints(positions, vertexCount, clipX.data(), clipY.data(), clipZ.data(), clipW.data());
+
+    float halfW = width * 0.5f, halfH = height * 0.5f;
+    float guardX = 1.0f + GUARD_BAND_PIXELS / halfW;
+    float guardY = 1.0f + GUARD_BAND_PIXELS / halfH;
+    for (size_t i = 0; i < vertexCount; ++i) {
+        ClipVertex v = { clipX[i], clipY[i], clipZ[i], clipW[i] };
+        frustumCodes[i] = clipOutcode(v, 1.0f, 1.0f);
+        guardCodes[i] = clipOutcode(v, guardX, guardY);
+        if (guardCodes[i]) continue;  // projected after clipping instead
+        float inv = 1.0f / v.w;
+        screenX[i] = (v.x * inv + 1.0f) * halfW;
+        screenY[i] = (v.y * inv + 1.0f) * halfH;
+        screenZ[i] = v.z * inv;
+    }
+
+    if (shadowed) {
+        shadowX.resize(vertexCount); shadowY.resize(vertexCount); shadowZ.resize(vertexCount);
+        (shadowMatrix * modelView).transformPoints(positions, vertexCount, shadowX.data(), shadowY.data(), shadowZ.data());
+    }
+    if (!attributes.normals || depthOnly) return;
+    float cof[3][3];
+    normalMatrix(modelView, cof);
+    vertexLight.resize(vertexCount);
+    for (size_t i = 0; i < vertexCount; ++i) {
+        const Vector3D& n = attributes.normals[i];
+        Vector3D viewNormal(cof[0][0] * n.x + cof[0][1] * n.y + cof[0][2] * n.z,
+                            cof[1][0] * n.x + cof[1][1] * n.y + cof[1][2] * n.z,
+                            cof[2][0] * n.x + cof[2][1] * n.y + cof[2][2] * n.z);
+        vertexLight[i] = std::max(0.0f, viewNormal.normalize().dot(lightDir));
+    }
+}
+
+void Renderer::submitTriangles(const uint32_t* indices, const uint32_t* colors, size_t first, size_t count,
+                               const VertexAttributes& attributes) {
+    const Texture* tex = attributes.uvs ? texture : nullptr;
+    bool smooth = attributes.normals || attributes.colors || tex || shadowed;
+    float halfW = width * 0.5f, halfH = height * 0.5f;
+    float guardX = 1.0f + GUARD_BAND_PIXELS / halfW;
+    float guardY = 1.0f + GUARD_BAND_PIXELS / halfH;
+    if (counting()) stats.trianglesSubmitted += count;
+    for (size_t t = first; t < first + count; ++t) {
+        uint32_t i0 = indices[3 * t], i1 = indices[3 * t + 1], i2 = indices[3 * t + 2];
+        // all three vertices outside the same frustum plane
+        if (frustumCodes[i0] & frustumCodes[i1] & frustumCodes[i2]) {
+            if (counting()) ++stats.trianglesCulled;
+            continue;
+        }
+
+        // depth-only draws only need the face normal to cull
+        Vector3D v0(viewX[i0], viewY[i0], viewZ[i0]);
+        Vector3D normal;
+        if (!depthOnly || cullMode != CullMode::None)
+            normal = (Vector3D(viewX[i1], viewY[i1], viewZ[i1]) - v0).cross(Vector3D(viewX[i2], viewY[i2], viewZ[i2]) - v0);
+        if (cullMode != CullMode::None) {
+            // the camera sits at the origin, so v0 is the view ray
+            float facing = normal.dot(v0);
+            if (cullMode == CullMode::Back ? facing >= 0.0f : facing <= 0.0f) {
+                if (counting()) ++stats.trianglesCulled;
+                continue;
+            }
+        }
+        uint8_t crossing = guardCodes[i0] | guardCodes[i1] | guardCodes[i2];
+        uint32_t color = 0;
+        if (!depthOnly) {
+            float brightness = std::max(0.0f, normal.normalize().dot(lightDir));
+            if (smooth) {
+                submitSmooth(t, i0, i1, i2, colors, brightness, crossing, attributes, tex);
+                continue;
+            }
+            uint32_t c = colors[t];
+            color = packColor((c >> 16) & 0xFF, (c >> 8) & 0xFF, c & 0xFF, brightness);
+        }
+
+        TriangleSetup setup;
+        if (!crossing) {
+            if (setupTriangle(screenX[i0], screenY[i0], screenZ[i0],
+                              screenX[i1], screenY[i1], screenZ[i1],
+                              screenX[i2], screenY[i2], screenZ[i2], color, setup)) submitTriangle(setup);
+            continue;
+        }
+
+        // Crosses the near/far plane or leaves the guard band: clip, then fan
+        ClipVertex poly[MAX_CLIP_VERTICES] = {
+            { clipX[i0], clipY[i0], clipZ[i0], clipW[i0] },
+            { clipX[i1], clipY[i1], clipZ[i1], clipW[i1] },
+            { clipX[i2], clipY[i2], clipZ[i2], clipW[i2] }
+        };
+        int n = clipPolygon(poly, 3, crossing, guardX, guardY);
+        float sx[MAX_CLIP_VERTICES], sy[MAX_CLIP_VERTICES], sz[MAX_CLIP_VERTICES];
+        for (int k = 0; k < n; ++k) {
+            float inv = 1.0f / poly[k].w;
+            sx[k] = (poly[k].x * inv + 1.0f) * halfW;
+            sy[k] = (poly[k].y * inv + 1.0f) * halfH;
+            sz[k] = poly[k].z * inv;
+        }
+        for (int k = 1; k + 1 < n; ++k) {
+            if (setupTriangle(sx[0], sy[0], sz[0], sx[k], sy[k], sz[k],
+                              sx[k + 1], sy[k + 1], sz[k + 1], color, setup)) submitTriangle(setup);
+        }
+    }
+}
+
+// Smooth path of submitTriangles: lit corner colors (and uvs when textured,
+// shadow-map positions when shadowed) become varyings over 1/w. Clipped
+// vertices rebuild theirs from barycentrics carried through the clipper.
+// Textured meshes without colors are white.
+void Renderer::submitSmooth(size_t t, uint32_t i0, uint32_t i1, uint32_t i2, const uint32_t* colors,
+                            float faceBrightness, uint8_t crossing, const VertexAttributes& attributes,
+                            const Texture* tex) {
+    uint32_t idx[3] = { i0, i1, i2 };
+    const ShadowMap* shadow = shadowed ? &shadowMap : nullptr;
+    int varyings = varyingCount(tex, shadow);
+    float corner[3][MAX_VARYINGS];
+    for (int k = 0; k < 3; ++k) {
+        uint32_t c = attributes.colors ? attributes.colors[idx[k]] : colors ? colors[t] : 0xFFFFFFu;
+        float light = attributes.normals ? vertexLight[idx[k]] : faceBrightness;
+        corner[k][VAR_R] = float((c >> 16) & 0xFF) * light;
+        corner[k][VAR_G] = float((c >> 8) & 0xFF) * light;
+        corner[k][VAR_B] = float(c & 0xFF) * light;
+        corner[k][VAR_U] = tex ? attributes.uvs[2 * idx[k]] : 0.0f;
+        corner[k][VAR_V] = tex ? attributes.uvs[2 * idx[k] + 1] : 0.0f;
+        if (shadow) {
+            corner[k][VAR_SX] = shadowX[idx[k]];
+            corner[k][VAR_SY] = shadowY[idx[k]];
+            corner[k][VAR_SZ] = shadowZ[idx[k]];
+        }
+    }
+
+    TriangleSetup setup;
+    VertexVaryings vertices[MAX_CLIP_VERTICES];
+    if (!crossing) {
+        for (int k = 0; k < 3; ++k) {
+            vertices[k].invW = 1.0f / clipW[idx[k]];
+            for (int a = 0; a < varyings; ++a) vertices[k].var[a] = corner[k][a] * vertices[k].invW;
+        }
+        if (setupTriangle(screenX[i0], screenY[i0], screenZ[i0],
+                          screenX[i1], screenY[i1], screenZ[i1],
+                          screenX[i2], screenY[i2], screenZ[i2], 0, setup, vertices, tex, shadow)) submitTriangle(setup);
+        return;
+    }
+
+    float halfW = width * 0.5f, halfH = height * 0.5f;
+    float guardX = 1.0f + GUARD_BAND_PIXELS / halfW;
+    float guardY = 1.0f + GUARD_BAND_PIXELS / halfH;
+    ClipVertex poly[MAX_CLIP_VERTICES] = {
+        { clipX[i0], clipY[i0], clipZ[i0], clipW[i0] },
+        { clipX[i1], clipY[i1], clipZ[i1], clipW[i1] },
+        { clipX[i2], clipY[i2], clipZ[i2], clipW[i2] }
+    };
+    float bary[MAX_CLIP_VERTICES][2] = { { 0, 0 }, { 1, 0 }, { 0, 1 } };
+    int n = clipPolygon(poly, 3, crossing, guardX, guardY, bary);
+    float sx[MAX_CLIP_VERTICES], sy[MAX_CLIP_VERTICES], sz[MAX_CLIP_VERTICES];
+    for (int k = 0; k < n; ++k) {
+        float inv = 1.0f / poly[k].w;
+        sx[k] = (poly[k].x * inv + 1.0f) * halfW;
+        sy[k] = (poly[k].y * inv + 1.0f) * halfH;
+        sz[k] = poly[k].z * inv;
+        vertices[k].invW = inv;
+        for (int a = 0; a < varyings; ++a) {
+            float value = corner[0][a] + (corner[1][a] - corner[0][a]) * bary[k][0] + (corner[2][a] - corner[0][a]) * bary[k][1];
+            vertices[k].var[a] = value * inv;
+        }
+    }
+    for (int k = 1; k + 1 < n; ++k) {
+        VertexVaryings fan[3] = { vertices[0], vertices[k], vertices[k + 1] };
+        if (setupTriangle(sx[0], sy[0], sz[0], sx[k], sy[k], sz[k],
+                          sx[k + 1], sy[k + 1], sz[k + 1], 0, setup, fan, tex, shadow)) submitTriangle(setup);
+    }
+}
+
+void Renderer::drawMesh(const Vector3D* positions, size_t vertexCount,
+                        const uint32_t* indices, size_t triangleCount,
+                        const uint32_t* colors, const Matrix4x4& modelView,
+                        const VertexAttributes& attributes) {
+    double start = nowMs();
+    if (shadowPass) {
+        shadowRenderer->drawMesh(positions, vertexCount, indices, triangleCount, colors, lightView * modelView);
+        timings.shadow += nowMs() - start;
+        return;
+    }
+    if (incremental && !replaying) {
+        RecordedDraw& d = recordDraw(DrawKind::Mesh);
+        d.positions = positions; d.vertexCount = vertexCount;
+        d.indices = indices; d.triangleCount = triangleCount;
+        d.colors = colors; d.modelView = modelView; d.attributes = attributes;
+        return;
+    }
+    transformVertices(positions, vertexCount, modelView, attributes);
+    double transformed = nowMs();
+    timings.transform += transformed - start;
+    submitTriangles(indices, colors, 0, triangleCount, attributes);
+    (tiled ? timings.setup : timings.raster) += nowMs() - transformed;
+}
+
+// View-space frustum planes (a, b, c, d), inside where a x + b y + c z + d >= 0:
+// clip-space -w <= x, y <= w and 0 <= z <= w pulled back through the projection
+void Renderer::frustumPlanes(float planes[6][4]) const {
+    const float (*p)[4] = projection.m;
+    for (int k = 0; k < 4; ++k) {
+        planes[0][k] = p[3][k] + p[0][k];
+        planes[1][k] = p[3][k] - p[0][k];
+        planes[2][k] = p[3][k] + p[1][k];
+        planes[3][k] = p[3][k] - p[1][k];
+        planes[4][k] = p[2][k];
+        planes[5][k] = p[3][k] - p[2][k];
+    }
+    for (int i = 0; i < 6; ++i) {
+        float* plane = planes[i];
+        float len = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        if (len > 0.0f) for (int k = 0; k < 4; ++k) plane[k] /= len;
+    }
+}
+
+void Renderer::drawMesh(const Vector3D* positions, size_t vertexCount,
+                        const uint32_t* indices, const uint32_t* colors,
+                        const Meshlet* meshlets, size_t meshletCount, const Matrix4x4& modelView,
+                        const VertexAttributes& attributes) {
+    double start = nowMs();
+    if (shadowPass) {
+        shadowRenderer->drawMesh(positions, vertexCount, indices, colors, meshlets, meshletCount, lightView * modelView);
+        timings.shadow += nowMs() - start;
+        return;
+    }
+    if (incremental && !replaying) {
+        RecordedDraw& d = recordDraw(DrawKind::MeshletMesh);
+        d.positions = positions; d.vertexCount = vertexCount;
+        d.indices = indices; d.colors = colors;
+        d.meshlets = meshlets; d.meshletCount = meshletCount;
+        d.modelView = modelView; d.attributes = attributes;
+        return;
+    }
+    transformVertices(positions, vertexCount, modelView, attributes);
+    double transformed = nowMs();
+    timings.transform += transformed - start;
+
+    float planes[6][4];
+    frustumPlanes(planes);
+
+    // Spheres grow by the largest axis scale. Normals only keep their
+    // direction under a uniform scale (times -1 when modelView mirrors).
+    const float (*m)[4] = modelView.m;
+    Vector3D axes[3];
+    for (int c = 0; c < 3; ++c) axes[c] = Vector3D(m[0][c], m[1][c], m[2][c]);
+    float scales[3] = { axes[0].magnitude(), axes[1].magnitude(), axes[2].magnitude() };
+    float scale = std::max(scales[0], std::max(scales[1], scales[2]));
+    float minScale = std::min(scales[0], std::min(scales[1], scales[2]));
+    bool conformal = minScale > 0.0f && scale - minScale <= 1e-4f * scale &&
+                     std::fabs(axes[0].dot(axes[1])) <= 1e-4f * scale * scale &&
+                     std::fabs(axes[0].dot(axes[2])) <= 1e-4f * scale * scale &&
+                     std::fabs(axes[1].dot(axes[2])) <= 1e-4f * scale * scale;
+    float orientation = axes[0].cross(axes[1]).dot(axes[2]) < 0.0f ? -1.0f : 1.0f;
+    if (cullMode == CullMode::Front) orientation = -orientation;
+    bool coneTest = conformal && cullMode != CullMode::None;
+
+    for (size_t i = 0; i < meshletCount; ++i) {
+        const Meshlet& ml = meshlets[i];
+        ++clusterStats.meshletsTested;
+        Vector3D center = modelView.transform(Vector3D(ml.center[0], ml.center[1], ml.center[2]));
+        float radius = ml.radius * scale;
+        bool outside = false;
+        for (const float* plane : planes) {
+            if (plane[0] * center.x + plane[1] * center.y + plane[2] * center.z + plane[3] < -radius) {
+                outside = true;
+                break;
+            }
+        }
+        if (outside) {
+            ++clusterStats.frustumCulled;
+            if (counting()) {
+                stats.trianglesSubmitted += ml.triangleCount;
+                stats.trianglesCulled += ml.triangleCount;
+            }
+            continue;
+        }
+
+        // Back-facing everywhere when no normal in the cone (half-angle theta)
+        // comes within 90 degrees of a ray towards the sphere, which spans
+        // asin(radius / distance) around the center direction (angle phi off
+        // the axis): distance * cos(theta + phi) >= radius.
+        if (coneTest && ml.coneCutoff > 0.0f) {
+            Vector3D axis = Vector3D(m[0][0] * ml.coneAxis[0] + m[0][1] * ml.coneAxis[1] + m[0][2] * ml.coneAxis[2],
+                                     m[1][0] * ml.coneAxis[0] + m[1][1] * ml.coneAxis[1] + m[1][2] * ml.coneAxis[2],
+                                     m[2][0] * ml.coneAxis[0] + m[2][1] * ml.coneAxis[1] + m[2][2] * ml.coneAxis[2]).normalize() * orientation;
+            float distance = center.magnitude();
+            if (distance > radius) {
+                float cosPhi = axis.dot(center) / distance;
+                float sinPhi = std::sqrt(std::max(0.0f, 1.0f - cosPhi * cosPhi));
+                float cosTheta = ml.coneCutoff;
+                float sinTheta = std::sqrt(std::max(0.0f, 1.0f - cosTheta * cosTheta));
+                if (distance * (cosPhi * cosTheta - sinPhi * sinTheta) >= radius) {
+                    ++clusterStats.backfaceCulled;
+                    if (counting()) {
+                        stats.trianglesSubmitted += ml.triangleCount;
+                        stats.trianglesCulled += ml.triangleCount;
+                    }
+                    continue;
+                }
+            }
+        }
+        submitTriangles(indices, colors, ml.firstTriangle, ml.triangleCount, attributes);
+    }
+    (tiled ? timings.setup : timings.raster) += nowMs() - transformed;
+}
+
+void Renderer::drawInstanced(const InstancedMesh& mesh, const Matrix4x4* transforms, size_t count,
+                             const Matrix4x4& view, const Vector3D& eye, float focal) {
+    if (mesh.lodCount == 0) return;
+    if (shadowPass) {
+        double start = nowMs();
+        shadowRenderer->drawInstanced(mesh, transforms, count, lightView * view, lightView.transform(eye), focal);
+        timings.shadow += nowMs() - start;
+        return;
+    }
+    float planes[6][4];
+    frustumPlanes(planes);
+    const Vector3D center(mesh.center[0], mesh.center[1], mesh.center[2]);
+    const size_t lastLod = mesh.lodCount - 1;
+
+    // Model-view matrices a batch at a time, so the multiplies run back to
+    // back over a small buffer that stays in cache
+    const size_t BATCH = 64;
+    instanceModelView.resize(BATCH);
+    for (size_t base = 0; base < count; base += BATCH) {
+        double start = nowMs();
+        size_t n = std::min(BATCH, count - base);
+        Matrix4x4::multiply(view, transforms + base, n, instanceModelView.data());
+        timings.transform += nowMs() - start;
+
+        for (size_t i = 0; i < n; ++i) {
+            const Matrix4x4& modelView = instanceModelView[i];
+            const float (*m)[4] = modelView.m;
+            ++instanceStats.instancesTested;
+            // the sphere grows by the largest axis scale
+            float scale2 = 0.0f;
+            for (int c = 0; c < 3; ++c)
+                scale2 = std::max(scale2, m[0][c] * m[0][c] + m[1][c] * m[1][c] + m[2][c] * m[2][c]);
+            float scale = std::sqrt(scale2);
+            float radius = mesh.radius * scale;
+            Vector3D c = modelView.transform(center);
+            bool outside = false;
+            for (const float* plane : planes) {
+                if (plane[0] * c.x + plane[1] * c.y + plane[2] * c.z + plane[3] < -radius) {
+                    outside = true;
+                    break;
+                }
+            }
+            if (outside) {
+                ++instanceStats.frustumCulled;
+                continue;
+            }
+
+            // projected sphere radius in pixels; from inside it, the finest level
+            float distance = (c - eye).magnitude();
+            float screenRadius = distance > radius ? radius * focal / distance : HUGE_VALF;
+            size_t lod = 0;
+            while (lod < lastLod && screenRadius < mesh.lods[lod].minScreenRadius) ++lod;
+            const MeshLod& level = mesh.lods[lod];
+            ++instanceStats.lodDrawn[std::min(lod, size_t(MAX_INSTANCE_LODS - 1))];
+            instanceStats.trianglesSubmitted += level.triangleCount;
+            if (level.meshlets) {
+                drawMesh(level.positions, level.vertexCount, level.indices, level.colors,
+                         level.meshlets, level.meshletCount, modelView, level.attributes);
+            } else {
+                drawMesh(level.positions, level.vertexCount, level.indices, level.triangleCount,
+                         level.colors, modelView, level.attributes);
+            }
+        }
+    }
+}
+
+// Rays are traced in rects of this many pixels square (whole HiZ blocks),
+// the renderer's tiles in tiled mode
+static const int TRACE_RECT = 64;
+
+void Renderer::raytrace(const Bvh& bvh, const uint32_t* colors, const Matrix4x4& modelView,
+                        const VertexAttributes& attributes, bool shadows) {
+    const float (*p)[4] = projection.m;
+    if (shadowPass || samples > 1 || bvh.empty() || p[3][2] == 0.0f) return;
+    if (incremental && !replaying) {
+        RecordedDraw& d = recordDraw(DrawKind::Raytrace);
+        d.bvh = &bvh; d.colors = colors; d.modelView = modelView;
+        d.attributes = attributes; d.shadows = shadows;
+        return;
+    }
+    double start = nowMs();
+    flush();
+
+    // Model-space rays: the inverse of modelView's upper 3x3 is the
+    // transposed cofactor matrix over the determinant
+    RayTraceJob job;
+    normalMatrix(modelView, job.normalMatrix);
+    const float (*m)[4] = modelView.m;
+    float det = m[0][0] * job.normalMatrix[0][0] + m[0][1] * job.normalMatrix[0][1] + m[0][2] * job.normalMatrix[0][2];
+    if (det == 0.0f) return;
+    float inv[3][3];
+    for (int r = 0; r < 3; ++r)
+        for (int c = 0; c < 3; ++c) inv[r][c] = job.normalMatrix[c][r] / det;
+    auto toModel = [&](const float* v, float* out) {
+        for (int r = 0; r < 3; ++r) out[r] = inv[r][0] * v[0] + inv[r][1] * v[1] + inv[r][2] * v[2];
+    };
+    const float eyeOffset[3] = { -m[0][3], -m[1][3], -m[2][3] };
+    toModel(eyeOffset, job.origin);
+    // View direction through pixel center x + 0.5 (and likewise y), scaled
+    // to unit view z: (ndc - p02) / p00 with ndc = (x + 0.5) / halfW - 1
+    float halfW = width * 0.5f, halfH = height * 0.5f;
+    const float viewBase[3] = { ((0.5f / halfW - 1.0f) * p[3][2] - p[0][2]) / p[0][0],
+                                ((0.5f / halfH - 1.0f) * p[3][2] - p[1][2]) / p[1][1], 1.0f };
+    toModel(viewBase, job.dirBase);
+    for (int r = 0; r < 3; ++r) {
+        job.dirDx[r] = inv[r][0] * p[3][2] / (halfW * p[0][0]);
+        job.dirDy[r] = inv[r][1] * p[3][2] / (halfH * p[1][1]);
+    }
+    // stored depth is (p22 z + p23) / (p32 z): 0 at one plane, 1 at the other
+    job.depthScale = p[2][2] / p[3][2];
+    job.depthOffset = p[2][3] / p[3][2];
+    job.depthFormat = depthFormat;
+    float tZero = -job.depthOffset / job.depthScale, tOne = job.depthOffset / (1.0f - job.depthScale);
+    job.tNear = std::min(tZero, tOne);
+    job.tFar = std::max(tZero, tOne);
+    const float light[3] = { lightDir.x, lightDir.y, lightDir.z };
+    std::memcpy(job.lightView, light, sizeof(light));
+    toModel(light, job.lightModel);
+    job.bvh = &bvh;
+    job.colors = colors;
+    job.normals = attributes.normals;
+    job.vertexColors = attributes.colors;
+    job.shadows = shadows;
+    job.shadowScale = 1.0f - std::min(1.0f, std::max(0.0f, shadowSettings.strength));
+    job.shadowOffset = bvh.getExtent() * 1e-4f;
+    job.simd = simd;
+
+    int size = tiled ? tileSize : TRACE_RECT;
+    int rectsX = (width + size - 1) / size, rectsY = (height + size - 1) / size;
+    std::vector<RayCounts> counts(size_t(rectsX) * rectsY);
+    auto traceTile = [&](int rect) {
+        int x0 = (rect % rectsX) * size, y0 = (rect / rectsX) * size;
+        int x1 = std::min(x0 + size, width) - 1, y1 = std::min(y0 + size, height) - 1;
+        counts[rect] = traceRect(job, x0, y0, x1, y1, buffer, stride, zbuffer.data(), width);
+        if (counts[rect].written) updateHiZRect(x0, y0, x1, y1);
+    };
+    if (tiled) pool->run(int(counts.size()), traceTile);
+    else for (int rect = 0; rect < int(counts.size()); ++rect) traceTile(rect);
+    for (size_t rect = 0; rect < counts.size(); ++rect) {
+        rayStats.primaryRays += counts[rect].primary;
+        rayStats.shadowRays += counts[rect].shadow;
+        if (tiled && counts[rect].written) {
+            targets[0].tiles[rect].clean = false;
+            tileDepthClean[rect] = false;
+        }
+    }
+    timings.trace += nowMs() - start;
+}
+
+void Renderer::setMultisample(int count) {
+    count = count > 1 ? MSAA_SAMPLES : 1;
+    if (count == samples) return;
+    flush();
+    samples = count;
+    invalidate();   // the same draws give other pixels now
+    // depth starts over; samples start out as copies of the target's pixels
+    size_t pixels = size_t(width) * height;
+    allocateDepth();
+    resetHiZRect(0, 0, width - 1, height - 1);
+    std::fill(tileDepthClean.begin(), tileDepthClean.end(), true);
+    depthClearPending = false;
+    if (samples == 1) {
+        std::vector<uint32_t>().swap(sampleColor);
+        return;
+    }
+    sampleColor.resize(pixels * samples);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+            std::fill_n(&sampleColor[(size_t(y) * width + x) * samples], samples, buffer[size_t(y) * stride + x]);
+    if (tiled) sampleTiles = targets[0].tiles;
+}
+
+void Renderer::allocateDepth() {
+    size_t count = size_t(width) * height * samples;
+    zbuffer.assign((count * depthBytes(depthFormat) + 3) / 4, 0);
+    clearSpan(nullptr, zbuffer.data(), depthFormat, count, 0, false);
+}
+
+void Renderer::setDepthFormat(DepthFormat format) {
+    if (format == depthFormat) return;
+    flush();
+    depthFormat = format;
+    depthSign = format == DepthFormat::ReversedFloat32 ? -1.0f : 1.0f;
+    invalidate();
+    setSimdLevel(simd);
+    setFieldOfView(fieldOfView);
+    allocateDepth();
+    resetHiZRect(0, 0, width - 1, height - 1);
+    std::fill(tileDepthClean.begin(), tileDepthClean.end(), true);
+    depthClearPending = false;
+}
+
+void Renderer::setDepthOnly(bool enabled) {
+    flush();
+    depthOnly = enabled;
+}
+
+// --- Shadow mapping ---
+
+void Renderer::beginShadowPass(const Vector3D& center, float radius) {
+    flush();
+    int size = std::max(1, shadowSettings.size);
+    if (!shadowRenderer || shadowRenderer->getWidth() != size) {
+        shadowRenderer.reset(new Renderer(size, size));
+        shadowRenderer->setDepthOnly(true);
+    }
+    shadowRenderer->setSimdLevel(simd);
+    shadowRenderer->setHiZ(hizEnabled);
+    // tiled like this renderer, on the same pool
+    if (tiled != shadowRenderer->tiled || shadowRenderer->pool != pool) {
+        if (tiled) {
+            shadowRenderer->pool = pool;
+            shadowRenderer->setTiled(true, pool->size(), tileSize);
+        } else shadowRenderer->setTiled(false);
+    }
+
+    // Light view: looking along -lightDir from the sphere's edge, x and y
+    // across (x cross y = z, as in view space); the sphere fills the map and
+    // its depth range
+    Vector3D forward = lightDir * -1.0f;
+    Vector3D across = std::fabs(forward.y) < 0.9f ? Vector3D(0, 1, 0) : Vector3D(1, 0, 0);
+    Vector3D right = across.cross(forward).normalize();
+    Vector3D down = forward.cross(right);
+    Vector3D eye = center - forward * radius;
+    const Vector3D* axes[3] = { &right, &down, &forward };
+    lightView = Matrix4x4::identity();
+    for (int r = 0; r < 3; ++r) {
+        lightView.m[r][0] = axes[r]->x;
+        lightView.m[r][1] = axes[r]->y;
+        lightView.m[r][2] = axes[r]->z;
+        lightView.m[r][3] = -axes[r]->dot(eye);
+    }
+    Matrix4x4 projection = Matrix4x4::orthographic(radius, radius, 0.0f, 2.0f * radius);
+    float half = float(size) * 0.5f;
+    shadowMatrix = Matrix4x4::translation(half, half, 0.0f) * Matrix4x4::scale(half, half, 1.0f) * projection * lightView;
+    shadowRenderer->setProjection(projection);
+    shadowRenderer->clearZ();
+    shadowPass = true;
+    shadowed = false;
+}
+
+void Renderer::endShadowPass() {
+    if (!shadowPass) return;
+    double start = nowMs();
+    shadowRenderer->flush();
+    timings.shadow += nowMs() - start;
+    shadowPass = false;
+    shadowed = true;
+    if (incremental) invalidate();   // the map has no change tracking of its own
+    float strength = std::min(1.0f, std::max(0.0f, shadowSettings.strength));
+    // the shadow renderer keeps the default Float32 depth
+    shadowMap = ShadowMap(static_cast<const float*>(shadowRenderer->getDepthBuffer()), shadowRenderer->getWidth(), shadowRenderer->getHeight(),
+                          shadowSettings.bias, uint32_t(strength * 256.0f + 0.5f));
+}
+
+void Renderer::disableShadows() {
+    flush();
+    shadowPass = false;
+    shadowed = false;
+}
+
+// --- Deferred tiled mode ---
+
+void Renderer::setTiled(bool enabled, int threads, int size) {
+    flush();
+    tiled = enabled;
+    invalidate();
+    if (!enabled) {
+        pool.reset();
+        bins.clear();
+        resetCells();
+        return;
+    }
+    // whole hierarchical-Z blocks per tile, so tiles never share a block
+    tileSize = std::max(HIZ_BLOCK, (size + HIZ_BLOCK - 1) / HIZ_BLOCK * HIZ_BLOCK);
+    tilesX = (width + tileSize - 1) / tileSize;
+    tilesY = (height + tileSize - 1) / tileSize;
+    bins.assign(size_t(tilesX) * tilesY, std::vector<uint32_t>());
+    for (TargetState& target : targets) target.tiles.assign(size_t(tilesX) * tilesY, TileColor{ 0, false });
+    tileDepthClean.assign(size_t(tilesX) * tilesY, false);
+    sampleTiles.assign(size_t(tilesX) * tilesY, TileColor{ 0, false });
+    resetCells();
+    if (threads <= 0) threads = int(std::thread::hardware_concurrency());
+    if (!pool || pool->size() != std::max(1, threads)) pool.reset(new ThreadPool(threads));
+}
+
+// Add t to every tile its bounding box touches, skipping tiles that lie
+// entirely outside one of its edges (thin slivers cross few tiles).
+void Renderer::binTriangle(const TriangleSetup& t) {
+    uint32_t index = uint32_t(triangles.size());
+    triangles.push_back(t);
+    int tx0 = t.minX / tileSize, tx1 = t.maxX / tileSize;
+    int ty0 = t.minY / tileSize, ty1 = t.maxY / tileSize;
+    bool single = tx0 == tx1 && ty0 == ty1;
+    // samples lie off the pixel centers the corners are taken at
+    int64_t reach0 = 0, reach1 = 0, reach2 = 0;
+    if (samples > 1 && !single) {
+        reach0 = sampleEdgeReach(t.stepX0, t.stepY0);
+        reach1 = sampleEdgeReach(t.stepX1, t.stepY1);
+        reach2 = sampleEdgeReach(t.stepX2, t.stepY2);
+    }
+    for (int ty = ty0; ty <= ty1; ++ty) {
+        int py0 = std::max(ty * tileSize, t.minY) - t.minY;
+        int py1 = std::min(ty * tileSize + tileSize - 1, t.maxY) - t.minY;
+        for (int tx = tx0; tx <= tx1; ++tx) {
+            if (!single) {
+                int px0 = std::max(tx * tileSize, t.minX) - t.minX;
+                int px1 = std::min(tx * tileSize + tileSize - 1, t.maxX) - t.minX;
+                // each edge at the tile corner where it is largest
+                int64_t e0 = t.w0 + t.stepX0 * (t.stepX0 > 0 ? px1 : px0) + t.stepY0 * (t.stepY0 > 0 ? py1 : py0);
+                int64_t e1 = t.w1 + t.stepX1 * (t.stepX1 > 0 ? px1 : px0) + t.stepY1 * (t.stepY1 > 0 ? py1 : py0);
+                int64_t e2 = t.w2 + t.stepX2 * (t.stepX2 > 0 ? px1 : px0) + t.stepY2 * (t.stepY2 > 0 ? py1 : py0);
+                if (((e0 + reach0) | (e1 + reach1) | (e2 + reach2)) < 0) continue;
+            }
+            if (replaying && !dirtyCells[size_t(ty) * tilesX + tx]) continue;
+            bins[size_t(ty) * tilesX + tx].push_back(index);
+        }
+    }
+}
+
+void Renderer::renderTile(int tile) {
+    int x0 = (tile % tilesX) * tileSize, y0 = (tile / tilesX) * tileSize;
+    int x1 = std::min(x0 + tileSize, width) - 1, y1 = std::min(y0 + tileSize, height) - 1;
+    for (uint32_t index : bins[tile]) rasterTriangle(triangles[index], x0, y0, x1, y1);
+    if (samples > 1) resolveRect(x0, y0, x1, y1);
+}
+
+void Renderer::resolveRect(int x0, int y0, int x1, int y1) {
+    for (int y = y0; y <= y1; ++y)
+        resolveSpan(sampleColor.data() + (size_t(y) * width + x0) * MSAA_SAMPLES, size_t(x1 - x0 + 1), buffer + size_t(y) * stride + x0);
+}
+
+// What a pending clear still has to write in a tile
+static const uint8_t CLEAR_COLOR = 1, CLEAR_DEPTH = 2, CLEAR_STREAMING = 4, CLEAR_SAMPLES = 8;
+
+uint8_t Renderer::tileClearFlags(int tile) const {
+    if (replaying && !dirtyCells[tile]) return 0;
+    const TileColor& state = targets[0].tiles[tile];
+    uint8_t flags = 0;
+    if (colorClearPending && !(state.clean && state.color == clearColor)) flags |= CLEAR_COLOR;
+    if (depthClearPending && !tileDepthClean[tile]) flags |= CLEAR_DEPTH;
+    if (samples > 1 && colorClearPending && !(sampleTiles[tile].clean && sampleTiles[tile].color == clearColor))
+        flags |= CLEAR_SAMPLES;
+    // a tile about to be drawn into keeps its lines cached for the raster pass;
+    // the rest are only read again by whoever presents the frame
+    if (flags && bins[tile].empty()) flags |= CLEAR_STREAMING;
+    return flags;
+}
+
+// Clear one row of tiles. Neighbouring tiles needing the same clear are
+// written as one span per pixel row, so a fully dirty strip streams whole rows.
+void Renderer::clearStrip(int strip) {
+    const uint8_t* flags = &clearFlags[size_t(strip) * tilesX];
+    int y0 = strip * tileSize, y1 = std::min(y0 + tileSize, height) - 1;
+    for (int y = y0; y <= y1; ++y) {
+        for (int tx = 0; tx < tilesX;) {
+            uint8_t f = flags[tx];
+            int end = tx + 1;
+            while (end < tilesX && flags[end] == f) ++end;
+            if (f) {
+                int x0 = tx * tileSize, x1 = std::min(end * tileSize, width);
+                size_t row = (size_t(y) * width + x0) * samples, count = size_t(x1 - x0);
+                bool streaming = (f & CLEAR_STREAMING) != 0;
+                if (samples == 1) {
+                    clearSpan((f & CLEAR_COLOR) ? buffer + size_t(y) * stride + x0 : nullptr, (f & CLEAR_DEPTH) ? depthAt(row) : nullptr,
+                              depthFormat, count, clearColor, streaming);
+                } else {
+                    if (f & CLEAR_COLOR) clearSpan(buffer + size_t(y) * stride + x0, nullptr, depthFormat, count, clearColor, streaming);
+                    clearSpan((f & CLEAR_SAMPLES) ? sampleColor.data() + row : nullptr, (f & CLEAR_DEPTH) ? depthAt(row) : nullptr,
+                              depthFormat, count * samples, clearColor, streaming);
+                }
+            }
+            tx = end;
+        }
+    }
+    for (int tx = 0; tx < tilesX; ++tx) {
+        size_t tile = size_t(strip) * tilesX + tx;
+        if (flags[tx] & CLEAR_COLOR) {
+            targets[0].tiles[tile].color = clearColor;
+            targets[0].tiles[tile].clean = true;
+        }
+        if (flags[tx] & CLEAR_SAMPLES) {
+            sampleTiles[tile].color = clearColor;
+            sampleTiles[tile].clean = true;
+        }
+        if (flags[tx] & CLEAR_DEPTH) {
+            tileDepthClean[tile] = true;
+            resetHiZRect(tx * tileSize, y0, std::min((tx + 1) * tileSize, width) - 1, y1);
+        }
+    }
+}
+
+// Transparent pass sort keys are 22-bit quantized depths above a 32-bit
+// queue index; two 11-bit passes with 8 KB histograms that stay in L1
+static const int SORT_KEY_BITS = 22, SORT_DIGIT_BITS = 11;
+
+// Stable LSD radix sort of keys by bits 32 and up; histograms come with the keys
+static void radixSortKeys(std::vector<uint64_t>& keys, std::vector<uint64_t>& scratch, uint32_t* counts) {
+    const int digits = 1 << SORT_DIGIT_BITS;
+    scratch.resize(keys.size());
+    for (int pass = 0; pass < SORT_KEY_BITS / SORT_DIGIT_BITS; ++pass) {
+        uint32_t* count = counts + pass * digits;
+        int shift = 32 + pass * SORT_DIGIT_BITS;
+        // one digit for every key: nothing to reorder
+        if (count[(keys[0] >> shift) & (digits - 1)] == keys.size()) continue;
+        uint32_t sum = 0;
+        for (int d = 0; d < digits; ++d) {
+            uint32_t c = count[d];
+            count[d] = sum;
+            sum += c;
+        }
+        for (uint64_t k : keys) scratch[count[(k >> shift) & (digits - 1)]++] = k;
+        keys.swap(scratch);
+    }
+}
+
+// Key until sorting: the depth at the center of t's screen bounds, as float
+// bits; the frame's depth range is tracked for quantizing
+void Renderer::queueTransparent(const TriangleSetup& t) {
+    float z = depthSign * planeZ(t, (t.minX + t.maxX) / 2, (t.minY + t.maxY) / 2);
+    uint32_t bits;
+    memcpy(&bits, &z, sizeof(bits));
+    if (transparent.empty()) transparentMinZ = transparentMaxZ = z;
+    transparentMinZ = std::min(transparentMinZ, z);
+    transparentMaxZ = std::max(transparentMaxZ, z);
+    sortKeys.push_back(uint64_t(bits) << 32 | uint32_t(transparent.size()));
+    transparent.push_back(t);
+}
+
+void Renderer::drawTransparent() {
+    if (transparent.empty()) return;
+    double start = nowMs();
+    // Depths quantized over this frame's range, farthest = 0; NaN sorts first
+    const uint32_t maxKey = (1u << SORT_KEY_BITS) - 1;
+    float range = transparentMaxZ - transparentMinZ;
+    float scale = range > 0.0f ? float(maxKey) / range : 0.0f;
+    std::vector<uint32_t> counts(size_t(SORT_KEY_BITS / SORT_DIGIT_BITS) << SORT_DIGIT_BITS, 0);
+    for (uint64_t& k : sortKeys) {
+        uint32_t bits = uint32_t(k >> 32);
+        float z;
+        memcpy(&z, &bits, sizeof(z));
+        float q = (transparentMaxZ - z) * scale;
+        uint32_t key = q > 0.0f ? (q < float(maxKey) ? uint32_t(q) : maxKey) : 0;
+        k = uint64_t(key) << 32 | uint32_t(k);
+        ++counts[key & ((1u << SORT_DIGIT_BITS) - 1)];
+        ++counts[(size_t(1) << SORT_DIGIT_BITS) + (key >> SORT_DIGIT_BITS)];
+    }
+    radixSortKeys(sortKeys, sortScratch, counts.data());
+    double sorted = nowMs();
+    timings.sort += sorted - start;
+
+    for (uint64_t key : sortKeys) {
+        const TriangleSetup& t = transparent[uint32_t(key)];
+        if (tiled) binTriangle(t);
+        else drawImmediate(t);
+    }
+    transparent.clear();
+    sortKeys.clear();
+    (tiled ? timings.setup : timings.raster) += nowMs() - sorted;
+}
+
+void Renderer::flush() {
+    if (incremental && !replaying) {
+        flushIncremental();
+        return;
+    }
+    drawTransparent();
+    if (!tiled) {
+        if (resolveX0 <= resolveX1) {
+            double start = nowMs();
+            if (replaying) {
+                // only the cells being redrawn hold this target's samples
+                for (const ScreenRect& r : dirtyRects) {
+                    int x0 = std::max(r.x0, resolveX0), y0 = std::max(r.y0, resolveY0);
+                    int x1 = std::min(r.x1, resolveX1), y1 = std::min(r.y1, resolveY1);
+                    if (x0 <= x1 && y0 <= y1) resolveRect(x0, y0, x1, y1);
                 }
             }
+            else resolveRect(resolveX0, resolveY0, resolveX1, resolveY1);
+            resolveX1 = -1;
+            timings.resolve += nowMs() - start;
+        }
+        return;
+    }
+    double start = nowMs();
+    // Pending clears only touch tiles drawn into since their last clear
+    if (colorClearPending || depthClearPending) {
+        activeTiles.clear();
+        clearFlags.resize(size_t(tilesX) * tilesY);
+        for (int ty = 0; ty < tilesY; ++ty) {
+            bool any = false;
+            for (int tx = 0; tx < tilesX; ++tx) {
+                int tile = ty * tilesX + tx;
+                clearFlags[tile] = tileClearFlags(tile);
+                any |= clearFlags[tile] != 0;
+            }
+            if (any) activeTiles.push_back(ty);
+        }
+        pool->run(int(activeTiles.size()), [this](int task) { clearStrip(activeTiles[task]); });
+        colorClearPending = depthClearPending = false;
+    }
+    double cleared = nowMs();
+    timings.clear += cleared - start;
+
+    activeTiles.clear();
+    for (int i = 0; i < tilesX * tilesY; ++i) {
+        if (bins[i].empty()) continue;
+        activeTiles.push_back(i);
+        targets[0].tiles[i].clean = false;
+        tileDepthClean[i] = false;
+        sampleTiles[i].clean = false;
+    }
+    pool->run(int(activeTiles.size()), [this](int task) { renderTile(activeTiles[task]); });
+    for (int i : activeTiles) bins[i].clear();
+    triangles.clear();
+    timings.raster += nowMs() - cleared;
+}
+
+// --- Incremental mode ---
+
+void Renderer::setIncremental(bool enabled) {
+    flush();
+    incremental = enabled;
+    frameDraws.clear();
+    framePending = false;
+    invalidate();
+    presentedRects.assign(1, ScreenRect{ 0, 0, width - 1, height - 1 });
+}
+
+void Renderer::invalidate() {
+    for (TargetState& target : targets) {
+        target.shown.clear();
+        target.shownValid = false;
+    }
+}
+
+void Renderer::resetCells() {
+    dirtyCell = tiled ? tileSize : DIRTY_CELL;
+    cellsX = (width + dirtyCell - 1) / dirtyCell;
+    cellsY = (height + dirtyCell - 1) / dirtyCell;
+    dirtyCells.assign(size_t(cellsX) * cellsY, 0);
+    presentedCells.assign(size_t(cellsX) * cellsY, 0);
+    cellStats.assign(size_t(cellsX) * cellsY, PixelStats());
+}
+
+void Renderer::beginIncrementalFrame(uint32_t color) {
+    frameDraws.clear();
+    framePending = true;
+    clearColor = color;
+    std::fill(presentedCells.begin(), presentedCells.end(), 0);
+    presentedRects.clear();
+}
+
+Renderer::RecordedDraw& Renderer::recordDraw(DrawKind kind) {
+    frameDraws.emplace_back();
+    RecordedDraw& d = frameDraws.back();
+    d.kind = kind;
+    d.pipeline = pipeline;
+    d.texture = texture;
+    d.cullMode = cullMode;
+    d.sortTransparent = sortTransparent;
+    d.depthOnly = depthOnly;
+    d.shadowed = shadowed;
+    d.lightDir = lightDir;
+    d.projection = projection;
+    d.bounds = ScreenRect{ 0, 0, -1, -1 };
+    framePending = true;
+    return d;
+}
+
+// Same inputs and state, floats compared bit for bit. A traced draw never
+// matches: its BVH may have been refitted in place.
+bool Renderer::sameDraw(const RecordedDraw& a, const RecordedDraw& b) {
+    if (a.kind != b.kind || a.kind == DrawKind::Raytrace) return false;
+    if (a.positions != b.positions || a.vertexCount != b.vertexCount ||
+        a.indices != b.indices || a.triangleCount != b.triangleCount || a.colors != b.colors ||
+        a.meshlets != b.meshlets || a.meshletCount != b.meshletCount ||
+        a.attributes.normals != b.attributes.normals || a.attributes.colors != b.attributes.colors ||
+        a.attributes.uvs != b.attributes.uvs) return false;
+    if (a.pipeline.depthTest != b.pipeline.depthTest || a.pipeline.depthWrite != b.pipeline.depthWrite ||
+        a.pipeline.blend != b.pipeline.blend || a.pipeline.alpha != b.pipeline.alpha ||
+        a.texture != b.texture || a.cullMode != b.cullMode || a.sortTransparent != b.sortTransparent ||
+        a.depthOnly != b.depthOnly || a.shadowed != b.shadowed) return false;
+    const float light[2][3] = { { a.lightDir.x, a.lightDir.y, a.lightDir.z }, { b.lightDir.x, b.lightDir.y, b.lightDir.z } };
+    return std::memcmp(a.modelView.m, b.modelView.m, sizeof(a.modelView.m)) == 0 &&
+           std::memcmp(a.projection.m, b.projection.m, sizeof(a.projection.m)) == 0 &&
+           std::memcmp(light[0], light[1], sizeof(light[0])) == 0 &&
+           std::memcmp(a.vertices, b.vertices, sizeof(a.vertices)) == 0;
+}
+
+// Conservative screen bounds: a pixel past the corners (samples and
+// rounding reach less), or for a mesh past its projected vertices, whose
+// outline holds every clipped triangle while all are in front of the eye
+ScreenRect Renderer::drawBounds(const RecordedDraw& d) {
+    const ScreenRect screen = { 0, 0, width - 1, height - 1 };
+    float loX = HUGE_VALF, loY = HUGE_VALF, hiX = -HUGE_VALF, hiY = -HUGE_VALF;
+    switch (d.kind) {
+    case DrawKind::Raytrace:
+        return screen;
+    case DrawKind::Pixel: {
+        int x = int(d.vertices[0].x), y = int(d.vertices[0].y);
+        return ScreenRect{ x, y, x, y };
+    }
+    case DrawKind::FlatTriangle:
+    case DrawKind::ShadedTriangle:
+        for (const ShadedVertex& v : d.vertices) {
+            loX = std::min(loX, v.x); hiX = std::max(hiX, v.x);
+            loY = std::min(loY, v.y); hiY = std::max(hiY, v.y);
+        }
+        break;
+    case DrawKind::Mesh:
+    case DrawKind::MeshletMesh: {
+        size_t n = d.vertexCount;
+        if (n == 0) return ScreenRect{ 0, 0, -1, -1 };
+        clipX.resize(n); clipY.resize(n); clipZ.resize(n); clipW.resize(n);
+        (d.projection * d.modelView).transformPoints(d.positions, n, clipX.data(), clipY.data(), clipZ.data(), clipW.data());
+        float halfW = width * 0.5f, halfH = height * 0.5f;
+        for (size_t i = 0; i < n; ++i) {
+            if (!(clipW[i] > 0.0f)) return screen;   // behind the eye: clipping can reach anywhere
+            float inv = 1.0f / clipW[i];
+            float x = (clipX[i] * inv + 1.0f) * halfW, y = (clipY[i] * inv + 1.0f) * halfH;
+            loX = std::min(loX, x); hiX = std::max(hiX, x);
+            loY = std::min(loY, y); hiY = std::max(hiY, y);
+        }
+        break;
+    }
+    }
+    if (!(loX <= hiX && loY <= hiY)) return screen;   // NaN
+    auto toPixel = [](float v, int size) { return std::min(float(size + 2), std::max(-2.0f, v)); };
+    ScreenRect r;
+    r.x0 = std::max(0, int(std::floor(toPixel(loX, width))) - 1);
+    r.y0 = std::max(0, int(std::floor(toPixel(loY, height))) - 1);
+    r.x1 = std::min(width - 1, int(std::ceil(toPixel(hiX, width))) + 1);
+    r.y1 = std::min(height - 1, int(std::ceil(toPixel(hiY, height))) + 1);
+    return r;
+}
+
+void Renderer::replayDraw(const RecordedDraw& d) {
+    pipeline = d.pipeline;
+    texture = d.texture;
+    cullMode = d.cullMode;
+    sortTransparent = d.sortTransparent;
+    // rasterized under depthOnly, so what is queued goes first, as in setDepthOnly
+    if (d.depthOnly != depthOnly) {
+        flush();
+        depthOnly = d.depthOnly;
+    }
+    shadowed = d.shadowed;
+    lightDir = d.lightDir;
+    projection = d.projection;
+    const ShadedVertex* v = d.vertices;
+    unsigned char r = (unsigned char)v[0].r, g = (unsigned char)v[0].g, b = (unsigned char)v[0].b;
+    switch (d.kind) {
+    case DrawKind::FlatTriangle:
+        drawTriangle(v[0].x, v[0].y, v[0].z, v[1].x, v[1].y, v[1].z, v[2].x, v[2].y, v[2].z, r, g, b, v[0].u);
+        break;
+    case DrawKind::ShadedTriangle:
+        drawTriangle(v[0], v[1], v[2]);
+        break;
+    case DrawKind::Mesh:
+        drawMesh(d.positions, d.vertexCount, d.indices, d.triangleCount, d.colors, d.modelView, d.attributes);
+        break;
+    case DrawKind::MeshletMesh:
+        drawMesh(d.positions, d.vertexCount, d.indices, d.colors, d.meshlets, d.meshletCount, d.modelView, d.attributes);
+        break;
+    case DrawKind::Raytrace:
+        raytrace(*d.bvh, d.colors, d.modelView, d.attributes, d.shadows);
+        break;
+    case DrawKind::Pixel:
+        setPixel(int(v[0].x), int(v[0].y), v[0].z, r, g, b);
+        break;
+    }
+}
+
+void Renderer::markCells(std::vector<uint8_t>& cells, const ScreenRect& r) const {
+    if (r.x0 > r.x1 || r.y0 > r.y1) return;
+    int cx0 = r.x0 / dirtyCell, cx1 = r.x1 / dirtyCell;
+    for (int cy = r.y0 / dirtyCell; cy <= r.y1 / dirtyCell; ++cy)
+        std::fill(cells.begin() + size_t(cy) * cellsX + cx0, cells.begin() + size_t(cy) * cellsX + cx1 + 1, 1);
+}
+
+bool Renderer::touchesDirty(int x0, int y0, int x1, int y1) const {
+    if (x0 > x1 || y0 > y1) return false;
+    int cx0 = x0 / dirtyCell, cx1 = x1 / dirtyCell;
+    for (int cy = y0 / dirtyCell; cy <= y1 / dirtyCell; ++cy) {
+        const uint8_t* row = &dirtyCells[size_t(cy) * cellsX];
+        for (int cx = cx0; cx <= cx1; ++cx)
+            if (row[cx]) return true;
+    }
+    return false;
+}
+
+// Runs of set cells along each cell row, each continuing the rect above it
+// when that one spans exactly the same columns
+void Renderer::cellRects(const std::vector<uint8_t>& cells, std::vector<ScreenRect>& rects) const {
+    rects.clear();
+    std::vector<size_t> open, next;   // rects ending on the previous row / this one
+    for (int cy = 0; cy < cellsY; ++cy) {
+        const uint8_t* row = &cells[size_t(cy) * cellsX];
+        int y0 = cy * dirtyCell, y1 = std::min(y0 + dirtyCell, height) - 1;
+        next.clear();
+        for (int cx = 0; cx < cellsX;) {
+            if (!row[cx]) {
+                ++cx;
+                continue;
+            }
+            int end = cx + 1;
+            while (end < cellsX && row[end]) ++end;
+            int x0 = cx * dirtyCell, x1 = std::min(end * dirtyCell, width) - 1;
+            auto above = std::find_if(open.begin(), open.end(), [&](size_t i) { return rects[i].x0 == x0 && rects[i].x1 == x1; });
+            if (above != open.end()) {
+                rects[*above].y1 = y1;
+                next.push_back(*above);
+            } else {
+                rects.push_back(ScreenRect{ x0, y0, x1, y1 });
+                next.push_back(rects.size() - 1);
+            }
+            cx = end;
+        }
+        open.swap(next);
+    }
+}
+
+// Diff the frame against what the target shows, clear the cells under
+// whatever changed and replay every draw that reaches them, clipped to them
+void Renderer::flushIncremental() {
+    if (!framePending || shadowPass) return;
+    framePending = false;
+    double start = nowMs();
+    TargetState& target = targets[0];
+    std::vector<RecordedDraw>& shown = target.shown;
+    bool all = !target.shownValid || target.shownClear != clearColor;
+    std::fill(dirtyCells.begin(), dirtyCells.end(), 0);
+    for (size_t i = 0; i < std::max(frameDraws.size(), shown.size()); ++i) {
+        bool drawn = i < frameDraws.size(), wasShown = i < shown.size();
+        if (drawn && wasShown && sameDraw(frameDraws[i], shown[i])) {
+            frameDraws[i].bounds = shown[i].bounds;
+            continue;
+        }
+        if (wasShown && !all) markCells(dirtyCells, shown[i].bounds);
+        if (drawn) {
+            frameDraws[i].bounds = drawBounds(frameDraws[i]);
+            if (!all) markCells(dirtyCells, frameDraws[i].bounds);
+        }
+    }
+    if (all) std::fill(dirtyCells.begin(), dirtyCells.end(), 1);
+    cellRects(dirtyCells, dirtyRects);
+    double diffed = nowMs();
+    timings.setup += diffed - start;
+
+    if (!dirtyRects.empty()) {
+        replaying = true;
+        if (tiled) {
+            // fast clears, limited to the dirty tiles by tileClearFlags
+            colorClearPending = depthClearPending = true;
+        } else {
+            for (const ScreenRect& r : dirtyRects) {
+                size_t count = size_t(r.x1 - r.x0 + 1);
+                for (int y = r.y0; y <= r.y1; ++y) {
+                    uint32_t* color = buffer + size_t(y) * stride + r.x0;
+                    size_t first = (size_t(y) * width + r.x0) * samples;
+                    if (samples == 1) clearSpan(color, depthAt(first), depthFormat, count, clearColor, false);
+                    else {
+                        clearSpan(color, nullptr, depthFormat, count, clearColor, false);
+                        clearSpan(sampleColor.data() + first, depthAt(first), depthFormat, count * samples, clearColor, false);
+                    }
+                }
+                resetHiZRect(r.x0, r.y0, r.x1, r.y1);
+            }
+            timings.clear += nowMs() - diffed;
+        }
+
+        // each draw under the state it was recorded with
+        PipelineState framePipeline = pipeline;
+        const Texture* frameTexture = texture;
+        CullMode frameCullMode = cullMode;
+        bool frameSort = sortTransparent;
+        bool frameDepthOnly = depthOnly, frameShadowed = shadowed;
+        Vector3D frameLight = lightDir;
+        Matrix4x4 frameProjection = projection;
+        for (const RecordedDraw& d : frameDraws) {
+            if (touchesDirty(d.bounds.x0, d.bounds.y0, d.bounds.x1, d.bounds.y1)) replayDraw(d);
+        }
+        flush();
+        pipeline = framePipeline;
+        texture = frameTexture;
+        cullMode = frameCullMode;
+        sortTransparent = frameSort;
+        depthOnly = frameDepthOnly;
+        shadowed = frameShadowed;
+        lightDir = frameLight;
+        projection = frameProjection;
+        replaying = false;
+
+        for (size_t i = 0; i < presentedCells.size(); ++i) presentedCells[i] |= dirtyCells[i];
+        cellRects(presentedCells, presentedRects);
+    }
+    target.shown = frameDraws;
+    target.shownClear = clearColor;
+    target.shownValid = true;
+}
+
+// --- Instrumentation ---
+
+void Renderer::setStats(bool enabled) {
+    flush();
+    statsEnabled = RENDER_STATS && enabled;
+    overdraw.assign(statsEnabled ? size_t(width) * height : 0, 0);
+    resetStats();
+}
+
+RenderStats Renderer::getStats() const {
+    RenderStats total = stats;
+    for (const PixelStats& cell : cellStats) {
+        total.pixels.tested += cell.tested;
+        total.pixels.passed += cell.passed;
+        total.pixels.written += cell.written;
+        total.pixels.ms += cell.ms;
+    }
+    return total;
+}
+
+void Renderer::resetStats() {
+    stats = RenderStats();
+    std::fill(cellStats.begin(), cellStats.end(), PixelStats());
+    std::fill(overdraw.begin(), overdraw.end(), 0);
+}
+
+// Blue, cyan, green, yellow, red as t goes from 0 to 1
+static uint32_t heatColor(float t) {
+    static const uint8_t stops[5][3] = { { 0, 0, 255 }, { 0, 255, 255 }, { 0, 255, 0 }, { 255, 255, 0 }, { 255, 0, 0 } };
+    float f = std::min(std::max(t, 0.0f), 1.0f) * 4.0f;
+    int i = std::min(int(f), 3);
+    float a = f - float(i);
+    uint32_t out = 0xFF000000u;
+    for (int c = 0; c < 3; ++c)
+        out |= uint32_t(float(stops[i][c]) + (float(stops[i + 1][c]) - float(stops[i][c])) * a + 0.5f) << (16 - 8 * c);
+    return out;
+}
+
+void Renderer::overdrawHeatmap(std::vector<uint32_t>& pixels) const {
+    pixels.assign(size_t(width) * height, 0xFF000000u);
+    if (overdraw.empty()) return;
+    uint32_t ramp[9] = { 0xFF000000u };
+    for (int n = 1; n <= 8; ++n) ramp[n] = heatColor(float(n - 1) / 7.0f);
+    for (size_t i = 0; i < pixels.size(); ++i) pixels[i] = ramp[std::min(overdraw[i], 8u)];
+}
+
+void Renderer::costHeatmap(std::vector<uint32_t>& pixels) const {
+    pixels.assign(size_t(width) * height, 0xFF000000u);
+    double costliest = 0;
+    for (const PixelStats& cell : cellStats) costliest = std::max(costliest, cell.ms);
+    if (costliest <= 0) return;
+    for (int cy = 0; cy < cellsY; ++cy) {
+        int y0 = cy * dirtyCell, y1 = std::min(y0 + dirtyCell, height);
+        for (int cx = 0; cx < cellsX; ++cx) {
+            double ms = cellStats[size_t(cy) * cellsX + cx].ms;
+            if (ms <= 0) continue;
+            uint32_t color = heatColor(float(ms / costliest));
+            int x0 = cx * dirtyCell, x1 = std::min(x0 + dirtyCell, width);
+            for (int y = y0; y < y1; ++y) std::fill(pixels.begin() + size_t(y) * width + x0, pixels.begin() + size_t(y) * width + x1, color);
         }
     }
 }
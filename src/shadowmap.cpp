@@ -0,0 +1,85 @@
+#include "ShadowMap.h"
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SHADOW_X86 1
+#endif
+
+// Same results as maxps / minps (see rasterkernels.cpp)
+static inline float maxf(float a, float b) { return a > b ? a : b; }
+static inline float minf(float a, float b) { return a < b ? a : b; }
+
+inline float ShadowMap::depthAt(int x, int y) const {
+    if (x < 0 || y < 0 || x >= width || y >= height) return HUGE_VALF;
+    return depth[size_t(y) * width + x];
+}
+
+uint32_t ShadowMap::light(float x, float y, float z) const {
+    // the texel centered up and left of (x, y); clamping keeps far-off
+    // (and NaN) points outside the map, and in int range for the floor
+    float sx = minf(maxf(x - 0.5f, -2.0f), float(width) + 1.0f);
+    float sy = minf(maxf(y - 0.5f, -2.0f), float(height) + 1.0f);
+    int x0 = int(sx), y0 = int(sy);
+    x0 -= float(x0) > sx;
+    y0 -= float(y0) > sy;
+    uint32_t wx = uint32_t((sx - float(x0)) * 256.0f), wy = uint32_t((sy - float(y0)) * 256.0f);
+    uint32_t top = (z <= depthAt(x0, y0) + bias ? 256 - wx : 0) + (z <= depthAt(x0 + 1, y0) + bias ? wx : 0);
+    uint32_t bottom = (z <= depthAt(x0, y0 + 1) + bias ? 256 - wx : 0) + (z <= depthAt(x0 + 1, y0 + 1) + bias ? wx : 0);
+    uint32_t visible = (top * (256 - wy) + bottom * wy) >> 8;
+    return 256 - (((256 - visible) * strength) >> 8);
+}
+
+#ifdef SHADOW_X86
+// floor of x (within int range) as float, and as int in xi
+__attribute__((target("sse2")))
+static inline __m128 floor4(__m128 x, __m128i& xi) {
+    xi = _mm_cvttps_epi32(x);
+    __m128 t = _mm_cvtepi32_ps(xi);
+    __m128 above = _mm_cmpgt_ps(t, x);
+    xi = _mm_add_epi32(xi, _mm_castps_si128(above));   // -1 where truncation rounded up
+    return _mm_sub_ps(t, _mm_and_ps(above, _mm_set1_ps(1.0f)));
+}
+
+__attribute__((target("sse2")))
+#endif
+void ShadowMap::light4(const float* x, const float* y, const float* z, uint32_t* out) const {
+#ifdef SHADOW_X86
+    const __m128 half = _mm_set1_ps(0.5f), lo = _mm_set1_ps(-2.0f);
+    __m128 sx = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(x), half), lo), _mm_set1_ps(float(width) + 1.0f));
+    __m128 sy = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(y), half), lo), _mm_set1_ps(float(height) + 1.0f));
+    __m128i xi, yi;
+    __m128 fx = floor4(sx, xi), fy = floor4(sy, yi);
+    __m128i wx = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(sx, fx), _mm_set1_ps(256.0f)));
+    __m128i wy = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(sy, fy), _mm_set1_ps(256.0f)));
+    alignas(16) int x0[4], y0[4];
+    _mm_store_si128(reinterpret_cast<__m128i*>(x0), xi);
+    _mm_store_si128(reinterpret_cast<__m128i*>(y0), yi);
+
+    // 2x2 footprints: top left, top right, bottom left, bottom right
+    alignas(16) float d[4][4];
+    for (int k = 0; k < 4; ++k) {
+        if (unsigned(x0[k]) < unsigned(width - 1) && unsigned(y0[k]) < unsigned(height - 1)) {
+            const float* p = depth + size_t(y0[k]) * width + x0[k];
+            d[0][k] = p[0]; d[1][k] = p[1];
+            d[2][k] = p[width]; d[3][k] = p[width + 1];
+        } else {
+            for (int c = 0; c < 4; ++c) d[c][k] = depthAt(x0[k] + (c & 1), y0[k] + (c >> 1));
+        }
+    }
+    const __m128 zv = _mm_loadu_ps(z), biasv = _mm_set1_ps(bias);
+    __m128i lit[4];
+    for (int c = 0; c < 4; ++c) lit[c] = _mm_castps_si128(_mm_cmple_ps(zv, _mm_add_ps(_mm_load_ps(d[c]), biasv)));
+
+    // Weights are at most 256, so every product fits one 16-bit madd
+    const __m128i full = _mm_set1_epi32(256);
+    __m128i wx1 = _mm_sub_epi32(full, wx), wy1 = _mm_sub_epi32(full, wy);
+    __m128i top = _mm_add_epi32(_mm_and_si128(lit[0], wx1), _mm_and_si128(lit[1], wx));
+    __m128i bottom = _mm_add_epi32(_mm_and_si128(lit[2], wx1), _mm_and_si128(lit[3], wx));
+    __m128i visible = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(top, wy1), _mm_madd_epi16(bottom, wy)), 8);
+    __m128i lost = _mm_srli_epi32(_mm_madd_epi16(_mm_sub_epi32(full, visible), _mm_set1_epi32(int(strength))), 8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_sub_epi32(full, lost));
+#else
+    for (int i = 0; i < 4; ++i) out[i] = light(x[i], y[i], z[i]);
+#endif
+}
@@ -0,0 +1,229 @@
+// src/shapes.cpp - procedural shapes shared by the SDL viewer and the headless renderer
+#include "Shapes.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+// --- Shape generators ---
+void makeCube(std::vector<Vec3> &verts, std::vector<Tri> &tris) {
+    verts = {
+        {-1,-1,-1}, {1,-1,-1}, {1,1,-1}, {-1,1,-1},
+        {-1,-1, 1}, {1,-1, 1}, {1,1, 1}, {-1,1, 1}
+    };
+    tris = {
+        {0,1,2, 220,220,220},{0,2,3, 220,220,220},
+        {4,6,5, 200,200,200},{4,7,6, 200,200,200},
+        {0,5,1, 180,180,180},{0,4,5, 180,180,180},
+        {2,6,7, 180,180,180},{2,7,3, 180,180,180},
+        {1,5,6, 160,160,160},{1,6,2, 160,160,160},
+        {0,3,7, 160,160,160},{0,7,4, 160,160,160}
+    };
+}
+
+void makeTetrahedron(std::vector<Vec3> &verts, std::vector<Tri> &tris) {
+    verts = { {0,0,1.2f}, {1,0,-0.4f}, {-0.5f,0.87f,-0.4f}, {-0.5f,-0.87f,-0.4f} };
+    tris = {
+        {0,1,2, 220,180,180}, {0,2,3, 180,220,180},
+        {0,3,1, 180,180,220}, {1,3,2, 220,220,180}
+    };
+}
+
+void makeIcosahedron(std::vector<Vec3> &verts, std::vector<Tri> &tris) {
+    verts.clear(); tris.clear();
+    float phi = (1 + sqrtf(5.0f)) * 0.5f;
+    verts = {
+        {-1,  phi, 0}, {1,  phi, 0}, {-1, -phi, 0}, {1, -phi, 0},
+        {0, -1,  phi}, {0,  1,  phi}, {0, -1, -phi}, {0,  1, -phi},
+        { phi, 0, -1}, { phi, 0,  1}, {-phi, 0, -1}, {-phi, 0,  1}
+    };
+    for (auto &v: verts) {
+        float l = sqrtf(v.x*v.x+v.y*v.y+v.z*v.z);
+        v.x/=l; v.y/=l; v.z/=l;
+    }
+    tris = {
+        {0,11,5, 200,200,255},{0,5,1, 200,255,200},
+        {0,1,7, 255,200,200},{0,7,10,220,220,180},
+        {0,10,11,180,220,220}
+    };
+}
+
+void makeHelix(std::vector<Vec3> &verts, std::vector<Tri> &tris, int N) {
+    verts.clear(); tris.clear();
+    for (int i=0; i<N; i++) {
+        float t=i*0.2f;
+        verts.push_back({cosf(t), sinf(t), t*0.1f});
+        if(i>=2) tris.push_back({i-2,i-1,i,200,180,255});
+    }
+}
+
+// --- Ent/Tree (simple leafy top) ---
+void makeEnt(std::vector<Vec3> &verts, std::vector<Tri> &tris) {
+    verts.clear(); tris.clear();
+    verts = {
+        {0,-1,0}, {0.3f,0,0}, {-0.3f,0,0}, {0,0,0.3f}, {0,0,-0.3f},
+        {0,1,0}, {0.6f,1.3f,0}, {-0.6f,1.3f,0}, {0,1.3f,0.6f}, {0,1.3f,-0.6f}
+    };
+    tris = {
+        {0,1,2,120,80,40},{0,2,3,120,80,40},{0,3,4,120,80,40},{0,4,1,120,80,40},
+        {1,5,2,120,80,40},{2,5,3,120,80,40},{3,5,4,120,80,40},{4,5,1,120,80,40},
+        {5,6,7,30,120,30},{5,7,8,30,120,30},{5,8,9,30,120,30},{5,9,6,30,120,30}
+    };
+}
+
+// --- Carrot (high-graphic) generator ---
+void makeCarrot(std::vector<Vec3> &verts, std::vector<Tri> &tris, int segments, int rings) {
+    verts.clear(); tris.clear();
+    srand(424242); // deterministic
+
+    if (segments < 3) segments = 3;
+    if (rings < 2) rings = 2;
+    const float baseY = -1.0f;
+    const float topY  = 0.9f;
+
+    std::vector<int> ringStart;
+    ringStart.reserve(rings);
+
+    for (int ri = 0; ri < rings; ++ri) {
+        float t = (float)ri / (rings - 1);           // 0..1
+        float y = baseY + t * (topY - baseY);
+        // radius: large at base, small at top; add ridge noise
+        float ridge = 0.06f * sinf(t * 18.0f + 0.5f * ((rand()%100)/100.0f));
+        float radius = (1.0f - powf(t, 1.6f)) * 0.45f + ridge;
+        // slight twist so it looks organic
+        float twist = t * 2.0f * PI * 0.18f;
+
+        int start = (int)verts.size();
+        ringStart.push_back(start);
+
+        for (int s = 0; s < segments; ++s) {
+            float a = (float)s / segments * 2.0f * PI + twist;
+            float x = cosf(a) * radius;
+            float z = sinf(a) * radius;
+            float wob = 0.02f * sinf(t * 10.0f + s * 0.5f);
+            verts.push_back({ x + wob * cosf(a*2.3f), y + 0.01f * sinf(a*3.1f), z + wob * sinf(a*1.7f) });
+        }
+    }
+
+    for (int ri = 1; ri < rings; ++ri) {
+        int prev = ringStart[ri-1];
+        int cur  = ringStart[ri];
+        for (int s = 0; s < segments; ++s) {
+            int a0 = prev + s;
+            int a1 = prev + ((s+1) % segments);
+            int b0 = cur  + s;
+            int b1 = cur  + ((s+1) % segments);
+            tris.push_back({ a0, a1, b1, 220,100,30 });
+            tris.push_back({ a0, b1, b0, 200,90,20 });
+        }
+    }
+
+    // tip
+    Vec3 tipPos = { 0.0f, topY + 0.06f, 0.0f };
+    int tipIndex = (int)verts.size();
+    verts.push_back(tipPos);
+
+    int lastStart = ringStart.back();
+    for (int s = 0; s < segments; ++s) {
+        int v0 = lastStart + s;
+        int v1 = lastStart + ((s+1) % segments);
+        tris.push_back({ v0, v1, tipIndex, 230,110,40 });
+    }
+
+    // leafy tuft
+    int leafCenter = (int)verts.size();
+    verts.push_back({ 0.0f, topY + 0.10f, 0.0f }); // leaf center
+
+    int leafCount = 8;
+    for (int i = 0; i < leafCount; ++i) {
+        float a = (float)i / leafCount * 2.0f * PI;
+        float lx = cosf(a) * 0.20f;
+        float lz = sinf(a) * 0.20f;
+        float ly = topY + 0.10f + 0.03f * cosf(a*2.0f);
+        int leafOuter = (int)verts.size();
+        verts.push_back({ lx * 0.6f, ly - 0.03f, lz * 0.6f });
+        int leafTip = (int)verts.size();
+        verts.push_back({ lx * 1.1f, ly + 0.02f, lz * 1.1f });
+        unsigned char gr = (unsigned char)(30 + (rand()%60));   // 30..89
+        unsigned char gg = (unsigned char)(110 + (rand()%80));  // 110..189
+        unsigned char gb = (unsigned char)(20 + (rand()%40));
+        tris.push_back({ leafCenter, leafOuter, leafTip, gr, gg, gb });
+    }
+
+    // freckles / small details at lower half
+    for (int f = 0; f < 12; ++f) {
+        float ty = baseY + ((float)rand()/RAND_MAX) * (topY - baseY) * 0.45f;
+        float ta = ((float)rand()/RAND_MAX) * 2.0f * PI;
+        float tr = 0.02f + ((float)rand()/RAND_MAX) * 0.03f;
+        Vec3 p0 = { cosf(ta)*tr*0.3f, ty, sinf(ta)*tr*0.3f };
+        Vec3 p1 = { cosf(ta+0.3f)*tr, ty+0.01f, sinf(ta+0.3f)*tr };
+        Vec3 p2 = { cosf(ta-0.3f)*tr, ty-0.01f, sinf(ta-0.3f)*tr };
+        int i0 = (int)verts.size(); verts.push_back(p0);
+        int i1 = (int)verts.size(); verts.push_back(p1);
+        int i2 = (int)verts.size(); verts.push_back(p2);
+        tris.push_back({ i0, i1, i2, 160,70,30 });
+    }
+}
+
+void makeShape(int index, std::vector<Vec3> &verts, std::vector<Tri> &tris) {
+    switch(index%SHAPE_COUNT){
+        case 0: makeCube(verts,tris); break;
+        case 1: makeTetrahedron(verts,tris); break;
+        case 2: makeIcosahedron(verts,tris); break;
+        case 3: makeHelix(verts,tris); break;
+        case 4: makeEnt(verts,tris); break;
+        case 5: makeCarrot(verts,tris); break;
+    }
+}
+
+const char* shapeName(int index) {
+    static const char* names[SHAPE_COUNT] = { "cube", "tetrahedron", "icosahedron", "helix", "ent", "carrot" };
+    return names[index%SHAPE_COUNT];
+}
+
+Mesh toMesh(const std::vector<Vec3> &verts, const std::vector<Tri> &tris) {
+    Mesh mesh;
+    mesh.positions.reserve(verts.size());
+    mesh.indices.reserve(tris.size()*3);
+    mesh.colors.reserve(tris.size());
+    for(auto &v: verts) mesh.positions.push_back(Vector3D(v.x,v.y,v.z));
+    for(auto &t: tris){
+        mesh.indices.push_back(t.v0); mesh.indices.push_back(t.v1); mesh.indices.push_back(t.v2);
+        mesh.colors.push_back((uint32_t(t.r)<<16)|(uint32_t(t.g)<<8)|t.b);
+    }
+    return mesh;
+}
+
+void computeVertexNormals(const Vector3D *positions, size_t vertexCount,
+                          const uint32_t *indices, size_t triangleCount,
+                          std::vector<Vector3D> &normals){
+    normals.assign(vertexCount, Vector3D(0,0,0));
+    for(size_t t=0; t<triangleCount; ++t){
+        uint32_t i0=indices[3*t], i1=indices[3*t+1], i2=indices[3*t+2];
+        const Vector3D &a=positions[i0];
+        // cross product length is twice the area: larger faces weigh more
+        Vector3D n=(positions[i1]-a).cross(positions[i2]-a);
+        normals[i0]=normals[i0]+n;
+        normals[i1]=normals[i1]+n;
+        normals[i2]=normals[i2]+n;
+    }
+    for(auto &n: normals) n=n.normalize();
+}
+
+void computeSphericalUVs(const Vector3D *positions, size_t vertexCount, std::vector<float> &uvs){
+    uvs.assign(vertexCount*2, 0.0f);
+    if(vertexCount==0) return;
+    Vector3D lo=positions[0], hi=lo;
+    for(size_t i=0; i<vertexCount; ++i){
+        const Vector3D &p=positions[i];
+        lo.x=std::min(lo.x,p.x); hi.x=std::max(hi.x,p.x);
+        lo.y=std::min(lo.y,p.y); hi.y=std::max(hi.y,p.y);
+        lo.z=std::min(lo.z,p.z); hi.z=std::max(hi.z,p.z);
+    }
+    Vector3D center=(lo+hi)*0.5f;
+    for(size_t i=0; i<vertexCount; ++i){
+        Vector3D d=positions[i]-center;
+        float r=d.magnitude();
+        uvs[2*i]=std::atan2(d.z,d.x)/(2*PI)+0.5f;
+        uvs[2*i+1]=r>0 ? std::acos(std::max(-1.0f,std::min(1.0f,d.y/r)))/PI : 0.5f;
+    }
+}
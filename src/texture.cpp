@@ -0,0 +1,294 @@
+#include "Texture.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define TEXTURE_X86 1
+#endif
+
+static int log2Ceil(int v) {
+    int shift = 0;
+    while ((1 << shift) < v) ++shift;
+    return shift;
+}
+
+// Per channel (a * (256 - f) + b * f + 128) >> 8 for f in 0-255. Every
+// intermediate fits in 16 bits, which the SSE2 blend relies on.
+static inline uint32_t lerpTexel(uint32_t a, uint32_t b, int f) {
+    uint32_t out = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        uint32_t ca = (a >> shift) & 0xFF, cb = (b >> shift) & 0xFF;
+        out |= ((ca * uint32_t(256 - f) + cb * uint32_t(f) + 128) >> 8) << shift;
+    }
+    return out;
+}
+
+// Texel (x, y) within a level: 4x4 tiles in row-major order, each tile's 16
+// texels row-major inside it
+static inline size_t tiledIndex(int tilesXShift, int x, int y) {
+    return ((size_t(y >> 2) << tilesXShift | size_t(x >> 2)) << 4) | size_t(y & 3) << 2 | size_t(x & 3);
+}
+
+// Same results as maxps / minps (see rasterkernels.cpp)
+static inline float maxf(float a, float b) { return a > b ? a : b; }
+static inline float minf(float a, float b) { return a < b ? a : b; }
+
+// Texel coordinates are clamped here before converting to int; far enough
+// out that repeat wrapping is unaffected in practice
+static const float COORD_LIMIT = float(1 << 24);
+
+Texture::Texture(const uint32_t* pixels, int width, int height, int pitchBytes) {
+    if (pitchBytes <= 0) pitchBytes = width * 4;
+    int shiftX = log2Ceil(width), shiftY = log2Ceil(height);
+    int w = 1 << shiftX, h = 1 << shiftY;
+
+    // Level 0, row-major; bilinearly resampled up when not a power of two
+    std::vector<uint32_t> level(size_t(w) * h);
+    auto src = [&](int x, int y) {
+        x = std::min(std::max(x, 0), width - 1);
+        y = std::min(std::max(y, 0), height - 1);
+        return *reinterpret_cast<const uint32_t*>(reinterpret_cast<const unsigned char*>(pixels) + size_t(y) * pitchBytes + size_t(x) * 4);
+    };
+    for (int y = 0; y < h; ++y) {
+        for (int x = 0; x < w; ++x) {
+            if (w == width && h == height) {
+                level[size_t(y) * w + x] = src(x, y);
+                continue;
+            }
+            float sx = (x + 0.5f) * float(width) / float(w) - 0.5f;
+            float sy = (y + 0.5f) * float(height) / float(h) - 0.5f;
+            int x0 = int(std::floor(sx)), y0 = int(std::floor(sy));
+            int fx = int((sx - float(x0)) * 256.0f), fy = int((sy - float(y0)) * 256.0f);
+            uint32_t top = lerpTexel(src(x0, y0), src(x0 + 1, y0), fx);
+            uint32_t bottom = lerpTexel(src(x0, y0 + 1), src(x0 + 1, y0 + 1), fx);
+            level[size_t(y) * w + x] = lerpTexel(top, bottom, fy);
+        }
+    }
+
+    // Mip chain down to 1x1, each level a rounded 2x2 box filter of the last;
+    // stored tiled as it is made
+    for (;;) {
+        Level l;
+        l.width = w; l.height = h;
+        l.tilesXShift = std::max(0, shiftX - 2);
+        l.offset = data.size();
+        int tilesY = std::max(1, h >> 2);
+        data.resize(data.size() + (size_t(tilesY) << l.tilesXShift) * 16, 0);
+        levels.push_back(l);
+        for (int y = 0; y < h; ++y)
+            for (int x = 0; x < w; ++x) data[l.offset + tiledIndex(l.tilesXShift, x, y)] = level[size_t(y) * w + x];
+        if (w == 1 && h == 1) break;
+
+        int nw = std::max(1, w >> 1), nh = std::max(1, h >> 1);
+        std::vector<uint32_t> next(size_t(nw) * nh);
+        for (int y = 0; y < nh; ++y) {
+            for (int x = 0; x < nw; ++x) {
+                int x0 = std::min(2 * x, w - 1), x1 = std::min(2 * x + 1, w - 1);
+                int y0 = std::min(2 * y, h - 1), y1 = std::min(2 * y + 1, h - 1);
+                uint32_t c[4] = { level[size_t(y0) * w + x0], level[size_t(y0) * w + x1],
+                                  level[size_t(y1) * w + x0], level[size_t(y1) * w + x1] };
+                uint32_t out = 0;
+                for (int shift = 0; shift < 32; shift += 8) {
+                    uint32_t sum = 2;
+                    for (uint32_t t : c) sum += (t >> shift) & 0xFF;
+                    out |= (sum >> 2) << shift;
+                }
+                next[size_t(y) * nw + x] = out;
+            }
+        }
+        level.swap(next);
+        w = nw; h = nh;
+        shiftX = std::max(0, shiftX - 1); shiftY = std::max(0, shiftY - 1);
+    }
+}
+
+int Texture::wrapCoord(int c, int size) const {
+    if (wrap == TextureWrap::Repeat) return c & (size - 1);
+    return c < 0 ? 0 : (c >= size ? size - 1 : c);
+}
+
+uint32_t Texture::fetch(const Level& l, int x, int y) const {
+    x = wrapCoord(x, l.width);
+    y = wrapCoord(y, l.height);
+    return data[l.offset + tiledIndex(l.tilesXShift, x, y)];
+}
+
+uint32_t Texture::texel(int level, int x, int y) const {
+    return fetch(levels[std::min(std::max(level, 0), int(levels.size()) - 1)], x, y);
+}
+
+void Texture::pickLevel(int lod, int& level, int& blend) const {
+    int last = int(levels.size()) - 1;
+    lod = std::min(std::max(lod, 0), last * 256);
+    if (filter == TextureFilter::Trilinear) {
+        level = lod >> 8;
+        blend = level < last ? lod & 255 : 0;
+    } else {
+        level = std::min((lod + 128) >> 8, last);
+        blend = 0;
+    }
+}
+
+uint32_t Texture::sampleLevel(int level, float u, float v) const {
+    const Level& l = levels[level];
+    if (filter == TextureFilter::Nearest) {
+        float fx = minf(maxf(u * float(l.width), -COORD_LIMIT), COORD_LIMIT);
+        float fy = minf(maxf(v * float(l.height), -COORD_LIMIT), COORD_LIMIT);
+        return fetch(l, int(std::floor(fx)), int(std::floor(fy)));
+    }
+    // texel centers sit at +0.5
+    float fx = minf(maxf(u * float(l.width) - 0.5f, -COORD_LIMIT), COORD_LIMIT);
+    float fy = minf(maxf(v * float(l.height) - 0.5f, -COORD_LIMIT), COORD_LIMIT);
+    float x0f = std::floor(fx), y0f = std::floor(fy);
+    int x0 = int(x0f), y0 = int(y0f);
+    int wx = int((fx - x0f) * 256.0f), wy = int((fy - y0f) * 256.0f);
+    uint32_t top = lerpTexel(fetch(l, x0, y0), fetch(l, x0 + 1, y0), wx);
+    uint32_t bottom = lerpTexel(fetch(l, x0, y0 + 1), fetch(l, x0 + 1, y0 + 1), wx);
+    return lerpTexel(top, bottom, wy);
+}
+
+uint32_t Texture::sample(float u, float v, int lod) const {
+    int level, blend;
+    pickLevel(lod, level, blend);
+    uint32_t c = sampleLevel(level, u, v);
+    if (blend) c = lerpTexel(c, sampleLevel(level + 1, u, v), blend);
+    return c;
+}
+
+#ifdef TEXTURE_X86
+
+// lerpTexel on 4 texels at once, 16 bits per channel
+__attribute__((target("sse2")))
+static inline __m128i lerpTexel4(__m128i a, __m128i b, __m128i f) {
+    const __m128i zero = _mm_setzero_si128();
+    // each texel's weight in all four of its 16-bit channels
+    __m128i f16 = _mm_or_si128(f, _mm_slli_epi32(f, 16));
+    __m128i fLo = _mm_unpacklo_epi32(f16, f16), fHi = _mm_unpackhi_epi32(f16, f16);
+    const __m128i full = _mm_set1_epi16(256), round = _mm_set1_epi16(128);
+    __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), _mm_sub_epi16(full, fLo)),
+                                             _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), fLo)), round);
+    __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), _mm_sub_epi16(full, fHi)),
+                                             _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), fHi)), round);
+    return _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+}
+
+// std::floor for |x| <= 2^24, as a float and as an int
+__attribute__((target("sse2")))
+static inline __m128 floor4(__m128 x, __m128i& xi) {
+    xi = _mm_cvttps_epi32(x);
+    __m128 t = _mm_cvtepi32_ps(xi);
+    __m128 above = _mm_cmpgt_ps(t, x);
+    xi = _mm_add_epi32(xi, _mm_castps_si128(above));   // -1 where truncation rounded up
+    return _mm_sub_ps(t, _mm_and_ps(above, _mm_set1_ps(1.0f)));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i loadTexels(const uint32_t* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+}
+
+#endif
+
+// Coordinates and blends run 4-wide; the texel fetches stay scalar (SSE2 has
+// no gather) and mostly land in the same 64-byte tiles
+#ifdef TEXTURE_X86
+__attribute__((target("sse2")))
+#endif
+void Texture::sample4(const float* u, const float* v, const int* lod, uint32_t* out) const {
+#ifdef TEXTURE_X86
+    int level[2][4], blend[4];
+    bool blending = false;
+    for (int k = 0; k < 4; ++k) {
+        pickLevel(lod[k], level[0][k], blend[k]);
+        level[1][k] = std::min(level[0][k] + 1, int(levels.size()) - 1);
+        blending |= blend[k] != 0;
+    }
+    const __m128 lo = _mm_set1_ps(-COORD_LIMIT), hi = _mm_set1_ps(COORD_LIMIT);
+    const __m128 uv[2] = { _mm_loadu_ps(u), _mm_loadu_ps(v) };
+    __m128i c[2];
+    for (int pass = 0; pass < (blending ? 2 : 1); ++pass) {
+        const Level* l[4];
+        alignas(16) float size[2][4];
+        for (int k = 0; k < 4; ++k) {
+            l[k] = &levels[level[pass][k]];
+            size[0][k] = float(l[k]->width);
+            size[1][k] = float(l[k]->height);
+        }
+        alignas(16) int x[4], y[4];
+        __m128i xi, yi;
+        if (filter == TextureFilter::Nearest) {
+            floor4(_mm_min_ps(_mm_max_ps(_mm_mul_ps(uv[0], _mm_load_ps(size[0])), lo), hi), xi);
+            floor4(_mm_min_ps(_mm_max_ps(_mm_mul_ps(uv[1], _mm_load_ps(size[1])), lo), hi), yi);
+            _mm_store_si128(reinterpret_cast<__m128i*>(x), xi);
+            _mm_store_si128(reinterpret_cast<__m128i*>(y), yi);
+            c[pass] = _mm_setr_epi32(int(fetch(*l[0], x[0], y[0])), int(fetch(*l[1], x[1], y[1])),
+                                     int(fetch(*l[2], x[2], y[2])), int(fetch(*l[3], x[3], y[3])));
+            continue;
+        }
+        const __m128 half = _mm_set1_ps(0.5f);
+        __m128 fx = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_mul_ps(uv[0], _mm_load_ps(size[0])), half), lo), hi);
+        __m128 fy = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_mul_ps(uv[1], _mm_load_ps(size[1])), half), lo), hi);
+        __m128 x0f = floor4(fx, xi), y0f = floor4(fy, yi);
+        _mm_store_si128(reinterpret_cast<__m128i*>(x), xi);
+        _mm_store_si128(reinterpret_cast<__m128i*>(y), yi);
+        __m128i wx = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(fx, x0f), _mm_set1_ps(256.0f)));
+        __m128i wy = _mm_cvttps_epi32(_mm_mul_ps(_mm_sub_ps(fy, y0f), _mm_set1_ps(256.0f)));
+        uint32_t c00[4], c10[4], c01[4], c11[4];
+        for (int k = 0; k < 4; ++k) {
+            c00[k] = fetch(*l[k], x[k], y[k]);
+            c10[k] = fetch(*l[k], x[k] + 1, y[k]);
+            c01[k] = fetch(*l[k], x[k], y[k] + 1);
+            c11[k] = fetch(*l[k], x[k] + 1, y[k] + 1);
+        }
+        __m128i top = lerpTexel4(loadTexels(c00), loadTexels(c10), wx);
+        __m128i bottom = lerpTexel4(loadTexels(c01), loadTexels(c11), wx);
+        c[pass] = lerpTexel4(top, bottom, wy);
+    }
+    if (blending) c[0] = lerpTexel4(c[0], c[1], _mm_setr_epi32(blend[0], blend[1], blend[2], blend[3]));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), c[0]);
+#else
+    for (int k = 0; k < 4; ++k) out[k] = sample(u[k], v[k], lod[k]);
+#endif
+}
+
+std::vector<uint32_t> checkerboard(int size, int cells, uint32_t a, uint32_t b) {
+    std::vector<uint32_t> pixels(size_t(size) * size);
+    for (int y = 0; y < size; ++y)
+        for (int x = 0; x < size; ++x) pixels[size_t(y) * size + x] = ((x * cells / size + y * cells / size) & 1) ? b : a;
+    return pixels;
+}
+
+bool loadPPM(const char* path, std::vector<uint32_t>& pixels, int& width, int& height, std::string* error) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        if (error) *error = std::string("cannot open ") + path;
+        return false;
+    }
+    int maxval = 0;
+    bool ok = fscanf(f, "P6 %d %d %d", &width, &height, &maxval) == 3 && fgetc(f) != EOF &&
+              width > 0 && height > 0 && maxval == 255;
+    // the header's size is only believed as far as the file holds it
+    if (ok) {
+        long at = ftell(f);
+        ok = at >= 0 && fseek(f, 0, SEEK_END) == 0;
+        long end = ok ? ftell(f) : -1;
+        ok = ok && end >= at && fseek(f, at, SEEK_SET) == 0 &&
+             uint64_t(end - at) / 3 / uint64_t(width) >= uint64_t(height);
+    }
+    std::vector<unsigned char> rgb;
+    if (ok) {
+        rgb.resize(size_t(width) * height * 3);
+        ok = fread(rgb.data(), 1, rgb.size(), f) == rgb.size();
+    }
+    fclose(f);
+    if (!ok) {
+        if (error) *error = std::string(path) + ": not a binary 8-bit PPM (P6)";
+        return false;
+    }
+    pixels.resize(size_t(width) * height);
+    for (size_t i = 0; i < pixels.size(); ++i)
+        pixels[i] = 0xFF000000u | uint32_t(rgb[3 * i]) << 16 | uint32_t(rgb[3 * i + 1]) << 8 | rgb[3 * i + 2];
+    return true;
+}
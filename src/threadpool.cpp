@@ -0,0 +1,101 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int threadCount) {
+    if (threadCount <= 0) threadCount = int(std::thread::hardware_concurrency());
+    workerCount = std::max(1, threadCount);
+    for (int i = 0; i < workerCount; ++i) queues.emplace_back(new Queue);
+    for (int i = 1; i < workerCount; ++i) threads.emplace_back(&ThreadPool::workerMain, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& t : threads) t.join();
+}
+
+void ThreadPool::run(int count, const std::function<void(int)>& fn) {
+    if (count <= 0) return;
+    if (workerCount == 1) {
+        for (int i = 0; i < count; ++i) fn(i);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = &fn;
+        remaining = count;
+    }
+    // contiguous blocks keep neighbouring tasks (e.g. screen tiles) on one worker
+    for (int w = 0; w < workerCount; ++w) {
+        int begin = int(int64_t(count) * w / workerCount);
+        int end = int(int64_t(count) * (w + 1) / workerCount);
+        std::lock_guard<std::mutex> lock(queues[w]->mutex);
+        for (int i = begin; i < end; ++i) queues[w]->tasks.push_back(i);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++generation;
+    }
+    wake.notify_all();
+
+    drain(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&] { return remaining == 0 && active == 0; });
+    job = nullptr;
+}
+
+void ThreadPool::workerMain(int index) {
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            ++active;
+        }
+        drain(index);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --active;
+        }
+        done.notify_all();
+    }
+}
+
+void ThreadPool::drain(int index) {
+    int task;
+    while (pop(index, task) || steal(index, task)) {
+        (*job)(task);
+        if (remaining.fetch_sub(1) == 1) {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.notify_all();
+        }
+    }
+}
+
+bool ThreadPool::pop(int index, int& task) {
+    Queue& q = *queues[index];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.tasks.empty()) return false;
+    task = q.tasks.front();
+    q.tasks.pop_front();
+    return true;
+}
+
+bool ThreadPool::steal(int index, int& task) {
+    for (int k = 1; k < workerCount; ++k) {
+        Queue& q = *queues[(index + k) % workerCount];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (q.tasks.empty()) continue;
+        task = q.tasks.back();
+        q.tasks.pop_back();
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,71 @@
+#include "ViewBatch.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <utility>
+
+ViewBatch::ViewBatch(int threadCount) : pool(new ThreadPool(threadCount)) {}
+
+ViewBatch::~ViewBatch() {}
+
+int ViewBatch::getThreadCount() const {
+    return pool->size();
+}
+
+std::unique_ptr<Renderer> ViewBatch::acquire(int width, int height) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < idle.size(); ++i) {
+            if (idle[i]->getWidth() != width || idle[i]->getHeight() != height) continue;
+            std::unique_ptr<Renderer> renderer = std::move(idle[i]);
+            idle[i] = std::move(idle.back());
+            idle.pop_back();
+            return renderer;
+        }
+    }
+    return std::unique_ptr<Renderer>(new Renderer(width, height));
+}
+
+void ViewBatch::release(std::unique_ptr<Renderer> renderer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    idle.push_back(std::move(renderer));
+}
+
+// No more than one renderer per worker is ever in use for a size, so the
+// pool is bounded once the sizes are; the previous batch's others go
+void ViewBatch::keepSizes(const BatchView* views, size_t count) {
+    std::vector<std::pair<int, int>> sizes;
+    for (size_t i = 0; i < count; ++i) sizes.emplace_back(views[i].width, views[i].height);
+    std::sort(sizes.begin(), sizes.end());
+    std::lock_guard<std::mutex> lock(mutex);
+    idle.erase(std::remove_if(idle.begin(), idle.end(), [&](const std::unique_ptr<Renderer>& r) {
+        return !std::binary_search(sizes.begin(), sizes.end(), std::make_pair(r->getWidth(), r->getHeight()));
+    }), idle.end());
+}
+
+void ViewBatch::render(const BatchScene& scene, const BatchView* views, size_t count, const ViewFn& done) {
+    keepSizes(views, count);
+    unsigned char r = (scene.clearColor >> 16) & 0xFF, g = (scene.clearColor >> 8) & 0xFF, b = scene.clearColor & 0xFF;
+    pool->run(int(count), [&](int task) {
+        const BatchView& view = views[task];
+        std::unique_ptr<Renderer> renderer = acquire(view.width, view.height);
+        // only what differs from the last view it drew costs anything
+        if (renderer->getDepthFormat() != scene.depthFormat) renderer->setDepthFormat(scene.depthFormat);
+        renderer->setMultisample(scene.samples);
+        renderer->setFieldOfView(view.fieldOfView);
+        renderer->setLightDirection(scene.lightDirection);
+        renderer->setCullMode(scene.cullMode);
+        renderer->setTexture(scene.texture);
+        renderer->clearColorAndDepth(r, g, b);
+        if (scene.meshlets) {
+            renderer->drawMesh(scene.positions, scene.vertexCount, scene.indices, scene.colors,
+                               scene.meshlets, scene.meshletCount, view.modelView, scene.attributes);
+        } else {
+            renderer->drawMesh(scene.positions, scene.vertexCount, scene.indices, scene.triangleCount,
+                               scene.colors, view.modelView, scene.attributes);
+        }
+        renderer->flush();
+        done(size_t(task), reinterpret_cast<const uint32_t*>(renderer->getBuffer()), view.width, view.height,
+             renderer->getPitch());
+        release(std::move(renderer));
+    });
+}